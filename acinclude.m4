@@ -255,7 +255,7 @@ dnl			else
 				HD44780_DRIVERS="$HD44780_DRIVERS hd44780-hd44780-bwct-usb.o hd44780-hd44780-uss720.o hd44780-hd44780-usbtiny.o hd44780-hd44780-usb4all.o"
 			fi
 			if test "$enable_libusb_1_0" = yes ; then
-				HD44780_DRIVERS="$HD44780_DRIVERS hd44780-hd44780-lcd2usb.o"
+				HD44780_DRIVERS="$HD44780_DRIVERS hd44780-hd44780-lcd2usb.o hd44780-usb_events.o"
 			fi
 			if test "$enable_libftdi" = yes ; then
 				HD44780_DRIVERS="$HD44780_DRIVERS hd44780-hd44780-ftdi.o"
@@ -20,7 +20,10 @@
 #include <signal.h>
 #include <time.h>
 #include <sys/wait.h>
+#include <sys/time.h>
 #include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
 
 #include "getopt.h"
 
@@ -42,6 +45,10 @@
 #define DEFAULT_CONFIGFILE	SYSCONFDIR "/lcdexec.conf"
 #define DEFAULT_PIDFILE		PIDFILEDIR "/lcdexec.pid"
 
+#define KEEPALIVE_INTERVAL	3000	/**< Interval for checking the server (in ms) */
+#define LINE_BUFFER_SIZE	1024	/**< Size of the buffer for server input */
+#define SEND_BUFFER_SIZE	4096	/**< Size of the buffer for server output */
+
 
 /** information about a process started by lcdexec */
 typedef struct ProcInfo {
@@ -96,6 +103,9 @@ int lcd_wid = 0;		/**< LCD display width reported by the server */
 int lcd_hgt = 0;		/**< LCD display height reported by the server */
 
 int sock = -1;			/**< socket to connect to server */
+static int sigchld_pipe[2] = { -1, -1 };	/**< self-pipe woken up by SIGCHLD */
+static SockReader *reader = NULL;	/**< buffered input from the server */
+static SockWriter *writer = NULL;	/**< buffered output to the server */
 
 int Quit = 0;			/**< indicate end of main loop */
 
@@ -103,6 +113,9 @@ int Quit = 0;			/**< indicate end of main loop */
 /* Function prototypes */
 static void exit_program(int val);
 static void sigchld_handler(int signal);
+static int setup_sigchld_pipe(void);
+static void reap_children(void);
+static void update_proc_queue(void);
 static int process_command_line(int argc, char **argv);
 static int process_configfile(char * configfile);
 static int connect_and_setup(void);
@@ -169,6 +182,8 @@ int main(int argc, char **argv)
 	sigaction(SIGKILL, &sa, NULL);	// kill -9 [cannot be trapped; but ...]
 
 	/* setup signal handler for children to avoid zombies */
+	CHAIN(error, setup_sigchld_pipe());
+	CHAIN_END(error);
 	sigemptyset(&sa.sa_mask);
 	sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
 	sa.sa_handler = sigchld_handler;
@@ -194,14 +209,52 @@ static void exit_program(int val)
 }
 
 
-/* the grim reaper ;-) */
+/**
+ * Wake up the main loop when a child has finished. The children are reaped
+ * by reap_children(), outside of the signal handler.
+ */
 static void sigchld_handler(int signal)
+{
+	int saved_errno = errno;
+	char c = 0;
+
+	if (write(sigchld_pipe[1], &c, 1) < 0) {
+		/* pipe full: the main loop has been woken up already */
+	}
+	errno = saved_errno;
+}
+
+
+/** Create the non-blocking self-pipe used by sigchld_handler(). */
+static int setup_sigchld_pipe(void)
+{
+	int i;
+
+	if (pipe(sigchld_pipe) < 0) {
+		report(RPT_ERR, "Could not create pipe: %s", strerror(errno));
+		return -1;
+	}
+	for (i = 0; i < 2; i++) {
+		fcntl(sigchld_pipe[i], F_SETFL, fcntl(sigchld_pipe[i], F_GETFL) | O_NONBLOCK);
+		fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+	}
+	return 0;
+}
+
+
+/* the grim reaper ;-) */
+static void reap_children(void)
 {
 	pid_t pid;
 	int status;
+	char buf[64];
+
+	/* empty the self-pipe */
+	while (read(sigchld_pipe[0], buf, sizeof(buf)) > 0)
+		;
 
-	/* wait for the child that was signalled as finished */
-	if ((pid = wait(&status)) != -1) {
+	/* collect all children that have finished */
+	while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
 		ProcInfo *p;
 
 		/* fill the procinfo structure with the necessary information */
@@ -215,6 +268,31 @@ static void sigchld_handler(int signal)
 }
 
 
+/**
+ * Show the feedback of finished processes and remove the processes whose
+ * feedback has been shown from the queue.
+ */
+static void update_proc_queue(void)
+{
+	ProcInfo **pp = &proc_queue;
+
+	while (*pp != NULL) {
+		ProcInfo *p = *pp;
+
+		/* look for a process to display, display it & mark it as shown */
+		p->shown |= show_procinfo_msg(p);
+
+		/* delete the ProcInfo from the queue */
+		if (p->shown) {
+			*pp = p->next;
+			free(p);
+		}
+		else
+			pp = &p->next;
+	}
+}
+
+
 static int process_command_line(int argc, char **argv)
 {
 	int c;
@@ -377,6 +455,11 @@ static int connect_and_setup(void)
 		return -1;
 	}
 
+	reader = sock_reader_create(sock, LINE_BUFFER_SIZE);
+	writer = sock_writer_create(sock, SEND_BUFFER_SIZE);
+	if ((reader == NULL) || (writer == NULL))
+		return -1;
+
 	return 0;
 }
 
@@ -617,58 +700,58 @@ static int show_procinfo_msg(ProcInfo *p)
 			if ((p->shown) || (!p->feedback))
 				return 1;
 
-			sock_printf(sock, "screen_add [%u]\n", p->pid);
-			sock_printf(sock, "screen_set [%u] -name {lcdexec [%u]}"
-					  " -priority alert -timeout %d"
-					  " -heartbeat off\n",
+			sock_writer_printf(writer, "screen_add [%u]\n", p->pid);
+			sock_writer_printf(writer, "screen_set [%u] -name {lcdexec [%u]}"
+						   " -priority alert -timeout %d"
+						   " -heartbeat off\n",
 					p->pid, p->pid, 6*8);
 
 			if (lcd_hgt > 2) {
-				sock_printf(sock, "widget_add [%u] t title\n", p->pid);
-				sock_printf(sock, "widget_set [%u] t {%s}\n", p->pid, p->cmd->displayname);
-				sock_printf(sock, "widget_add [%u] s1 string\n", p->pid);
-				sock_printf(sock, "widget_add [%u] s2 string\n", p->pid);
-				sock_printf(sock, "widget_add [%u] s3 string\n", p->pid);
+				sock_writer_printf(writer, "widget_add [%u] t title\n", p->pid);
+				sock_writer_printf(writer, "widget_set [%u] t {%s}\n", p->pid, p->cmd->displayname);
+				sock_writer_printf(writer, "widget_add [%u] s1 string\n", p->pid);
+				sock_writer_printf(writer, "widget_add [%u] s2 string\n", p->pid);
+				sock_writer_printf(writer, "widget_add [%u] s3 string\n", p->pid);
 
-				sock_printf(sock, "widget_set [%u] s1 1 2 {[%u] finished%s}\n",
+				sock_writer_printf(writer, "widget_set [%u] s1 1 2 {[%u] finished%s}\n",
 						p->pid, p->pid, (WIFSIGNALED(p->status) ? "," : ""));
 
 				if (WIFEXITED(p->status)) {
 					if (WEXITSTATUS(p->status) == EXIT_SUCCESS) {
-						sock_printf(sock, "widget_set [%u] s2 1 3 {successfully.}\n",
+						sock_writer_printf(writer, "widget_set [%u] s2 1 3 {successfully.}\n",
 								p->pid);
 					}
 					else {
-						sock_printf(sock, "widget_set [%u] s2 1 3 {with code 0x%02X.}\n",
+						sock_writer_printf(writer, "widget_set [%u] s2 1 3 {with code 0x%02X.}\n",
 								p->pid, WEXITSTATUS(p->status));
 					}
 				}
 				else if (WIFSIGNALED(p->status)) {
-					sock_printf(sock, "widget_set [%u] s2 1 3 {killed by SIG %d.}\n",
+					sock_writer_printf(writer, "widget_set [%u] s2 1 3 {killed by SIG %d.}\n",
 						p->pid, WTERMSIG(p->status));
 				}
 
 				if (lcd_hgt > 3)
-					sock_printf(sock, "widget_set [%u] s3 1 4 {Exec time: %lds}\n",
+					sock_writer_printf(writer, "widget_set [%u] s3 1 4 {Exec time: %lds}\n",
 							p->pid, p->endtime - p->starttime);
 			}
 			else {
-				sock_printf(sock, "widget_add [%u] s1 string\n", p->pid);
-				sock_printf(sock, "widget_add [%u] s2 string\n", p->pid);
-				sock_printf(sock, "widget_set [%u] s1 1 1 {%s}\n",
+				sock_writer_printf(writer, "widget_add [%u] s1 string\n", p->pid);
+				sock_writer_printf(writer, "widget_add [%u] s2 string\n", p->pid);
+				sock_writer_printf(writer, "widget_set [%u] s1 1 1 {%s}\n",
 						p->pid, p->cmd->displayname);
 				if (WIFEXITED(p->status)) {
 					if (WEXITSTATUS(p->status) == EXIT_SUCCESS) {
-						sock_printf(sock, "widget_set [%u] s2 1 2 {succeeded}\n",
+						sock_writer_printf(writer, "widget_set [%u] s2 1 2 {succeeded}\n",
 								p->pid, p->status);
 					}
 					else {
-						sock_printf(sock, "widget_set [%u] s2 1 2 {finished (0x%02X)}\n",
+						sock_writer_printf(writer, "widget_set [%u] s2 1 2 {finished (0x%02X)}\n",
 								p->pid, p->status);
 					}
 				}
 				else if (WIFSIGNALED(p->status)) {
-					sock_printf(sock, "widget_set [%u] s2 1 2 {killed by SIG %d}\n",
+					sock_writer_printf(writer, "widget_set [%u] s2 1 2 {killed by SIG %d}\n",
 							p->pid, WTERMSIG(p->status));
 
 				}
@@ -682,56 +765,51 @@ static int show_procinfo_msg(ProcInfo *p)
 
 static int main_loop(void)
 {
-	int num_bytes;
-	char buf[100];
-	int keepalive_delay = 0;
-	int status_delay = 0;
-
-	/* Continuously check if we get a menu event... */
-	while (!Quit && ((num_bytes = sock_recv_string(sock, buf, sizeof(buf)-1)) >= 0)) {
-		if (num_bytes == 0) {
-			ProcInfo *p;
-
-			/* wait for 1/10th of a second */
-			usleep(100000);
-
-			/* send an empty line every 3 seconds to make sure the server still exists */
-			if (keepalive_delay++ >= 30) {
-				keepalive_delay = 0;
-				if (sock_send_string(sock, "\n") < 0) {
-					break; /* Out of while loop */
-				}
-			}
-
-			/* check for a screen to show and procinfo deletion every second */
-			if (status_delay++ >= 10) {
-				status_delay = 0;
+	int num_bytes = 0;
+	char buf[LINE_BUFFER_SIZE];
+	struct pollfd pfd[2];
+	struct timeval now;
+	long long now_ms, keepalive_due;
+
+	gettimeofday(&now, NULL);
+	keepalive_due = (long long) now.tv_sec * 1000 + now.tv_usec / 1000 + KEEPALIVE_INTERVAL;
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[1].fd = sigchld_pipe[0];
+	pfd[1].events = POLLIN;
+
+	/* Sleep until we get a menu event or a child finishes... */
+	while (!Quit) {
+		gettimeofday(&now, NULL);
+		now_ms = (long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+
+		/* send an empty line every 3 seconds to make sure the server still exists */
+		if (now_ms >= keepalive_due) {
+			keepalive_due = now_ms + KEEPALIVE_INTERVAL;
+			if (sock_send_string(sock, "\n") < 0)
+				break; /* Out of while loop */
+		}
 
-				/* delete the ProcInfo from the queue */
-				for (p = proc_queue; p != NULL; p = p->next) {
-					ProcInfo *pn = p->next;
+		if (poll(pfd, 2, (int) (keepalive_due - now_ms)) < 0) {
+			if (errno == EINTR)
+				continue;
+			report(RPT_ERR, "poll failed: %s", strerror(errno));
+			break;
+		}
 
-					if ((pn != NULL) && (pn->shown)) {
-						p->next = pn->next;
-						free(pn);
-					}
-				}
-				/* deleting queue head is special */
-				if ((proc_queue != NULL) && (proc_queue->shown)) {
-					p = proc_queue;
-					proc_queue = proc_queue->next;
-					free(p);
-				}
+		if (pfd[1].revents & POLLIN)
+			reap_children();
 
-				/* look for a process to display, display it & mark it as shown */
-				for (p = proc_queue; p != NULL; p = p->next) {
-					p->shown |= show_procinfo_msg(p);
-				}
-			}
-		}
-		else {
-			process_response(buf);
+		if (pfd[0].revents & (POLLIN | POLLHUP | POLLERR)) {
+			while ((num_bytes = sock_readline(reader, buf, sizeof(buf))) > 0)
+				process_response(buf);
+			if (num_bytes < 0)
+				break; /* Out of while loop */
 		}
+
+		update_proc_queue();
+		sock_writer_flush(writer);
 	}
 
 	if (!Quit)
@@ -19,6 +19,7 @@
 #include "shared/sockets.h"
 
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "batt.h"
 #include "machine.h"
@@ -109,20 +110,20 @@ battery_screen(int rep, int display, int *flags_ptr)
 	if ((*flags_ptr & INITIALIZED) == 0) {
 		*flags_ptr |= INITIALIZED;
 
-		sock_send_string(sock, "screen_add B\n");
-		sock_printf(sock, "screen_set B -name {APM stats:%s}\n", get_hostname());
-		sock_send_string(sock, "widget_add B title title\n");
-		sock_printf(sock, "widget_set B title {LCDPROC %s}\n", version);
-		sock_send_string(sock, "widget_add B one string\n");
+		send_string("screen_add B\n");
+		send_printf("screen_set B -name {APM stats:%s}\n", get_hostname());
+		send_string("widget_add B title title\n");
+		send_printf("widget_set B title {LCDPROC %s}\n", version);
+		send_string("widget_add B one string\n");
 		if (lcd_hgt >= 4) {
-			sock_send_string(sock, "widget_add B two string\n");
-			sock_send_string(sock, "widget_add B three string\n");
-			sock_send_string(sock, "widget_add B gauge hbar\n");
-
-			sock_send_string(sock, "widget_set B one 1 2 {AC: Unknown}\n");
-			sock_send_string(sock, "widget_set B two 1 3 {Batt: Unknown}\n");
-			sock_printf(sock, "widget_set B three 1 4 {E%*sF}\n", gauge_wid, "");
-			sock_send_string(sock, "widget_set B gauge 2 4 0\n");
+			send_string("widget_add B two string\n");
+			send_string("widget_add B three string\n");
+			send_string("widget_add B gauge hbar\n");
+
+			send_string("widget_set B one 1 2 {AC: Unknown}\n");
+			send_string("widget_set B two 1 3 {Batt: Unknown}\n");
+			send_printf("widget_set B three 1 4 {E%*sF}\n", gauge_wid, "");
+			send_string("widget_set B gauge 2 4 0\n");
 		}
 	}
 
@@ -135,19 +136,19 @@ battery_screen(int rep, int display, int *flags_ptr)
 			sprintf(tmp, "%d%%", percent);
 		else
 			sprintf(tmp, "??%%");
-		sock_printf(sock, "widget_set B title {%s: %s:%s}\n",
+		send_printf("widget_set B title {%s: %s:%s}\n",
 				(acstat == LCDP_AC_ON && battstat == LCDP_BATT_ABSENT) ? "AC" : "Batt",
 				tmp, get_hostname());
 
 		if (lcd_hgt >= 4) {		/* 4-line version of the screen */
-			sock_printf(sock, "widget_set B one 1 2 {AC: %s}\n", ac_status(acstat));
-			sock_printf(sock, "widget_set B two 1 3 {Batt: %s}\n", battery_status(battstat));
+			send_printf("widget_set B one 1 2 {AC: %s}\n", ac_status(acstat));
+			send_printf("widget_set B two 1 3 {Batt: %s}\n", battery_status(battstat));
 			if (percent > 0)
-				sock_printf(sock, "widget_set B gauge 2 4 %d\n",
+				send_printf("widget_set B gauge 2 4 %d\n",
 						(percent * gauge_wid * lcd_cellwid) / 100);
 		}
 		else {				/* two-line version of the screen */
-			sock_printf(sock, "widget_set B one 1 2 {%sBatt: %s}\n",
+			send_printf("widget_set B one 1 2 {%sBatt: %s}\n",
 					(acstat == LCDP_AC_ON) ? "AC, " : "",
 					battery_status(battstat));
 		}
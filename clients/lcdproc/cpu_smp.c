@@ -6,9 +6,9 @@
  * Really boring for the moment, it only shows a current usage percentage graph
  * for each CPU.
  *
- * It will handle up to 2xlcd_hgt or 8 CPUs, whichever is less.  If there are
- * more CPUs than lines on the LCD, it puts 2 CPUs per line, splitting the line
- * in half.  Otherwise, it uses one line per CPU.
+ * It will handle up to 2xlcd_hgt CPUs.  If there are more CPUs than lines on
+ * the LCD, it puts 2 CPUs per line, splitting the line in half.  Otherwise, it
+ * uses one line per CPU.
  *
  * If the number of lines used to display the bar graphs for the CPUs is smaller
  * than the LCD's height, a title line is introduced, so that the screen looks
@@ -35,8 +35,10 @@
 #include <ctype.h>
 
 #include "shared/sockets.h"
+#include "shared/report.h"
 
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "machine.h"
 #include "cpu_smp.h"
@@ -56,19 +58,32 @@ cpu_smp_screen (int rep, int display, int *flags_ptr)
 #undef CPU_BUF_SIZE
 #define CPU_BUF_SIZE 4
 	int z;
-	static float cpu[MAX_CPUS][CPU_BUF_SIZE + 1];	/* last buffer is scratch */
-	load_type load[MAX_CPUS];
-	int num_cpus = MAX_CPUS;
+	static float (*cpu)[CPU_BUF_SIZE + 1] = NULL;	/* last buffer is scratch */
+	static load_type *load = NULL;
+	static int max_cpus = 0;
+	int num_cpus;
 	int bar_size;
 	int lines_used;
 
+	/* keep as many CPUs as fit on the display: twice its height */
+	if (load == NULL) {
+		max_cpus = 2 * lcd_hgt;
+		cpu = calloc(max_cpus, sizeof(*cpu));
+		load = calloc(max_cpus, sizeof(*load));
+		if ((cpu == NULL) || (load == NULL)) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			free(cpu);
+			free(load);
+			cpu = NULL;
+			load = NULL;
+			return 0;
+		}
+	}
+
 	/* get SMP load - inform about max #CPUs allowed */
+	num_cpus = max_cpus;
 	machine_get_smpload(load, &num_cpus);
 
-	/* restrict num_cpus to max. twice the display height */
-	if (num_cpus > 2 * lcd_hgt)
-		num_cpus = 2 * lcd_hgt;
-
 	/* 2 CPUs per line if more CPUs than lines */
 	bar_size = (num_cpus > lcd_hgt) ? (lcd_wid / 2 - 6) : (lcd_wid - 6);
 	lines_used = (num_cpus > lcd_hgt) ? (num_cpus + 1) / 2 : num_cpus;
@@ -76,28 +91,28 @@ cpu_smp_screen (int rep, int display, int *flags_ptr)
 	if ((*flags_ptr & INITIALIZED) == 0) {
 		*flags_ptr |= INITIALIZED;
 
-		sock_send_string(sock, "screen_add P\n");
+		send_string("screen_add P\n");
 
 		/* print title if he have room for it */
 		if (lines_used < lcd_hgt) {
-			sock_send_string(sock, "widget_add P title title\n");
-			sock_printf(sock, "widget_set P title {SMP CPU%s}\n", get_hostname());
+			send_string("widget_add P title title\n");
+			send_printf("widget_set P title {SMP CPU%s}\n", get_hostname());
 		}
 		else {
-			sock_send_string(sock, "screen_set P -heartbeat off\n");
+			send_string("screen_set P -heartbeat off\n");
 		}
 
-		sock_printf(sock, "screen_set P -name {CPU Use: %s}\n", get_hostname());
+		send_printf("screen_set P -name {CPU Use: %s}\n", get_hostname());
 
 		for (z = 0; z < num_cpus; z++) {
 			int y_offs = (lines_used < lcd_hgt) ? 2 : 1;
 			int x = (num_cpus > lcd_hgt) ? ((z % 2) * (lcd_wid/2) + 1) : 1;
 			int y = (num_cpus > lcd_hgt) ? (z/2 + y_offs) : (z + y_offs);
 
-			sock_printf(sock, "widget_add P cpu%d_title string\n", z);
-			sock_printf(sock, "widget_set P cpu%d_title %d %d \"CPU%d[%*s]\"\n",
+			send_printf("widget_add P cpu%d_title string\n", z);
+			send_printf("widget_set P cpu%d_title %d %d \"CPU%d[%*s]\"\n",
 					z, x, y, z, bar_size, "");
-			sock_printf(sock, "widget_add P cpu%d_bar hbar\n", z);
+			send_printf("widget_add P cpu%d_bar hbar\n", z);
 		}
 
 		return 0;
@@ -126,7 +141,7 @@ cpu_smp_screen (int rep, int display, int *flags_ptr)
 		value /= CPU_BUF_SIZE;
 
 		n = (int) ((value * lcd_cellwid * bar_size) / 100.0 + 0.5);
-		sock_printf(sock, "widget_set P cpu%d_bar %d %d %d\n", z, x, y, n);
+		send_printf("widget_set P cpu%d_bar %d %d %d\n", z, x, y, n);
 	}
 
 	return 0;
@@ -25,6 +25,7 @@
 #include "shared/sockets.h"
 
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "machine.h"
 #include "eyebox.h"
@@ -42,8 +43,8 @@ eyebox_screen(char display, int init)
 	load_type load;
 
 	if (init == 0) {
-		sock_printf(sock, "widget_add %c eyebo_cpu string\n", display);
-		sock_printf(sock, "widget_add %c eyebo_mem string\n", display);
+		send_printf("widget_add %c eyebo_cpu string\n", display);
+		send_printf("widget_add %c eyebo_mem string\n", display);
 
 		return 0;
 	}
@@ -86,7 +87,7 @@ eyebox_screen(char display, int init)
 	 * a = Bar ID
 	 * b = Level
 	 */
-	sock_printf(sock, "widget_set %c eyebo_cpu 1 2 {/xB%d%d}\n",
+	send_printf("widget_set %c eyebo_cpu 1 2 {/xB%d%d}\n",
 			display, 2,(int)(cpu[CPU_BUF_SIZE][4]/10));
 
 	/*-
@@ -96,7 +97,7 @@ eyebox_screen(char display, int init)
 	 */
 	value = 1.0 - (double) (mem[0].free + mem[0].buffers + mem[0].cache)
 		/ (double) mem[0].total;
-	sock_printf(sock, "widget_set %c eyebo_mem 1 3 {/xB%d%d}\n", display, 1, (int) (value * 10));
+	send_printf("widget_set %c eyebo_mem 1 3 {/xB%d%d}\n", display, 1, (int) (value * 10));
 
 	return 0;
 }
@@ -105,19 +106,19 @@ void
 eyebox_clear(void)
 {
 	/* Clear LEDs before exit */
-	sock_send_string(sock, "screen_add OFF\n");
-	sock_send_string(sock, "screen_set OFF -priority alert -name {EyeBO}\n");
-	sock_send_string(sock, "widget_add OFF title title\n");
-	sock_send_string(sock, "widget_set OFF title {EYEBOX ONE}\n");
-	sock_send_string(sock, "widget_add OFF text string\n");
-	sock_send_string(sock, "widget_add OFF about string\n");
-	sock_send_string(sock, "widget_add OFF cpu string\n");
-	sock_send_string(sock, "widget_add OFF mem string\n");
-
-	sock_send_string(sock, "widget_set OFF text 1 2 {Reseting Leds...}\n");
-	sock_send_string(sock, "widget_set OFF about 5 4 {EyeBO by NeZetiC}\n");
-	sock_printf(sock, "widget_set OFF cpu 1 2 {/xB%d%d}\n", 2, 0);
-	sock_printf(sock, "widget_set OFF mem 1 3 {/xB%d%d}\n", 1, 0);
+	send_string("screen_add OFF\n");
+	send_string("screen_set OFF -priority alert -name {EyeBO}\n");
+	send_string("widget_add OFF title title\n");
+	send_string("widget_set OFF title {EYEBOX ONE}\n");
+	send_string("widget_add OFF text string\n");
+	send_string("widget_add OFF about string\n");
+	send_string("widget_add OFF cpu string\n");
+	send_string("widget_add OFF mem string\n");
+
+	send_string("widget_set OFF text 1 2 {Reseting Leds...}\n");
+	send_string("widget_set OFF about 5 4 {EyeBO by NeZetiC}\n");
+	send_printf("widget_set OFF cpu 1 2 {/xB%d%d}\n", 2, 0);
+	send_printf("widget_set OFF mem 1 3 {/xB%d%d}\n", 1, 0);
 	usleep(2000000);	/* Wait last order execution */
 }
 
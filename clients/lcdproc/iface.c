@@ -25,6 +25,7 @@
 #include "shared/report.h"
 #include "shared/configfile.h"
 #include "main.h"
+#include "send.h"
 #include "machine.h"
 #include "util.h"
 #include "iface.h"
@@ -182,46 +183,46 @@ initialize_speed_screen(void)
 {
 	int iface_nmbr;	/* interface number */
 
-	sock_send_string(sock, "screen_add I\n");
-	sock_send_string(sock, "screen_set I name {Load}\n");
-	sock_send_string(sock, "widget_add I title title\n");
+	send_string("screen_add I\n");
+	send_string("screen_set I name {Load}\n");
+	send_string("widget_add I title title\n");
 
 	/* Single interface mode */
 	if ((iface_count == 1) && (lcd_hgt >= 4 )) {
-		sock_printf(sock, "widget_set I title {Net Load: %s}\n", iface[0].alias);
-		sock_send_string(sock, "widget_add I dl string\n");
-		sock_send_string(sock, "widget_set I dl 1 2 {DL:}\n");
-		sock_send_string(sock, "widget_add I ul string\n");
-		sock_send_string(sock, "widget_set I ul 1 3 {UL:}\n");
-		sock_send_string(sock, "widget_add I total string\n");
-		sock_send_string(sock, "widget_set I total 1 4 {Total:}\n");
+		send_printf("widget_set I title {Net Load: %s}\n", iface[0].alias);
+		send_string("widget_add I dl string\n");
+		send_string("widget_set I dl 1 2 {DL:}\n");
+		send_string("widget_add I ul string\n");
+		send_string("widget_set I ul 1 3 {UL:}\n");
+		send_string("widget_add I total string\n");
+		send_string("widget_set I total 1 4 {Total:}\n");
 	}
 	/* multi-interfaces mode: one line per interface */
 	else {
 		/* Set title */
 		if (strstr(unit_label, "B")) {
-			sock_printf(sock, "widget_set I title {Net Load (bytes)}\n");
+			send_printf("widget_set I title {Net Load (bytes)}\n");
 		}
 		else {
 			if (strstr(unit_label, "b")) {
-				sock_printf(sock, "widget_set I title {Net Load (bits)}\n");
+				send_printf("widget_set I title {Net Load (bits)}\n");
 			}
 			else {
-				sock_printf(sock, "widget_set I title {Net Load (packets)}\n");
+				send_printf("widget_set I title {Net Load (packets)}\n");
 			}
 		}
 
 		/* frame from (2, left) to (width, height) that is iface_count lines high */
-		sock_send_string (sock, "widget_add I f frame\n");
-		sock_printf(sock, "widget_set I f 1 2 %d %d %d %d v 16\n",
+		send_string("widget_add I f frame\n");
+		send_printf("widget_set I f 1 2 %d %d %d %d v 16\n",
 			    lcd_wid, lcd_hgt, lcd_wid, iface_count,
 			    /* scroll rate: 1 line every X ticks (=1/8 sec) */
 			    ((lcd_hgt >= 4) ? 8 : 16));
 
 		/* Add interfaces to frame */
 		for (iface_nmbr = 0; iface_nmbr < iface_count; iface_nmbr++) {
-			sock_printf(sock, "widget_add I i%1d string -in f\n", iface_nmbr);
-			sock_printf(sock, "widget_set I i%1d 1 %1d {%5.5s NA (never)}\n",
+			send_printf("widget_add I i%1d string -in f\n", iface_nmbr);
+			send_printf("widget_set I i%1d 1 %1d {%5.5s NA (never)}\n",
 				    iface_nmbr, iface_nmbr+1, iface[iface_nmbr].alias);
 		}
 	}
@@ -358,7 +359,7 @@ actualize_speed_screen(IfaceInfo *iface, unsigned int interval, int index)
 				rc_speed = (iface->rc_byte - iface->rc_byte_old) / interval;
 				format_value(speed, rc_speed, unit_label);
 			}
-			sock_printf(sock, "widget_set I dl 1 2 {DL: %*s/s}\n", lcd_wid - 6, speed);
+			send_printf("widget_set I dl 1 2 {DL: %*s/s}\n", lcd_wid - 6, speed);
 
 			/* Calculate and actualize upload speed */
 			if (strstr(unit_label, "pkt")) {
@@ -369,7 +370,7 @@ actualize_speed_screen(IfaceInfo *iface, unsigned int interval, int index)
 				tr_speed = (iface->tr_byte - iface->tr_byte_old) / interval;
 				format_value(speed, tr_speed, unit_label);
 			}
-			sock_printf(sock, "widget_set I ul 1 3 {UL: %*s/s}\n", lcd_wid - 6, speed);
+			send_printf("widget_set I ul 1 3 {UL: %*s/s}\n", lcd_wid - 6, speed);
 
 			/* Calculate and actualize total speed */
 			if (strstr(unit_label, "pkt")) {
@@ -378,13 +379,13 @@ actualize_speed_screen(IfaceInfo *iface, unsigned int interval, int index)
 			else {
 				format_value(speed, rc_speed + tr_speed, unit_label);
 			}
-			sock_printf(sock, "widget_set I total 1 4 {Total: %*s/s}\n", lcd_wid - 9, speed);
+			send_printf("widget_set I total 1 4 {Total: %*s/s}\n", lcd_wid - 9, speed);
 		}
 		else {
 			get_time_string(speed, iface->last_online);
-			sock_printf(sock, "widget_set I dl 1 2 {NA (%s)}\n", speed);
-			sock_send_string(sock, "widget_set I ul 1 3 {}\n");
-			sock_send_string(sock, "widget_set I total 1 4 {}\n");
+			send_printf("widget_set I dl 1 2 {NA (%s)}\n", speed);
+			send_string("widget_set I ul 1 3 {}\n");
+			send_string("widget_set I total 1 4 {}\n");
 		}
 	}
 	/* multi-interfaces mode: 1 line per interface */
@@ -403,15 +404,15 @@ actualize_speed_screen(IfaceInfo *iface, unsigned int interval, int index)
 			format_value_multi_interface(speed, rc_speed, unit_label);
 			format_value_multi_interface(speed1, tr_speed, unit_label);
 			if (lcd_wid > 16)
-				sock_printf(sock, "widget_set I i%1d 1 %1d {%5.5s U:%.4s D:%.4s}\n",
+				send_printf("widget_set I i%1d 1 %1d {%5.5s U:%.4s D:%.4s}\n",
 					    index, index+1, iface->alias, speed1, speed);
 			else
-				sock_printf(sock, "widget_set I i%1d 1 %1d {%4.4s ^%.4s v%.4s}\n",
+				send_printf("widget_set I i%1d 1 %1d {%4.4s ^%.4s v%.4s}\n",
 					    index, index+1, iface->alias, speed1, speed);
 		}
 		else {
 			get_time_string(speed, iface->last_online);
-			sock_printf(sock, "widget_set I i%1d 1 %1d {%5.5s NA (%s)}\n",
+			send_printf("widget_set I i%1d 1 %1d {%5.5s NA (%s)}\n",
 					index, index+1, iface->alias, speed);
 		}
 	}
@@ -426,36 +427,36 @@ initialize_transfer_screen(void)
 {
 	int iface_nmbr;		/* interface number */
 
-	sock_send_string(sock, "screen_add NT\n");
-	sock_send_string(sock, "screen_set NT name {Transfer}\n");
-	sock_send_string(sock, "widget_add NT title title\n");
+	send_string("screen_add NT\n");
+	send_string("screen_set NT name {Transfer}\n");
+	send_string("widget_add NT title title\n");
 
 	/* single interface mode */
 	if ((iface_count == 1) && (lcd_hgt >= 4)) {
-		sock_printf(sock, "widget_set NT title {Transfer: %s}\n", iface[0].alias);
-		sock_send_string(sock, "widget_add NT dl string\n");
-		sock_send_string(sock, "widget_set NT dl 1 2 {DL:}\n");
-		sock_send_string(sock, "widget_add NT ul string\n");
-		sock_send_string(sock, "widget_set NT ul 1 3 {UL:}\n");
-		sock_send_string(sock, "widget_add NT total string\n");
-		sock_send_string(sock, "widget_set NT total 1 4 {Total:}\n");
+		send_printf("widget_set NT title {Transfer: %s}\n", iface[0].alias);
+		send_string("widget_add NT dl string\n");
+		send_string("widget_set NT dl 1 2 {DL:}\n");
+		send_string("widget_add NT ul string\n");
+		send_string("widget_set NT ul 1 3 {UL:}\n");
+		send_string("widget_add NT total string\n");
+		send_string("widget_set NT total 1 4 {Total:}\n");
 	}
 	/* multi-interfaces mode: one line per interface */
 	else {
 		/* Set title (transfer screen is always in "bytes") */
-		sock_send_string(sock, "widget_set NT title {Net Transfer (bytes)}\n");
+		send_string("widget_set NT title {Net Transfer (bytes)}\n");
 
 		/* frame from (2, left) to (width, height) that is iface_count lines high */
-		sock_send_string(sock, "widget_add NT f frame\n");
-		sock_printf(sock, "widget_set NT f 1 2 %d %d %d %d v 16\n",
+		send_string("widget_add NT f frame\n");
+		send_printf("widget_set NT f 1 2 %d %d %d %d v 16\n",
 			    lcd_wid, lcd_hgt, lcd_wid, iface_count,
 			    /* scroll rate: 1 line every X ticks (=1/8 sec) */
 			    ((lcd_hgt >= 4) ? 8 : 16));
 
 		/* Add interfaces */
 		for (iface_nmbr = 0; iface_nmbr < iface_count; iface_nmbr++) {
-			sock_printf(sock, "widget_add NT i%1d string -in f\n", iface_nmbr);
-			sock_printf(sock, "widget_set NT i%1d 1 %1d {%5.5s NA (never)}\n",
+			send_printf("widget_add NT i%1d string -in f\n", iface_nmbr);
+			send_printf("widget_set NT i%1d 1 %1d {%5.5s NA (never)}\n",
 				    iface_nmbr, iface_nmbr+1, iface[iface_nmbr].alias);
 		}
 	}
@@ -478,21 +479,21 @@ actualize_transfer_screen(IfaceInfo *iface, int index)
 		if (iface->status == up) {
 			/* download traffic */
 			format_value(transfer, iface->rc_byte, "B");
-			sock_printf(sock, "widget_set NT dl 1 2 {DL: %*s}\n", lcd_wid - 4, transfer);
+			send_printf("widget_set NT dl 1 2 {DL: %*s}\n", lcd_wid - 4, transfer);
 
 			/* upload traffic */
 			format_value(transfer, iface->tr_byte, "B");
-			sock_printf(sock, "widget_set NT ul 1 3 {UL: %*s}\n", lcd_wid - 4, transfer);
+			send_printf("widget_set NT ul 1 3 {UL: %*s}\n", lcd_wid - 4, transfer);
 
 			/* total traffic */
 			format_value(transfer, iface->rc_byte + iface->tr_byte, "B");
-			sock_printf(sock, "widget_set NT total 1 4 {Total: %*s}\n", lcd_wid - 7, transfer);
+			send_printf("widget_set NT total 1 4 {Total: %*s}\n", lcd_wid - 7, transfer);
 		}
 		else {
 			get_time_string(transfer, iface->last_online);
-			sock_printf(sock, "widget_set NT dl 1 2 {NA (%s)}\n", transfer);
-			sock_send_string(sock, "widget_set NT ul 1 3 {}\n");
-			sock_send_string(sock, "widget_set NT total 1 4 {}\n");
+			send_printf("widget_set NT dl 1 2 {NA (%s)}\n", transfer);
+			send_string("widget_set NT ul 1 3 {}\n");
+			send_string("widget_set NT total 1 4 {}\n");
 		}
 	}
 	/* multi-interfaces mode: one line per interface */
@@ -503,15 +504,15 @@ actualize_transfer_screen(IfaceInfo *iface, int index)
 			format_value_multi_interface(transfer, iface->rc_byte, "B");
 			format_value_multi_interface(transfer1, iface->tr_byte, "B");
 			if (lcd_wid > 16)
-				sock_printf(sock, "widget_set NT i%1d 1 %1d {%5.5s U:%.4s D:%.4s}\n",
+				send_printf("widget_set NT i%1d 1 %1d {%5.5s U:%.4s D:%.4s}\n",
 					    index, index+1, iface->alias, transfer1, transfer);
 			else
-				sock_printf(sock, "widget_set NT i%1d 1 %1d {%4.4s ^%.4s v%.4s}\n",
+				send_printf("widget_set NT i%1d 1 %1d {%4.4s ^%.4s v%.4s}\n",
 					    index, index+1, iface->alias, transfer1, transfer);
 		}
 		else {
 			get_time_string(transfer, iface->last_online);
-			sock_printf(sock, "widget_set NT i%1d 1 %1d {%5.5s NA (%s)}\n",
+			send_printf("widget_set NT i%1d 1 %1d {%5.5s NA (%s)}\n",
 					index, index+1, iface->alias, transfer);
 		}
 	}
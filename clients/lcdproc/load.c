@@ -22,6 +22,7 @@
 #include "shared/configfile.h"
 #include "shared/sockets.h"
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "machine.h"
 #include "load.h"
@@ -67,26 +68,26 @@ xload_screen(int rep, int display, int *flags_ptr)
 		gauge_hgt = (lcd_hgt > 2) ? (lcd_hgt - 1) : lcd_hgt;
 		memset(loads, '\0', sizeof(double) * LCD_MAX_WIDTH);
 
-		sock_send_string(sock, "screen_add L\n");
-		sock_printf(sock, "screen_set L -name {Load: %s}\n", get_hostname());
+		send_string("screen_add L\n");
+		send_printf("screen_set L -name {Load: %s}\n", get_hostname());
 		/* Add the vbars... */
 		for (i = 1; i < lcd_wid; i++) {
-			sock_printf(sock, "widget_add L bar%i vbar\n", i);
-			sock_printf(sock, "widget_set L bar%i %i %i 0\n", i, i, lcd_hgt);
+			send_printf("widget_add L bar%i vbar\n", i);
+			send_printf("widget_set L bar%i %i %i 0\n", i, i, lcd_hgt);
 		}
 		/* And add a title... */
 		if (lcd_hgt > 2) {
-			sock_send_string(sock, "widget_add L title title\n");
-			sock_send_string(sock, "widget_set L title {LOAD        }\n");
+			send_string("widget_add L title title\n");
+			send_string("widget_set L title {LOAD        }\n");
 		} else {
-			sock_send_string(sock, "widget_add L title string\n");
-			sock_send_string(sock, "widget_set L title 1 1 {LOAD}\n");
-			sock_send_string(sock, "screen_set L -heartbeat off\n");
+			send_string("widget_add L title string\n");
+			send_string("widget_set L title 1 1 {LOAD}\n");
+			send_string("screen_set L -heartbeat off\n");
 		}
-		sock_send_string(sock, "widget_add L zero string\n");
-		sock_send_string(sock, "widget_add L top string\n");
-		sock_printf(sock, "widget_set L zero %i %i 0\n", lcd_wid, lcd_hgt);
-		sock_printf(sock, "widget_set L top %i %i 1\n", lcd_wid, (lcd_hgt + 1 - gauge_hgt));
+		send_string("widget_add L zero string\n");
+		send_string("widget_add L top string\n");
+		send_printf("widget_set L zero %i %i 0\n", lcd_wid, lcd_hgt);
+		send_printf("widget_set L top %i %i 1\n", lcd_wid, (lcd_hgt + 1 - gauge_hgt));
 	}
 
 	/* shift load history */
@@ -112,19 +113,19 @@ xload_screen(int rep, int display, int *flags_ptr)
 	factor = (double) (lcd_cellhgt * gauge_hgt) / (double) loadtop;
 
 	/* display load */
-	sock_printf(sock, "widget_set L top %i %i %i\n", lcd_wid, (lcd_hgt + 1 - gauge_hgt), loadtop);
+	send_printf("widget_set L top %i %i %i\n", lcd_wid, (lcd_hgt + 1 - gauge_hgt), loadtop);
 
 	for (i = 0; i < lcd_wid - 1; i++) {
 		double x = loads[i] * factor;
 
-		sock_printf(sock, "widget_set L bar%i %i %i %i\n", i + 1, i + 1, lcd_hgt, (int) x);
+		send_printf("widget_set L bar%i %i %i %i\n", i + 1, i + 1, lcd_hgt, (int) x);
 	}
 
 	/* And now the title... */
 	if (lcd_hgt > 2)
-		sock_printf(sock, "widget_set L title {LOAD %2.2f:%s}\n", loads[lcd_wid - 2], get_hostname());
+		send_printf("widget_set L title {LOAD %2.2f:%s}\n", loads[lcd_wid - 2], get_hostname());
 	else
-		sock_printf(sock, "widget_set L title 1 1 {%s %2.2f}\n", get_hostname(), loads[lcd_wid - 2]);
+		send_printf("widget_set L title 1 1 {%s %2.2f}\n", get_hostname(), loads[lcd_wid - 2]);
 
 	/* set return status depending on max & current load */
 	if (lowLoad < highLoad) {
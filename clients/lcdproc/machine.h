@@ -32,7 +32,7 @@
 #endif
 
 #ifndef MAX_CPUS
-# define MAX_CPUS	16	/**< maximal number of CPUs for which load history is kept */
+# define MAX_CPUS	256	/**< maximal number of CPUs for which load history is kept */
 #endif
 
 
@@ -373,8 +373,9 @@ machine_get_smpload(load_type * result, int *numcpus)
 		return (FALSE);
 	}
 
-	/* restrict #CPUs to max. *numcpus */
+	/* restrict #CPUs to max. *numcpus and the history kept */
 	num = (*numcpus >= num) ? num : *numcpus;
+	num = (num > MAX_CPUS) ? MAX_CPUS : num;
 	*numcpus = num;
 
 #ifndef HAVE_SYS_PCPU_H
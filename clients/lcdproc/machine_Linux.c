@@ -15,7 +15,6 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <unistd.h>
-#include <ctype.h>
 #include <string.h>
 #include <fcntl.h>
 #include <dirent.h>
@@ -24,11 +23,17 @@
 #include <sys/stat.h>
 #include <sys/statvfs.h>
 #include <errno.h>
+#include <limits.h>
+#include <poll.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #if TIME_WITH_SYS_TIME
 # include <sys/time.h>
 # include <time.h>
@@ -65,59 +70,146 @@
 #include "shared/report.h"
 
 
+/** Age (in microseconds) up to which a sample of a /proc file is reused */
+#define SAMPLE_MAX_AGE	100000
+
+/**
+ * Contents of a /proc file. Each file is read at most once per tick; all
+ * screen modes that need it during that tick share the same sample.
+ */
+typedef struct {
+	const char *name;	/**< path of the file */
+	int fd;			/**< open file descriptor, -1 if not open */
+	char *buf;		/**< contents; grows as needed, NUL terminated */
+	size_t size;		/**< allocated size of buf */
+	size_t len;		/**< length of the contents */
+	struct timeval stamp;	/**< time of the sample */
+} ProcFile;
+
+static ProcFile stat_file = { "/proc/stat", -1 };
+static ProcFile meminfo_file = { "/proc/meminfo", -1 };
+static ProcFile uptime_file = { "/proc/uptime", -1 };
+#ifndef USE_GETLOADAVG
+static ProcFile loadavg_file = { "/proc/loadavg", -1 };
+#endif
+
 static int batt_fd;
-static int load_fd;
-static int loadavg_fd;
-static int meminfo_fd;
-static int uptime_fd;
 
-static char procbuf[1024];	/* TODO ugly hack! */
+/* CPU times parsed from /proc/stat: absolute values and deltas between the
+ * last two samples. Index 0 is the sum of all CPUs, index n + 1 is CPU n. */
+static load_type *cpu_last = NULL;
+static load_type *cpu_delta = NULL;
+static int cpu_alloc = 0;		/**< number of allocated entries */
+static int cpu_count = 0;		/**< number of CPUs in the last sample */
 
-static FILE *mtab_fd;
+#ifndef USE_GETLOADAVG
+static double loadavg_1min;
+#endif
+static double uptime_up, uptime_idle;
+static meminfo_type meminfo[2];
+
+/*
+ * The process scan behind machine_get_procs() is spread over several calls:
+ * each call reads /proc/<pid>/statm and /proc/<pid>/comm for as many
+ * processes as fit into PROC_SCAN_BUDGET and aggregates them by name in a
+ * hash table. When a pass over /proc is complete, the PROC_TOP_MAX biggest
+ * entries are picked with a min-heap and returned until the next pass is
+ * complete. Only the very first pass runs to completion in one call.
+ */
+#define PROC_SCAN_BUDGET	20000	/**< time per call (in microseconds) */
+#define PROC_TOP_MAX		32	/**< number of entries kept */
+#define PROC_THRESHOLD		400	/**< ignore processes smaller than this (in kB) */
+
+/** Aggregated memory usage of all processes with the same name */
+typedef struct {
+	procinfo_type info;
+	unsigned int hash;
+	int used;
+} ProcEntry;
+
+static DIR *proc_dir = NULL;		/**< /proc, while a pass is running */
+static ProcEntry *proc_table = NULL;	/**< hash table, power of 2 sized */
+static int proc_table_size = 0;
+static int proc_table_used = 0;
+static procinfo_type proc_top[PROC_TOP_MAX];	/**< result of the last pass */
+static int proc_top_count = 0;
+static int proc_passes = 0;		/**< number of completed passes */
+
+/*
+ * File system statistics are collected by a worker thread, so a hanging
+ * network mount cannot block lcdproc; machine_get_fs() returns the last
+ * known values. The mount table is only reread when poll() on
+ * /proc/self/mounts reports a change.
+ */
+#define FS_STAT_TIMEOUT		2	/**< give up on a statfs() call after this (in seconds) */
+
+/** A mounted file system and its last known statistics */
+typedef struct {
+	mounts_type info;
+	int valid;		/**< info holds statistics */
+	int hung;		/**< a statfs() call on it did not return in time */
+} FsEntry;
+
+static ProcFile mounts_file = { "/proc/self/mounts", -1 };
+static FsEntry *fs_table = NULL;
+static int fs_count = 0;
+
+#ifdef HAVE_PTHREAD
+/** State of a worker thread collecting file system statistics */
+typedef struct {
+	int abandoned;		/**< the thread ends as soon as it can */
+	char current[256];	/**< mount point in statfs(), empty if none */
+	struct timeval since;	/**< start of the current statfs() call */
+} FsWorker;
+
+static FsWorker *fs_worker = NULL;	/**< current worker */
+static int fs_cycle_requested = 0;
+static int fs_cycles = 0;		/**< number of completed cycles */
+static pthread_mutex_t fs_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t fs_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t fs_done_cond = PTHREAD_COND_INITIALIZER;
+#endif
+
+
+static int
+proc_open(ProcFile *pf)
+{
+	pf->fd = open(pf->name, O_RDONLY);
+	if (pf->fd < 0) {
+		perror(pf->name);
+		return (FALSE);
+	}
+	pf->len = 0;
+	pf->stamp.tv_sec = pf->stamp.tv_usec = 0;
+	return (TRUE);
+}
 
+static void
+proc_close(ProcFile *pf)
+{
+	if (pf->fd >= 0)
+		close(pf->fd);
+	pf->fd = -1;
+	free(pf->buf);
+	pf->buf = NULL;
+	pf->size = 0;
+}
 
 int
 machine_init(void)
 {
-	uptime_fd = -1;
 	batt_fd = -1;
-	load_fd = -1;
-	loadavg_fd = -1;
-	meminfo_fd = -1;
-
-	if (uptime_fd < 0) {
-		uptime_fd = open("/proc/uptime", O_RDONLY);
-		if (uptime_fd < 0) {
-			perror("open /proc/uptime");
-			return (FALSE);
-		}
-	}
 
-	if (load_fd < 0) {
-		load_fd = open("/proc/stat", O_RDONLY);
-		if (load_fd < 0) {
-			perror("open /proc/stat");
-			return (FALSE);
-		}
-	}
+	if (!proc_open(&uptime_file) || !proc_open(&stat_file))
+		return (FALSE);
 
 #ifndef USE_GETLOADAVG
-	if (loadavg_fd < 0) {
-		loadavg_fd = open("/proc/loadavg", O_RDONLY);
-		if (loadavg_fd < 0) {
-			perror("open /proc/loadavg");
-			return (FALSE);
-		}
-	}
+	if (!proc_open(&loadavg_file))
+		return (FALSE);
 #endif
 
-	if (meminfo_fd < 0) {
-		meminfo_fd = open("/proc/meminfo", O_RDONLY);
-		if (meminfo_fd < 0) {
-			perror("open /proc/meminfo");
-			return (FALSE);
-		}
-	}
+	if (!proc_open(&meminfo_file))
+		return (FALSE);
 
 	if (batt_fd < 0) {
 		batt_fd = open("/proc/apm", O_RDONLY);
@@ -137,59 +229,277 @@ machine_close(void)
 		close(batt_fd);
 	batt_fd = -1;
 
-	if (load_fd >= 0)
-		close(load_fd);
-	load_fd = -1;
-
+	proc_close(&stat_file);
 #ifndef USE_GETLOADAVG
-	if (loadavg_fd >= 0)
-		close(loadavg_fd);
-	loadavg_fd = -1;
+	proc_close(&loadavg_file);
+#endif
+	proc_close(&meminfo_file);
+	proc_close(&uptime_file);
+
+	free(cpu_last);
+	free(cpu_delta);
+	cpu_last = cpu_delta = NULL;
+	cpu_alloc = cpu_count = 0;
+
+	if (proc_dir != NULL)
+		closedir(proc_dir);
+	proc_dir = NULL;
+	free(proc_table);
+	proc_table = NULL;
+	proc_table_size = proc_table_used = 0;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&fs_mutex);
+	if (fs_worker != NULL) {
+		fs_worker->abandoned = 1;
+		pthread_cond_broadcast(&fs_cond);
+		fs_worker = NULL;
+	}
 #endif
+	free(fs_table);
+	fs_table = NULL;
+	fs_count = 0;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&fs_mutex);
+#endif
+	proc_close(&mounts_file);
 
-	if (meminfo_fd >= 0)
-		close(meminfo_fd);
-	meminfo_fd = -1;
+	return (TRUE);
+}
 
-	if (uptime_fd >= 0)
-		close(uptime_fd);
-	uptime_fd = -1;
+/**
+ * Read a /proc file from the start. The buffer grows until the whole file
+ * fits into it.
+ * \return  TRUE if OK, FALSE on error.
+ */
+static int
+proc_read(ProcFile *pf)
+{
+	ssize_t n;
+
+	if (lseek(pf->fd, 0L, SEEK_SET) != 0)
+		return (FALSE);
+
+	pf->len = 0;
+	while (1) {
+		if (pf->len + 1 >= pf->size) {
+			size_t size = (pf->size > 0) ? 2 * pf->size : 4096;
+			char *buf = realloc(pf->buf, size);
+
+			if (buf == NULL)
+				return (FALSE);
+			pf->buf = buf;
+			pf->size = size;
+		}
+		n = read(pf->fd, pf->buf + pf->len, pf->size - pf->len - 1);
+		if (n < 0)
+			return (FALSE);
+		if (n == 0)
+			break;
+		pf->len += n;
+	}
+	pf->buf[pf->len] = '\0';
+	gettimeofday(&pf->stamp, NULL);
 
 	return (TRUE);
 }
 
-static void
-reread(int f, char *errmsg)
+/**
+ * Make sure the sample of a /proc file is current: reread it unless it has
+ * been read during this tick already.
+ * \return  TRUE if the file has been reread, FALSE if the sample is reused.
+ */
+static int
+proc_sample(ProcFile *pf)
 {
-	if (lseek(f, 0L, 0) == 0 && read(f, procbuf, sizeof(procbuf) - 1) > 0)
-		return;
-	perror(errmsg);
-	exit(1);
+	struct timeval now;
+	long age;
+
+	gettimeofday(&now, NULL);
+	age = (now.tv_sec - pf->stamp.tv_sec) * 1000000L + (now.tv_usec - pf->stamp.tv_usec);
+	if ((pf->buf != NULL) && (age >= 0) && (age < SAMPLE_MAX_AGE))
+		return (FALSE);
+
+	if (!proc_read(pf) || (pf->len == 0)) {
+		perror(pf->name);
+		exit(1);
+	}
+
+	return (TRUE);
 }
 
+/* Skip blanks (but not newlines). */
+static inline const char *
+skip_blanks(const char *p)
+{
+	while ((*p == ' ') || (*p == '\t'))
+		p++;
+	return p;
+}
+
+/* Advance to the start of the next line, or the terminating NUL. */
+static inline const char *
+next_line(const char *p)
+{
+	while ((*p != '\n') && (*p != '\0'))
+		p++;
+	return (*p == '\n') ? p + 1 : p;
+}
+
+/* Scan an unsigned decimal number; returns NULL if there is none. */
+static inline const char *
+scan_ulong(const char *p, unsigned long *value)
+{
+	unsigned long v = 0;
+
+	p = skip_blanks(p);
+	if ((*p < '0') || (*p > '9'))
+		return NULL;
+	while ((*p >= '0') && (*p <= '9'))
+		v = v * 10 + (*p++ - '0');
+	*value = v;
+	return p;
+}
+
+/* Scan a non-negative decimal fraction like "1234.56"; NULL if there is none. */
+static const char *
+scan_double(const char *p, double *value)
+{
+	unsigned long ipart;
+	double v, scale = 0.1;
+
+	p = scan_ulong(p, &ipart);
+	if (p == NULL)
+		return NULL;
+	v = ipart;
+	if (*p == '.') {
+		for (p++; (*p >= '0') && (*p <= '9'); p++) {
+			v += (*p - '0') * scale;
+			scale /= 10;
+		}
+	}
+	*value = v;
+	return p;
+}
+
+/* Make room for CPU times of n entries. */
 static int
-getentry(const char *tag, const char *bufptr, long *value)
-{
-	char *tail;
-	int len = strlen(tag);
-	long val;
-
-	while (bufptr != NULL) {
-		if (*bufptr == '\n')
-			bufptr++;
-		if (!strncmp(tag, bufptr, len)) {
-			errno = 0;
-			val = strtol(bufptr + len, &tail, 10);
-			if ((errno == 0) && (tail != bufptr + len)) {
-				*value = val;
-				return TRUE;
-			}
-			else
-				return FALSE;
+cpu_reserve(int n)
+{
+	load_type *last, *delta;
+	int alloc = (cpu_alloc > 0) ? cpu_alloc : 8;
+
+	if (n <= cpu_alloc)
+		return (TRUE);
+	while (alloc < n)
+		alloc *= 2;
+
+	last = realloc(cpu_last, alloc * sizeof(load_type));
+	if (last == NULL)
+		return (FALSE);
+	cpu_last = last;
+	delta = realloc(cpu_delta, alloc * sizeof(load_type));
+	if (delta == NULL)
+		return (FALSE);
+	cpu_delta = delta;
+
+	memset(cpu_last + cpu_alloc, 0, (alloc - cpu_alloc) * sizeof(load_type));
+	memset(cpu_delta + cpu_alloc, 0, (alloc - cpu_alloc) * sizeof(load_type));
+	cpu_alloc = alloc;
+	return (TRUE);
+}
+
+/*
+ * Parse the "cpu" lines at the start of /proc/stat:
+ * "cpu[N] user nice system idle [iowait [irq [softirq ...]]]".
+ * Parsing stops at the first other line, the huge "intr" line is skipped.
+ */
+static void
+parse_stat(void)
+{
+	const char *p = stat_file.buf;
+	int ncpu = 0;
+
+	while ((p[0] == 'c') && (p[1] == 'p') && (p[2] == 'u')) {
+		unsigned long val[7];
+		unsigned long cpu;
+		load_type load;
+		int idx, n;
+
+		p += 3;
+		if (*p == ' ')
+			idx = 0;
+		else if ((p = scan_ulong(p, &cpu)) != NULL)
+			idx = cpu + 1;
+		else
+			break;
+
+		for (n = 0; n < 7; n++) {
+			const char *q = scan_ulong(p, &val[n]);
+
+			if (q == NULL)
+				break;
+			p = q;
 		}
-		bufptr = strchr(bufptr, '\n');
+		p = next_line(p);
+		if ((n < 4) || !cpu_reserve(idx + 1))
+			continue;
+
+		load.user = val[0];
+		load.nice = val[1];
+		load.system = val[2];
+		load.idle = val[3];
+		if (n >= 5)
+			load.idle += val[4];	/* iowait */
+		if (n >= 6)
+			load.system += val[5];	/* irq */
+		if (n >= 7)
+			load.system += val[6];	/* softirq */
+		load.total = load.user + load.nice + load.system + load.idle;
+
+		cpu_delta[idx].user = load.user - cpu_last[idx].user;
+		cpu_delta[idx].nice = load.nice - cpu_last[idx].nice;
+		cpu_delta[idx].system = load.system - cpu_last[idx].system;
+		cpu_delta[idx].idle = load.idle - cpu_last[idx].idle;
+		cpu_delta[idx].total = load.total - cpu_last[idx].total;
+
+		/* struct assignment is legal in C89 */
+		cpu_last[idx] = load;
+
+		if (idx > ncpu)
+			ncpu = idx;
 	}
-	return FALSE;
+	cpu_count = ncpu;
+}
+
+/* Get the value of a "Tag: value kB" line in /proc/meminfo. */
+static long
+meminfo_entry(const char *tag)
+{
+	const char *p = meminfo_file.buf;
+	size_t len = strlen(tag);
+
+	while (*p != '\0') {
+		if (strncmp(p, tag, len) == 0) {
+			unsigned long val;
+
+			return (scan_ulong(p + len, &val) != NULL) ? (long) val : 0L;
+		}
+		p = next_line(p);
+	}
+	return 0L;
+}
+
+static void
+parse_meminfo(void)
+{
+	meminfo[0].total = meminfo_entry("MemTotal:");
+	meminfo[0].free = meminfo_entry("MemFree:");
+	meminfo[0].shared = meminfo_entry("MemShared:");
+	meminfo[0].buffers = meminfo_entry("Buffers:");
+	meminfo[0].cache = meminfo_entry("Cached:");
+	meminfo[1].total = meminfo_entry("SwapTotal:");
+	meminfo[1].free = meminfo_entry("SwapFree:");
 }
 
 int
@@ -248,102 +558,322 @@ machine_get_battstat(int *acstat, int *battflag, int *percent)
 	return (TRUE);
 }
 
-int
-machine_get_fs(mounts_type fs[], int *cnt)
+/* Get the statistics of a file system; returns TRUE if there are any. */
+static int
+fs_stat(const char *mpoint, mounts_type *m)
 {
 #ifdef STAT_STATVFS
 	struct statvfs fsinfo;
 #else
 	struct statfs fsinfo;
 #endif
-	char line[256];
-	int x = 0, err;
+	int err;
 
-#ifdef MTAB_FILE
-	mtab_fd = fopen(MTAB_FILE, "r");
+#ifdef STAT_STATVFS
+	err = statvfs(mpoint, &fsinfo);
+#elif STAT_STATFS2_BSIZE
+	err = statfs(mpoint, &fsinfo);
+#elif STAT_STATFS4
+	err = statfs(mpoint, &fsinfo, sizeof(fsinfo), 0);
 #else
-#error "Can't find your mounted filesystem table file."
+#error "statfs for this system not yet supported"
 #endif
+	if (err < 0) {
+		debug(RPT_INFO, "statvfs(%s): %s", mpoint, strerror(errno));
+		return (FALSE);
+	}
 
-	/* Get rid of old, unmounted filesystems... */
-	memset(fs, 0, sizeof(mounts_type) * 256);
+	m->blocks = fsinfo.f_blocks;
+	m->bsize = fsinfo.f_bsize;
+	m->bfree = fsinfo.f_bfree;
+	m->files = fsinfo.f_files;
+	m->ffree = fsinfo.f_ffree;
 
-	while (x < 256) {
-		if (fgets(line, 256, mtab_fd) == NULL)
-			break;
+	return (m->blocks > 0);
+}
 
-		sscanf(line, "%s %s %s", fs[x].dev, fs[x].mpoint, fs[x].type);
+/* Find the entry of a mount point in the mount table; must hold fs_mutex. */
+static FsEntry *
+fs_find(const char *mpoint)
+{
+	int i;
 
-		if (strcmp(fs[x].type, "proc")
-		    && strcmp(fs[x].type, "tmpfs")
+	for (i = 0; i < fs_count; i++) {
+		if (strcmp(fs_table[i].info.mpoint, mpoint) == 0)
+			return &fs_table[i];
+	}
+	return NULL;
+}
+
+/* Copy a field of a mount table line, decoding octal escapes like "\040". */
+static const char *
+fs_field(const char *p, char *dst, size_t size)
+{
+	size_t n = 0;
+
+	p = skip_blanks(p);
+	while ((*p != ' ') && (*p != '\t') && (*p != '\n') && (*p != '\0')) {
+		char c = *p++;
+
+		if ((c == '\\') && (p[0] >= '0') && (p[0] <= '3')
+		    && (p[1] >= '0') && (p[1] <= '7') && (p[2] >= '0') && (p[2] <= '7')) {
+			c = ((p[0] - '0') << 6) | ((p[1] - '0') << 3) | (p[2] - '0');
+			p += 3;
+		}
+		if (n + 1 < size)
+			dst[n++] = c;
+	}
+	dst[n] = '\0';
+	return p;
+}
+
+/*
+ * (Re)read the mount table. Entries of mount points that are still there
+ * keep their last known statistics.
+ */
+static void
+fs_read_mounts(void)
+{
+	FsEntry *table = NULL;
+	int count = 0, alloc = 0;
+	const char *p;
+	int i;
+
+	if (!proc_read(&mounts_file)) {
+		perror(mounts_file.name);
+		return;
+	}
+
+	for (p = mounts_file.buf; *p != '\0'; p = next_line(p)) {
+		mounts_type m;
+
+		memset(&m, 0, sizeof(m));
+		p = fs_field(p, m.dev, sizeof(m.dev));
+		p = fs_field(p, m.mpoint, sizeof(m.mpoint));
+		p = fs_field(p, m.type, sizeof(m.type));
+
+		if ((m.mpoint[0] == '\0')
+		    || !strcmp(m.type, "proc")
+		    || !strcmp(m.type, "tmpfs")
 #ifndef STAT_NFS
-		    && strcmp(fs[x].type, "nfs")
+		    || !strcmp(m.type, "nfs")
 #endif
 #ifndef STAT_SMBFS
-		    && strcmp(fs[x].type, "smbfs")
+		    || !strcmp(m.type, "smbfs")
 #endif
-			) {
-#ifdef STAT_STATVFS
-			err = statvfs(fs[x].mpoint, &fsinfo);
-#elif STAT_STATFS2_BSIZE
-			err = statfs(fs[x].mpoint, &fsinfo);
-#elif STAT_STATFS4
-			err = statfs(fs[x].mpoint, &fsinfo, sizeof(fsinfo), 0);
-#else
-#error "statfs for this system not yet supported"
+			)
+			continue;
+
+		if (count == alloc) {
+			FsEntry *t = realloc(table, (alloc + 32) * sizeof(FsEntry));
+
+			if (t == NULL)
+				break;
+			table = t;
+			alloc += 32;
+		}
+		memset(&table[count], 0, sizeof(FsEntry));
+		/* struct assignment is legal in C89 */
+		table[count++].info = m;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&fs_mutex);
+#endif
+	for (i = 0; i < count; i++) {
+		FsEntry *old = fs_find(table[i].info.mpoint);
+
+		if (old != NULL)
+			table[i] = *old;
+	}
+	free(fs_table);
+	fs_table = table;
+	fs_count = count;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&fs_mutex);
 #endif
-			if (err < 0) {
-				debug(RPT_INFO, "statvfs(%s): %s", fs[x].mpoint, strerror(errno));
+}
+
+#ifdef HAVE_PTHREAD
+/*
+ * Worker thread: update the statistics of all mounts each time a cycle is
+ * requested. A worker that is stuck in statfs() for longer than
+ * FS_STAT_TIMEOUT is abandoned by machine_get_fs(); when the call finally
+ * returns, the worker releases the mount and ends.
+ */
+static void *
+fs_worker_main(void *arg)
+{
+	FsWorker *w = arg;
+	char (*mpoints)[256] = NULL;
+	int alloc = 0;
+
+	pthread_mutex_lock(&fs_mutex);
+	while (!w->abandoned) {
+		int n, i;
+
+		while (!fs_cycle_requested && !w->abandoned)
+			pthread_cond_wait(&fs_cond, &fs_mutex);
+		if (w->abandoned)
+			break;
+		fs_cycle_requested = 0;
+
+		/* Work on a copy of the mount points, the table may change */
+		if (alloc < fs_count) {
+			char (*m)[256] = realloc(mpoints, fs_count * sizeof(*mpoints));
+
+			if (m == NULL)
 				continue;
-			}
+			mpoints = m;
+			alloc = fs_count;
+		}
+		for (i = n = 0; i < fs_count; i++) {
+			if (!fs_table[i].hung)
+				strcpy(mpoints[n++], fs_table[i].info.mpoint);
+		}
 
-			fs[x].blocks = fsinfo.f_blocks;
-			if (fs[x].blocks > 0) {
-				fs[x].bsize = fsinfo.f_bsize;
-				fs[x].bfree = fsinfo.f_bfree;
-				fs[x].files = fsinfo.f_files;
-				fs[x].ffree = fsinfo.f_ffree;
-				x++;
+		for (i = 0; (i < n) && !w->abandoned; i++) {
+			mounts_type m;
+			FsEntry *e;
+			int valid;
+
+			strcpy(w->current, mpoints[i]);
+			gettimeofday(&w->since, NULL);
+			pthread_mutex_unlock(&fs_mutex);
+
+			valid = fs_stat(mpoints[i], &m);
+
+			pthread_mutex_lock(&fs_mutex);
+			w->current[0] = '\0';
+			e = fs_find(mpoints[i]);
+			if (w->abandoned) {
+				if (e != NULL)
+					e->hung = 0;
+				break;
+			}
+			if (e != NULL)
+				e->valid = valid;
+			if ((e != NULL) && valid) {
+				e->info.bsize = m.bsize;
+				e->info.blocks = m.blocks;
+				e->info.bfree = m.bfree;
+				e->info.files = m.files;
+				e->info.ffree = m.ffree;
 			}
 		}
+		fs_cycles++;
+		pthread_cond_broadcast(&fs_done_cond);
 	}
+	pthread_mutex_unlock(&fs_mutex);
 
-	fclose(mtab_fd);
-	*cnt = x;
-	return (TRUE);
+	free(mpoints);
+	free(w);
+	return NULL;
 }
 
+/* Start a new worker thread; must hold fs_mutex. */
+static void
+fs_start_worker(void)
+{
+	pthread_t thread;
+
+	fs_worker = calloc(1, sizeof(FsWorker));
+	if (fs_worker == NULL)
+		return;
+	if (pthread_create(&thread, NULL, fs_worker_main, fs_worker) != 0) {
+		perror("machine_get_fs: pthread_create");
+		free(fs_worker);
+		fs_worker = NULL;
+		return;
+	}
+	pthread_detach(thread);
+}
+#endif
+
 int
-machine_get_load(load_type * curr_load)
+machine_get_fs(mounts_type fs[], int *cnt)
 {
-	static load_type last_load = {0, 0, 0, 0, 0};
-	load_type load;
-	int ret;
-	unsigned long load_iowait, load_irq, load_softirq;
+	struct pollfd pfd;
+	int x = 0, i;
 
-	reread(load_fd, "get_load");
+	/* Reread the mount table only if it has changed */
+	if (mounts_file.fd < 0) {
+		if (!proc_open(&mounts_file))
+			return (FALSE);
+		fs_read_mounts();
+	}
+	else {
+		pfd.fd = mounts_file.fd;
+		pfd.events = POLLPRI;
+		pfd.revents = 0;
+		if ((poll(&pfd, 1, 0) > 0) && (pfd.revents & (POLLPRI | POLLERR)))
+			fs_read_mounts();
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&fs_mutex);
+
+	/* Abandon a worker that hangs on a mount and start a new one */
+	if ((fs_worker != NULL) && (fs_worker->current[0] != '\0')) {
+		struct timeval now;
+		FsEntry *e;
 
-	ret = sscanf(procbuf, "cpu %lu %lu %lu %lu %lu %lu %lu",
-		     &load.user, &load.nice, &load.system, &load.idle,
-		     &load_iowait, &load_irq, &load_softirq);
+		gettimeofday(&now, NULL);
+		if (now.tv_sec - fs_worker->since.tv_sec > FS_STAT_TIMEOUT) {
+			e = fs_find(fs_worker->current);
+			if (e != NULL) {
+				e->hung = 1;
+				e->valid = 0;
+			}
+			fs_worker->abandoned = 1;
+			pthread_cond_broadcast(&fs_cond);
+			fs_worker = NULL;
+		}
+	}
+	if (fs_worker == NULL)
+		fs_start_worker();
 
-	if (ret >= 5)
-		load.idle += load_iowait;
-	if (ret >= 6)
-		load.system += load_irq;
-	if (ret >= 7)
-		load.system += load_softirq;
+	fs_cycle_requested = 1;
+	pthread_cond_broadcast(&fs_cond);
 
-	load.total = load.user + load.nice + load.system + load.idle;
+	/* Give the first cycle a moment, so there is something to show */
+	if ((fs_cycles == 0) && (fs_worker != NULL)) {
+		struct timespec ts;
 
-	curr_load->user = load.user - last_load.user;
-	curr_load->nice = load.nice - last_load.nice;
-	curr_load->system = load.system - last_load.system;
-	curr_load->idle = load.idle - last_load.idle;
-	curr_load->total = load.total - last_load.total;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		ts.tv_sec++;
+		pthread_cond_timedwait(&fs_done_cond, &fs_mutex, &ts);
+	}
+#else
+	/* No threads: update synchronously */
+	for (i = 0; i < fs_count; i++)
+		fs_table[i].valid = fs_stat(fs_table[i].info.mpoint, &fs_table[i].info);
+#endif
+
+	for (i = 0; (i < fs_count) && (x < 256); i++) {
+		if (fs_table[i].valid)
+			fs[x++] = fs_table[i].info;
+	}
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&fs_mutex);
+#endif
+
+	*cnt = x;
+	return (TRUE);
+}
+
+int
+machine_get_load(load_type * curr_load)
+{
+	if (proc_sample(&stat_file))
+		parse_stat();
+
+	if (cpu_alloc == 0)
+		return (FALSE);
 
 	/* struct assignment is legal in C89 */
-	last_load = load;
+	*curr_load = cpu_delta[0];
 
 	return (TRUE);
 }
@@ -360,8 +890,9 @@ machine_get_loadavg(double *load)
 	}
 	*load = loadavg[LOADAVG_1MIN];
 #else
-	reread(loadavg_fd, "get_loadavg");
-	sscanf(procbuf, "%lf", load);
+	if (proc_sample(&loadavg_file))
+		scan_double(loadavg_file.buf, &loadavg_1min);
+	*load = loadavg_1min;
 #endif
 	return (TRUE);
 }
@@ -369,177 +900,255 @@ machine_get_loadavg(double *load)
 int
 machine_get_meminfo(meminfo_type * result)
 {
-	long tmp;
+	if (proc_sample(&meminfo_file))
+		parse_meminfo();
 
-	reread(meminfo_fd, "get_meminfo");
-	result[0].total = (getentry("MemTotal:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[0].free = (getentry("MemFree:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[0].shared = (getentry("MemShared:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[0].buffers = (getentry("Buffers:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[0].cache = (getentry("Cached:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[1].total = (getentry("SwapTotal:", procbuf, &tmp) == TRUE) ? tmp : 0L;
-	result[1].free = (getentry("SwapFree:", procbuf, &tmp) == TRUE) ? tmp : 0L;
+	result[0] = meminfo[0];
+	result[1] = meminfo[1];
 
 	return (TRUE);
 }
 
-int
-machine_get_procs(LinkedList * procs)
+static unsigned int
+proc_hash(const char *name)
 {
-	/* Much of this code was ripped from "gmemusage" */
-	DIR *proc;
-	FILE *StatusFile;
-	struct dirent *procdir;
+	unsigned int h = 2166136261u;
 
-	char procName[16];
-	int procSize, procRSS, procData, procStk, procExe;
-	const char
-			*NameLine = "Name:",
-			*VmSizeLine = "VmSize:",
-			*VmRSSLine = "VmRSS",
-			*VmDataLine = "VmData",
-			*VmStkLine = "VmStk",
-			*VmExeLine = "VmExe";
-	const int
-			NameLineLen = strlen(NameLine),
-			VmSizeLineLen = strlen(VmSizeLine),
-			VmDataLineLen = strlen(VmDataLine),
-			VmStkLineLen = strlen(VmStkLine),
-			VmExeLineLen = strlen(VmExeLine),
-			VmRSSLineLen = strlen(VmRSSLine);
-	int threshold = 400, unique;
-
-	if ((proc = opendir("/proc")) == NULL) {
-		/* ToDo: correct error reporting */
-		perror("mem_top_screen: unable to open /proc");
+	while (*name != '\0')
+		h = (h ^ (unsigned char) *name++) * 16777619u;
+	return h;
+}
+
+/* Resize the hash table to the given number of slots (a power of 2). */
+static int
+proc_table_resize(int size)
+{
+	ProcEntry *old = proc_table;
+	int old_size = proc_table_size;
+	int i;
+
+	proc_table = calloc(size, sizeof(ProcEntry));
+	if (proc_table == NULL) {
+		proc_table = old;
 		return (FALSE);
 	}
+	proc_table_size = size;
 
-	while ((procdir = readdir(proc))) {
-		char buf[128];
+	for (i = 0; i < old_size; i++) {
+		if (old[i].used) {
+			int j = old[i].hash & (size - 1);
 
-		/* ignore everything in proc except process ids */
-		if (!strchr("1234567890", procdir->d_name[0]))
-			continue;
+			while (proc_table[j].used)
+				j = (j + 1) & (size - 1);
+			proc_table[j] = old[i];
+		}
+	}
+	free(old);
+	return (TRUE);
+}
 
-		sprintf(buf, "/proc/%s/status", procdir->d_name);
-		if ((StatusFile = fopen(buf, "r")) == NULL) {
-			/*
-			 * Not a serious error; process has finished before
-			 * we could examine it:
-			 */
-			continue;
+/* Add the memory of one process to the entry for its name. */
+static void
+proc_add(const char *name, long totl)
+{
+	unsigned int h = proc_hash(name);
+	int i;
+
+	if ((proc_table_used + 1) * 4 > proc_table_size * 3) {
+		if (!proc_table_resize((proc_table_size > 0) ? 2 * proc_table_size : 1024))
+			return;
+	}
+
+	for (i = h & (proc_table_size - 1); proc_table[i].used; i = (i + 1) & (proc_table_size - 1)) {
+		if ((proc_table[i].hash == h) && (strcmp(proc_table[i].info.name, name) == 0)) {
+			proc_table[i].info.totl += totl;
+			proc_table[i].info.number++;
+			return;
 		}
+	}
 
-		procRSS = procSize = procData = procStk = procExe = 0;
-		while (fgets(buf, sizeof(buf), StatusFile)) {
-			if (!strncmp(buf, NameLine, NameLineLen)) {
-				/* Name: procName */
-				sscanf(buf, "%*s %s", procName);
-			}
-			else if (!strncmp(buf, VmSizeLine, VmSizeLineLen)) {
-				/* VmSize: procSize kB */
-				sscanf(buf, "%*s %d", &procSize);
-			}
-			else if (!strncmp(buf, VmRSSLine, VmRSSLineLen)) {
-				/* VmRSS: procRSS kB */
-				sscanf(buf, "%*s %d", &procRSS);
-			}
-			else if (!strncmp(buf, VmDataLine, VmDataLineLen)) {
-				/* VmData: procData kB */
-				sscanf(buf, "%*s %d", &procData);
-			}
-			else if (!strncmp(buf, VmStkLine, VmStkLineLen)) {
-				/* VmStk: procStk kB */
-				sscanf(buf, "%*s %d", &procStk);
-			}
-			else if (!strncmp(buf, VmExeLine, VmExeLineLen)) {
-				/* VmExe: procExe kB */
-				sscanf(buf, "%*s %d", &procExe);
+	proc_table[i].used = 1;
+	proc_table[i].hash = h;
+	strncpy(proc_table[i].info.name, name, sizeof(proc_table[i].info.name) - 1);
+	proc_table[i].info.name[sizeof(proc_table[i].info.name) - 1] = '\0';
+	proc_table[i].info.totl = totl;
+	proc_table[i].info.number = 1;
+	proc_table_used++;
+}
+
+/* Read a small file below /proc into buf; returns the length or -1. */
+static int
+proc_read_small(int dir_fd, const char *path, char *buf, int size)
+{
+	int fd = openat(dir_fd, path, O_RDONLY);
+	int n;
+
+	if (fd < 0)
+		return -1;
+	n = read(fd, buf, size - 1);
+	close(fd);
+	if (n <= 0)
+		return -1;
+	buf[n] = '\0';
+	return n;
+}
+
+/* Account one process; it may have finished already, which is no error. */
+static void
+proc_scan_pid(int dir_fd, const char *pid)
+{
+	static long page_kb = 0;
+	char path[NAME_MAX + 8];
+	char buf[128];
+	unsigned long val[6];
+	const char *p = buf;
+	int n;
+
+	if (page_kb == 0)
+		page_kb = sysconf(_SC_PAGESIZE) / 1024;
+
+	/* statm: size resident shared text lib data (in pages) */
+	snprintf(path, sizeof(path), "%s/statm", pid);
+	if (proc_read_small(dir_fd, path, buf, sizeof(buf)) < 0)
+		return;
+	for (n = 0; n < 6; n++) {
+		if ((p = scan_ulong(p, &val[n])) == NULL)
+			return;
+	}
+	if ((long) val[0] * page_kb <= PROC_THRESHOLD)
+		return;
+
+	snprintf(path, sizeof(path), "%s/comm", pid);
+	n = proc_read_small(dir_fd, path, buf, sizeof(buf));
+	if (n < 0)
+		return;
+	if (buf[n - 1] == '\n')
+		buf[n - 1] = '\0';
+
+	/* data + stack + text, like VmData + VmStk + VmExe */
+	proc_add(buf, (long) (val[5] + val[3]) * page_kb);
+}
+
+/* Sift entry i of the min-heap of n entries down. */
+static void
+proc_heap_down(procinfo_type *heap, int n, int i)
+{
+	while (1) {
+		procinfo_type tmp;
+		int min = i;
+		int l = 2 * i + 1;
+		int r = l + 1;
+
+		if ((l < n) && (heap[l].totl < heap[min].totl))
+			min = l;
+		if ((r < n) && (heap[r].totl < heap[min].totl))
+			min = r;
+		if (min == i)
+			break;
+
+		tmp = heap[i];
+		heap[i] = heap[min];
+		heap[min] = tmp;
+		i = min;
+	}
+}
+
+/* A pass is complete: keep the biggest entries and clear the table. */
+static void
+proc_finish_pass(void)
+{
+	int i, n = 0;
+
+	for (i = 0; i < proc_table_size; i++) {
+		if (!proc_table[i].used)
+			continue;
+		if (n < PROC_TOP_MAX) {
+			int j;
+
+			proc_top[n++] = proc_table[i].info;
+			/* restore the heap property bottom-up once it is full */
+			if (n == PROC_TOP_MAX) {
+				for (j = n / 2 - 1; j >= 0; j--)
+					proc_heap_down(proc_top, n, j);
 			}
 		}
-		fclose(StatusFile);
-
-		if (procSize > threshold) {
-			/* Figure out if it's sharing any memory... */
-			unique = 1;
-			LL_Rewind(procs);
-			do {
-				procinfo_type *p = LL_Get(procs);
-
-				if ((p != NULL) && (0 == strcmp(p->name, procName))) {
-					unique = 0;
-					p->number++;
-					p->totl += procData + procStk + procExe;
-				}
-			} while (LL_Next(procs) == 0);
-
-			/* If this is the first one by this name... */
-			if (unique) {
-				procinfo_type *p = malloc(sizeof(procinfo_type));
-				if (p == NULL) {
-					perror("mem_top_screen: Error allocating process entry");
-					break;
-				}
-				strcpy(p->name, procName);
-				p->totl = procData + procStk + procExe;
-				p->number = 1;
-				/* TODO:  Check for errors here? */
-				LL_Push(procs, (void *)p);
-			}
+		else if (proc_table[i].info.totl > proc_top[0].totl) {
+			proc_top[0] = proc_table[i].info;
+			proc_heap_down(proc_top, n, 0);
 		}
 	}
-	closedir(proc);
+	proc_top_count = n;
 
-	return (TRUE);
+	memset(proc_table, 0, proc_table_size * sizeof(ProcEntry));
+	proc_table_used = 0;
+	proc_passes++;
 }
 
 int
-machine_get_smpload(load_type * result, int *numcpus)
+machine_get_procs(LinkedList * procs)
 {
-	char *token;
-	static load_type last_load[MAX_CPUS];
-	load_type curr_load[MAX_CPUS];
-	int ncpu = 0;
-	int ret;
-	unsigned long load_iowait, load_irq, load_softirq;
-
-	reread(load_fd, "get_load");
-
-	/* Look for lines starting with "cpu0", "cpu1", etc. */
-	token = strtok(procbuf, "\n");
-	while (token != NULL) {
-		if ((strlen(token) > 3) && (!strncmp(token, "cpu", 3)) && isdigit(token[3])) {
-			ret = sscanf(token, "cpu%*d %lu %lu %lu %lu %lu %lu %lu",
-				     &curr_load[ncpu].user, &curr_load[ncpu].nice, &curr_load[ncpu].system,
-				     &curr_load[ncpu].idle, &load_iowait, &load_irq, &load_softirq);
-
-			if (ret >= 5)
-				curr_load[ncpu].idle += load_iowait;
-			if (ret >= 6)
-				curr_load[ncpu].system += load_irq;
-			if (ret >= 7)
-				curr_load[ncpu].system += load_softirq;
-
-			curr_load[ncpu].total = curr_load[ncpu].user + curr_load[ncpu].nice +
-				curr_load[ncpu].system + curr_load[ncpu].idle;
-
-			result[ncpu].total = curr_load[ncpu].total - last_load[ncpu].total;
-			result[ncpu].user = curr_load[ncpu].user - last_load[ncpu].user;
-			result[ncpu].nice = curr_load[ncpu].nice - last_load[ncpu].nice;
-			result[ncpu].system = curr_load[ncpu].system - last_load[ncpu].system;
-			result[ncpu].idle = curr_load[ncpu].idle - last_load[ncpu].idle;
-
-			/* struct assignment is legal in C89 */
-			last_load[ncpu] = curr_load[ncpu];
-
-			/* restrict # CPUs to min(*numcpus, MAX_CPUS) */
-			ncpu++;
-			if ((ncpu >= *numcpus) || (ncpu >= MAX_CPUS))
+	struct timeval start, now;
+	struct dirent *procdir;
+	int count = 0;
+	int i;
+
+	if (proc_dir == NULL) {
+		if ((proc_dir = opendir("/proc")) == NULL) {
+			/* ToDo: correct error reporting */
+			perror("mem_top_screen: unable to open /proc");
+			return (FALSE);
+		}
+	}
+	gettimeofday(&start, NULL);
+
+	while ((procdir = readdir(proc_dir)) != NULL) {
+		/* ignore everything in proc except process ids */
+		if ((procdir->d_name[0] < '0') || (procdir->d_name[0] > '9'))
+			continue;
+
+		proc_scan_pid(dirfd(proc_dir), procdir->d_name);
+
+		/* Check the time budget every now and then */
+		if ((proc_passes > 0) && ((++count & 63) == 0)) {
+			gettimeofday(&now, NULL);
+			if ((now.tv_sec - start.tv_sec) * 1000000L + (now.tv_usec - start.tv_usec)
+			    > PROC_SCAN_BUDGET)
 				break;
 		}
-		token = strtok(NULL, "\n");
 	}
+	if (procdir == NULL) {
+		proc_finish_pass();
+		closedir(proc_dir);
+		proc_dir = NULL;
+	}
+
+	for (i = 0; i < proc_top_count; i++) {
+		procinfo_type *p = malloc(sizeof(procinfo_type));
+
+		if (p == NULL) {
+			perror("mem_top_screen: Error allocating process entry");
+			break;
+		}
+		/* struct assignment is legal in C89 */
+		*p = proc_top[i];
+		LL_Push(procs, (void *)p);
+	}
+
+	return (TRUE);
+}
+
+int
+machine_get_smpload(load_type * result, int *numcpus)
+{
+	int ncpu;
+
+	if (proc_sample(&stat_file))
+		parse_stat();
+
+	/* restrict # CPUs to *numcpus */
+	ncpu = (cpu_count < *numcpus) ? cpu_count : *numcpus;
+	if (ncpu > 0)
+		memcpy(result, cpu_delta + 1, ncpu * sizeof(load_type));
 	*numcpus = ncpu;
 
 	return (TRUE);
@@ -548,15 +1157,18 @@ machine_get_smpload(load_type * result, int *numcpus)
 int
 machine_get_uptime(double *up, double *idle)
 {
-	double local_up, local_idle;
+	if (proc_sample(&uptime_file)) {
+		const char *p = scan_double(uptime_file.buf, &uptime_up);
+
+		if ((p == NULL) || (scan_double(p, &uptime_idle) == NULL))
+			uptime_up = uptime_idle = 0;
+	}
 
-	reread(uptime_fd, "get_uptime");
-	sscanf(procbuf, "%lf %lf", &local_up, &local_idle);
 	if (up != NULL)
-		*up = local_up;
+		*up = uptime_up;
 	if (idle != NULL)
-		*idle = (local_up != 0)
-			? 100 * local_idle / local_up
+		*idle = (uptime_up != 0)
+			? 100 * uptime_idle / uptime_up
 			: 100;
 
 	return (TRUE);
@@ -27,12 +27,15 @@
 #include <sys/stat.h>
 #include <sys/utsname.h>
 #include <sys/param.h>
+#include <poll.h>
+#include <time.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
 
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "shared/sockets.h"
 #include "shared/report.h"
@@ -73,6 +76,7 @@ static struct utsname unamebuf;
 static void HelpScreen(int exit_state);
 static void exit_program(int val);
 static void main_loop(void);
+static void schedule_rebuild(void);
 static int process_configfile(char *cfgfile);
 
 
@@ -119,6 +123,18 @@ ScreenMode sequence[] =
 
 /* All variables are set to 'unset' values */
 static int islow = -1;		/**< pause after mode update (in 1/100s) */
+
+/*
+ * Scheduling of the screen updates: the active modes are kept in a
+ * min-heap ordered by the time their next update is due, so the main loop
+ * can sleep until then instead of waking up every TIME_UNIT.
+ */
+static int num_modes = 0;
+static long long *mode_last = NULL;	/**< time of the last update (in ms), -1 if none */
+static long long *mode_due = NULL;	/**< time the next update is due (in ms) */
+static int *due_heap = NULL;		/**< indices into sequence[] */
+static int due_count = 0;
+static int schedule_changed = 1;	/**< modes were (de)activated or (un)hidden */
 char *progname = "lcdproc";
 char *server = NULL;
 int port = LCDPORT;
@@ -184,13 +200,16 @@ set_mode(int shortname, char *longname, int state)
 				 * since we delete the screen
 				 */
 				sequence[k].flags &= (~ACTIVE & ~INITIALIZED);
+				schedule_changed = 1;
 				/* delete the screen if we are connected */
 				if (sock >= 0) {
-					sock_printf(sock, "screen_del %c\n", sequence[k].which);
+					send_printf("screen_del %c\n", sequence[k].which);
 				}
 			}
-			else
+			else {
 				sequence[k].flags |= ACTIVE;
+				schedule_changed = 1;
+			}
 			return 1;	/* found */
 		}
 	}
@@ -526,6 +545,7 @@ exit_program(int val)
 #endif
 	Quit = 1;
 	sock_close(sock);
+	send_close();
 	mode_close();
 	if ((foreground != TRUE) && (pidfile != NULL) && (pidfile_written == TRUE))
 		unlink(pidfile);
@@ -540,7 +560,7 @@ menus_init()
 
 	for (k = 0; sequence[k].which; k++) {
 		if (sequence[k].longname) {
-			sock_printf(sock, "menu_add_item {} %c checkbox {%s} -value %s\n",
+			send_printf("menu_add_item {} %c checkbox {%s} -value %s\n",
 				    sequence[k].which, sequence[k].longname,
 			       (sequence[k].flags & ACTIVE) ? "on" : "off");
 		}
@@ -551,34 +571,34 @@ menus_init()
 	 * to be entered on escape from test_menu (but overwritten for
 	 * test_{checkbox,ring}
 	 */
-	sock_send_string(sock, "menu_add_item {} ask menu {Leave menus?} -is_hidden true\n");
-	sock_send_string(sock, "menu_add_item {ask} ask_yes action {Yes} -next _quit_\n");
-	sock_send_string(sock, "menu_add_item {ask} ask_no action {No} -next _close_\n");
-	sock_send_string(sock, "menu_add_item {} test menu {Test}\n");
-	sock_send_string(sock, "menu_add_item {test} test_action action {Action}\n");
-	sock_send_string(sock, "menu_add_item {test} test_checkbox checkbox {Checkbox}\n");
-	sock_send_string(sock, "menu_add_item {test} test_ring ring {Ring} -strings {one\ttwo\tthree}\n");
-	sock_send_string(sock, "menu_add_item {test} test_slider slider {Slider} -mintext < -maxtext > -value 50\n");
-	sock_send_string(sock, "menu_add_item {test} test_numeric numeric {Numeric} -value 42\n");
-	sock_send_string(sock, "menu_add_item {test} test_alpha alpha {Alpha} -value abc\n");
-	sock_send_string(sock, "menu_add_item {test} test_ip ip {IP} -v6 false -value 192.168.1.1\n");
-	sock_send_string(sock, "menu_add_item {test} test_menu menu {Menu}\n");
-	sock_send_string(sock, "menu_add_item {test_menu} test_menu_action action {Submenu's action}\n");
+	send_string("menu_add_item {} ask menu {Leave menus?} -is_hidden true\n");
+	send_string("menu_add_item {ask} ask_yes action {Yes} -next _quit_\n");
+	send_string("menu_add_item {ask} ask_no action {No} -next _close_\n");
+	send_string("menu_add_item {} test menu {Test}\n");
+	send_string("menu_add_item {test} test_action action {Action}\n");
+	send_string("menu_add_item {test} test_checkbox checkbox {Checkbox}\n");
+	send_string("menu_add_item {test} test_ring ring {Ring} -strings {one\ttwo\tthree}\n");
+	send_string("menu_add_item {test} test_slider slider {Slider} -mintext < -maxtext > -value 50\n");
+	send_string("menu_add_item {test} test_numeric numeric {Numeric} -value 42\n");
+	send_string("menu_add_item {test} test_alpha alpha {Alpha} -value abc\n");
+	send_string("menu_add_item {test} test_ip ip {IP} -v6 false -value 192.168.1.1\n");
+	send_string("menu_add_item {test} test_menu menu {Menu}\n");
+	send_string("menu_add_item {test_menu} test_menu_action action {Submenu's action}\n");
 	/*
 	 * no successor for menus. Since test_checkbox and test_ring have
 	 * their own predecessors defined the "ask" rule will not work for
 	 * them.
 	 */
-	sock_send_string(sock, "menu_set_item {} test -prev {ask}\n");
-
-	sock_send_string(sock, "menu_set_item {} test_action -next {test_checkbox}\n");
-	sock_send_string(sock, "menu_set_item {} test_checkbox -next {test_ring} -prev test_action\n");
-	sock_send_string(sock, "menu_set_item {} test_ring -next {test_slider} -prev {test_checkbox}\n");
-	sock_send_string(sock, "menu_set_item {} test_slider -next {test_numeric} -prev {test_ring}\n");
-	sock_send_string(sock, "menu_set_item {} test_numeric -next {test_alpha} -prev {test_slider}\n");
-	sock_send_string(sock, "menu_set_item {} test_alpha -next {test_ip} -prev {test_numeric}\n");
-	sock_send_string(sock, "menu_set_item {} test_ip -next {test_menu} -prev {test_alpha}\n");
-	sock_send_string(sock, "menu_set_item {} test_menu_action -next {_close_}\n");
+	send_string("menu_set_item {} test -prev {ask}\n");
+
+	send_string("menu_set_item {} test_action -next {test_checkbox}\n");
+	send_string("menu_set_item {} test_checkbox -next {test_ring} -prev test_action\n");
+	send_string("menu_set_item {} test_ring -next {test_slider} -prev {test_checkbox}\n");
+	send_string("menu_set_item {} test_slider -next {test_numeric} -prev {test_ring}\n");
+	send_string("menu_set_item {} test_numeric -next {test_alpha} -prev {test_slider}\n");
+	send_string("menu_set_item {} test_alpha -next {test_ip} -prev {test_numeric}\n");
+	send_string("menu_set_item {} test_ip -next {test_menu} -prev {test_alpha}\n");
+	send_string("menu_set_item {} test_menu_action -next {_close_}\n");
 #endif				/* LCDPROC_CLIENT_TESTMENUS */
 
 	return 0;
@@ -586,6 +606,71 @@ menus_init()
 #endif				/* LCDPROC_MENUS */
 
 
+/** Get a monotonic time stamp in milliseconds. */
+static long long
+now_ms(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (long long) ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/** Get the update interval of a mode in milliseconds.
+ * An OnTime or OffTime of 0 means every tick. */
+static long long
+mode_interval(int i)
+{
+	int ticks = (sequence[i].flags & VISIBLE) ? sequence[i].on_time : sequence[i].off_time;
+
+	if (ticks < 1)
+		ticks = 1;
+	return (long long) ticks * (TIME_UNIT / 1000);
+}
+
+/** Restore the heap property from position pos downwards. */
+static void
+heap_down(int pos)
+{
+	while (1) {
+		int min = pos;
+		int l = 2 * pos + 1;
+		int r = l + 1;
+		int tmp;
+
+		if ((l < due_count) && (mode_due[due_heap[l]] < mode_due[due_heap[min]]))
+			min = l;
+		if ((r < due_count) && (mode_due[due_heap[r]] < mode_due[due_heap[min]]))
+			min = r;
+		if (min == pos)
+			break;
+
+		tmp = due_heap[pos];
+		due_heap[pos] = due_heap[min];
+		due_heap[min] = tmp;
+		pos = min;
+	}
+}
+
+/** Recalculate the due times of all active modes and rebuild the heap. */
+static void
+schedule_rebuild(void)
+{
+	int i;
+
+	due_count = 0;
+	for (i = 0; i < num_modes; i++) {
+		if (!(sequence[i].flags & ACTIVE))
+			continue;
+		mode_due[i] = (mode_last[i] < 0) ? 0 : mode_last[i] + mode_interval(i);
+		due_heap[due_count++] = i;
+	}
+	for (i = due_count / 2 - 1; i >= 0; i--)
+		heap_down(i);
+
+	schedule_changed = 0;
+}
+
 /** Main program loop... */
 void
 main_loop(void)
@@ -596,10 +681,34 @@ main_loop(void)
 	char *argv[256];
 	int argc, newtoken;
 	int len;
+	struct pollfd pfd;
+
+	for (num_modes = 0; sequence[num_modes].which != 0; num_modes++)
+		;
+	mode_last = malloc(num_modes * sizeof(long long));
+	mode_due = malloc(num_modes * sizeof(long long));
+	due_heap = malloc(num_modes * sizeof(int));
+	if ((mode_last == NULL) || (mode_due == NULL) || (due_heap == NULL)) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return;
+	}
+	for (i = 0; i < num_modes; i++)
+		mode_last[i] = -1;
+
+	pfd.fd = sock;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
 
 	while (!Quit) {
+		long long now;
+		int timeout = -1;
+
 		/* Check for server input... */
 		len = sock_recv(sock, buf, 8000);
+		if ((len == 0) && (pfd.revents & (POLLIN | POLLHUP | POLLERR))) {
+			report(RPT_ERR, "Connection to server lost");
+			exit_program(EXIT_FAILURE);
+		}
 
 		/* Handle server input... */
 		while (len > 0) {
@@ -627,6 +736,7 @@ main_loop(void)
 								for (j = 0; sequence[j].which; j++) {
 									if (sequence[j].which == argv[1][0]) {
 										sequence[j].flags |= VISIBLE;
+										schedule_changed = 1;
 										debug(RPT_DEBUG, "Listen %s", argv[1]);
 									}
 								}
@@ -635,6 +745,7 @@ main_loop(void)
 								for (j = 0; sequence[j].which; j++) {
 									if (sequence[j].which == argv[1][0]) {
 										sequence[j].flags &= ~VISIBLE;
+										schedule_changed = 1;
 										debug(RPT_DEBUG, "Ignore %s", argv[1]);
 									}
 								}
@@ -668,9 +779,9 @@ main_loop(void)
 								}
 								connected = 1;
 								if (displayname != NULL)
-									sock_printf(sock, "client_set -name \"%s\"\n", displayname);
+									send_printf("client_set -name \"%s\"\n", displayname);
 								else
-									sock_printf(sock, "client_set -name {LCDproc %s}\n", get_hostname());
+									send_printf("client_set -name {LCDproc %s}\n", get_hostname());
 #ifdef LCDPROC_MENUS
 								menus_init();
 #endif
@@ -700,35 +811,45 @@ main_loop(void)
 			len = sock_recv(sock, buf, 8000);
 		}
 
-		/* Gather stats and update screens */
+		/* Update the screens that are due */
 		if (connected) {
-			for (i = 0; sequence[i].which > 0; i++) {
-				sequence[i].timer++;
-
-				if (!(sequence[i].flags & ACTIVE))
-					continue;
-
-				if (sequence[i].flags & VISIBLE) {
-					if (sequence[i].timer >= sequence[i].on_time) {
-						sequence[i].timer = 0;
-						/* Now, update the screen... */
-						update_screen(&sequence[i], 1);
-					}
-				}
-				else {
-					if (sequence[i].timer >= sequence[i].off_time) {
-						sequence[i].timer = 0;
-						/* Now, update the screen... */
-						update_screen(&sequence[i], sequence[i].show_invisible);
-					}
-				}
+			now = now_ms();
+			if (schedule_changed)
+				schedule_rebuild();
+
+			while ((due_count > 0) && (mode_due[due_heap[0]] <= now)) {
+				i = due_heap[0];
+				sequence[i].timer = 0;
+				/* Now, update the screen... */
+				if (sequence[i].flags & VISIBLE)
+					update_screen(&sequence[i], 1);
+				else
+					update_screen(&sequence[i], sequence[i].show_invisible);
+
+				mode_last[i] = now;
+				mode_due[i] = now + mode_interval(i);
+				heap_down(0);
+
 				if (islow > 0)
 					usleep(islow * 10000);
 			}
+
+			if (due_count > 0) {
+				now = now_ms();
+				timeout = (mode_due[due_heap[0]] > now) ? (int) (mode_due[due_heap[0]] - now) : 0;
+			}
 		}
 
-		/* Now sleep... */
-		usleep(TIME_UNIT);
+		/* Send the commands of this round in one go */
+		send_flush();
+
+		/* Now sleep until an update is due or the server talks to us */
+		pfd.revents = 0;
+		if ((poll(&pfd, 1, timeout) < 0) && (errno != EINTR)) {
+			report(RPT_ERR, "%s: poll failed: %s", __FUNCTION__, strerror(errno));
+			pfd.revents = 0;
+			usleep(TIME_UNIT);
+		}
 	}
 }
 
@@ -23,6 +23,7 @@
 #include "shared/LL.h"
 
 #include "main.h"
+#include "send.h"
 #include "mode.h"
 #include "machine.h"
 #include "mem.h"
@@ -62,8 +63,8 @@ mem_screen(int rep, int display, int *flags_ptr)
 	if ((*flags_ptr & INITIALIZED) == 0) {
 		*flags_ptr |= INITIALIZED;
 
-		sock_send_string(sock, "screen_add M\n");
-		sock_printf(sock, "screen_set M -name {Memory & Swap: %s}\n", get_hostname());
+		send_string("screen_add M\n");
+		send_printf("screen_set M -name {Memory & Swap: %s}\n", get_hostname());
 
 		title_sep_wid = (lcd_wid >= 16) ? lcd_wid - 16 : 0;
 
@@ -75,14 +76,14 @@ mem_screen(int rep, int display, int *flags_ptr)
 			label_wid = (title_sep_wid >= 4) ? 4 : title_sep_wid;
 			label_offs = (lcd_wid - label_wid) / 2 + 1;
 
-			sock_send_string(sock, "widget_add M title title\n");
-			sock_printf(sock, "widget_set M title { MEM %.*s SWAP}\n", title_sep_wid, title_sep);
-			sock_send_string(sock, "widget_add M totl string\n");
-			sock_send_string(sock, "widget_add M free string\n");
-			sock_printf(sock, "widget_set M totl %i 2 %.*s\n", label_offs, label_wid, "Totl");
-			sock_printf(sock, "widget_set M free %i 3 %.*s\n", label_offs, label_wid, "Free");
-			sock_send_string(sock, "widget_add M memused string\n");
-			sock_send_string(sock, "widget_add M swapused string\n");
+			send_string("widget_add M title title\n");
+			send_printf("widget_set M title { MEM %.*s SWAP}\n", title_sep_wid, title_sep);
+			send_string("widget_add M totl string\n");
+			send_string("widget_add M free string\n");
+			send_printf("widget_set M totl %i 2 %.*s\n", label_offs, label_wid, "Totl");
+			send_printf("widget_set M free %i 3 %.*s\n", label_offs, label_wid, "Free");
+			send_string("widget_add M memused string\n");
+			send_string("widget_add M swapused string\n");
 		}
 		else {
 			if (lcd_wid >= 20) {
@@ -98,16 +99,16 @@ mem_screen(int rep, int display, int *flags_ptr)
 				gauge_wid = gauge_offs = 0;
 			}
 
-			sock_send_string(sock, "widget_add M m string\n");
-			sock_send_string(sock, "widget_add M s string\n");
-			sock_send_string(sock, "widget_set M m 1 1 {M}\n");
-			sock_send_string(sock, "widget_set M s 1 2 {S}\n");
-			sock_send_string(sock, "widget_add M mem% string\n");
-			sock_send_string(sock, "widget_add M swap% string\n");
+			send_string("widget_add M m string\n");
+			send_string("widget_add M s string\n");
+			send_string("widget_set M m 1 1 {M}\n");
+			send_string("widget_set M s 1 2 {S}\n");
+			send_string("widget_add M mem% string\n");
+			send_string("widget_add M swap% string\n");
 		}
 
-		sock_send_string(sock, "widget_add M memtotl string\n");
-		sock_send_string(sock, "widget_add M swaptotl string\n");
+		send_string("widget_add M memtotl string\n");
+		send_string("widget_add M swaptotl string\n");
 
 		pbar_widget_add("M", "memgauge");
 		pbar_widget_add("M", "swapgauge");
@@ -117,10 +118,10 @@ mem_screen(int rep, int display, int *flags_ptr)
 		/* flip the title back and forth... (every 4 updates) */
 		if (which_title & 4) {
 			if (get_hostname()[0] != '\0')
-				sock_printf(sock, "widget_set M title {%s}\n", get_hostname());
+				send_printf("widget_set M title {%s}\n", get_hostname());
 		}
 		else {
-			sock_printf(sock, "widget_set M title { MEM %.*s SWAP}\n", title_sep_wid, title_sep);
+			send_printf("widget_set M title { MEM %.*s SWAP}\n", title_sep_wid, title_sep);
 		}
 		which_title = (which_title + 1) & 7;
 	}
@@ -135,19 +136,19 @@ mem_screen(int rep, int display, int *flags_ptr)
 
 		/* Total memory */
 		sprintf_memory(tmp, mem[0].total * 1024.0, 1);
-		sock_printf(sock, "widget_set M memtotl 1 2 {%7s}\n", tmp);
+		send_printf("widget_set M memtotl 1 2 {%7s}\n", tmp);
 
 		/* Free memory (plus buffers and cache) */
 		sprintf_memory(tmp, (mem[0].free + mem[0].buffers + mem[0].cache) * 1024.0, 1);
-		sock_printf(sock, "widget_set M memused 1 3 {%7s}\n", tmp);
+		send_printf("widget_set M memused 1 3 {%7s}\n", tmp);
 
 		/* Total swap */
 		sprintf_memory(tmp, mem[1].total * 1024.0, 1);
-		sock_printf(sock, "widget_set M swaptotl %i 2 {%7s}\n", lcd_wid - 7, tmp);
+		send_printf("widget_set M swaptotl %i 2 {%7s}\n", lcd_wid - 7, tmp);
 
 		/* Free swap */
 		sprintf_memory(tmp, mem[1].free * 1024.0, 1);
-		sock_printf(sock, "widget_set M swapused %i 3 {%7s}\n", lcd_wid - 7, tmp);
+		send_printf("widget_set M swapused %i 3 {%7s}\n", lcd_wid - 7, tmp);
 
 		if (gauge_wid > 0) {
 			/* Free memory graph */
@@ -171,11 +172,11 @@ mem_screen(int rep, int display, int *flags_ptr)
 
 		/* Total memory */
 		sprintf_memory(tmp, mem[0].total * 1024.0, 1);
-		sock_printf(sock, "widget_set M memtotl 3 1 {%6s}\n", tmp);
+		send_printf("widget_set M memtotl 3 1 {%6s}\n", tmp);
 
 		/* Total swap */
 		sprintf_memory(tmp, mem[1].total * 1024.0, 1);
-		sock_printf(sock, "widget_set M swaptotl 3 2 {%6s}\n", tmp);
+		send_printf("widget_set M swaptotl 3 2 {%6s}\n", tmp);
 
 		/* Free memory graph */
 		strcpy(tmp, "N/A");
@@ -188,7 +189,7 @@ mem_screen(int rep, int display, int *flags_ptr)
 
 			sprintf_percent(tmp, value * 100);
 		}
-		sock_printf(sock, "widget_set M mem%% %i 1 {%5s}\n", lcd_wid - 5, tmp);
+		send_printf("widget_set M mem%% %i 1 {%5s}\n", lcd_wid - 5, tmp);
 
 		/* Free swap graph */
 		strcpy(tmp, "N/A");
@@ -200,7 +201,7 @@ mem_screen(int rep, int display, int *flags_ptr)
 
 			sprintf_percent(tmp, value * 100);
 		}
-		sock_printf(sock, "widget_set M swap%% %i 2 {%5s}\n", lcd_wid - 5, tmp);
+		send_printf("widget_set M swap%% %i 2 {%5s}\n", lcd_wid - 5, tmp);
 	}
 
 	return 0;
@@ -271,24 +272,24 @@ mem_top_screen(int rep, int display, int *flags_ptr)
 	if ((*flags_ptr & INITIALIZED) == 0) {
 		*flags_ptr |= INITIALIZED;
 
-		sock_send_string(sock, "screen_add S\n");
-		sock_printf(sock, "screen_set S -name {Top Memory Use: %s}\n", get_hostname());
-		sock_send_string(sock, "widget_add S title title\n");
-		sock_printf(sock, "widget_set S title {TOP MEM:%s}\n", get_hostname());
+		send_string("screen_add S\n");
+		send_printf("screen_set S -name {Top Memory Use: %s}\n", get_hostname());
+		send_string("widget_add S title title\n");
+		send_printf("widget_set S title {TOP MEM:%s}\n", get_hostname());
 
 		/* frame from (2nd line, left) to (last line, right) */
-		sock_send_string(sock, "widget_add S f frame\n");
+		send_string("widget_add S f frame\n");
 
 		/* scroll rate: 1 line every X ticks (= 1/8 sec) */
-		sock_printf(sock, "widget_set S f 1 2 %i %i %i %i v %i\n",
+		send_printf("widget_set S f 1 2 %i %i %i %i v %i\n",
 			    lcd_wid, lcd_hgt, lcd_wid, lines,
 			    ((lcd_hgt >= 4) ? 8 : 12));
 
 		/* frame contents */
 		for (i = 1; i <= lines; i++) {
-			sock_printf(sock, "widget_add S %i string -in f\n", i);
+			send_printf("widget_add S %i string -in f\n", i);
 		}
-		sock_send_string(sock, "widget_set S 1 1 1 Checking...\n");
+		send_string("widget_set S 1 1 1 Checking...\n");
 	}
 
 	if (!display)
@@ -320,14 +321,14 @@ mem_top_screen(int rep, int display, int *flags_ptr)
 			sprintf_memory(mem, (double) p->totl * 1024.0, 1);
 
 			if (p->number > 1)
-				sock_printf(sock, "widget_set S %i 1 %i {%i %5s %s(%i)}\n",
+				send_printf("widget_set S %i 1 %i {%i %5s %s(%i)}\n",
 					    i, i, i, mem, p->name, p->number);
 			else
-				sock_printf(sock, "widget_set S %i 1 %i {%i %5s %s}\n",
+				send_printf("widget_set S %i 1 %i {%i %5s %s}\n",
 					    i, i, i, mem, p->name);
 		}
 		else {
-			sock_printf(sock, "widget_set S %i 1 %i { }\n", i, i);
+			send_printf("widget_set S %i 1 %i { }\n", i, i);
 		}
 
 		LL_Next(procs);
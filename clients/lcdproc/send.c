@@ -0,0 +1,306 @@
+/** \file clients/lcdproc/send.c
+ * Buffered sending of commands to the server.
+ *
+ * The screen modes queue their commands with send_printf() and
+ * send_string(); the main loop sends everything queued during a tick in a
+ * single write with send_flush(). A widget_set command that would set a
+ * widget to the parameters it already has is not sent at all: the last
+ * parameters of every widget are remembered until the widget or its screen
+ * is added or deleted again, or sending fails and it is unknown what the
+ * server got.
+ */
+
+/*-
+ * This file is part of lcdproc, the lcdproc client.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "shared/sockets.h"
+#include "shared/report.h"
+
+#include "main.h"
+#include "send.h"
+
+#define SEND_MAXMSG		8192	/**< longest command */
+#define SEND_FLUSH_SIZE		32768	/**< send early if this much is queued */
+#define WIDGET_BUCKETS		256
+
+/** Last parameters sent for a widget */
+typedef struct WidgetCacheEntry {
+	char *key;			/**< "screen widget" */
+	char *line;			/**< the complete widget_set command */
+	unsigned int hash;
+	struct WidgetCacheEntry *next;
+} WidgetCacheEntry;
+
+static char *sendbuf = NULL;
+static size_t sendbuf_len = 0;
+static size_t sendbuf_size = 0;
+
+static WidgetCacheEntry *widget_cache[WIDGET_BUCKETS];
+
+
+static unsigned int
+cache_hash(const char *key, size_t len)
+{
+	unsigned int h = 2166136261u;
+
+	while (len-- > 0)
+		h = (h ^ (unsigned char) *key++) * 16777619u;
+	return h;
+}
+
+/* Get the position and length of the n-th (0-based) word of a command. */
+static const char *
+word(const char *line, size_t len, int n, size_t *wlen)
+{
+	const char *p = line;
+	const char *end = line + len;
+
+	while (1) {
+		while ((p < end) && (*p == ' '))
+			p++;
+		*wlen = 0;
+		while ((p + *wlen < end) && (p[*wlen] != ' '))
+			(*wlen)++;
+		if ((n-- == 0) || (*wlen == 0))
+			return p;
+		p += *wlen;
+	}
+}
+
+/* Forget all widgets. */
+static void
+cache_clear(void)
+{
+	int i;
+
+	for (i = 0; i < WIDGET_BUCKETS; i++) {
+		while (widget_cache[i] != NULL) {
+			WidgetCacheEntry *e = widget_cache[i];
+
+			widget_cache[i] = e->next;
+			free(e->key);
+			free(e->line);
+			free(e);
+		}
+	}
+}
+
+/* Forget widgets: a single widget if name is given, else all of the screen. */
+static void
+cache_forget(const char *screen, size_t slen, const char *name, size_t nlen)
+{
+	int i;
+
+	for (i = 0; i < WIDGET_BUCKETS; i++) {
+		WidgetCacheEntry **pe = &widget_cache[i];
+
+		while (*pe != NULL) {
+			WidgetCacheEntry *e = *pe;
+
+			if ((strncmp(e->key, screen, slen) == 0) && (e->key[slen] == ' ')
+			    && ((name == NULL)
+				|| ((strncmp(e->key + slen + 1, name, nlen) == 0)
+				    && (e->key[slen + 1 + nlen] == '\0')))) {
+				*pe = e->next;
+				free(e->key);
+				free(e->line);
+				free(e);
+			}
+			else
+				pe = &e->next;
+		}
+	}
+}
+
+/*
+ * Check a single command against the widget cache.
+ * Returns 1 if the command is needless, 0 if it must be sent.
+ */
+static int
+cache_check(const char *line, size_t len)
+{
+	const char *cmd, *screen, *name;
+	size_t clen, slen, nlen, klen;
+	WidgetCacheEntry *e;
+	unsigned int h;
+
+	cmd = word(line, len, 0, &clen);
+	screen = word(line, len, 1, &slen);
+	name = word(line, len, 2, &nlen);
+	if (slen == 0)
+		return 0;
+
+	if (((clen == 10) && (strncmp(cmd, "widget_add", clen) == 0))
+	    || ((clen == 10) && (strncmp(cmd, "widget_del", clen) == 0))) {
+		cache_forget(screen, slen, name, nlen);
+		return 0;
+	}
+	if (((clen == 10) && (strncmp(cmd, "screen_add", clen) == 0))
+	    || ((clen == 10) && (strncmp(cmd, "screen_del", clen) == 0))) {
+		cache_forget(screen, slen, NULL, 0);
+		return 0;
+	}
+	if ((clen != 10) || (strncmp(cmd, "widget_set", clen) != 0) || (nlen == 0))
+		return 0;
+
+	/* The key is "screen widget" */
+	klen = name + nlen - screen;
+	h = cache_hash(screen, klen);
+	for (e = widget_cache[h % WIDGET_BUCKETS]; e != NULL; e = e->next) {
+		if ((e->hash == h) && (strncmp(e->key, screen, klen) == 0) && (e->key[klen] == '\0'))
+			break;
+	}
+
+	if (e == NULL) {
+		e = calloc(1, sizeof(WidgetCacheEntry));
+		if (e == NULL)
+			return 0;
+		e->key = malloc(klen + 1);
+		if (e->key == NULL) {
+			free(e);
+			return 0;
+		}
+		memcpy(e->key, screen, klen);
+		e->key[klen] = '\0';
+		e->hash = h;
+		e->next = widget_cache[h % WIDGET_BUCKETS];
+		widget_cache[h % WIDGET_BUCKETS] = e;
+	}
+	else if ((strncmp(e->line, line, len) == 0) && (e->line[len] == '\0')) {
+		/* Unchanged */
+		return 1;
+	}
+
+	free(e->line);
+	e->line = malloc(len + 1);
+	if (e->line != NULL) {
+		memcpy(e->line, line, len);
+		e->line[len] = '\0';
+	}
+	return 0;
+}
+
+/* Append data to the send buffer. */
+static int
+queue(const char *data, size_t len)
+{
+	if (sendbuf_len + len > sendbuf_size) {
+		size_t size = (sendbuf_size > 0) ? sendbuf_size : 4096;
+		char *buf;
+
+		while (sendbuf_len + len > size)
+			size *= 2;
+		buf = realloc(sendbuf, size);
+		if (buf == NULL) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			return -1;
+		}
+		sendbuf = buf;
+		sendbuf_size = size;
+	}
+	memcpy(sendbuf + sendbuf_len, data, len);
+	sendbuf_len += len;
+
+	return len;
+}
+
+
+/**
+ * Queue one or more commands (each terminated by a newline) for the server.
+ * \param string  The commands.
+ * \return  Number of bytes queued, -1 on error.
+ */
+int
+send_string(const char *string)
+{
+	const char *line = string;
+	int total = 0;
+
+	while (*line != '\0') {
+		const char *eol = strchr(line, '\n');
+		size_t len = (eol != NULL) ? (size_t) (eol - line) : strlen(line);
+
+		if (!cache_check(line, len)) {
+			if (queue(line, (eol != NULL) ? len + 1 : len) < 0)
+				return -1;
+			total += len + 1;
+		}
+		line += (eol != NULL) ? len + 1 : len;
+	}
+
+	if (sendbuf_len >= SEND_FLUSH_SIZE)
+		send_flush();
+
+	return total;
+}
+
+
+/**
+ * Queue a formatted command for the server.
+ * \param format  Format string, like for printf().
+ * \return  Number of bytes queued, -1 on error.
+ */
+int
+send_printf(const char *format, ...)
+{
+	char buf[SEND_MAXMSG];
+	va_list ap;
+	int size;
+
+	va_start(ap, format);
+	size = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	if (size < 0) {
+		report(RPT_ERR, "send_printf: vsnprintf failed");
+		return -1;
+	}
+	if (size >= sizeof(buf))
+		report(RPT_WARNING, "send_printf: vsnprintf truncated message");
+
+	return send_string(buf);
+}
+
+
+/**
+ * Send all queued commands to the server. If that fails all widgets are
+ * forgotten, so their parameters are sent again with the next update.
+ * \return  Number of bytes sent, -1 on error.
+ */
+int
+send_flush(void)
+{
+	int ret;
+
+	if (sendbuf_len == 0)
+		return 0;
+
+	ret = sock_send(sock, sendbuf, sendbuf_len);
+	if (ret < (int) sendbuf_len)
+		cache_clear();
+	sendbuf_len = 0;
+	return ret;
+}
+
+
+/**
+ * Free the send buffer and forget all widgets.
+ */
+void
+send_close(void)
+{
+	free(sendbuf);
+	sendbuf = NULL;
+	sendbuf_len = sendbuf_size = 0;
+
+	cache_clear();
+}
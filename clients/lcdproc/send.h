@@ -0,0 +1,27 @@
+/** \file clients/lcdproc/send.h
+ * Header file for \c send.c
+ */
+
+/*-
+ * This file is part of lcdproc, the lcdproc client.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifndef LCDPROC_SEND_H
+#define LCDPROC_SEND_H
+
+/** queue a formatted command for the server */
+int send_printf(const char *format, ...);
+
+/** queue one or more commands for the server */
+int send_string(const char *string);
+
+/** send all queued commands in one write */
+int send_flush(void);
+
+/** free the send buffer and the widget cache */
+void send_close(void);
+
+#endif
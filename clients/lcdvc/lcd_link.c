@@ -33,6 +33,8 @@ int port = UNSET_INT;
 short autoscroll = 1;
 
 int sock;
+static SockReader *reader = NULL;	/**< buffered input from the server */
+static SockWriter *writer = NULL;	/**< buffered output to the server */
 short listening = 0;
 short scroll_x = 0, scroll_y = 0;
 short lcd_cursor_x, lcd_cursor_y;
@@ -62,6 +64,11 @@ int setup_connection(void)
 		report(RPT_ERR, "Connecting to %s:%d failed", address, port);
 		return -1;
 	}
+	reader = sock_reader_create(sock, 8192);
+	writer = sock_writer_create(sock, 4096);
+	if ((reader == NULL) || (writer == NULL))
+		return -1;
+
 	/* Create our menu */
 	sock_send_string(sock, "hello\n");
 	if (read_connect_string() < 0) {
@@ -100,6 +107,8 @@ int setup_connection(void)
 
 int teardown_connection(void)
 {
+	sock_writer_destroy(writer);
+	sock_reader_destroy(reader);
 	sock_close(sock);
 
 	return 0;
@@ -119,7 +128,7 @@ static int read_connect_string(void)
 	buf[0] = '\0';
 
 	while (!received && timeout > 0) {
-		len = sock_recv_string(sock, buf, sizeof(buf));
+		len = sock_readline(reader, buf, sizeof(buf));
 		if (len == 0) {
 			usleep(100000);
 			timeout --;
@@ -184,7 +193,7 @@ static int split(char *str, char delim, char *parts[], int maxparts)
 
 int read_response(char *buf, int maxsize)
 {
-	return sock_recv_string(sock, buf, maxsize);
+	return sock_readline(reader, buf, maxsize);
 }
 
 
@@ -315,7 +324,7 @@ int update_display(void)
 					lcd_cursor_x, lcd_cursor_y);
 		}
 		buf[sizeof(buf)-1] = 0;
-		CHAIN(e, sock_send_string(sock, buf));
+		CHAIN(e, sock_writer_send_string(writer, buf));
 	}
 
 	/* Send all (changed) lines */
@@ -355,7 +364,7 @@ int update_display(void)
 			*a++ = '\"'; /* end string */
 			*a++ = '\n'; /* newline */
 			*a = 0; /* terminate */
-			CHAIN(e, sock_send_string(sock, str_buf));
+			CHAIN(e, sock_writer_send_string(writer, str_buf));
 
 			/* And store the new data */
 			memcpy(lcd_p, vc_p, line_width);
@@ -364,6 +373,9 @@ int update_display(void)
 	}
 	free(str_buf);
 
+	/* Send all changes in one go */
+	CHAIN(e, sock_writer_flush(writer));
+
 	if (e < 0) {
 		report(RPT_ERR, "Error while sending data to LCDd");
 		return -1;
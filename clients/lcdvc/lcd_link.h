@@ -3,6 +3,7 @@
 
 extern char *address;
 extern int port;
+extern int sock;
 
 int setup_connection(void);
 int teardown_connection(void);
@@ -21,6 +21,8 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <stdlib.h>
+#include <poll.h>
+#include <sys/time.h>
 
 #include "getopt.h"
 
@@ -41,6 +43,13 @@
 #define DEFAULT_CONFIGFILE	SYSCONFDIR "/lcdvc.conf"
 #define DEFAULT_PIDFILE		PIDFILEDIR "/lcdvc.pid"
 
+#define NOP_INTERVAL	3000	/**< Interval for checking the server (in ms) */
+#define POLL_INTERVAL	50	/**< Interval for rereading a console that
+				 * does not signal changes, and least time
+				 * between two rereads of one that does,
+				 * so changes in between are sent together
+				 * (in ms) */
+
 
 char *help_text =
 "lcdvc - LCDproc virtual console\n"
@@ -270,26 +279,74 @@ static int main_loop(void)
 {
 	int num_bytes;
 	char buf[80];
-	short w = 0;
-
-	/* Continuously check if we get a menu event... */
-
-	while (!Quit && ((num_bytes = read_response(buf, sizeof(buf)-1)) >= 0)) {
-		if (num_bytes != 0) {
+	struct pollfd pfd[2];
+	struct timeval now;
+	long long now_ms, nop_due, read_due;
+	int vc_changed = 1;
+	int timeout;
+
+	gettimeofday(&now, NULL);
+	read_due = (long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+	nop_due = read_due + NOP_INTERVAL;
+
+	pfd[0].fd = sock;
+	pfd[0].events = POLLIN;
+	pfd[0].revents = 0;
+	pfd[1].fd = vcsa;
+	pfd[1].events = POLLPRI;
+
+	while (!Quit) {
+		/* Check if we get a menu event or key... */
+		while ((num_bytes = read_response(buf, sizeof(buf)-1)) > 0)
 			process_response(buf);
+		if (num_bytes < 0)
+			break;	/* Out of while loop */
+
+		gettimeofday(&now, NULL);
+		now_ms = (long long) now.tv_sec * 1000 + now.tv_usec / 1000;
+		if (read_due - now_ms > POLL_INTERVAL) {
+			/* The clock was set back, start over */
+			read_due = now_ms;
+			nop_due = now_ms + NOP_INTERVAL;
 		}
-		else {
+
+		/* Reread the console only if it has changed, and not more
+		 * often than every POLL_INTERVAL */
+		if ((vc_changed || !vc_notify) && (now_ms >= read_due)) {
 			read_vcdata();
-			update_display();
-
-			/* Send an empty line every 3 seconds to make sure the server still exists */
-			if (w++ >= 60) {
-				w = 0;
-				if (send_nop() < 0) {
-					break; /* Out of while loop */
-				}
+			vc_changed = 0;
+			read_due = now_ms + POLL_INTERVAL;
+		}
+		update_display();
+
+		/* Send an empty line every 3 seconds to make sure the server still exists */
+		if (now_ms >= nop_due) {
+			nop_due = now_ms + NOP_INTERVAL;
+			if (send_nop() < 0)
+				break;	/* Out of while loop */
+		}
+		timeout = (int) (nop_due - now_ms);
+		if ((vc_changed || !vc_notify) && (read_due - now_ms < timeout))
+			timeout = (int) (read_due - now_ms);
+
+		/* Sleep until the server talks to us or the console changes.
+		 * A change waiting to be read keeps signalling, so only the
+		 * server is watched until then. */
+		pfd[0].revents = 0;
+		pfd[1].revents = 0;
+		if (poll(pfd, (vc_notify && !vc_changed) ? 2 : 1, timeout) < 0) {
+			if (errno != EINTR) {
+				report(RPT_ERR, "poll failed: %s", strerror(errno));
+				break;
 			}
-			usleep(50000);
+			continue;
+		}
+
+		if (pfd[1].revents & (POLLPRI | POLLERR | POLLHUP))
+			vc_changed = 1;
+		if (pfd[1].revents & (POLLERR | POLLHUP)) {
+			/* The console was deallocated; don't spin on it */
+			usleep(POLL_INTERVAL * 1000);
 		}
 	}
 
@@ -297,4 +354,3 @@ static int main_loop(void)
 		report(RPT_WARNING, "Server disconnected %d", num_bytes);
 	return 0;
 }
-
@@ -27,6 +27,7 @@
 #include "shared/sockets.h"
 
 int vcs0, vcsa;
+int vc_notify = 0;
 unsigned short vc_width = 0, vc_height = 0;
 unsigned short vc_cursor_x = 0, vc_cursor_y = 0;
 char *vc_buf = NULL;
@@ -34,6 +35,8 @@ char *vc_buf = NULL;
 
 int open_vcs(void)
 {
+	struct stat st;
+
 	/* Open the /dev/vcsX and /dev/vcsaX devices */
 	vcs0 = open(vcs_device, O_RDONLY);
 	if (vcs0 < 0) {
@@ -45,6 +48,17 @@ int open_vcs(void)
 		report(RPT_ERR, "Could not open %s: %s", vcsa_device, strerror(errno));
 		return -1;
 	}
+
+	/*
+	 * The console devices signal changes of the screen contents by
+	 * POLLPRI. Anything else (e.g. a plain file used for testing) has to
+	 * be reread periodically.
+	 */
+	if ((fstat(vcsa, &st) == 0) && S_ISCHR(st.st_mode))
+		vc_notify = 1;
+	else
+		report(RPT_INFO, "%s does not signal changes, polling it", vcsa_device);
+
 	return 0;
 }
 
@@ -58,8 +72,7 @@ int read_vcdata(void)
 	unsigned char buf[20];
 
 	/* Read size and cursor position from /dev/vcsa */
-	lseek(vcsa, 0, SEEK_SET);
-	bytes_read = read(vcsa, buf, 4);
+	bytes_read = pread(vcsa, buf, 4, 0);
 	if (bytes_read != 4) {
 		report(RPT_ERR, "Could not read from %s", vcsa_device);
 		return -1;
@@ -86,8 +99,7 @@ int read_vcdata(void)
 	}
 
 	/* Read characters from /dev/cvs0 */
-	lseek(vcs0, 0, SEEK_SET);
-	bytes_read = read(vcs0, vc_buf, vc_width * vc_height);
+	bytes_read = pread(vcs0, vc_buf, vc_width * vc_height, 0);
 	if (bytes_read != vc_width * vc_height) {
 		report(RPT_ERR, "Could not read from %s", vcs_device);
 		return -1;
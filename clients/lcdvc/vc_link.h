@@ -4,6 +4,8 @@
 extern unsigned short vc_width, vc_height;
 extern unsigned short vc_cursor_x, vc_cursor_y;
 extern char *vc_buf;
+extern int vcsa;
+extern int vc_notify;
 
 int open_vcs(void);
 int read_vcdata(void);
@@ -0,0 +1,349 @@
+/** \file server/arena.c
+ * This file contains the region allocator for client data.
+ *
+ * Every client gets an arena, and its screens, widgets, their texts and its
+ * key reservations are allocated from it. Small allocations are carved from
+ * large chunks and recycled through free lists per size class, so a client
+ * that keeps changing its widgets does not churn the heap. When the client
+ * goes away the arena releases all chunks at once, instead of freeing every
+ * string and structure on its own; nothing the client allocated can leak.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+/** Size of the chunks small allocations are carved from */
+#define ARENA_CHUNK_SIZE	8192
+/** Size of the smallest class is 1 << ARENA_MIN_SHIFT */
+#define ARENA_MIN_SHIFT		4
+/** Number of size classes: 16 to 1024 bytes */
+#define ARENA_CLASSES		7
+/** Class of allocations too large for the chunks */
+#define ARENA_LARGE		ARENA_CLASSES
+
+#define ARENA_CLASS_SIZE(cls)	((size_t) 1 << ((cls) + ARENA_MIN_SHIFT))
+
+/** Header in front of every allocation */
+typedef union ArenaHeader {
+	unsigned int cls;	/**< Size class of the allocation */
+	void *align_p;		/**< Keep the payload aligned */
+	double align_d;
+} ArenaHeader;
+
+/** Chunk small allocations are carved from */
+typedef union ArenaChunk {
+	union ArenaChunk *next;	/**< Next chunk of the arena */
+	double align_d;
+} ArenaChunk;
+
+/** Allocation too large for the chunks, made with malloc() */
+typedef struct ArenaLarge {
+	struct ArenaLarge *prev;
+	struct ArenaLarge *next;
+	size_t size;		/**< Usable size */
+	ArenaHeader hdr;	/**< Must be last: the payload follows */
+} ArenaLarge;
+
+/** Free allocation; the link is kept in the payload */
+typedef struct ArenaFree {
+	struct ArenaFree *next;
+} ArenaFree;
+
+struct Arena {
+	ArenaChunk *chunks;		/**< All chunks of the arena */
+	char *top;			/**< Start of unused space in the newest chunk */
+	char *end;			/**< End of the newest chunk */
+	ArenaFree *free_list[ARENA_CLASSES];
+	ArenaLarge *large;		/**< Large allocations */
+	ArenaStats stats;
+};
+
+
+#define HEADER(ptr)	((ArenaHeader *) (ptr) - 1)
+#define PAYLOAD(hdr)	((void *) ((ArenaHeader *) (hdr) + 1))
+
+
+/** Find the smallest size class that holds \c size bytes. */
+static unsigned int
+arena_class(size_t size)
+{
+	unsigned int cls = 0;
+
+	while (ARENA_CLASS_SIZE(cls) < size)
+		cls++;
+	return cls;
+}
+
+
+/** Put the rest of the newest chunk on the free lists, largest classes
+ * first, before starting another chunk. */
+static void
+arena_retire_top(Arena *a)
+{
+	int cls;
+
+	for (cls = ARENA_CLASSES - 1; cls >= 0; cls--) {
+		size_t need = sizeof(ArenaHeader) + ARENA_CLASS_SIZE(cls);
+
+		while ((size_t) (a->end - a->top) >= need) {
+			ArenaHeader *hdr = (ArenaHeader *) a->top;
+			ArenaFree *f = PAYLOAD(hdr);
+
+			hdr->cls = cls;
+			f->next = a->free_list[cls];
+			a->free_list[cls] = f;
+			a->top += need;
+		}
+	}
+}
+
+
+/** Create an empty arena.
+ * \return  The new arena; \c NULL on error.
+ */
+Arena *
+arena_create(void)
+{
+	return calloc(1, sizeof(Arena));
+}
+
+
+/** Destroy an arena and free all memory allocated from it.
+ * \param a  The arena.
+ */
+void
+arena_destroy(Arena *a)
+{
+	if (a == NULL)
+		return;
+
+	while (a->chunks != NULL) {
+		ArenaChunk *next = a->chunks->next;
+
+		free(a->chunks);
+		a->chunks = next;
+	}
+	while (a->large != NULL) {
+		ArenaLarge *next = a->large->next;
+
+		free(a->large);
+		a->large = next;
+	}
+	free(a);
+}
+
+
+/** Allocate memory from an arena.
+ * \param a     The arena; \c NULL to use malloc().
+ * \param size  Number of bytes.
+ * \return      The memory; \c NULL on error.
+ */
+void *
+arena_alloc(Arena *a, size_t size)
+{
+	ArenaHeader *hdr;
+	unsigned int cls;
+
+	if (a == NULL)
+		return malloc(size);
+
+	if (size > ARENA_CLASS_SIZE(ARENA_CLASSES - 1)) {
+		ArenaLarge *l = malloc(sizeof(ArenaLarge) + size);
+
+		if (l == NULL)
+			return NULL;
+		l->size = size;
+		l->hdr.cls = ARENA_LARGE;
+		l->prev = NULL;
+		l->next = a->large;
+		if (a->large != NULL)
+			a->large->prev = l;
+		a->large = l;
+
+		a->stats.allocs++;
+		a->stats.in_use += size;
+		a->stats.reserved += sizeof(ArenaLarge) + size;
+		return PAYLOAD(&l->hdr);
+	}
+
+	cls = arena_class(size);
+	if (a->free_list[cls] != NULL) {
+		ArenaFree *f = a->free_list[cls];
+
+		a->free_list[cls] = f->next;
+		hdr = HEADER(f);
+	}
+	else {
+		size_t need = sizeof(ArenaHeader) + ARENA_CLASS_SIZE(cls);
+
+		if ((a->top == NULL) || ((size_t) (a->end - a->top) < need)) {
+			ArenaChunk *c = malloc(ARENA_CHUNK_SIZE);
+
+			if (c == NULL)
+				return NULL;
+			if (a->top != NULL)
+				arena_retire_top(a);
+			c->next = a->chunks;
+			a->chunks = c;
+			a->top = (char *) (c + 1);
+			a->end = (char *) c + ARENA_CHUNK_SIZE;
+			a->stats.reserved += ARENA_CHUNK_SIZE;
+		}
+		hdr = (ArenaHeader *) a->top;
+		hdr->cls = cls;
+		a->top += need;
+	}
+
+	a->stats.allocs++;
+	a->stats.in_use += ARENA_CLASS_SIZE(cls);
+	return PAYLOAD(hdr);
+}
+
+
+/** Allocate zeroed memory from an arena.
+ * \param a     The arena; \c NULL to use calloc().
+ * \param size  Number of bytes.
+ * \return      The memory; \c NULL on error.
+ */
+void *
+arena_calloc(Arena *a, size_t size)
+{
+	void *ptr;
+
+	if (a == NULL)
+		return calloc(1, size);
+
+	ptr = arena_alloc(a, size);
+	if (ptr != NULL)
+		memset(ptr, 0, size);
+	return ptr;
+}
+
+
+/** Usable size of an allocation. */
+static size_t
+arena_size(void *ptr)
+{
+	ArenaHeader *hdr = HEADER(ptr);
+
+	if (hdr->cls == ARENA_LARGE)
+		return ((ArenaLarge *) ((char *) hdr - offsetof(ArenaLarge, hdr)))->size;
+	return ARENA_CLASS_SIZE(hdr->cls);
+}
+
+
+/** Resize memory allocated from an arena.
+ * \param a     The arena; \c NULL to use realloc().
+ * \param ptr   Memory to resize; may be \c NULL.
+ * \param size  New number of bytes.
+ * \return      The memory; \c NULL on error, leaving \c ptr as it was.
+ */
+void *
+arena_realloc(Arena *a, void *ptr, size_t size)
+{
+	void *new_ptr;
+	size_t old_size;
+
+	if (a == NULL)
+		return realloc(ptr, size);
+	if (ptr == NULL)
+		return arena_alloc(a, size);
+
+	old_size = arena_size(ptr);
+	if ((size <= old_size) && (size > old_size / 2))
+		return ptr;
+
+	new_ptr = arena_alloc(a, size);
+	if (new_ptr == NULL)
+		return NULL;
+	memcpy(new_ptr, ptr, (size < old_size) ? size : old_size);
+	arena_free(a, ptr);
+	return new_ptr;
+}
+
+
+/** Copy a string to memory allocated from an arena.
+ * \param a    The arena; \c NULL to use strdup().
+ * \param str  String to copy.
+ * \return     The copy; \c NULL on error.
+ */
+char *
+arena_strdup(Arena *a, const char *str)
+{
+	size_t len = strlen(str) + 1;
+	char *copy;
+
+	if (a == NULL)
+		return strdup(str);
+
+	copy = arena_alloc(a, len);
+	if (copy != NULL)
+		memcpy(copy, str, len);
+	return copy;
+}
+
+
+/** Return memory to an arena.
+ * Small allocations stay with the arena for reuse.
+ * \param a    The arena the memory came from; \c NULL to use free().
+ * \param ptr  Memory to free; may be \c NULL.
+ */
+void
+arena_free(Arena *a, void *ptr)
+{
+	ArenaHeader *hdr;
+
+	if (a == NULL) {
+		free(ptr);
+		return;
+	}
+	if (ptr == NULL)
+		return;
+
+	hdr = HEADER(ptr);
+	a->stats.frees++;
+	if (hdr->cls == ARENA_LARGE) {
+		ArenaLarge *l = (ArenaLarge *) ((char *) hdr - offsetof(ArenaLarge, hdr));
+
+		if (l->prev != NULL)
+			l->prev->next = l->next;
+		else
+			a->large = l->next;
+		if (l->next != NULL)
+			l->next->prev = l->prev;
+
+		a->stats.in_use -= l->size;
+		a->stats.reserved -= sizeof(ArenaLarge) + l->size;
+		free(l);
+	}
+	else {
+		ArenaFree *f = ptr;
+
+		f->next = a->free_list[hdr->cls];
+		a->free_list[hdr->cls] = f;
+		a->stats.in_use -= ARENA_CLASS_SIZE(hdr->cls);
+	}
+}
+
+
+/** Get the allocation counters of an arena.
+ * \param a  The arena.
+ * \return   The counters.
+ */
+const ArenaStats *
+arena_stats(const Arena *a)
+{
+	return &a->stats;
+}
@@ -0,0 +1,43 @@
+/** \file server/arena.h
+ * Defines the region allocator holding the memory of a client's screens,
+ * widgets and key reservations.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+/** Allocation counters of an arena */
+typedef struct ArenaStats {
+	unsigned long allocs;	/**< Allocations made */
+	unsigned long frees;	/**< Allocations freed again */
+	size_t in_use;		/**< Bytes handed out and not freed */
+	size_t reserved;	/**< Bytes taken from the system */
+} ArenaStats;
+
+typedef struct Arena Arena;
+
+/* Create and destroy an arena; destroying it frees everything allocated
+ * from it at once */
+Arena *arena_create(void);
+void arena_destroy(Arena *a);
+
+/* Allocate from an arena; with a NULL arena these fall back to the
+ * functions of the C library */
+void *arena_alloc(Arena *a, size_t size);
+void *arena_calloc(Arena *a, size_t size);
+void *arena_realloc(Arena *a, void *ptr, size_t size);
+char *arena_strdup(Arena *a, const char *str);
+void arena_free(Arena *a, void *ptr);
+
+/* Get the counters of an arena */
+const ArenaStats *arena_stats(const Arena *a);
+
+#endif
@@ -35,7 +35,7 @@ Client *client_create(int sock)
 	debug(RPT_DEBUG, "%s(sock=%i)", __FUNCTION__, sock);
 
 	/* Allocate new client...*/
-	c = malloc(sizeof(Client));
+	c = calloc(1, sizeof(Client));
 	if (!c) {
 		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
 		return NULL;
@@ -54,23 +54,32 @@ Client *client_create(int sock)
 		return NULL;
 	}
 
+	c->arena = arena_create();
+	if (!c->arena) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		LL_Destroy(c->messages);
+		free(c);
+		return NULL;
+	}
+
 	c->state = NEW;
 	c->name = NULL;
 	c->menu = NULL;
+	c->bytes_in = 0;
+	c->bytes_out = 0;
+	c->commands = 0;
+	c->peer_pid = -1;
+	c->peer_uid = -1;
 
-	c->screenlist = LL_new();
+	LL_ListInit(&c->screenlist);
 
-	if (!c->screenlist) {
-		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
-		return NULL;
-	}
 	return c;
 }
 
 int
 client_destroy(Client *c)
 {
-	Screen *s;
+	LL_link *l;
 	Menu *m;
 	char *str;
 
@@ -88,14 +97,12 @@ client_destroy(Client *c)
 	/* Clean up the screenlist...*/
 	debug(RPT_DEBUG, "%s: Cleaning screenlist", __FUNCTION__);
 
-	for (s = LL_GetFirst(c->screenlist); s; s = LL_GetNext(c->screenlist)) {
-		/* Free its memory...*/
-		screen_destroy(s);
-		/* Note that the screen is not removed from the list because
-		 * the list will be destroyed anyway...
+	LL_FOREACH(&c->screenlist, l) {
+		/* Only take it off the server's lists; its memory, and that
+		 * of its widgets, is released with the client's arena below.
 		 */
+		screen_unlink(LL_ENTRY(l, Screen, link));
 	}
-	LL_Destroy(c->screenlist);
 
 	m = (Menu *) c->menu;
 	/* Destroy the client's menu, if it exists */
@@ -119,6 +126,9 @@ client_destroy(Client *c)
 	if (c->name)
 		free(c->name);
 
+	/* Release the screens, widgets and key reservations at once */
+	arena_destroy(c->arena);
+
 	/* Remove structure */
 	free(c);
 
@@ -166,7 +176,7 @@ client_get_message(Client *c)
 Screen *
 client_find_screen(Client *c, char *id)
 {
-	Screen *s;
+	LL_link *l;
 
 	if (!c)
 		return NULL;
@@ -175,14 +185,14 @@ client_find_screen(Client *c, char *id)
 
 	debug(RPT_DEBUG, "%s(c=[%d], id=\"%s\")", __FUNCTION__, c->sock, id);
 
-	LL_Rewind(c->screenlist);
-	do {
-		s = LL_Get(c->screenlist);
-		if ((s) && (0 == strcmp(s->id, id))) {
+	LL_FOREACH(&c->screenlist, l) {
+		Screen *s = LL_ENTRY(l, Screen, link);
+
+		if (0 == strcmp(s->id, id)) {
 			debug(RPT_DEBUG, "%s: Found %s", __FUNCTION__, id);
 			return s;
 		}
-	} while (LL_Next(c->screenlist) == 0);
+	}
 
 	return NULL;
 }
@@ -197,7 +207,7 @@ client_add_screen(Client *c, Screen *s)
 
 	debug(RPT_DEBUG, "%s(c=[%d], s=[%s])", __FUNCTION__, c->sock, s->id);
 
-	LL_Push(c->screenlist, (void *) s);
+	LL_ListAppend(&c->screenlist, &s->link);
 
 	/* Now, add it to the screenlist...*/
 	screenlist_add(s);
@@ -215,8 +225,7 @@ client_remove_screen(Client *c, Screen *s)
 
 	debug(RPT_DEBUG, "%s(c=[%d], s=[%s])", __FUNCTION__, c->sock, s->id);
 
-	/* TODO:  Check for errors here?*/
-	LL_Remove(c->screenlist, (void *) s, NEXT);
+	LL_ListRemove(&c->screenlist, &s->link);
 
 	/* Now, remove it from the screenlist...*/
 	screenlist_remove(s);
@@ -226,5 +235,5 @@ client_remove_screen(Client *c, Screen *s)
 
 int client_screen_count(Client *c)
 {
-	return LL_Length(c->screenlist);
+	return LL_ListLength(&c->screenlist);
 }
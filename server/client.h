@@ -25,6 +25,7 @@
 #define CLIENT_H_TYPES
 
 #include "shared/LL.h"
+#include "arena.h"
 
 #define CLIENT_NAME_SIZE 256
 
@@ -45,9 +46,18 @@ typedef struct Client {
 	int heartbeat;
 
 	LinkedList *messages;		/**< Messages that the client sent. */
-	LinkedList *screenlist;		/**< List of client's screens. */
+	LL_list screenlist;		/**< List of client's screens. */
+	LL_link link;			/**< In the list of clients. */
+	Arena *arena;			/**< Memory of the client's screens and widgets. */
 
 	void* menu;			/**< Menu hierarchy, if any */
+
+	unsigned long bytes_in;		/**< Bytes received from the client. */
+	unsigned long bytes_out;	/**< Bytes sent to the client. */
+	unsigned long commands;		/**< Commands parsed for the client. */
+
+	long peer_pid;			/**< Process of a client on the UNIX socket; -1 otherwise. */
+	long peer_uid;			/**< User of a client on the UNIX socket; -1 otherwise. */
 } Client;
 
 #endif
@@ -25,7 +25,7 @@
 #include "clients.h"
 #include "render.h"
 
-LinkedList *clientlist = NULL;
+static LL_list clientlist;
 
 /* Initialize and kill client list...*/
 int
@@ -33,11 +33,7 @@ clients_init(void)
 {
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
-	clientlist = LL_new();
-	if (!clientlist) {
-		report(RPT_ERR, "%s: Unable to create client list", __FUNCTION__);
-		return -1;
-	}
+	LL_ListInit(&clientlist);
 
 	return 0;
 }
@@ -45,33 +41,28 @@ clients_init(void)
 int
 clients_shutdown(void)
 {
-	Client *c;
+	LL_link *l, *tmp;
 
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
-	if (!clientlist) {
+	if (clientlist.anchor.next == NULL) {
 		/* Program shutdown before completed startup */
 		return -1;
 	}
 
 	/* Free all client structures... */
-	for (c = LL_GetFirst(clientlist); c; c = LL_GetNext(clientlist)) {
-		debug(RPT_DEBUG, "%s: ...", __FUNCTION__);
-		if (c) {
-			debug(RPT_DEBUG, "%s: ... %i ...", __FUNCTION__, c->sock);
-			if (client_destroy(c) != 0) {
-				report(RPT_ERR, "%s: Error freeing client", __FUNCTION__);
-			} else {
-				debug(RPT_DEBUG, "%s: Freed client...", __FUNCTION__);
-			}
+	LL_FOREACH_SAFE(&clientlist, l, tmp) {
+		Client *c = LL_ENTRY(l, Client, link);
+
+		debug(RPT_DEBUG, "%s: ... %i ...", __FUNCTION__, c->sock);
+		LL_ListRemove(&clientlist, l);
+		if (client_destroy(c) != 0) {
+			report(RPT_ERR, "%s: Error freeing client", __FUNCTION__);
 		} else {
-			debug(RPT_DEBUG, "%s: No client!", __FUNCTION__);
+			debug(RPT_DEBUG, "%s: Freed client...", __FUNCTION__);
 		}
 	}
 
-	/* Then, free the list...*/
-	LL_Destroy(clientlist);
-
 	debug(RPT_DEBUG, "%s: done", __FUNCTION__);
 
 	return 0;
@@ -81,37 +72,49 @@ clients_shutdown(void)
 Client *
 clients_add_client(Client *c)
 {
-	if (LL_Push(clientlist, c) == 0)
-		return c;
+	if (c == NULL)
+		return NULL;
 
-	return NULL;
+	LL_ListAppend(&clientlist, &c->link);
+
+	return c;
 }
 
 /* Remove the client from the clients list... */
 Client *
-clients_remove_client(Client *c, Direction whereto)
+clients_remove_client(Client *c)
 {
-	Client *client = LL_Remove(clientlist, c, whereto);
+	if (c == NULL)
+		return NULL;
+
+	LL_ListRemove(&clientlist, &c->link);
 
-	return client;
+	return c;
 }
 
+/* The iteration keeps no state in the list, so it can be nested. */
 Client *
 clients_getfirst(void)
 {
-	return (Client *) LL_GetFirst(clientlist);
+	if (LL_ListLength(&clientlist) == 0)
+		return NULL;
+
+	return LL_ENTRY(clientlist.anchor.next, Client, link);
 }
 
 Client *
-clients_getnext(void)
+clients_getnext(Client *c)
 {
-	return (Client *) LL_GetNext(clientlist);
+	if ((c == NULL) || (c->link.next == &clientlist.anchor))
+		return NULL;
+
+	return LL_ENTRY(c->link.next, Client, link);
 }
 
 int
 clients_client_count(void)
 {
-	return LL_Length(clientlist);
+	return LL_ListLength(&clientlist);
 }
 
 
@@ -122,11 +125,13 @@ clients_client_count(void)
 Client *
 clients_find_client_by_sock(int sock)
 {
-	Client *c;
+	LL_link *l;
 
 	debug(RPT_DEBUG, "%s(sock=%i)", __FUNCTION__, sock);
 
-	for (c = LL_GetFirst(clientlist); c; c = LL_GetNext(clientlist)) {
+	LL_FOREACH(&clientlist, l) {
+		Client *c = LL_ENTRY(l, Client, link);
+
 		if (c->sock == sock) {
 			return c;
 		}
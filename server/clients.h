@@ -21,11 +21,11 @@ int clients_shutdown(void);
 
 /* Add/remove clients (return NULL for error) */
 Client *clients_add_client(Client *c);
-Client *clients_remove_client(Client *c, Direction whereto);
+Client *clients_remove_client(Client *c);
 
-/* List functions */
+/* List functions; clients_getnext() returns the client after c */
 Client *clients_getfirst(void);
-Client *clients_getnext(void);
+Client *clients_getnext(Client *c);
 int clients_client_count(void);
 
 /* Search for a client with a particular filedescriptor...*/
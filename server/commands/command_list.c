@@ -48,13 +48,15 @@ static client_function commands[] = {
 	{ "output",         output_func         },
 	{ "noop",           noop_func           },
 	{ "info",           info_func           },
+	{ "stats",          stats_func          },
 	{ "sleep",          sleep_func          },
 	{ "bye",            bye_func            },
 	{ NULL,             NULL},
 };
 
 /**
- * Looks up a function for a command sent by the client.
+ * Looks up a function for a command sent by the client, and counts the
+ * command for the statistics.
  * \param cmd  Command to look up as string.
  * \return  Pointer to the implementing function.
  */
@@ -66,8 +68,30 @@ CommandFunc get_command_function(char *cmd)
 		return NULL;
 
 	for (i = 0; commands[i].keyword != NULL; i++) {
-		if (0 == strcmp(cmd, commands[i].keyword))
+		if (0 == strcmp(cmd, commands[i].keyword)) {
+			commands[i].count++;
 			return commands[i].function;
+		}
+	}
+
+	return NULL;
+}
+
+/**
+ * Gets the number of times a command has been called.
+ * \param index  Index of the command in the command table.
+ * \param count  Where to store the number of calls.
+ * \return  Keyword of the command, or NULL if index is past the table.
+ */
+const char *get_command_stats(int index, unsigned long *count)
+{
+	int i;
+
+	for (i = 0; commands[i].keyword != NULL; i++) {
+		if (i == index) {
+			*count = commands[i].count;
+			return commands[i].keyword;
+		}
 	}
 
 	return NULL;
@@ -25,9 +25,11 @@ typedef int (*CommandFunc) (Client *c, int argc, char **argv);
 typedef struct client_function {
 	char *keyword;		/**< Command string in the protocol */
 	CommandFunc function;	/**< Pointer to the associated function */
+	unsigned long count;	/**< Number of times the command was looked up */
 } client_function;
 
 
 CommandFunc get_command_function(char *cmd);
+const char *get_command_stats(int index, unsigned long *count);
 
 #endif
@@ -182,9 +182,8 @@ screen_set_func(Client *c, int argc, char **argv)
 				debug(RPT_DEBUG, "screen_set: name=\"%s\"", argv[i]);
 
 				/* set the name...*/
-				if (s->name != NULL)
-					free(s->name);
-				s->name = strdup(argv[i]);
+				arena_free(c->arena, s->name);
+				s->name = arena_strdup(c->arena, argv[i]);
 				sock_send_string(c->sock, "success\n");
 			}
 			else {
@@ -426,6 +425,7 @@ int
 key_add_func(Client *c, int argc, char **argv)
 {
 	Screen *s;
+	char *keys;
 	int len;
 
 	if (argc < 3) {
@@ -441,7 +441,12 @@ key_add_func(Client *c, int argc, char **argv)
 
 	len = argv[argc - 1] - argv[2] + strlen(argv[argc - 1]) + 1;
 
-	s->keys = realloc(s->keys, len + s->keys_size);
+	keys = arena_realloc(c->arena, s->keys, len + s->keys_size);
+	if (keys == NULL) {
+		sock_send_error(c->sock, "Error allocating\n");
+		return 0;
+	}
+	s->keys = keys;
 	memcpy(&s->keys[s->keys_size], argv[2], len);
 	s->keys_size += len;
 
@@ -29,6 +29,7 @@
 
 #include "client.h"
 #include "render.h"
+#include "stats.h"
 #include "server_commands.h"
 
 #define ALL_OUTPUTS_ON -1
@@ -181,3 +182,35 @@ noop_func(Client *c, int argc, char **argv)
 	sock_send_string(c->sock, "noop complete\n");
 	return 0;
 }
+
+/**
+ * Sends the server statistics, one sample per line in the Prometheus text
+ * format, followed by "success".
+ *
+ *\verbatim
+ * Usage: stats
+ *\endverbatim
+ */
+int
+stats_func(Client *c, int argc, char **argv)
+{
+	char *text;
+
+	if (c->state != ACTIVE)
+		return 1;
+
+	if (argc > 1) {
+		sock_send_error(c->sock, "Extra arguments ignored...\n");
+	}
+
+	text = stats_format(0);
+	if (text == NULL) {
+		sock_send_error(c->sock, "Could not collect statistics\n");
+		return 0;
+	}
+	sock_send_string(c->sock, text);
+	free(text);
+
+	sock_send_string(c->sock, "success\n");
+	return 0;
+}
@@ -17,5 +17,6 @@ int test_func_func(Client *c, int argc, char **argv);
 int noop_func(Client *c, int argc, char **argv);
 int info_func(Client *c, int argc, char **argv);
 int sleep_func(Client *c, int argc, char **argv);
+int stats_func(Client *c, int argc, char **argv);
 
 #endif
@@ -246,8 +246,8 @@ widget_set_func(Client *c, int argc, char **argv)
 
 		w->x = atoi(argv[i]);
 		w->y = atoi(argv[i + 1]);
-		free(w->text);
-		w->text = strdup(argv[i + 2]);
+		arena_free(c->arena, w->text);
+		w->text = arena_strdup(c->arena, argv[i + 2]);
 		debug(RPT_DEBUG, "Widget %s set to %s", wid, w->text);
 
 		break;
@@ -298,8 +298,8 @@ widget_set_func(Client *c, int argc, char **argv)
 			sock_send_error(c->sock, "Invalid coordinates\n");
 			return 0;
 		}
-		free(w->begin_label);
-		free(w->end_label);
+		arena_free(c->arena, w->begin_label);
+		arena_free(c->arena, w->end_label);
 		w->begin_label = NULL;
 		w->end_label = NULL;
 		w->x = atoi(argv[i]);
@@ -307,9 +307,9 @@ widget_set_func(Client *c, int argc, char **argv)
 		w->width = atoi(argv[i + 2]);
 		w->promille = atoi(argv[i + 3]);
 		if (argc >= i + 5)
-			w->begin_label = strdup(argv[i + 4]);
+			w->begin_label = arena_strdup(c->arena, argv[i + 4]);
 		if (argc >= i + 6)
-			w->end_label = strdup(argv[i + 5]);
+			w->end_label = arena_strdup(c->arena, argv[i + 5]);
 		debug(RPT_DEBUG, "Widget %s set to %i", wid, w->promille);
 
 		break;
@@ -343,8 +343,8 @@ widget_set_func(Client *c, int argc, char **argv)
 			return 0;
 		}
 
-		free(w->text);
-		w->text = strdup(argv[i]);
+		arena_free(c->arena, w->text);
+		w->text = arena_strdup(c->arena, argv[i]);
 		/* Set width too */
 		w->width = display_props->width;
 		debug(RPT_DEBUG, "Widget %s set to %s", wid, w->text);
@@ -376,8 +376,8 @@ widget_set_func(Client *c, int argc, char **argv)
 		w->bottom = atoi(argv[i + 3]);
 		w->length = argv[i + 4][0];
 		w->speed = atoi(argv[i + 5]);
-		free(w->text);
-		w->text = strdup(argv[i + 6]);
+		arena_free(c->arena, w->text);
+		w->text = arena_strdup(c->arena, argv[i + 6]);
 		debug(RPT_DEBUG, "Widget %s set to %s", wid, w->text);
 
 		break;
@@ -0,0 +1,393 @@
+/** \file server/compose.c
+ * This file contains the composed frame objects. The renderer draws a
+ * screen into the back buffer of a ComposeBuffer and publishes it; the
+ * driver flush takes the most recent frame and replays it on the drivers.
+ *
+ * Publishing and acquiring are a single atomic exchange each, so the
+ * renderer and the consumer of the frames never block each other. This
+ * allows frames to be rendered at a different pace than slow displays can
+ * accept them: a consumer that lags behind simply skips the frames that
+ * have been superseded in the meantime.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "shared/report.h"
+
+#include "drivers/lcd.h"
+#include "compose.h"
+
+/** Flag in ComposeBuffer.middle marking a published but unread frame */
+#define COMPOSE_FRESH	0x4
+#define COMPOSE_INDEX	0x3
+
+#define COMPOSE_MIN_OPS		32
+#define COMPOSE_MIN_TEXT	256
+
+
+static int compose_frame_init(ComposedFrame *f, int width, int height);
+static void compose_frame_reset(ComposedFrame *f);
+static ComposeOp *compose_add_op(ComposedFrame *f, ComposeOpType type, int x, int y);
+static int compose_add_text(ComposedFrame *f, const char *text);
+
+
+/**
+ * Create a triple buffer of composed frames.
+ * \param width   Width of the display in characters.
+ * \param height  Height of the display in characters.
+ * \return        Pointer to the new buffer, or NULL on error.
+ */
+ComposeBuffer *
+compose_buffer_create(int width, int height)
+{
+	ComposeBuffer *cb;
+	int i;
+
+	debug(RPT_DEBUG, "%s(width=%d, height=%d)", __FUNCTION__, width, height);
+
+	cb = calloc(1, sizeof(ComposeBuffer));
+	if (cb == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
+
+	for (i = 0; i < 3; i++) {
+		if (compose_frame_init(&cb->frames[i], width, height) < 0) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			compose_buffer_destroy(cb);
+			return NULL;
+		}
+	}
+	cb->back = 0;
+	cb->middle = 1;
+	cb->front = 2;
+
+	return cb;
+}
+
+
+/**
+ * Destroy a triple buffer and all its frames.
+ * \param cb  The buffer to destroy.
+ */
+void
+compose_buffer_destroy(ComposeBuffer *cb)
+{
+	int i;
+
+	if (cb == NULL)
+		return;
+
+	for (i = 0; i < 3; i++) {
+		free(cb->frames[i].ops);
+		free(cb->frames[i].text);
+	}
+	free(cb);
+}
+
+
+/**
+ * Get the back buffer, cleared and ready for rendering.
+ * Must only be called by the producer.
+ * \param cb  The triple buffer.
+ * \return    The frame to render into.
+ */
+ComposedFrame *
+compose_buffer_begin(ComposeBuffer *cb)
+{
+	ComposedFrame *f = &cb->frames[cb->back];
+
+	compose_frame_reset(f);
+	f->serial = ++cb->serial;
+
+	return f;
+}
+
+
+/**
+ * Publish the back buffer, making it the latest frame for the consumer.
+ * The previously published frame, if it has not been read, becomes the
+ * new back buffer.
+ * Must only be called by the producer.
+ * \param cb  The triple buffer.
+ */
+void
+compose_buffer_publish(ComposeBuffer *cb)
+{
+	int old;
+
+	old = __atomic_exchange_n(&cb->middle, cb->back | COMPOSE_FRESH, __ATOMIC_ACQ_REL);
+	cb->back = old & COMPOSE_INDEX;
+}
+
+
+/**
+ * Take the most recently published frame.
+ * Must only be called by the consumer.
+ * \param cb  The triple buffer.
+ * \return    The new frame, or NULL if nothing was published since the last call.
+ */
+ComposedFrame *
+compose_buffer_acquire(ComposeBuffer *cb)
+{
+	int old;
+
+	if ((__atomic_load_n(&cb->middle, __ATOMIC_ACQUIRE) & COMPOSE_FRESH) == 0)
+		return NULL;
+
+	old = __atomic_exchange_n(&cb->middle, cb->front, __ATOMIC_ACQ_REL);
+	cb->front = old & COMPOSE_INDEX;
+
+	return &cb->frames[cb->front];
+}
+
+
+/**
+ * Write a string into a frame.
+ * \param f       The frame.
+ * \param x       Horizontal character position (column).
+ * \param y       Vertical character position (row).
+ * \param string  String that gets written.
+ */
+void
+compose_string(ComposedFrame *f, int x, int y, const char *string)
+{
+	ComposeOp *op;
+
+	op = compose_add_op(f, COMPOSE_STRING, x, y);
+	if (op != NULL)
+		op->text = compose_add_text(f, string);
+}
+
+
+/**
+ * Write a character into a frame.
+ * \param f       The frame.
+ * \param x       Horizontal character position (column).
+ * \param y       Vertical character position (row).
+ * \param c       Character that gets written.
+ */
+void
+compose_chr(ComposedFrame *f, int x, int y, char c)
+{
+	ComposeOp *op;
+
+	op = compose_add_op(f, COMPOSE_CHR, x, y);
+	if (op != NULL)
+		op->arg[0] = (unsigned char) c;
+}
+
+
+/**
+ * Record a vertical bar in a frame.
+ * \param f        The frame.
+ * \param x        Horizontal character position (column) of the starting point.
+ * \param y        Vertical character position (row) of the starting point.
+ * \param len      Number of characters that the bar is long at 100%
+ * \param promille Current length level of the bar in promille.
+ * \param pattern  Options (currently unused).
+ */
+void
+compose_vbar(ComposedFrame *f, int x, int y, int len, int promille, int pattern)
+{
+	ComposeOp *op = compose_add_op(f, COMPOSE_VBAR, x, y);
+
+	if (op != NULL) {
+		op->arg[0] = len;
+		op->arg[1] = promille;
+		op->arg[2] = pattern;
+	}
+}
+
+
+/**
+ * Record a horizontal bar in a frame.
+ * \param f        The frame.
+ * \param x        Horizontal character position (column) of the starting point.
+ * \param y        Vertical character position (row) of the starting point.
+ * \param len      Number of characters that the bar is long at 100%
+ * \param promille Current length level of the bar in promille.
+ * \param pattern  Options (currently unused).
+ */
+void
+compose_hbar(ComposedFrame *f, int x, int y, int len, int promille, int pattern)
+{
+	ComposeOp *op = compose_add_op(f, COMPOSE_HBAR, x, y);
+
+	if (op != NULL) {
+		op->arg[0] = len;
+		op->arg[1] = promille;
+		op->arg[2] = pattern;
+	}
+}
+
+
+/**
+ * Record a percentage-bar in a frame.
+ * \param f            The frame.
+ * \param x            Horizontal character position (column) of the starting point.
+ * \param y            Vertical character position (row) of the starting point.
+ * \param width        Width of the widget in characters.
+ * \param promille     Current length level of the bar in promille.
+ * \param begin_label  Optional (may be NULL) label in front of the bar.
+ * \param end_label    Optional (may be NULL) label at the end of the bar.
+ */
+void
+compose_pbar(ComposedFrame *f, int x, int y, int width, int promille,
+	     const char *begin_label, const char *end_label)
+{
+	ComposeOp *op = compose_add_op(f, COMPOSE_PBAR, x, y);
+
+	if (op != NULL) {
+		op->arg[0] = width;
+		op->arg[1] = promille;
+		if (begin_label != NULL)
+			op->text = compose_add_text(f, begin_label);
+		if (end_label != NULL)
+			op->text2 = compose_add_text(f, end_label);
+	}
+}
+
+
+/**
+ * Record a big number in a frame.
+ * \param f        The frame.
+ * \param x        Horizontal character position (column).
+ * \param num      Character to write (0 - 10 with 10 representing ':')
+ */
+void
+compose_num(ComposedFrame *f, int x, int num)
+{
+	ComposeOp *op = compose_add_op(f, COMPOSE_NUM, x, 0);
+
+	if (op != NULL)
+		op->arg[0] = num;
+}
+
+
+/**
+ * Record an icon in a frame.
+ * \param f        The frame.
+ * \param x        Horizontal character position (column).
+ * \param y        Vertical character position (row).
+ * \param icon     Symbolic value representing the icon.
+ */
+void
+compose_icon(ComposedFrame *f, int x, int y, int icon)
+{
+	ComposeOp *op = compose_add_op(f, COMPOSE_ICON, x, y);
+
+	if (op != NULL)
+		op->arg[0] = icon;
+}
+
+
+/**
+ * Mark the start of the overlay: all operations recorded from now on are
+ * drawn after the cursor and the heartbeat have been set.
+ * \param f        The frame.
+ */
+void
+compose_begin_overlay(ComposedFrame *f)
+{
+	f->body_ops = f->num_ops;
+}
+
+
+static int
+compose_frame_init(ComposedFrame *f, int width, int height)
+{
+	f->width = width;
+	f->height = height;
+
+	f->max_ops = COMPOSE_MIN_OPS;
+	f->ops = malloc(f->max_ops * sizeof(ComposeOp));
+	f->text_size = COMPOSE_MIN_TEXT;
+	f->text = malloc(f->text_size);
+
+	if ((f->ops == NULL) || (f->text == NULL))
+		return -1;
+
+	compose_frame_reset(f);
+	return 0;
+}
+
+
+static void
+compose_frame_reset(ComposedFrame *f)
+{
+	f->num_ops = 0;
+	f->body_ops = -1;
+	f->text_len = 0;
+
+	f->backlight = BACKLIGHT_ON;
+	f->output = 0;
+	f->cursor = CURSOR_OFF;
+	f->cursor_x = 1;
+	f->cursor_y = 1;
+	f->heartbeat = HEARTBEAT_OFF;
+	f->animated = 0;
+	f->next_change = -1;
+}
+
+
+static ComposeOp *
+compose_add_op(ComposedFrame *f, ComposeOpType type, int x, int y)
+{
+	ComposeOp *op;
+
+	if (f->num_ops == f->max_ops) {
+		ComposeOp *ops = realloc(f->ops, 2 * f->max_ops * sizeof(ComposeOp));
+
+		if (ops == NULL) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			return NULL;
+		}
+		f->ops = ops;
+		f->max_ops *= 2;
+	}
+
+	op = &f->ops[f->num_ops++];
+	op->type = type;
+	op->x = x;
+	op->y = y;
+	op->arg[0] = op->arg[1] = op->arg[2] = 0;
+	op->text = op->text2 = -1;
+
+	return op;
+}
+
+
+static int
+compose_add_text(ComposedFrame *f, const char *text)
+{
+	int len = strlen(text) + 1;
+	int offset = f->text_len;
+
+	if (f->text_len + len > f->text_size) {
+		int size = f->text_size;
+		char *buf;
+
+		while (f->text_len + len > size)
+			size *= 2;
+		buf = realloc(f->text, size);
+		if (buf == NULL) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			return -1;
+		}
+		f->text = buf;
+		f->text_size = size;
+	}
+
+	memcpy(f->text + offset, text, len);
+	f->text_len += len;
+
+	return offset;
+}
@@ -0,0 +1,98 @@
+/** \file server/compose.h
+ * Public interface to the composed frames that are handed from the renderer
+ * to the drivers.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifndef COMPOSE_H
+#define COMPOSE_H
+
+/** Operations recorded in a composed frame, replayed in order on flush. */
+typedef enum {
+	COMPOSE_STRING,		/**< string at x,y; text */
+	COMPOSE_CHR,		/**< character at x,y; arg[0] */
+	COMPOSE_VBAR,		/**< vbar at x,y; len, promille, pattern */
+	COMPOSE_HBAR,		/**< hbar at x,y; len, promille, pattern */
+	COMPOSE_PBAR,		/**< pbar at x,y; width, promille; text, text2 */
+	COMPOSE_NUM,		/**< big number at x; arg[0] */
+	COMPOSE_ICON,		/**< icon at x,y; arg[0] */
+} ComposeOpType;
+
+typedef struct ComposeOp {
+	ComposeOpType type;
+	int x, y;
+	int arg[3];
+	int text;		/**< offset in ComposedFrame.text, or -1 */
+	int text2;		/**< second label offset, or -1 */
+} ComposeOp;
+
+/**
+ * Everything that makes up one frame on the display: the drawing
+ * operations, including those that need the driver's CGRAM (bars, icons,
+ * big numbers), and the out-of-band state.
+ */
+typedef struct ComposedFrame {
+	unsigned long serial;	/**< increases with every published frame */
+	int width, height;
+
+	ComposeOp *ops;		/**< operations in rendering order */
+	int num_ops, max_ops;
+	int body_ops;		/**< ops from this index on are overlays */
+
+	char *text;		/**< arena for the texts of string ops */
+	int text_len, text_size;
+
+	int backlight;
+	int output;
+	int cursor_x, cursor_y, cursor;
+	int heartbeat;
+
+	int animated;		/**< contents change in between timer ticks */
+	long next_change;	/**< next tick changing the contents, or -1 */
+} ComposedFrame;
+
+/**
+ * Triple buffer of composed frames with a single producer (the renderer)
+ * and a single consumer (the driver flush). Neither side ever waits for
+ * the other: the renderer always has a back buffer to draw into and the
+ * consumer always gets the most recently published frame.
+ */
+typedef struct ComposeBuffer {
+	ComposedFrame frames[3];
+	int back;		/**< index owned by the producer */
+	int front;		/**< index owned by the consumer */
+	int middle;		/**< exchanged atomically, COMPOSE_FRESH if unread */
+	unsigned long serial;
+} ComposeBuffer;
+
+ComposeBuffer *compose_buffer_create(int width, int height);
+void compose_buffer_destroy(ComposeBuffer *cb);
+
+/* Producer side */
+ComposedFrame *compose_buffer_begin(ComposeBuffer *cb);
+void compose_buffer_publish(ComposeBuffer *cb);
+
+/* Consumer side */
+ComposedFrame *compose_buffer_acquire(ComposeBuffer *cb);
+
+/* Drawing into a frame */
+void compose_string(ComposedFrame *f, int x, int y, const char *string);
+void compose_chr(ComposedFrame *f, int x, int y, char c);
+void compose_vbar(ComposedFrame *f, int x, int y, int len, int promille, int pattern);
+void compose_hbar(ComposedFrame *f, int x, int y, int len, int promille, int pattern);
+void compose_pbar(ComposedFrame *f, int x, int y, int width, int promille, const char *begin_label, const char *end_label);
+void compose_num(ComposedFrame *f, int x, int num);
+void compose_icon(ComposedFrame *f, int x, int y, int icon);
+void compose_begin_overlay(ComposedFrame *f);
+
+static inline const char *compose_op_text(const ComposedFrame *f, int offset)
+{
+	return (offset < 0) ? NULL : f->text + offset;
+}
+
+#endif
@@ -14,12 +14,18 @@
 #include <stdio.h>
 #include <unistd.h>
 #include <string.h>
+#include <strings.h>
 #include <errno.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
 
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+# include <time.h>
+#endif
+
 #include "shared/LL.h"
 #include "shared/report.h"
 #include "shared/configfile.h"
@@ -27,6 +33,7 @@
 #include "driver.h"
 #include "drivers.h"
 #include "widget.h"
+#include "stats.h"
 
 Driver *output_driver = NULL;
 LinkedList *loaded_drivers = NULL;		/**< list of loaded drivers */
@@ -34,6 +41,33 @@ DisplayProps *display_props = NULL;		/**< properties of the display */
 
 #define ForAllDrivers(drv) for (drv = LL_GetFirst(loaded_drivers); drv; drv = LL_GetNext(loaded_drivers))
 
+#ifdef HAVE_PTHREAD
+/** Driver that is being initialized by a thread of its own */
+typedef struct PendingDriver {
+	char *name;			/**< driver section name */
+	char *filename;			/**< module to load */
+	Driver *driver;			/**< the loaded driver, \c NULL if loading failed */
+	struct timespec deadline;	/**< when to stop waiting for the driver */
+	int state;			/**< one of PENDING_* (protected by pending_mutex) */
+} PendingDriver;
+
+#define PENDING_RUNNING		0	/**< driver is still initializing */
+#define PENDING_DONE		1	/**< driver_load() has returned */
+#define PENDING_ABANDONED	2	/**< timed out, the thread cleans up */
+
+static LinkedList *pending_drivers = NULL;	/**< list of PendingDriver */
+static pthread_mutex_t pending_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t pending_cond = PTHREAD_COND_INITIALIZER;
+
+static Driver *drivers_take_pending(PendingDriver *p, int *res);
+static void drivers_free_pending(PendingDriver *p);
+#endif
+
+static char *drivers_module_filename(const char *name);
+static int drivers_attach(Driver *driver);
+static void drivers_set_output(Driver *driver);
+static void drivers_replay_ops(const ComposedFrame *f, int first, int last);
+
 
 /**
  * Load driver based on "DriverPath" config setting and section name or
@@ -47,62 +81,365 @@ int
 drivers_load_driver(const char *name)
 {
 	Driver *driver;
-	const char *s;
+	char *filename;
 
 	debug(RPT_DEBUG, "%s(name=\"%.40s\")", __FUNCTION__, name);
 
-	/* First driver ? */
-	if (!loaded_drivers) {
-		/* Create linked list */
-		loaded_drivers = LL_new();
-		if (!loaded_drivers) {
+	filename = drivers_module_filename(name);
+	if (filename == NULL)
+		return -1;
+
+	/* Load the module */
+	driver = driver_load(name, filename);
+	if (driver == NULL) {
+		/* It failed. The message has already been given by driver_load() */
+		report(RPT_INFO, "Module %.40s could not be loaded", filename);
+		free(filename);
+		return -1;
+	}
+	free(filename);
+
+	return drivers_attach(driver);
+}
+
+
+#ifdef HAVE_PTHREAD
+/* Thread function: load and initialize one driver. */
+static void *
+drivers_load_thread(void *arg)
+{
+	PendingDriver *p = arg;
+	Driver *driver;
+
+	driver = driver_load(p->name, p->filename);
+
+	pthread_mutex_lock(&pending_mutex);
+	p->driver = driver;
+	if (p->state == PENDING_ABANDONED) {
+		/* Nobody is waiting for this driver any longer */
+		pthread_mutex_unlock(&pending_mutex);
+		if (driver != NULL) {
+			report(RPT_WARNING, "Driver [%.40s] initialized too late, unloading it", p->name);
+			driver_unload(driver);
+		}
+		drivers_free_pending(p);
+		return NULL;
+	}
+	p->state = PENDING_DONE;
+	pthread_cond_broadcast(&pending_cond);
+	pthread_mutex_unlock(&pending_mutex);
+
+	return NULL;
+}
+
+
+/**
+ * Start loading a driver in a thread of its own. The driver is not used
+ * before drivers_wait_pending() or drivers_attach_pending() added it to the
+ * list of loaded drivers; until then drivers_is_pending() returns true.
+ * If the thread cannot be created the driver is loaded right away.
+ * \param name     Driver section name.
+ * \param timeout  Seconds to wait for the driver to initialize.
+ * \retval  <0  error.
+ * \retval   0  OK
+ * \retval   2  OK, driver needs to run in the foreground.
+ */
+int
+drivers_start_driver(const char *name, int timeout)
+{
+	PendingDriver *p;
+	pthread_t thread;
+
+	debug(RPT_DEBUG, "%s(name=\"%.40s\", timeout=%d)", __FUNCTION__, name, timeout);
+
+	if (!pending_drivers) {
+		pending_drivers = LL_new();
+		if (!pending_drivers) {
 			report(RPT_ERR, "Error allocating driver list.");
 			return -1;
 		}
 	}
 
-	/* Retrieve data from config file */
-	s = config_get_string("server", "DriverPath", 0, "");
-	char driverpath[strlen(s) + 1];
-	strcpy(driverpath, s);
+	p = calloc(1, sizeof(PendingDriver));
+	if (p == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return -1;
+	}
+	p->name = strdup(name);
+	p->filename = drivers_module_filename(name);
+	if ((p->name == NULL) || (p->filename == NULL)) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		drivers_free_pending(p);
+		return -1;
+	}
+	p->state = PENDING_RUNNING;
+	clock_gettime(CLOCK_REALTIME, &p->deadline);
+	p->deadline.tv_sec += timeout;
+
+	LL_Push(pending_drivers, p);
+	if (pthread_create(&thread, NULL, drivers_load_thread, p) != 0) {
+		report(RPT_WARNING, "Could not start a thread for driver [%.40s], loading it now", name);
+		LL_Remove(pending_drivers, p, NEXT);
+		drivers_free_pending(p);
+		return drivers_load_driver(name);
+	}
+	pthread_detach(thread);
+
+	return 0;
+}
+
+
+/**
+ * Check whether a driver is still being initialized in the background.
+ * \param name  Driver section name.
+ * \return      1 if the driver is pending, 0 otherwise.
+ */
+int
+drivers_is_pending(const char *name)
+{
+	PendingDriver *p;
+
+	for (p = LL_GetFirst(pending_drivers); p; p = LL_GetNext(pending_drivers)) {
+		if (strcasecmp(p->name, name) == 0)
+			return 1;
+	}
+	return 0;
+}
+
+
+/**
+ * Wait for a driver started by drivers_start_driver() until it is
+ * initialized or its timeout expires, and add it to the loaded drivers.
+ * \param name  Driver section name.
+ * \retval  <0  error: the driver failed, timed out or is not pending.
+ * \retval   0  OK
+ * \retval   2  OK, driver needs to run in the foreground.
+ */
+int
+drivers_wait_pending(const char *name)
+{
+	PendingDriver *p;
+	Driver *driver;
+	int res = -1;
+
+	debug(RPT_DEBUG, "%s(name=\"%.40s\")", __FUNCTION__, name);
+
+	for (p = LL_GetFirst(pending_drivers); p; p = LL_GetNext(pending_drivers)) {
+		if (strcasecmp(p->name, name) == 0)
+			break;
+	}
+	if (p == NULL)
+		return -1;
+
+	pthread_mutex_lock(&pending_mutex);
+	while (p->state == PENDING_RUNNING) {
+		if (pthread_cond_timedwait(&pending_cond, &pending_mutex, &p->deadline) == ETIMEDOUT)
+			break;
+	}
+	driver = drivers_take_pending(p, &res);
+	pthread_mutex_unlock(&pending_mutex);
+
+	if (driver != NULL)
+		res = drivers_attach(driver);
+
+	return res;
+}
+
+
+/**
+ * Wait for all drivers that are still being initialized.
+ */
+void
+drivers_wait_all_pending(void)
+{
+	PendingDriver *p;
+	char name[41];
+
+	while ((p = LL_GetFirst(pending_drivers)) != NULL) {
+		/* p is freed by drivers_wait_pending() */
+		strncpy(name, p->name, sizeof(name) - 1);
+		name[sizeof(name) - 1] = '\0';
+		if (drivers_wait_pending(name) < 0)
+			report(RPT_ERR, "Could not load driver %.40s", name);
+	}
+}
+
+
+/**
+ * Add the drivers that have finished initializing in the background to the
+ * loaded drivers, and give up on the ones that timed out. Does not block.
+ * \return  Number of drivers that are still initializing.
+ */
+int
+drivers_attach_pending(void)
+{
+	PendingDriver *p;
+	struct timespec now;
+
+	if (LL_GetFirst(pending_drivers) == NULL)
+		return 0;
+
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	do {
+		Driver *driver = NULL;
+		char name[41];
+		int res = -1;
+
+		pthread_mutex_lock(&pending_mutex);
+		for (p = LL_GetFirst(pending_drivers); p; p = LL_GetNext(pending_drivers)) {
+			if ((p->state != PENDING_RUNNING)
+			    || (now.tv_sec > p->deadline.tv_sec)
+			    || ((now.tv_sec == p->deadline.tv_sec) && (now.tv_nsec >= p->deadline.tv_nsec)))
+				break;
+		}
+		if (p != NULL) {
+			strncpy(name, p->name, sizeof(name) - 1);
+			name[sizeof(name) - 1] = '\0';
+			driver = drivers_take_pending(p, &res);
+		}
+		pthread_mutex_unlock(&pending_mutex);
+
+		if (driver != NULL) {
+			res = drivers_attach(driver);
+			if (res == 2)
+				report(RPT_WARNING, "Driver [%.40s] wants to run in the foreground, but the server already is in the background", name);
+		}
+		if ((p != NULL) && (res < 0))
+			report(RPT_ERR, "Could not load driver %.40s", name);
+	} while (p != NULL);
+
+	return LL_Length(pending_drivers);
+}
+
+
+/*
+ * Remove a pending driver from the list. If it is done, return the loaded
+ * driver and free the entry; otherwise mark it abandoned, which leaves the
+ * cleanup to its thread. Must be called with pending_mutex locked.
+ */
+static Driver *
+drivers_take_pending(PendingDriver *p, int *res)
+{
+	Driver *driver;
+
+	LL_Remove(pending_drivers, p, NEXT);
+
+	if (p->state == PENDING_RUNNING) {
+		report(RPT_ERR, "Driver [%.40s] did not initialize in time", p->name);
+		p->state = PENDING_ABANDONED;
+		*res = -1;
+		return NULL;
+	}
+
+	driver = p->driver;
+	if (driver == NULL)
+		report(RPT_INFO, "Module %.40s could not be loaded", p->filename);
+	drivers_free_pending(p);
+	*res = -1;
+	return driver;
+}
+
+
+static void
+drivers_free_pending(PendingDriver *p)
+{
+	free(p->name);
+	free(p->filename);
+	free(p);
+}
+
+#else
+
+int
+drivers_start_driver(const char *name, int timeout)
+{
+	return drivers_load_driver(name);
+}
+
+
+int
+drivers_is_pending(const char *name)
+{
+	return 0;
+}
 
+
+int
+drivers_wait_pending(const char *name)
+{
+	return -1;
+}
+
+
+void
+drivers_wait_all_pending(void)
+{
+}
+
+
+int
+drivers_attach_pending(void)
+{
+	return 0;
+}
+
+#endif /* HAVE_PTHREAD */
+
+
+/*
+ * Build the path of a driver module from the "DriverPath" setting and the
+ * section name or the "File" setting in the driver's section.
+ * The result must be freed by the caller.
+ */
+static char *
+drivers_module_filename(const char *name)
+{
+	const char *driverpath;
+	const char *s;
+	char *filename;
+
+	/* Retrieve data from config file */
+	driverpath = config_get_string("server", "DriverPath", 0, "");
 	s = config_get_string(name, "File", 0, name);
-	char filename[strlen(driverpath) + strlen(s) + sizeof(MODULE_EXTENSION)];
+
+	filename = malloc(strlen(driverpath) + strlen(s) + sizeof(MODULE_EXTENSION));
+	if (filename == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
 	strcpy(filename, driverpath);
 	strcat(filename, s);
 	if (s == name)
 		strcat(filename, MODULE_EXTENSION);
 
-	/* Load the module */
-	driver = driver_load(name, filename);
-	if (driver == NULL) {
-		/* It failed. The message has already been given by driver_load() */
-		report(RPT_INFO, "Module %.40s could not be loaded", filename);
-		return -1;
+	return filename;
+}
+
+
+/*
+ * Add a loaded driver to the list of drivers.
+ */
+static int
+drivers_attach(Driver *driver)
+{
+	/* First driver ? */
+	if (!loaded_drivers) {
+		/* Create linked list */
+		loaded_drivers = LL_new();
+		if (!loaded_drivers) {
+			report(RPT_ERR, "Error allocating driver list.");
+			driver_unload(driver);
+			return -1;
+		}
 	}
 
 	/* Add driver to list */
 	LL_Push(loaded_drivers, driver);
 
 	/* If first output driver, store display properties */
-	if (driver_does_output(driver) && !output_driver) {
-		output_driver = driver;
-
-		/* Allocate new DisplayProps structure */
-		display_props = malloc(sizeof(DisplayProps));
-		display_props->width      = driver->width(driver);
-		display_props->height     = driver->height(driver);
-
-		if (driver->cellwidth != NULL && driver->cellwidth(driver) > 0)
-			display_props->cellwidth  = driver->cellwidth(driver);
-		else
-			display_props->cellwidth  = LCD_DEFAULT_CELLWIDTH;
-
-		if (driver->cellheight != NULL && driver->cellheight(driver) > 0)
-			display_props->cellheight = driver->cellheight(driver);
-		else
-			display_props->cellheight = LCD_DEFAULT_CELLHEIGHT;
-	}
+	if (driver_does_output(driver) && !output_driver)
+		drivers_set_output(driver);
 
 	/* Return the driver type */
 	if (driver_stay_in_foreground(driver))
@@ -130,6 +467,53 @@ drivers_unload_all(void)
 }
 
 
+/**
+ * Unload a single driver.
+ * If it was the output driver, the next loaded output driver (if any)
+ * takes its place.
+ * \param driver  The driver to unload.
+ */
+void
+drivers_unload_driver(Driver *driver)
+{
+	Driver *drv;
+
+	debug(RPT_DEBUG, "%s(driver=[%.40s])", __FUNCTION__, driver->name);
+
+	LL_Remove(loaded_drivers, driver, NEXT);
+
+	if (driver == output_driver) {
+		output_driver = NULL;
+		ForAllDrivers(drv) {
+			if (driver_does_output(drv)) {
+				drivers_set_output(drv);
+				break;
+			}
+		}
+	}
+
+	driver_unload(driver);
+}
+
+
+/**
+ * Find a loaded driver by its name.
+ * \param name  Driver section name.
+ * \return      The driver; \c NULL if no such driver is loaded.
+ */
+Driver *
+drivers_find(const char *name)
+{
+	Driver *drv;
+
+	ForAllDrivers(drv) {
+		if (strcasecmp(drv->name, name) == 0)
+			return drv;
+	}
+	return NULL;
+}
+
+
 /**
  * Get information from loaded drivers.
  * \return  Pointer to information string of first driver with get_info() function defined,
@@ -181,12 +565,45 @@ drivers_flush(void)
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
 	ForAllDrivers(drv) {
-		if (drv->flush)
+		if (drv->flush) {
+			struct timeval start;
+
+			gettimeofday(&start, NULL);
 			drv->flush(drv);
+			stats_driver_flush(drv->name, stats_usec_since(&start));
+		}
 	}
 }
 
 
+/**
+ * Replay a composed frame on all loaded drivers and flush them.
+ * The drivers see exactly the same sequence of calls as if the frame had
+ * been rendered on them directly.
+ * \param f  The frame to present.
+ */
+void
+drivers_present(const ComposedFrame *f)
+{
+	int body_ops = (f->body_ops < 0) ? f->num_ops : f->body_ops;
+
+	debug(RPT_DEBUG, "%s(f=[%lu])", __FUNCTION__, f->serial);
+
+	drivers_clear();
+	drivers_backlight(f->backlight);
+	drivers_output(f->output);
+
+	drivers_replay_ops(f, 0, body_ops);
+
+	drivers_cursor(f->cursor_x, f->cursor_y, f->cursor);
+	drivers_heartbeat(f->heartbeat);
+
+	drivers_replay_ops(f, body_ops, f->num_ops);
+
+	drivers_flush();
+}
+
+
 /**
  * Write string to all loaded drivers.
  * Call string() function of all loaded drivers that have a flush() function defined.
@@ -479,3 +896,74 @@ drivers_get_key(void)
 	return NULL;
 }
 
+
+
+/**
+ * Replay a range of the operations recorded in a composed frame.
+ * \param f      The frame.
+ * \param first  Index of the first operation.
+ * \param last   Index after the last operation.
+ */
+static void
+drivers_replay_ops(const ComposedFrame *f, int first, int last)
+{
+	int i;
+
+	for (i = first; i < last; i++) {
+		const ComposeOp *op = &f->ops[i];
+
+		switch (op->type) {
+		case COMPOSE_STRING:
+			if (op->text >= 0)
+				drivers_string(op->x, op->y, compose_op_text(f, op->text));
+			break;
+		case COMPOSE_CHR:
+			drivers_chr(op->x, op->y, (char) op->arg[0]);
+			break;
+		case COMPOSE_VBAR:
+			drivers_vbar(op->x, op->y, op->arg[0], op->arg[1], op->arg[2]);
+			break;
+		case COMPOSE_HBAR:
+			drivers_hbar(op->x, op->y, op->arg[0], op->arg[1], op->arg[2]);
+			break;
+		case COMPOSE_PBAR:
+			drivers_pbar(op->x, op->y, op->arg[0], op->arg[1],
+				     (char *) compose_op_text(f, op->text),
+				     (char *) compose_op_text(f, op->text2));
+			break;
+		case COMPOSE_NUM:
+			drivers_num(op->x, op->arg[0]);
+			break;
+		case COMPOSE_ICON:
+			drivers_icon(op->x, op->y, op->arg[0]);
+			break;
+		}
+	}
+}
+
+
+/**
+ * Make a driver the output driver and store its display properties.
+ * \param driver  The new output driver.
+ */
+static void
+drivers_set_output(Driver *driver)
+{
+	output_driver = driver;
+
+	/* Allocate new DisplayProps structure */
+	if (display_props == NULL)
+		display_props = malloc(sizeof(DisplayProps));
+	display_props->width      = driver->width(driver);
+	display_props->height     = driver->height(driver);
+
+	if (driver->cellwidth != NULL && driver->cellwidth(driver) > 0)
+		display_props->cellwidth  = driver->cellwidth(driver);
+	else
+		display_props->cellwidth  = LCD_DEFAULT_CELLWIDTH;
+
+	if (driver->cellheight != NULL && driver->cellheight(driver) > 0)
+		display_props->cellheight = driver->cellheight(driver);
+	else
+		display_props->cellheight = LCD_DEFAULT_CELLHEIGHT;
+}
@@ -14,6 +14,7 @@
 
 #include "drivers/lcd.h"
 #include "shared/LL.h"
+#include "compose.h"
 
 typedef struct DisplayProps {
 	int width, height;
@@ -25,9 +26,30 @@ extern DisplayProps *display_props;
 int
 drivers_load_driver(const char *name);
 
+int
+drivers_start_driver(const char *name, int timeout);
+
+int
+drivers_is_pending(const char *name);
+
+int
+drivers_wait_pending(const char *name);
+
+void
+drivers_wait_all_pending(void);
+
+int
+drivers_attach_pending(void);
+
 void
 drivers_unload_all(void);
 
+void
+drivers_unload_driver(Driver *driver);
+
+Driver *
+drivers_find(const char *name);
+
 const char *
 drivers_get_info(void);
 
@@ -37,6 +59,9 @@ drivers_clear(void);
 void
 drivers_flush(void);
 
+void
+drivers_present(const ComposedFrame *f);
+
 void
 drivers_string(int x, int y, const char *string);
 
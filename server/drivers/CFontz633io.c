@@ -2,6 +2,13 @@
  * I/O routines for the \c CFontzPacket driver. Currently the CFA-631,
  * CFA-533, CFA-633 and CFA-635 LCDs use this type of protocol.
  *
+ * Commands are not sent one at a time waiting for each acknowledgement.
+ * Up to CFONTZ633_WINDOW commands may be in flight; acknowledgements and
+ * key reports are picked up from the receive buffer whenever data has
+ * arrived. As the LCD executes commands in order, a command that is not
+ * acknowledged in time is sent again together with all commands following
+ * it, so the display ends up in the same state.
+ *
  * \todo  Add reporting (shared/report.h) to the send_#_message functions
  *        if send failed (or an error response is received).
  * \todo  Make the content of a response packet available to the driver.
@@ -60,32 +67,57 @@
 #include <unistd.h>
 #include <stdio.h>
 #include <string.h>
-
-#if defined(HAVE_SYS_SELECT_H)
-# include <sys/select.h>
-#else
-# include <sys/time.h>
-# include <sys/types.h>
-#endif
+#include <errno.h>
+#include <poll.h>
+#include <sys/time.h>
 
 #include "CFontz633io.h"
+#include "shared/report.h"
 
 /* Return values for the check_for_packet() */
 #define TRY_AGAIN 0
 #define GOOD_MSG 1
 #define GIVE_UP 2
 
-/* define CFONTZ633_WRITE_DELAY to use select when waiting for packet acknowledgement */
-#if !defined(CFONTZ633_WRITE_DELAY)
-# define CFONTZ633_WRITE_DELAY 250
+/* Number of commands that may wait for their acknowledgement */
+#if !defined(CFONTZ633_WINDOW)
+# define CFONTZ633_WINDOW 4
+#endif
+
+/* Milliseconds to wait for an acknowledgement before sending a command again
+ * (LCDs should answer within max. 250ms) */
+#if !defined(CFONTZ633_ACK_TIMEOUT)
+# define CFONTZ633_ACK_TIMEOUT 250
 #endif
 
+/* Number of times a command is sent again before giving up on it */
+#define CFONTZ633_MAX_RETRIES 1
+
+/** A command sent to the LCD, kept until it is acknowledged. */
+typedef struct {
+	unsigned char bytes[MAX_DATA_LENGTH + 4];	/**< Packet as sent */
+	int length;			/**< Length of the packet */
+	int acked;			/**< Acknowledgement received */
+	int retries;			/**< Number of times sent again */
+	struct timeval sent;		/**< Time of the last transmission */
+} PendingPacket;
+
+/** The commands in flight, oldest first. */
+typedef struct {
+	PendingPacket packets[CFONTZ633_WINDOW];
+	int first;
+	int count;
+} PacketWindow;
+
 
 /* static local functions */
-static void send_packet(int fd, COMMAND_PACKET *out, COMMAND_PACKET *in);
+static void send_packet(int fd, COMMAND_PACKET *out);
 static int  get_crc(unsigned char *buf, int len, int seed);
-static int  test_packet(int fd, unsigned char response, COMMAND_PACKET *in);
-static int  check_for_packet(int fd, COMMAND_PACKET *in, unsigned char expected_length);
+static void write_packet(int fd, PendingPacket *pp);
+static void handle_packet(COMMAND_PACKET *in);
+static void retransmit_packets(int fd);
+static int  ack_wait_time(void);
+static int  check_for_packet(COMMAND_PACKET *in);
 #ifdef DEBUG
 static void print_packet(COMMAND_PACKET *packet);
 #endif
@@ -165,14 +197,13 @@ unsigned char GetKeyFromKeyRing(KeyRing *kr)
 void send_bytes_message(int fd, unsigned char msg, int len, unsigned char *data)
 {
 	COMMAND_PACKET out;
-	COMMAND_PACKET in;
 
 	out.command = msg;
 	out.data_length = (unsigned char) ((len > MAX_DATA_LENGTH) ? MAX_DATA_LENGTH : len);
 	memcpy(out.data, data, out.data_length);
 
 	/* send message & calc CRC */
-	send_packet(fd, &out, &in);
+	send_packet(fd, &out);
 }
 
 
@@ -185,14 +216,13 @@ void send_bytes_message(int fd, unsigned char msg, int len, unsigned char *data)
 void send_onebyte_message(int fd, unsigned char msg, unsigned char value)
 {
 	COMMAND_PACKET out;
-	COMMAND_PACKET in;
 
 	out.command = msg;
 	out.data_length = 1;
 	out.data[0] = value;
 
 	/* send message & calc CRC */
-	send_packet(fd, &out, &in);
+	send_packet(fd, &out);
 }
 
 
@@ -204,46 +234,255 @@ void send_onebyte_message(int fd, unsigned char msg, unsigned char value)
 void send_zerobyte_message(int fd, unsigned char msg)
 {
 	COMMAND_PACKET out;
-	COMMAND_PACKET in;
 
 	out.command = msg;
 	out.data_length = 0;
 
 	/* send message & calc CRC */
-	send_packet(fd, &out, &in);
+	send_packet(fd, &out);
+}
+
+
+/** \addtogroup CFA_PacketWindow
+ *
+ * Handling of the commands in flight.
+ * @{
+ */
+
+static PacketWindow window;
+static int write_failed = 0;	/**< Last write failed, already reported */
+static int unresponsive = 0;	/**< A command went unanswered, nothing is
+				 * waited for or sent again until the LCD
+				 * answers again */
+
+/**
+ * Forget about all commands in flight.
+ */
+void EmptyPacketWindow(void)
+{
+	window.first = window.count = 0;
+	unresponsive = 0;
 }
 
 
 /**
  * Send out to the given handle; calc & send CRC when doing so.
+ * Waits only if too many commands are waiting for their acknowledgement,
+ * and not at all while the LCD does not answer.
  * \param fd    File handle to write to.
  * \param out   Pointer to COMMAND_PACKET structure to write.
- * \param in    Pointer to COMMAND_PACKET structure to read after write.
  */
 static void
-send_packet(int fd, COMMAND_PACKET *out, COMMAND_PACKET *in)
+send_packet(int fd, COMMAND_PACKET *out)
 {
-	unsigned char CRC[2];
+	PendingPacket *pp;
+
+	/* make room in the window */
+	while ((window.count == CFONTZ633_WINDOW) && !unresponsive)
+		receive_packets(fd, ack_wait_time());
+	if (window.count == CFONTZ633_WINDOW) {
+		/* drop the oldest command, it will not be sent again */
+		window.first = (window.first + 1) % CFONTZ633_WINDOW;
+		window.count--;
+	}
 
-	write(fd, &out->command, 1);
-	write(fd, &out->data_length, 1);
-	if (out->data_length > 0)
-		write(fd, out->data, out->data_length);
+	pp = &window.packets[(window.first + window.count) % CFONTZ633_WINDOW];
+	window.count++;
 
-	/* calculate & send the CRC: convert to bytes manually to avoid endianess issues */
+	/* assemble the packet: calculate the CRC and convert it to bytes
+	 * manually to avoid endianess issues */
 	out->crc = get_crc((unsigned char *) out, out->data_length + 2, 0xFFFF);
-	CRC[0] = out->crc & 0xFF;
-	CRC[1] = (out->crc >> 8) & 0xFF;
-	write(fd, CRC, 2);
+	pp->bytes[0] = out->command;
+	pp->bytes[1] = out->data_length;
+	memcpy(pp->bytes + 2, out->data, out->data_length);
+	pp->bytes[out->data_length + 2] = out->crc & 0xFF;
+	pp->bytes[out->data_length + 3] = (out->crc >> 8) & 0xFF;
+	pp->length = out->data_length + 4;
+	pp->acked = 0;
+	pp->retries = 0;
 
 	/**** TEST STUFF ****/
 	//print_packet(out);
 
-	/* Every time we send a message, we also check for an incoming one. */
-	test_packet(fd, 0x40 | out->command, in);
+	write_packet(fd, pp);
+
+	/* Every time we send a message, we also check for incoming ones. */
+	receive_packets(fd, 0);
 }
 
 
+/**
+ * Write a packet with a single write(), waiting if the port is busy.
+ * \param fd    File handle to write to.
+ * \param pp    Packet to write.
+ */
+static void
+write_packet(int fd, PendingPacket *pp)
+{
+	int done = 0;
+
+	gettimeofday(&pp->sent, NULL);
+
+	while (done < pp->length) {
+		int len = write(fd, pp->bytes + done, pp->length - done);
+
+		if (len < 0) {
+			struct pollfd pfd = { fd, POLLOUT, 0 };
+
+			if ((errno == EINTR)
+			    || ((errno == EAGAIN) && (poll(&pfd, 1, CFONTZ633_ACK_TIMEOUT) > 0)))
+				continue;
+			if (!write_failed)
+				report(RPT_WARNING, "CFontzPacket: write failed: %s", strerror(errno));
+			write_failed = 1;
+			return;
+		}
+		done += len;
+	}
+	write_failed = 0;
+}
+
+
+/**
+ * Handle the data received so far: match acknowledgements to the commands
+ * in flight, store key reports in the key ring and send commands again
+ * that have not been acknowledged in time.
+ * \param fd       File handle to read from.
+ * \param timeout  Milliseconds to wait for data if none has arrived.
+ */
+void
+receive_packets(int fd, int timeout)
+{
+	COMMAND_PACKET in;
+	int is_msg;
+
+	SyncReceiveBuffer(&receivebuffer, fd, timeout);
+
+	while ((is_msg = check_for_packet(&in)) != GIVE_UP) {
+		if (is_msg == GOOD_MSG)
+			handle_packet(&in);
+	}
+
+	retransmit_packets(fd);
+}
+
+
+/**
+ * Wait until all commands in flight have been acknowledged or given up on.
+ * Does not wait if the LCD cannot be written to or does not answer.
+ * \param fd    File handle to read from.
+ */
+void
+wait_for_acks(int fd)
+{
+	while ((window.count > 0) && !write_failed && !unresponsive)
+		receive_packets(fd, ack_wait_time());
+}
+
+
+/**
+ * Handle a packet received from the LCD.
+ * \param in    Pointer to COMMAND_PACKET structure received.
+ */
+static void
+handle_packet(COMMAND_PACKET *in)
+{
+	int i;
+
+	if (unresponsive) {
+		report(RPT_INFO, "CFontzPacket: LCD answers again");
+		unresponsive = 0;
+	}
+
+	/* key activity ? */
+	if (in->command == 0x80) {
+		AddKeyToKeyRing(&keyring, in->data[0]);
+		return;
+	}
+
+	/* other reports are not used */
+	if ((in->command & 0xC0) == 0x80)
+		return;
+
+	/* Normal (0x40) or error (0xC0) response: it belongs to the oldest
+	 * command of that type in flight. Error responses are not retried. */
+	for (i = 0; i < window.count; i++) {
+		PendingPacket *pp = &window.packets[(window.first + i) % CFONTZ633_WINDOW];
+
+		if (!pp->acked && ((pp->bytes[0] & 0x3F) == (in->command & 0x3F))) {
+			pp->acked = 1;
+			break;
+		}
+	}
+
+	/* retire the acknowledged commands at the front */
+	while ((window.count > 0) && window.packets[window.first].acked) {
+		window.first = (window.first + 1) % CFONTZ633_WINDOW;
+		window.count--;
+	}
+}
+
+
+/**
+ * Milliseconds until the oldest command in flight times out.
+ * \return  Time to wait, at least 1 ms.
+ */
+static int
+ack_wait_time(void)
+{
+	struct timeval now;
+	long elapsed;
+
+	if (window.count == 0)
+		return 0;
+
+	gettimeofday(&now, NULL);
+	elapsed = (now.tv_sec - window.packets[window.first].sent.tv_sec) * 1000
+		  + (now.tv_usec - window.packets[window.first].sent.tv_usec) / 1000;
+
+	if (elapsed < 0)
+		return 1;
+	return (elapsed < CFONTZ633_ACK_TIMEOUT) ? (CFONTZ633_ACK_TIMEOUT - elapsed) : 1;
+}
+
+
+/**
+ * Send the commands in flight again if the oldest one was not acknowledged
+ * in time. All of them are sent again in order, as the LCD may have
+ * executed the following ones already. If the oldest one stays unanswered
+ * the LCD is taken as unresponsive, so a silent or unplugged LCD delays
+ * the server only once.
+ * \param fd    File handle to write to.
+ */
+static void
+retransmit_packets(int fd)
+{
+	PendingPacket *pp;
+	int i;
+
+	if ((window.count == 0) || unresponsive || (ack_wait_time() > 1))
+		return;
+
+	pp = &window.packets[window.first];
+	if (pp->retries >= CFONTZ633_MAX_RETRIES) {
+		report(RPT_WARNING, "CFontzPacket: no response to command %d, not waiting for the LCD until it answers",
+		       pp->bytes[0]);
+		window.first = (window.first + 1) % CFONTZ633_WINDOW;
+		window.count--;
+		unresponsive = 1;
+		return;
+	}
+	pp->retries++;
+
+	for (i = 0; i < window.count; i++) {
+		pp = &window.packets[(window.first + i) % CFONTZ633_WINDOW];
+		pp->acked = 0;
+		write_packet(fd, pp);
+	}
+}
+/** @} */
+
+
 /**
  * Calculate CRC over given buffer with given length.
  * \param buf   Byte buffer.
@@ -341,33 +580,25 @@ void EmptyReceiveBuffer(ReceiveBuffer *rb)
 
 
 /**
- * Read given number of bytes from given file handle into receive buffer.
- * \param rb      Pointer to ReceiveBuffer structure.
- * \param fd      File handle to read from.
- * \param number  Max. number of bytes to read from file handle.
+ * Read the bytes available from given file handle into receive buffer.
+ * \param rb       Pointer to ReceiveBuffer structure.
+ * \param fd       File handle to read from.
+ * \param timeout  Milliseconds to wait for data if none is available.
  */
-void SyncReceiveBuffer(ReceiveBuffer *rb, int fd, unsigned int number)
+void SyncReceiveBuffer(ReceiveBuffer *rb, int fd, int timeout)
 {
-	unsigned char buffer[MAX_DATA_LENGTH];
+	unsigned char buffer[RECEIVEBUFFERSIZE];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	int number;
 	int BytesRead;
 
-#if defined(HAVE_SELECT) && defined(CFONTZ633_WRITE_DELAY) && (CFONTZ633_WRITE_DELAY > 0)
-	fd_set rfds;
-	struct timeval timeout;
-	int retval;
-
-	FD_ZERO(&rfds);
-	FD_SET(fd, &rfds);
-	timeout.tv_sec = 0;
-	timeout.tv_usec = CFONTZ633_WRITE_DELAY;
-	retval = select(fd + 1, &rfds, NULL, NULL, &timeout);
-
-	if (!retval)
+	if (poll(&pfd, 1, timeout) <= 0)
 		return;
-#endif
 
-	if (number > MAX_DATA_LENGTH)
-		number = MAX_DATA_LENGTH;
+	/* do not overwrite unread bytes */
+	number = RECEIVEBUFFERSIZE - 1 - BytesAvail(rb);
+	if (number <= 0)
+		return;
 
 	BytesRead = read(fd, buffer, number);
 
@@ -492,78 +723,22 @@ unsigned char PeekByte(ReceiveBuffer *rb)
 
 
 /**
- * Check for a response packet and try to identify it.
- * \param fd        File handle to read from.
- * \param response  Expected response command.
- * \param in        Pointer to COMMAND_PACKET structure to write the response to.
- * \retval 1  Expected response received.
- * \retval 0  Expected response not received.
+ * Check for a packet in the receive buffer. If there is a valid packet in
+ * the buffer it will copy it into \c in and return GOOD_MSG. If there is no
+ * enough data available for a valid packet it returns GIVE_UP.
  *
- * \todo check_for_packet is always called with MAX_DATA_LENGTH. This doesn't
- *       do any harm, but passing that parameter is useless then. Additionally
- *       one complete packet is MAX_DATA_LENGTH + 4 (command, length, CRC).
- */
-static int
-test_packet(int fd, unsigned char response, COMMAND_PACKET *in)
-{
-#if defined(HAVE_SELECT) && defined(CFONTZ633_WRITE_DELAY) && (CFONTZ633_WRITE_DELAY > 0)
-	int response_received = 0;
-	int loop;
-
-	/* wait for answer packet but forever (LCDs should answer within max. 250ms) */
-	for (loop = 250000/CFONTZ633_WRITE_DELAY; !response_received && loop > 0; loop--) {
-		int is_msg = check_for_packet(fd, in, MAX_DATA_LENGTH);
-
-		while (is_msg != GIVE_UP) {
-			if (is_msg == GOOD_MSG) {
-				/* key activity ? */
-				if (in->command == 0x80)
-					AddKeyToKeyRing(&keyring, in->data[0]);
-				else if (in->command == response)
-					response_received = 1;
-			}
-
-			is_msg = check_for_packet(fd, in, MAX_DATA_LENGTH);
-		}
-	}
-	return(response_received);
-#else
-	int is_msg = check_for_packet(fd, in, MAX_DATA_LENGTH);
-	while (is_msg != GIVE_UP) {
-		if (is_msg == GOOD_MSG) {
-			if (in->command == 0x80)
-				AddKeyToKeyRing(&keyring, in->data[0]);
-		}
-
-		is_msg = check_for_packet(fd, in, MAX_DATA_LENGTH);
-	}
-
-	return 1;
-#endif
-}
-
-
-/**
- * Check for a packet to read. If there is a valid packet in the input buffer
- * it will copy it into \c in and return GOOD_MSG. If there is no enough data
- * available for a valid packet it returns GIVE_UP.
- *
- * \param fd        File handle to read from.
  * \param in        Pointer to COMMAND_PACKET structure to write the response to.
- * \param expected_length  Expected response length.
  *
  * \retval GIVE_UP    No message and we should not retry until new input.
  * \retval TRY_AGAIN  No message but we should try again immediately.
  * \retval GOOD_MSG   Message correctly identified.
  */
 static int
-check_for_packet(int fd, COMMAND_PACKET *in, unsigned char expected_length)
+check_for_packet(COMMAND_PACKET *in)
 {
 	int i;
 	int testcrc;
 
-	SyncReceiveBuffer(&receivebuffer, fd, expected_length);
-
 	/*
 	 * There must be at least 4 bytes available in the input stream for
 	 * there to be a valid command in it (command, length, no data, CRC).
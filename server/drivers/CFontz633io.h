@@ -116,8 +116,12 @@ void          send_bytes_message(int fd, unsigned char msg, int len, unsigned ch
 void          send_onebyte_message(int fd, unsigned char msg, unsigned char value);
 void          send_zerobyte_message(int fd, unsigned char msg);
 
+void          EmptyPacketWindow(void);
+void          receive_packets(int fd, int timeout);
+void          wait_for_acks(int fd);
+
 void          EmptyReceiveBuffer(ReceiveBuffer *rb);
-void          SyncReceiveBuffer(ReceiveBuffer *rb, int fd, unsigned int number);
+void          SyncReceiveBuffer(ReceiveBuffer *rb, int fd, int timeout);
 int           BytesAvail(ReceiveBuffer *rb);
 unsigned char GetByte(ReceiveBuffer *rb);
 int           PeekBytesAvail(ReceiveBuffer *rb);
@@ -148,6 +148,7 @@ CFontzPacket_init (Driver *drvthis)
 
 	EmptyKeyRing(&keyring);
 	EmptyReceiveBuffer(&receivebuffer);
+	EmptyPacketWindow();
 
 	/* Read config file */
 
@@ -324,8 +325,11 @@ CFontzPacket_close (Driver *drvthis)
 	PrivateData *p = drvthis->private_data;
 
 	if (p != NULL) {
-		if (p->fd >= 0)
+		if (p->fd >= 0) {
+			/* let the last commands reach the LCD */
+			wait_for_acks(p->fd);
 			close(p->fd);
+		}
 
 		if (p->framebuf)
 			free(p->framebuf);
@@ -492,9 +496,9 @@ CFontzPacket_flush (Driver *drvthis)
 			memcpy(p->backingstore, p->framebuf, p->width * p->height);
 	}
 
-	/* send something to the LCD to allow keys to be received */
+	/* pick up acknowledgements and keys that arrived meanwhile */
 	if (!modified)
-		send_zerobyte_message(p->fd, CF633_Ping_Command);
+		receive_packets(p->fd, 0);
 }
 
 
@@ -507,7 +511,12 @@ CFontzPacket_flush (Driver *drvthis)
 MODULE_EXPORT const char *
 CFontzPacket_get_key (Driver *drvthis)
 {
-	unsigned char key = GetKeyFromKeyRing(&keyring);
+	PrivateData *p = drvthis->private_data;
+	unsigned char key;
+
+	/* keys are reported asynchronously, look for new ones */
+	receive_packets(p->fd, 0);
+	key = GetKeyFromKeyRing(&keyring);
 
 	switch (key) {
 		case CFP_KEY_UL_PRESS:
@@ -780,6 +789,7 @@ CFontzPacket_reboot (Driver *drvthis)
 	unsigned char out[3] = { 8, 18, 99 };
 
 	send_bytes_message(p->fd, CF633_Reboot, 3, out);
+	wait_for_acks(p->fd);
 	sleep(2);
 }
 
@@ -55,6 +55,7 @@ Different implementations of (n)curses available on:
 #include <string.h>
 #include <strings.h>
 #include <ctype.h>
+#include <sys/time.h>
 #ifdef HAVE_NCURSES_H
 #include <ncurses.h>
 #else
@@ -100,6 +101,13 @@ Different implementations of (n)curses available on:
 #define DEFAULT_FOREGROUND_COLOR COLOR_CYAN
 #define DEFAULT_BACKGROUND_COLOR COLOR_BLUE
 
+/* Estimated output bytes of a terminal update: resetting the attributes
+ * at its end, moving the cursor to a changed cell and setting its colors,
+ * and switching to the alternative character set and back */
+#define CURSES_UPDATE_COST	40
+#define CURSES_MOVE_COST	16
+#define CURSES_ACS_COST		20
+
 
 /** private data for the \c curses driver */
 typedef struct curses_private_data {
@@ -120,6 +128,15 @@ typedef struct curses_private_data {
 	int useACS;
 
 	int drawBorder;
+	int border_dirty;	/**< border needs to be drawn with the next flush */
+
+	chtype *framebuf;	/**< cells as drawn by the server */
+	chtype *backingstore;	/**< cells as sent to the terminal */
+
+	int bandwidth;		/**< output bytes per second allowed, 0 for no limit */
+	long budget;		/**< output bytes allowed for the next flush */
+	struct timeval last_flush;
+	int next_cell;		/**< cell to continue with if output was cut short */
 } PrivateData;
 
 
@@ -133,6 +150,7 @@ MODULE_EXPORT char *symbol_prefix = "curses_";
 static void curses_wborder (Driver *drvthis);
 static chtype get_color_by_name (char *colorname, chtype default_color);
 static void curses_restore_screen (Driver *drvthis);
+static void curses_put (Driver *drvthis, int x, int y, chtype ch);
 
 
 /**
@@ -203,6 +221,16 @@ curses_init (Driver *drvthis)
 	p->drawBorder = drvthis->config_get_bool(drvthis->name, "DrawBorder", 0, CONF_DEF_DRAWBORDER);
 	debug(RPT_DEBUG, "%s: drawing Border %s", drvthis->name, (p->drawBorder) ? "ON" : "OFF");
 
+	/* output bandwidth limit for slow links */
+	tmp = drvthis->config_get_int(drvthis->name, "MaxBandwidth", 0, CONF_DEF_MAXBANDWIDTH);
+	if ((tmp != 0) && (tmp < 100)) {
+		report(RPT_WARNING, "%s: MaxBandwidth must be 0 or at least 100; using default %d",
+				drvthis->name, CONF_DEF_MAXBANDWIDTH);
+		tmp = CONF_DEF_MAXBANDWIDTH;
+	}
+	p->bandwidth = tmp;
+	debug(RPT_DEBUG, "%s: limiting output to %d bytes/s", drvthis->name, p->bandwidth);
+
 	/* Get size settings */
 	if ((drvthis->request_display_width() > 0)
 	    && (drvthis->request_display_height() > 0)) {
@@ -240,6 +268,20 @@ curses_init (Driver *drvthis)
 	}
 	p->yoffs = tmp;
 
+	/* Allocate the frame buffer and the backing store */
+	p->framebuf = malloc(p->width * p->height * sizeof(chtype));
+	p->backingstore = malloc(p->width * p->height * sizeof(chtype));
+	if ((p->framebuf == NULL) || (p->backingstore == NULL)) {
+		report(RPT_ERR, "%s: unable to create frame buffer", drvthis->name);
+		return -1;
+	}
+	for (tmp = 0; tmp < p->width * p->height; tmp++) {
+		p->framebuf[tmp] = ' ';
+		p->backingstore[tmp] = ' ';
+	}
+	p->budget = p->bandwidth;
+	gettimeofday(&p->last_flush, NULL);
+
 	//debug: sleep(1);
 
 	// Init curses...
@@ -280,7 +322,10 @@ curses_init (Driver *drvthis)
 		init_pair(5, COLOR_WHITE, backlight_color);
 	}
 
-	curses_clear(drvthis);
+	/* The window starts out blank, as does the backing store */
+	wbkgd(p->win, COLOR_PAIR(p->current_color_pair) | ' ');
+	werase(p->win);
+	p->border_dirty = p->drawBorder;
 
 	report(RPT_DEBUG, "%s: init() done", drvthis->name);
 
@@ -303,13 +348,20 @@ curses_close (Driver *drvthis)
 
 	if (p != NULL) {
 		// Close curses
-		wrefresh(p->win);
-		delwin(p->win);
-
-		move(0, 0);
-		endwin();
-		curs_set(1);
+		if (p->win != NULL) {
+			wnoutrefresh(p->win);
+			doupdate();
+			delwin(p->win);
+
+			move(0, 0);
+			endwin();
+			curs_set(1);
+		}
 
+		if (p->framebuf != NULL)
+			free(p->framebuf);
+		if (p->backingstore != NULL)
+			free(p->backingstore);
 		free(p);
 	}
 	drvthis->store_private_ptr(drvthis, NULL);
@@ -351,13 +403,10 @@ MODULE_EXPORT void
 curses_clear (Driver *drvthis)
 {
 	PrivateData *p = drvthis->private_data;
+	int i;
 
-	wbkgdset(p->win, COLOR_PAIR(p->current_color_pair) | ' ');
-
-	if (p->drawBorder)
-		curses_wborder(drvthis);
-
-	werase(p->win);
+	for (i = 0; i < p->width * p->height; i++)
+		p->framebuf[i] = ' ';
 }
 
 
@@ -390,7 +439,9 @@ curses_backlight (Driver *drvthis, int on)
 		p->current_border_pair = 3;
 	}
 
-	curses_clear(drvthis);
+	/* Recolor all cells; their contents do not change */
+	wbkgd(p->win, COLOR_PAIR(p->current_color_pair) | ' ');
+	p->border_dirty = p->drawBorder;
 }
 
 
@@ -406,16 +457,13 @@ MODULE_EXPORT void
 curses_string (Driver *drvthis, int x, int y, const char string[])
 {
 	PrivateData *p = drvthis->private_data;
+	int i;
 
-	if ((x <= 0) || (y <= 0) || (x > p->width) || (y > p->height))
+	if ((y <= 0) || (y > p->height))
 		return;
 
-	if (!p->drawBorder) {
-		x--;
-		y--;
-	}
-
-	mvwaddstr(p->win, y, x, string);
+	for (i = 0; (string[i] != '\0') && (x + i <= p->width); i++)
+		curses_put(drvthis, x + i, y, (unsigned char) string[i]);
 }
 
 
@@ -430,17 +478,7 @@ curses_string (Driver *drvthis, int x, int y, const char string[])
 MODULE_EXPORT void
 curses_chr (Driver *drvthis, int x, int y, char c)
 {
-	PrivateData *p = drvthis->private_data;
-
-	if ((x <= 0) || (y <= 0) || (x > p->width) || (y > p->height))
-		return;
-
-	if (!p->drawBorder) {
-		x--;
-		y--;
-	}
-
-	mvwaddch(p->win, y, x, c);
+	curses_put(drvthis, x, y, (unsigned char) c);
 }
 
 
@@ -458,9 +496,9 @@ curses_vbar (Driver *drvthis, int x, int y, int len, int promille, int options)
 {
 	PrivateData *p = drvthis->private_data;
 	// map
-	char ACS_map[] = { ACS_S9, ACS_S9, ACS_S7, ACS_S7, ACS_S3, ACS_S3, ACS_S1, ACS_S1 };
-	char ascii_map[] = { ' ', ' ', '-', '-', '=', '=', '#', '#' };
-	char *map = (p->useACS) ? ACS_map : ascii_map;
+	chtype ACS_map[] = { ACS_S9, ACS_S9, ACS_S7, ACS_S7, ACS_S3, ACS_S3, ACS_S1, ACS_S1 };
+	chtype ascii_map[] = { ' ', ' ', '-', '-', '=', '=', '#', '#' };
+	chtype *map = (p->useACS) ? ACS_map : ascii_map;
 	int pixels = ((long) 2 * len * p->cellheight) * promille / 2000;
 	int pos;
 
@@ -482,11 +520,11 @@ curses_vbar (Driver *drvthis, int x, int y, int len, int promille, int options)
 
 		if (pixels >= p->cellheight) {
 			/* write a "full" block to the screen... */
-			curses_chr(drvthis, x, y-pos, (p->useACS) ? ACS_BLOCK : '#');
+			curses_put(drvthis, x, y-pos, (p->useACS) ? ACS_BLOCK : '#');
 		}
 		else if (pixels > 0) {
 			// write a partial block...
-			curses_chr(drvthis, x, y-pos, map[len-1]);
+			curses_put(drvthis, x, y-pos, map[len-1]);
 			break;
 		}
 		else {
@@ -560,7 +598,7 @@ MODULE_EXPORT int
 curses_icon (Driver *drvthis, int x, int y, int icon)
 {
 	PrivateData *p = drvthis->private_data;
-	char ch = '?';
+	chtype ch = '?';
 
 	switch (icon) {
 		case ICON_BLOCK_FILLED:
@@ -590,21 +628,28 @@ curses_icon (Driver *drvthis, int x, int y, int icon)
 		default:
 			return -1; /* Let the core do it */
 	}
-	curses_chr(drvthis, x, y, ch);
+	curses_put(drvthis, x, y, ch);
 
 	return 0;
 }
 
 
 /**
- * Flush data on screen to the display.
+ * Flush data on screen to the display. Only cells that differ from the
+ * backing store are written, and all window updates go out with a single
+ * doupdate(). If MaxBandwidth is set, the cells exceeding the estimated
+ * output budget are left for the next flush.
  * \param drvthis  Pointer to driver structure.
  */
 MODULE_EXPORT void
 curses_flush (Driver *drvthis)
 {
 	PrivateData *p = drvthis->private_data;
-	int c;
+	int size = p->width * p->height;
+	int offset = (p->drawBorder) ? 1 : 0;
+	int i, n, c;
+	int prev = -2;
+	long cost = CURSES_UPDATE_COST;
 
 	if ((c = getch()) != ERR) {
 		if (c == 0x0C) {	/* ^L restores screen */
@@ -613,10 +658,48 @@ curses_flush (Driver *drvthis)
 		ungetch(c);
 	}
 
-	if (p->drawBorder)
+	if (p->bandwidth > 0) {
+		struct timeval now, diff;
+
+		/* Refill the budget, allowing bursts of up to one second */
+		gettimeofday(&now, NULL);
+		timersub(&now, &p->last_flush, &diff);
+		p->last_flush = now;
+		p->budget += ((long) diff.tv_sec * 1000000 + diff.tv_usec) / 1000 * p->bandwidth / 1000;
+		if (p->budget > p->bandwidth)
+			p->budget = p->bandwidth;
+	}
+
+	if (p->border_dirty) {
 		curses_wborder(drvthis);
+		p->border_dirty = 0;
+	}
+
+	/* Continue where the last limited flush stopped, so no cell starves */
+	for (n = 0, i = p->next_cell; n < size; n++, i = (i + 1) % size) {
+		chtype ch = p->framebuf[i];
+
+		if (ch == p->backingstore[i])
+			continue;
+
+		if (p->bandwidth > 0) {
+			cost += ((ch & A_ALTCHARSET) ? CURSES_ACS_COST : 1)
+				+ ((i == prev + 1) ? 0 : CURSES_MOVE_COST);
+			if (cost > p->budget) {
+				p->next_cell = i;
+				break;
+			}
+			p->budget -= cost;
+			cost = 0;
+		}
+
+		mvwaddch(p->win, i / p->width + offset, i % p->width + offset, ch);
+		p->backingstore[i] = ch;
+		prev = i;
+	}
 
-	wrefresh(p->win);
+	wnoutrefresh(p->win);
+	doupdate();
 }
 
 
@@ -733,11 +816,31 @@ curses_restore_screen (Driver *drvthis)
 	PrivateData *p = drvthis->private_data;
 
 	erase();
-	refresh();
+	wnoutrefresh(stdscr);
 #ifdef CURSES_HAS_REDRAWWIN
 	redrawwin(p->win);
 #endif
-	wrefresh(p->win);
+	wnoutrefresh(p->win);
+	doupdate();
+}
+
+
+/**
+ * Put a character into the frame buffer at position (x,y).
+ * \param drvthis  Pointer to driver structure.
+ * \param x        Horizontal character position (column).
+ * \param y        Vertical character position (row).
+ * \param ch       Character, possibly from the alternative character set.
+ */
+static void
+curses_put (Driver *drvthis, int x, int y, chtype ch)
+{
+	PrivateData *p = drvthis->private_data;
+
+	if ((x <= 0) || (y <= 0) || (x > p->width) || (y > p->height))
+		return;
+
+	p->framebuf[(y - 1) * p->width + (x - 1)] = ch;
 }
 
 /* EOF */
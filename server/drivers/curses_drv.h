@@ -30,5 +30,6 @@ MODULE_EXPORT const char *curses_get_info(Driver *drvthis);
 #define CONF_DEF_TOP_LEFT_Y	7
 #define CONF_DEF_USEACS		0
 #define CONF_DEF_DRAWBORDER	1
+#define CONF_DEF_MAXBANDWIDTH	0
 
 #endif
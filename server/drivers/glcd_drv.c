@@ -110,7 +110,7 @@ glcd_init(Driver *drvthis)
 		return -1;
 	}
 	p->glcd_functions->drv_report = report;
-	p->glcd_functions->drv_debug = debug;
+	p->glcd_functions->drv_debug = debug_report;
 	p->glcd_functions->blit = NULL;
 	p->glcd_functions->close = NULL;
 	p->glcd_functions->set_contrast = NULL;
@@ -19,7 +19,12 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <sys/socket.h>
+#include <netinet/in.h>
+#include <netdb.h>
+#include <poll.h>
 #include <stdlib.h>
+#include <unistd.h>
+#include <time.h>
 
 #include "lcd.h"
 #include "hd44780-ethlcd.h"
@@ -27,14 +32,39 @@
 #include "shared/sockets.h"
 #include "shared/report.h"
 
+/** State of the connection to the device */
+typedef enum {
+	ETHLCD_CONNECTED,	/**< Commands are sent */
+	ETHLCD_CONNECTING,	/**< A non-blocking connect is in progress */
+	ETHLCD_DISCONNECTED	/**< Waiting for the next attempt to connect */
+} ethlcd_state;
+
+/** Connection data of the ethlcd connection type */
+typedef struct {
+	char hostname[256];	/**< Host name or address of the device */
+	struct sockaddr_in addr;	/**< Address of the device, resolved at init */
+	ethlcd_state state;	/**< State of the connection */
+	time_t retry_time;	/**< Time of the next attempt to connect */
+	int batch_size;		/**< Maximum number of commands in one batch */
+	int count;		/**< Number of commands queued */
+	unsigned char queue[2 * ETHLCD_MAX_BATCH];	/**< Queued commands, two bytes each */
+	unsigned char reply[ETHLCD_MAX_BATCH];		/**< Replies to the queued commands */
+} ethlcd_connection;
+
 
 void ethlcd_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch);
 unsigned char ethlcd_HD44780_scankeypad(PrivateData *p);
 void ethlcd_HD44780_backlight(PrivateData *p, unsigned char state);
+void ethlcd_HD44780_flush(PrivateData *p);
 void ethlcd_HD44780_close(PrivateData *p);
 
-/* helper function */
-static void ethlcd_send_low(PrivateData *p, unsigned char *data, int length);
+/* helper functions */
+static int ethlcd_transfer(PrivateData *p, unsigned char *data, int length,
+			   unsigned char *reply, int reply_len);
+static void ethlcd_queue(PrivateData *p, unsigned char cmd, unsigned char arg);
+static int ethlcd_setup_socket(PrivateData *p);
+static void ethlcd_disconnect(PrivateData *p);
+static void ethlcd_reconnect(PrivateData *p);
 
 /* fake pause function (pausing is handled by ethlcd device itself) */
 void
@@ -51,9 +81,8 @@ ethlcd_HD44780_uPause(PrivateData *p, int usecs)
 int
 hd_init_ethlcd(Driver *drvthis)
 {
-	char hostname[256];
-	unsigned long flags = 0;
-	struct timeval tv;
+	ethlcd_connection *conn;
+	struct hostent *host;
 
 	PrivateData *p = (PrivateData *) drvthis->private_data;
 	HD44780_functions *hd44780_functions = p->hd44780_functions;
@@ -62,45 +91,48 @@ hd_init_ethlcd(Driver *drvthis)
 	hd44780_functions->backlight = ethlcd_HD44780_backlight;
 	hd44780_functions->scankeypad = ethlcd_HD44780_scankeypad;
 	hd44780_functions->uPause = ethlcd_HD44780_uPause;
+	hd44780_functions->flush = ethlcd_HD44780_flush;
 	hd44780_functions->close = ethlcd_HD44780_close;
 
-	/* reading configuration file */
-	strncpy(hostname, drvthis->config_get_string(drvthis->name, "Device", 0, "ethlcd"), sizeof(hostname));
-	hostname[sizeof(hostname) - 1] = '\0';
-
-	p->sock = sock_connect(hostname, DEFAULT_ETHLCD_PORT);
-	if (p->sock < 0) {
-		report(RPT_ERR, "%s[%s]: Connecting to %s:%d failed",
-			drvthis->name, ETHLCD_DRV_NAME, hostname, DEFAULT_ETHLCD_PORT);
+	conn = (ethlcd_connection *) calloc(1, sizeof(ethlcd_connection));
+	if (conn == NULL) {
+		report(RPT_ERR, "%s[%s]: Error allocating", drvthis->name, ETHLCD_DRV_NAME);
 		return -1;
 	}
+	p->connection_data = conn;
 
-	/* we need to have a blocking read back again: */
-	if (fcntl(p->sock, F_GETFL, &flags) < 0) {
-		report(RPT_ERR, "%s[%s]: Cannot obtain current flags: %s",
-			drvthis->name, ETHLCD_DRV_NAME, strerror(errno));
-		return -1;
+	/* reading configuration file */
+	strncpy(conn->hostname, drvthis->config_get_string(drvthis->name, "Device", 0, "ethlcd"), sizeof(conn->hostname));
+	conn->hostname[sizeof(conn->hostname) - 1] = '\0';
+
+	conn->batch_size = drvthis->config_get_int(drvthis->name, "ethlcd_batch", 0, DEFAULT_ETHLCD_BATCH);
+	if (conn->batch_size < 1 || conn->batch_size > ETHLCD_MAX_BATCH) {
+		report(RPT_WARNING, "%s[%s]: ethlcd_batch must be between 1 and %d; using default %d",
+			drvthis->name, ETHLCD_DRV_NAME, ETHLCD_MAX_BATCH, DEFAULT_ETHLCD_BATCH);
+		conn->batch_size = DEFAULT_ETHLCD_BATCH;
 	}
-	flags &= ~O_NONBLOCK;
-	if (fcntl(p->sock, F_SETFL, flags) < 0) {
-		report(RPT_ERR, "%s[%s]: Unable to change socket to O_NONBLOCK: %s",
-			drvthis->name, ETHLCD_DRV_NAME, strerror(errno));
+
+	/* Resolve the address only once: reconnecting must not block */
+	host = gethostbyname(conn->hostname);
+	if (host == NULL || host->h_addrtype != AF_INET) {
+		report(RPT_ERR, "%s[%s]: Unknown host %s",
+			drvthis->name, ETHLCD_DRV_NAME, conn->hostname);
 		return -1;
 	}
+	conn->addr.sin_family = AF_INET;
+	conn->addr.sin_port = htons(DEFAULT_ETHLCD_PORT);
+	memcpy(&conn->addr.sin_addr, host->h_addr, sizeof(conn->addr.sin_addr));
 
-	/* setting timeouts */
-	tv.tv_sec = ETHLCD_TIMEOUT;
-	tv.tv_usec = 0;
-	if (setsockopt(p->sock, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof(struct timeval)) < 0) {
-		report(RPT_ERR, "%s[%s]: Cannot set receive timeout: %s",
-			drvthis->name, ETHLCD_DRV_NAME, strerror(errno));
+	p->sock = socket(PF_INET, SOCK_STREAM, 0);
+	if (p->sock < 0
+	    || connect(p->sock, (struct sockaddr *) &conn->addr, sizeof(conn->addr)) < 0) {
+		report(RPT_ERR, "%s[%s]: Connecting to %s:%d failed",
+			drvthis->name, ETHLCD_DRV_NAME, conn->hostname, DEFAULT_ETHLCD_PORT);
 		return -1;
 	}
-	if (setsockopt(p->sock, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(struct timeval)) < 0) {
-		report(RPT_ERR, "%s[%s]: Cannot set send timeout: %s",
-			drvthis->name, ETHLCD_DRV_NAME, strerror(errno));
+	if (ethlcd_setup_socket(p) < 0)
 		return -1;
-	}
+	conn->state = ETHLCD_CONNECTED;
 
 	/* Set up two-line, small character (5x8) mode */
 	hd44780_functions->senddata(p, 0, RS_INSTR, FUNCSET | IF_4BIT | TWOLINE | SMALLCHAR);
@@ -117,7 +149,8 @@ hd_init_ethlcd(Driver *drvthis)
 
 
 /**
- * Send data or commands to the display.
+ * Send data or commands to the display. The command is queued and sent
+ * with the next batch.
  * \param p          Pointer to driver's private data structure.
  * \param displayID  ID of the display (or 0 for all) to send data to.
  * \param flags      Defines whether to end a command or data.
@@ -126,15 +159,10 @@ hd_init_ethlcd(Driver *drvthis)
 void
 ethlcd_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch)
 {
-	static unsigned char buff[2];
-
 	if (flags == RS_INSTR)
-		buff[0] = ETHLCD_SEND_INSTR;
+		ethlcd_queue(p, ETHLCD_SEND_INSTR, ch);
 	else			/* RS_DATA */
-		buff[0] = ETHLCD_SEND_DATA;
-	buff[1] = ch;
-
-	ethlcd_send_low(p, buff, 2);
+		ethlcd_queue(p, ETHLCD_SEND_DATA, ch);
 }
 
 
@@ -146,12 +174,20 @@ ethlcd_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char f
 unsigned char
 ethlcd_HD44780_scankeypad(PrivateData *p)
 {
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
 	unsigned char readval;
-	static unsigned char buff[2];
+	unsigned char cmd = ETHLCD_GET_BUTTONS;
+	unsigned char buff[2];
 
-	buff[0] = ETHLCD_GET_BUTTONS;
+	/* Commands queued before must reach the device first */
+	ethlcd_HD44780_flush(p);
+	if (conn->state != ETHLCD_CONNECTED)
+		return '\0';
 
-	ethlcd_send_low(p, buff, 1);
+	if (ethlcd_transfer(p, &cmd, 1, buff, 2) < 0 || buff[0] != cmd) {
+		ethlcd_disconnect(p);
+		return '\0';
+	}
 
 	/* answer should be in second byte on bits 0-6 in negative logic: */
 	readval = buff[1];
@@ -184,20 +220,59 @@ ethlcd_HD44780_scankeypad(PrivateData *p)
 void
 ethlcd_HD44780_backlight(PrivateData *p, unsigned char state)
 {
-	static unsigned char buff[2];
-
-	buff[0] = ETHLCD_SET_BACKLIGHT;
+	unsigned char arg;
 
 	if (state == BACKLIGHT_ON) {
 		if (p->brightness >= 500)
-			buff[1] = ETHLCD_BACKLIGHT_ON;
+			arg = ETHLCD_BACKLIGHT_ON;
 		else
-			buff[1] = ETHLCD_BACKLIGHT_HALF;
+			arg = ETHLCD_BACKLIGHT_HALF;
 	}
 	else
-		buff[1] = ETHLCD_BACKLIGHT_OFF;
+		arg = ETHLCD_BACKLIGHT_OFF;
 
-	ethlcd_send_low(p, buff, 2);
+	ethlcd_queue(p, ETHLCD_SET_BACKLIGHT, arg);
+}
+
+
+/**
+ * Send all queued commands to the device as one batch. The device answers
+ * every command by echoing its command byte, so the replies are read back
+ * at once and checked against the commands of the batch. While the device
+ * is not reachable this tries to reconnect instead.
+ * \param p  Pointer to driver's private data structure.
+ */
+void
+ethlcd_HD44780_flush(PrivateData *p)
+{
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
+	int count = conn->count;
+	int i;
+
+	if (conn->state != ETHLCD_CONNECTED) {
+		conn->count = 0;
+		ethlcd_reconnect(p);
+		return;
+	}
+	if (count == 0)
+		return;
+
+	/* Empty the queue first: a reconnect may queue new commands */
+	conn->count = 0;
+
+	if (ethlcd_transfer(p, conn->queue, 2 * count, conn->reply, count) < 0) {
+		ethlcd_disconnect(p);
+		return;
+	}
+
+	for (i = 0; i < count; i++) {
+		if (conn->reply[i] != conn->queue[2 * i]) {
+			p->hd44780_functions->drv_report(RPT_WARNING, "%s: Invalid device response to command %d of %d: got 0x%02X, expected: 0x%02X",
+						ETHLCD_DRV_NAME, i + 1, count, conn->reply[i], conn->queue[2 * i]);
+			ethlcd_disconnect(p);
+			return;
+		}
+	}
 }
 
 
@@ -208,64 +283,206 @@ ethlcd_HD44780_backlight(PrivateData *p, unsigned char state)
 void
 ethlcd_HD44780_close(PrivateData *p)
 {
-	sock_close(p->sock);
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
+
+	if (conn != NULL) {
+		ethlcd_HD44780_flush(p);
+		free(conn);
+		p->connection_data = NULL;
+	}
+	if (p->sock >= 0) {
+		close(p->sock);
+		p->sock = -1;
+	}
 }
 
 
 /**
- * Send the data to ethlcd device.
- * \param p       Pointer to driver's private data structure.
- * \param data    Pointer to buffer with data to send.
- * \param length  Number of bytes to send.
- *
- * \todo  This functions makes LCDd exit on fatal error without any clean-up.
- *        There is currently no way to make LCDd exit cleanly in those cases.
+ * Queue a command for the next batch, sending the batch once it is full.
+ * Commands are dropped while the device is not connected.
+ * \param p    Pointer to driver's private data structure.
+ * \param cmd  Command byte.
+ * \param arg  Argument of the command.
  */
 static void
-ethlcd_send_low(PrivateData *p, unsigned char *data, int length)
+ethlcd_queue(PrivateData *p, unsigned char cmd, unsigned char arg)
 {
-	int response_len, len;
-	unsigned char cmd;
-	int i, ok = 0;
-
-	for (i = 0; i <= ETHLCD_MAX_RETRIES; i++) {
-		/* Send data to device */
-		cmd = data[0];		/* store command byte for verification */
-		len = sock_send(p->sock, data, length);
-		if (len <= 0) {
-			p->hd44780_functions->drv_report(RPT_WARNING, "%s: Write to socket failed (attempt #%d): %s",
-						ETHLCD_DRV_NAME, i + 1, strerror(errno));
-			continue;
-		}
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
 
-		/* Check if this is a command with reply */
-		if (cmd == ETHLCD_GET_BUTTONS)
-			response_len = 2;
-		else
-			response_len = 1;
+	if (conn->state != ETHLCD_CONNECTED)
+		return;
 
-		/* Wait for reply */
-		len = sock_recv(p->sock, data, response_len);
+	conn->queue[2 * conn->count] = cmd;
+	conn->queue[2 * conn->count + 1] = arg;
+	conn->count++;
+
+	if (conn->count >= conn->batch_size)
+		ethlcd_HD44780_flush(p);
+}
+
+
+/**
+ * Send data to the ethlcd device and read its reply.
+ * \param p          Pointer to driver's private data structure.
+ * \param data       Pointer to buffer with data to send.
+ * \param length     Number of bytes to send.
+ * \param reply      Buffer receiving the reply.
+ * \param reply_len  Number of bytes to read.
+ * \retval 0   Success.
+ * \retval -1  Error; the connection should be dropped.
+ */
+static int
+ethlcd_transfer(PrivateData *p, unsigned char *data, int length,
+		unsigned char *reply, int reply_len)
+{
+	int len, got;
+
+	len = sock_send(p->sock, data, length);
+	if (len != length) {
+		p->hd44780_functions->drv_report(RPT_WARNING, "%s: Write to socket failed: %s",
+					ETHLCD_DRV_NAME, (len < 0) ? strerror(errno) : "short write");
+		return -1;
+	}
+
+	/* The reply may arrive in several segments */
+	for (got = 0; got < reply_len; got += len) {
+		len = sock_recv(p->sock, reply + got, reply_len - got);
 		if (len <= 0) {
-			p->hd44780_functions->drv_report(RPT_WARNING, "%s: Read from socket failed (attempt #%d): %s",
-						ETHLCD_DRV_NAME, i + 1, strerror(errno));
-			continue;
+			p->hd44780_functions->drv_report(RPT_WARNING, "%s: Read from socket failed: %s",
+						ETHLCD_DRV_NAME, (len < 0) ? strerror(errno) : "connection closed");
+			return -1;
 		}
+	}
+
+	return 0;
+}
+
+
+/**
+ * Make the socket blocking and set the timeouts for talking to the device.
+ * \param p  Pointer to driver's private data structure.
+ * \retval 0   Success.
+ * \retval -1  Error.
+ */
+static int
+ethlcd_setup_socket(PrivateData *p)
+{
+	int flags;
+	struct timeval tv;
+
+	/* we need to have a blocking read back again: */
+	flags = fcntl(p->sock, F_GETFL, 0);
+	if (flags < 0) {
+		p->hd44780_functions->drv_report(RPT_ERR, "%s: Cannot obtain current flags: %s",
+					ETHLCD_DRV_NAME, strerror(errno));
+		return -1;
+	}
+	if (fcntl(p->sock, F_SETFL, flags & ~O_NONBLOCK) < 0) {
+		p->hd44780_functions->drv_report(RPT_ERR, "%s: Unable to clear O_NONBLOCK: %s",
+					ETHLCD_DRV_NAME, strerror(errno));
+		return -1;
+	}
+
+	/* setting timeouts */
+	tv.tv_sec = ETHLCD_TIMEOUT;
+	tv.tv_usec = 0;
+	if (setsockopt(p->sock, SOL_SOCKET, SO_RCVTIMEO, (void *)&tv, sizeof(struct timeval)) < 0) {
+		p->hd44780_functions->drv_report(RPT_ERR, "%s: Cannot set receive timeout: %s",
+					ETHLCD_DRV_NAME, strerror(errno));
+		return -1;
+	}
+	if (setsockopt(p->sock, SOL_SOCKET, SO_SNDTIMEO, (void *)&tv, sizeof(struct timeval)) < 0) {
+		p->hd44780_functions->drv_report(RPT_ERR, "%s: Cannot set send timeout: %s",
+					ETHLCD_DRV_NAME, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Drop the connection to the device after an error. Queued commands are
+ * discarded and reconnecting is attempted later.
+ * \param p  Pointer to driver's private data structure.
+ */
+static void
+ethlcd_disconnect(PrivateData *p)
+{
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
+
+	if (conn->state == ETHLCD_CONNECTED)
+		p->hd44780_functions->drv_report(RPT_ERR, "%s: Lost connection to %s; retrying every %d seconds",
+					ETHLCD_DRV_NAME, conn->hostname, ETHLCD_RECONNECT_INTERVAL);
 
-		/* Check reply */
-		if (data[0] != cmd) {
-			p->hd44780_functions->drv_report(RPT_WARNING, "%s: Invalid device response (attempt #%d): got 0x%02X, expected: 0x%02X",
-						ETHLCD_DRV_NAME, i + 1, data[0], cmd);
-			sleep(ETHLCD_TIMEOUT);
-		} else {
-			ok = 1;
-			break;
+	if (p->sock >= 0) {
+		close(p->sock);
+		p->sock = -1;
+	}
+	conn->count = 0;
+	conn->state = ETHLCD_DISCONNECTED;
+	conn->retry_time = time(NULL) + ETHLCD_RECONNECT_INTERVAL;
+}
+
+
+/**
+ * Advance reconnecting to the device without blocking: start a
+ * non-blocking connect when it is time to retry, check if a pending connect
+ * has completed, and once connected initialize the display again and mark
+ * its contents as lost so that the next flush redraws everything.
+ * \param p  Pointer to driver's private data structure.
+ */
+static void
+ethlcd_reconnect(PrivateData *p)
+{
+	ethlcd_connection *conn = (ethlcd_connection *) p->connection_data;
+	struct pollfd pfd;
+	int err = 0;
+	socklen_t errlen = sizeof(err);
+	int i;
+
+	if (conn->state == ETHLCD_DISCONNECTED) {
+		if (time(NULL) < conn->retry_time)
+			return;
+		conn->retry_time = time(NULL) + ETHLCD_RECONNECT_INTERVAL;
+
+		p->sock = socket(PF_INET, SOCK_STREAM, 0);
+		if (p->sock < 0)
+			return;
+		if (fcntl(p->sock, F_SETFL, O_NONBLOCK) < 0
+		    || (connect(p->sock, (struct sockaddr *) &conn->addr, sizeof(conn->addr)) < 0
+			&& errno != EINPROGRESS)) {
+			close(p->sock);
+			p->sock = -1;
+			return;
 		}
+		conn->state = ETHLCD_CONNECTING;
 	}
 
-	if (ok == 0) {
-		p->hd44780_functions->drv_report(RPT_CRIT, "%s: Device communication error. Exiting",
-					ETHLCD_DRV_NAME);
-		exit(-1);
+	/* Has the connect completed? */
+	pfd.fd = p->sock;
+	pfd.events = POLLOUT;
+	if (poll(&pfd, 1, 0) <= 0)
+		return;
+	if (getsockopt(p->sock, SOL_SOCKET, SO_ERROR, &err, &errlen) < 0 || err != 0
+	    || ethlcd_setup_socket(p) < 0) {
+		close(p->sock);
+		p->sock = -1;
+		conn->state = ETHLCD_DISCONNECTED;
+		return;
 	}
+
+	p->hd44780_functions->drv_report(RPT_NOTICE, "%s: Reconnected to %s",
+				ETHLCD_DRV_NAME, conn->hostname);
+	conn->state = ETHLCD_CONNECTED;
+
+	/* The device may have been reset: initialize it again */
+	p->hd44780_functions->senddata(p, 0, RS_INSTR, FUNCSET | IF_4BIT | TWOLINE | SMALLCHAR);
+	common_init(p, IF_4BIT);
+
+	/* The display has been cleared; restore it with the next flush */
+	memset(p->backingstore, ' ', p->width * p->height);
+	for (i = 0; i < NUM_CCs; i++)
+		p->cc[i].clean = 0;
+	p->backlightstate = -1;
 }
@@ -7,7 +7,11 @@ int hd_init_ethlcd(Driver *drvthis);
 #define ETHLCD_DRV_NAME      "ethlcd"
 #define DEFAULT_ETHLCD_PORT  2425
 #define ETHLCD_TIMEOUT       1
-#define ETHLCD_MAX_RETRIES   3
+/* seconds between attempts to reconnect to a lost device */
+#define ETHLCD_RECONNECT_INTERVAL  5
+/* commands sent to the device in one batch */
+#define DEFAULT_ETHLCD_BATCH 32
+#define ETHLCD_MAX_BATCH     256
 
 /* ethlcd protocol constants: */
 #define ETHLCD_SEND_INSTR               0x01
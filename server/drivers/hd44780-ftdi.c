@@ -17,6 +17,13 @@
 
    RW of your display can either be connected to D6 or GND.
 \endverbatim
+ *
+ * In 4 bit mode the bytes for the port are collected in a stream that is
+ * written on flush with as few transfers as possible. Pauses are made by
+ * repeating the last byte as often as the bit-bang clock needs for the
+ * time to pass, so the chip does the timing instead of the host. In 8 bit
+ * mode data and control lines are on separate interfaces that cannot be
+ * kept in step that way, so every byte is still written on its own.
  */
 
 /*-
@@ -49,12 +56,27 @@
 
 #include "hd44780-ftdi.h"
 #include "hd44780-low.h"
+#include "timing.h"
 #include "shared/report.h"
 
 /* connection type specific functions to be exposed using pointers in init() */
 void ftdi_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch);
 void ftdi_HD44780_backlight(PrivateData *p, unsigned char state);
 void ftdi_HD44780_close(PrivateData *p);
+void ftdi_HD44780_uPause(PrivateData *p, int usecs);
+void ftdi_HD44780_flush(PrivateData *p);
+
+/** Size of the bit-bang stream in 4 bit mode */
+#define FTDI_STREAM_SIZE	4096
+
+/** Default baudrate in 4 bit mode */
+#define FTDI_DEFAULT_BAUDRATE	921600
+
+/**
+ * Highest baudrate used in 4 bit mode: a bit-bang clock of 1 MB/s, which is
+ * about what full speed USB delivers
+ */
+#define FTDI_MAX_STREAM_BAUDRATE	62500
 
 
 /**
@@ -133,13 +155,33 @@ hd_init_ftdi(Driver *drvthis)
     debug(RPT_DEBUG, "enabling bitbang mode(channel 1)\n");
 
     if (p->ftdi_mode == 4) {
-	/* set fast baudrate for 4 bit wiring to eliminate garbage on lcd */
-	f = ftdi_set_baudrate(&p->ftdic, 921600);
+	/*
+	 * The baudrate sets the bit-bang clock, which does the timing for
+	 * the display: each byte is output for at least 1/16 of a baud.
+	 * A clock faster than the USB link can feed would only make every
+	 * pause take more bytes, so it is capped.
+	 */
+	int baudrate = drvthis->config_get_int(drvthis->name, "ftdi_baudrate", 0, FTDI_DEFAULT_BAUDRATE);
+
+	if (baudrate > FTDI_MAX_STREAM_BAUDRATE)
+	    baudrate = FTDI_MAX_STREAM_BAUDRATE;
+	f = ftdi_set_baudrate(&p->ftdic, baudrate);
 	if (f < 0) {
 	    report(RPT_ERR, "unable to open ftdi device: %d (%s)", f, ftdi_get_error_string(&p->ftdic));
 	    f = -1;
             goto hd_init_ftdi_done;
 	}
+	p->ftdi_bitbang_rate = p->ftdic.baudrate * 16;
+
+	p->tx_buf.buffer = malloc(FTDI_STREAM_SIZE);
+	if (p->tx_buf.buffer == NULL) {
+	    report(RPT_ERR, "hd_init_ftdi: could not allocate bit-bang stream");
+	    f = -1;
+	    goto hd_init_ftdi_done;
+	}
+	p->tx_buf.use_count = 0;
+	p->hd44780_functions->uPause = ftdi_HD44780_uPause;
+	p->hd44780_functions->flush = ftdi_HD44780_flush;
     }
 
     ftdi_set_bitmode(&p->ftdic, 0xFF, BITMODE_BITBANG);
@@ -176,8 +218,11 @@ hd_init_ftdi(Driver *drvthis)
     }
     else if (p->ftdi_mode == 4) {
 	ftdi_HD44780_senddata(p, 0, RS_INSTR, FUNCSET | IF_4BIT);
+	ftdi_HD44780_uPause(p, 4100);
 	ftdi_HD44780_senddata(p, 0, RS_INSTR, FUNCSET | IF_4BIT);
+	ftdi_HD44780_uPause(p, 4100);
 	ftdi_HD44780_senddata(p, 0, RS_INSTR, FUNCSET | IF_4BIT);
+	ftdi_HD44780_uPause(p, 4100);
 
 	common_init(p, IF_4BIT);
     }
@@ -190,6 +235,76 @@ hd_init_ftdi_done:
 }
 
 
+/**
+ * Write the bit-bang stream collected so far.
+ * \param p  Pointer to driver's private data structure.
+ */
+void
+ftdi_HD44780_flush(PrivateData *p)
+{
+    int f;
+
+    if (p->tx_buf.use_count == 0)
+	return;
+
+    f = ftdi_write_data(&p->ftdic, p->tx_buf.buffer, p->tx_buf.use_count);
+    if (f < 0) {
+	p->hd44780_functions->drv_report(RPT_ERR, "failed to write: %d (%s). Exiting",
+				   f, ftdi_get_error_string(&p->ftdic));
+	exit(-1);
+    }
+    p->tx_buf.use_count = 0;
+}
+
+
+/**
+ * Append bytes to the bit-bang stream, writing it out when it is full.
+ * \param p    Pointer to driver's private data structure.
+ * \param buf  Bytes to append.
+ * \param len  Number of bytes.
+ */
+static void
+ftdi_stream_add(PrivateData *p, const unsigned char *buf, int len)
+{
+    while (len-- > 0) {
+	if (p->tx_buf.use_count == FTDI_STREAM_SIZE)
+	    ftdi_HD44780_flush(p);
+	p->tx_buf.buffer[p->tx_buf.use_count++] = *buf++;
+    }
+}
+
+
+/**
+ * Wait for some microseconds by holding the port state in the stream.
+ * Pauses that would take more than the whole stream are spent sleeping
+ * after writing the stream out instead.
+ * \param p      Pointer to driver's private data structure.
+ * \param usecs  Time to wait in microseconds.
+ */
+void
+ftdi_HD44780_uPause(PrivateData *p, int usecs)
+{
+    unsigned char idle;
+    long count;
+
+    usecs *= p->delayMult;
+    count = ((long long) usecs * p->ftdi_bitbang_rate + 999999) / 1000000;
+    if (count > FTDI_STREAM_SIZE) {
+	ftdi_HD44780_flush(p);
+	timing_uPause(usecs);
+	return;
+    }
+
+    /* keep the lines as they are, with EN inactive */
+    idle = (p->tx_buf.use_count > 0)
+	   ? p->tx_buf.buffer[p->tx_buf.use_count - 1]
+	   : p->backlight_bit;
+
+    while (count-- > 0)
+	ftdi_stream_add(p, &idle, 1);
+}
+
+
 /**
  * Send data or commands to the display.
  * \param p          Pointer to driver's private data structure.
@@ -255,17 +370,9 @@ ftdi_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char fla
 	buf[1] = ((ch >> 4) & 0x0F) | portControl;
 	buf[2] = (ch & 0x0F) | portControl | enableLines;
 	buf[3] = (ch & 0x0F) | portControl;
-	int f = ftdi_write_data(&p->ftdic, buf, 4);
-
-	if (f < 0) {
-	    p->hd44780_functions->drv_report(RPT_ERR, "failed to write: %d (%s). Exiting",
-				       f, ftdi_get_error_string(&p->ftdic));
-	    exit(-1);
-	}
 
-	if (flags == RS_INSTR) {
-	    usleep(4100);
-	}
+	/* the time the controller needs is added by the caller's uPause() */
+	ftdi_stream_add(p, buf, 4);
     }
 }
 
@@ -293,12 +400,8 @@ ftdi_HD44780_backlight(PrivateData *p, unsigned char state)
 	}
     }
     else {
-	f = ftdi_write_data(&p->ftdic, buf, 1);
-	if (f < 0) {
-	    p->hd44780_functions->drv_report(RPT_ERR, "failed to write: %d (%s). Exiting",
-				  f, ftdi_get_error_string(&p->ftdic));
-	    exit(-1);
-	}
+	ftdi_stream_add(p, buf, 1);
+	ftdi_HD44780_flush(p);
     }
 }
 
@@ -310,6 +413,12 @@ ftdi_HD44780_backlight(PrivateData *p, unsigned char state)
 void
 ftdi_HD44780_close(PrivateData *p)
 {
+    if (p->tx_buf.buffer != NULL) {
+	ftdi_HD44780_flush(p);
+	free(p->tx_buf.buffer);
+	p->tx_buf.buffer = NULL;
+    }
+
     ftdi_disable_bitbang(&p->ftdic);
     ftdi_usb_close(&p->ftdic);
     ftdi_deinit(&p->ftdic);
@@ -8,6 +8,10 @@
  * Mappings can be set in the config file using the keys:
  * pin_EN, pin_EN2, pin_RS, pin_D7, pin_D6, pin_D5, pin_D4, pin_BL, pin_RW
  * in the [hd44780] section.
+ *
+ * RS, the data lines and EN(2) are requested as one bulk, so a nibble
+ * takes two requests: data with the rising edge of EN, then its falling
+ * edge.
  */
 
 /*-
@@ -35,63 +39,124 @@ void gpiod_HD44780_backlight(PrivateData *p, unsigned char state);
 void gpiod_HD44780_reset(PrivateData *p);
 void gpiod_HD44780_close(PrivateData *p);
 
+/** Lines switched together with one request, in this order */
+enum {
+	BUS_RS,
+	BUS_D7,
+	BUS_D6,
+	BUS_D5,
+	BUS_D4,
+	BUS_EN,
+	BUS_EN2,	/**< only with two controllers */
+	BUS_LINES
+};
+
 typedef struct {
 	struct gpiod_chip *chip;
-	struct gpiod_line *en;
-	struct gpiod_line *rs;
-	struct gpiod_line *d7;
-	struct gpiod_line *d6;
-	struct gpiod_line *d5;
-	struct gpiod_line *d4;
-	struct gpiod_line *en2;
+	struct gpiod_line_bulk bus;	/**< RS, D7-D4, EN and EN2 */
+	int values[BUS_LINES];		/**< current levels of the bus lines */
 	struct gpiod_line *bl;
 	struct gpiod_line *rw;
 } gpio_pins;
 
 /**
- * Initialize a struct gpiod_line context by reading the related configuration
- * option.
+ * Look up a GPIO line by reading the related configuration option.
  *
  * \param drvthis   Pointer to driver structure.
- * \param pin       Pointer to struct gpiod_line *structure to be initialized.
  * \param name      Name of the GPIO pin.
- * \return          0 on success; -1 on error.
+ * \return          The line; NULL if not configured or on error.
  */
-static int
-init_gpio_pin(Driver *drvthis, struct gpiod_line **pin, const char *name)
+static struct gpiod_line *
+get_gpio_line(Driver *drvthis, const char *name)
 {
 	PrivateData *p = (PrivateData *) drvthis->private_data;
 	gpio_pins *pins = (gpio_pins *) p->connection_data;
+	struct gpiod_line *line;
 	char config_key[8];
 	int number;
 
 	snprintf(config_key, sizeof(config_key), "pin_%s", name);
 	number = drvthis->config_get_int(drvthis->name, config_key, 0, -1);
 	if (number == -1)
-		return -1;
+		return NULL;
 
-	*pin = gpiod_chip_get_line(pins->chip, number);
-	if (*pin == NULL) {
-		report(RPT_ERR, "init_gpio_pin: unable to request GPIO%d: %s",
+	line = gpiod_chip_get_line(pins->chip, number);
+	if (line == NULL) {
+		report(RPT_ERR, "get_gpio_line: unable to request GPIO%d: %s",
 		       number, strerror(errno));
-		return -1;
+		return NULL;
 	}
 
+	report(RPT_INFO, "get_gpio_line: Pin %s mapped to GPIO%d", name, number);
+
+	return line;
+}
+
+
+/**
+ * Initialize a struct gpiod_line context of a line that is switched on its
+ * own by reading the related configuration option.
+ *
+ * \param drvthis   Pointer to driver structure.
+ * \param pin       Pointer to struct gpiod_line *structure to be initialized.
+ * \param name      Name of the GPIO pin.
+ * \return          0 on success; -1 on error.
+ */
+static int
+init_gpio_pin(Driver *drvthis, struct gpiod_line **pin, const char *name)
+{
+	*pin = get_gpio_line(drvthis, name);
+	if (*pin == NULL)
+		return -1;
+
 	if (gpiod_line_request_output(*pin, "LCDd", 0) < 0) {
-		report(RPT_ERR, "init_gpio_pin: unable to open file descriptor for GPIO%d: %s",
-		       number, strerror(errno));
+		report(RPT_ERR, "init_gpio_pin: unable to open file descriptor for GPIO %s: %s",
+		       name, strerror(errno));
 		*pin = NULL;
 		return -1;
 	}
 
-	report(RPT_INFO, "init_gpio_pin: Pin %s mapped to GPIO%d", name, number);
+	return 0;
+}
+
 
+/**
+ * Add a line to the bus.
+ *
+ * \param drvthis   Pointer to driver structure.
+ * \param name      Name of the GPIO pin.
+ * \return          0 on success; -1 on error.
+ */
+static int
+add_bus_pin(Driver *drvthis, const char *name)
+{
+	PrivateData *p = (PrivateData *) drvthis->private_data;
+	gpio_pins *pins = (gpio_pins *) p->connection_data;
+	struct gpiod_line *line = get_gpio_line(drvthis, name);
+
+	if (line == NULL)
+		return -1;
+
+	gpiod_line_bulk_add(&pins->bus, line);
 	return 0;
 }
 
 
 /**
- * Send 4-bit data.
+ * Drive the bus lines to their current values with a single request.
+ *
+ * \param pins  Pointer to the connection data.
+ */
+static void
+write_bus(gpio_pins *pins)
+{
+	gpiod_line_set_value_bulk(&pins->bus, pins->values);
+}
+
+
+/**
+ * Send 4-bit data. Takes two requests: the data is set together with the
+ * rising edge of EN and clocked on its falling edge.
  *
  * \param p     Pointer to driver's private data structure.
  * \param ch    The value to send (lower nibble must contain the data).
@@ -101,23 +166,21 @@ send_nibble(PrivateData *p, unsigned char ch, unsigned char displayID)
 {
 	gpio_pins *pins = (gpio_pins *) p->connection_data;
 
-	gpiod_line_set_value(pins->d7, ch & 0x08);
-	gpiod_line_set_value(pins->d6, ch & 0x04);
-	gpiod_line_set_value(pins->d5, ch & 0x02);
-	gpiod_line_set_value(pins->d4, ch & 0x01);
+	pins->values[BUS_D7] = (ch & 0x08) ? 1 : 0;
+	pins->values[BUS_D6] = (ch & 0x04) ? 1 : 0;
+	pins->values[BUS_D5] = (ch & 0x02) ? 1 : 0;
+	pins->values[BUS_D4] = (ch & 0x01) ? 1 : 0;
 
-	/* Data is clocked on the falling edge of EN */
 	if (displayID == 1 || displayID == 0)
-		gpiod_line_set_value(pins->en, 1);
+		pins->values[BUS_EN] = 1;
 	if (displayID == 2 || (p->numDisplays > 1 && displayID == 0))
-		gpiod_line_set_value(pins->en2, 1);
-        p->hd44780_functions->uPause(p, 50);
+		pins->values[BUS_EN2] = 1;
+	write_bus(pins);
+	p->hd44780_functions->uPause(p, 1);
 
-	if (displayID == 1 || displayID == 0)
-		gpiod_line_set_value(pins->en, 0);
-	if (displayID == 2 || (p->numDisplays > 1 && displayID == 0))
-		gpiod_line_set_value(pins->en2, 0);
-	p->hd44780_functions->uPause(p, 50);
+	pins->values[BUS_EN] = 0;
+	pins->values[BUS_EN2] = 0;
+	write_bus(pins);
 }
 
 
@@ -145,7 +208,11 @@ hd_init_gpiod(Driver *drvthis)
 		return -1;
 	}
 
-	pins = malloc(sizeof(gpio_pins));
+	pins = calloc(1, sizeof(gpio_pins));
+	if (pins == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return -1;
+	}
 
 	pins->chip = gpiod_chip_open_lookup(chip);
 	if (!pins->chip) {
@@ -156,23 +223,24 @@ hd_init_gpiod(Driver *drvthis)
 
 	p->connection_data = pins;
 
-	if (init_gpio_pin(drvthis, &pins->en, "EN") != 0 ||
-	    init_gpio_pin(drvthis, &pins->rs, "RS") != 0 ||
-	    init_gpio_pin(drvthis, &pins->d7, "D7") != 0 ||
-	    init_gpio_pin(drvthis, &pins->d6, "D6") != 0 ||
-	    init_gpio_pin(drvthis, &pins->d5, "D5") != 0 ||
-	    init_gpio_pin(drvthis, &pins->d4, "D4") != 0) {
+	/* All lines but backlight and RW are switched together, in the order
+	 * of the BUS_* indexes */
+	gpiod_line_bulk_init(&pins->bus);
+	if (add_bus_pin(drvthis, "RS") != 0 ||
+	    add_bus_pin(drvthis, "D7") != 0 ||
+	    add_bus_pin(drvthis, "D6") != 0 ||
+	    add_bus_pin(drvthis, "D5") != 0 ||
+	    add_bus_pin(drvthis, "D4") != 0 ||
+	    add_bus_pin(drvthis, "EN") != 0 ||
+	    (p->numDisplays > 1 && add_bus_pin(drvthis, "EN2") != 0)) {	/* For displays with two controllers */
 		report(RPT_ERR, "hd_init_gpio: unable to initialize GPIO pins");
 		gpiod_HD44780_close(p);
 		return -1;
 	}
-
-	if (p->numDisplays > 1) {       /* For displays with two controllers */
-		if (init_gpio_pin(drvthis, &pins->en2, "EN2") != 0) {
-			report(RPT_ERR, "hd_init_gpio: unable to initialize GPIO pins");
-			gpiod_HD44780_close(p);
-			return -1;
-		}
+	if (gpiod_line_request_bulk_output(&pins->bus, "LCDd", pins->values) < 0) {
+		report(RPT_ERR, "hd_init_gpio: unable to request GPIO lines: %s", strerror(errno));
+		gpiod_HD44780_close(p);
+		return -1;
 	}
 
 	p->hd44780_functions->senddata = gpiod_HD44780_senddata;
@@ -208,14 +276,17 @@ gpiod_HD44780_reset(PrivateData *p)
 {
 	gpio_pins *pins = (gpio_pins *) p->connection_data;
 
-	gpiod_line_set_value(pins->rs, 0);
+	pins->values[BUS_RS] = 0;
+	write_bus(pins);
 
 	send_nibble(p, (FUNCSET | IF_8BIT) >> 4, 0);
 	p->hd44780_functions->uPause(p, 4100);
 	send_nibble(p, (FUNCSET | IF_8BIT) >> 4, 0);
 	p->hd44780_functions->uPause(p, 100);
 	send_nibble(p, (FUNCSET | IF_8BIT) >> 4, 0);
+	p->hd44780_functions->uPause(p, 50);
 	send_nibble(p, (FUNCSET | IF_4BIT) >> 4, 0);
+	p->hd44780_functions->uPause(p, 50);
 
 	common_init(p, IF_4BIT);
 }
@@ -234,11 +305,19 @@ gpiod_HD44780_senddata(PrivateData *p, unsigned char displayID,
 		      unsigned char flags, unsigned char ch)
 {
 	gpio_pins *pins = (gpio_pins *) p->connection_data;
+	int rs = (flags == RS_INSTR) ? 0 : 1;
 
-	gpiod_line_set_value(pins->rs, (flags == RS_INSTR) ? 0 : 1);
+	/* RS has to be stable before EN rises */
+	if (pins->values[BUS_RS] != rs) {
+		pins->values[BUS_RS] = rs;
+		write_bus(pins);
+	}
 
 	send_nibble(p, ch >> 4, displayID);
 	send_nibble(p, ch, displayID);
+
+	/* execution time of the command */
+	p->hd44780_functions->uPause(p, 50);
 }
 
 
@@ -20,8 +20,12 @@
 
 #include "hd44780-lcd2usb.h"
 #include "hd44780-low.h"
+#include "usb_events.h"
 #include "shared/report.h"
 
+/** Timeout of USB transfers in milliseconds */
+#define LCD2USB_TIMEOUT		1000
+
 /* connection type specific functions to be exposed using pointers in init() */
 void lcd2usb_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch);
 void lcd2usb_HD44780_backlight(PrivateData *p, unsigned char state);
@@ -29,6 +33,7 @@ unsigned char lcd2usb_HD44780_scankeypad(PrivateData *p);
 void lcd2usb_HD44780_close(PrivateData *p);
 void lcd2usb_HD44780_set_contrast(PrivateData *p, unsigned char value);
 void lcd2usb_HD44780_flush(PrivateData *p);
+static void lcd2usb_send_buffer(PrivateData *p);
 
 
 /**
@@ -53,8 +58,7 @@ int
 hd_init_lcd2usb(Driver *drvthis)
 {
 	PrivateData *p = (PrivateData *) drvthis->private_data;
-
-	struct usb_bus *bus;
+	libusb_context *ctx;
 
 	p->hd44780_functions->senddata = lcd2usb_HD44780_senddata;
 	p->hd44780_functions->backlight = lcd2usb_HD44780_backlight;
@@ -68,12 +72,16 @@ hd_init_lcd2usb(Driver *drvthis)
 	usb_debug = 2;
 #endif
 
-	libusb_init(NULL);
+	/* The context and its event thread are shared by all USB drivers */
+	ctx = usb_events_init();
+	if (ctx == NULL)
+		return -1;
 
 	libusb_device **list;
-	ssize_t count = libusb_get_device_list(NULL, &list);
+	ssize_t count = libusb_get_device_list(ctx, &list);
 	if (count < 0) {
 		report(RPT_WARNING, "hd_init_lcd2usb: list error %s", libusb_strerror(count));
+		usb_events_exit();
 		return -1;
 	}
 
@@ -122,6 +130,14 @@ hd_init_lcd2usb(Driver *drvthis)
 	}
 	else {
 		report(RPT_ERR, "hd_init_lcd2usb: no (matching) LCD2USB device found");
+		usb_events_exit();
+		return -1;
+	}
+
+	/* output is queued and submitted by the flush function */
+	p->connection_data = usb_out_queue_new(p->libusbHandle, USB_OUT_TRANSFERS, 0, LCD2USB_TIMEOUT);
+	if (p->connection_data == NULL) {
+		lcd2usb_HD44780_close(p);
 		return -1;
 	}
 
@@ -157,39 +173,38 @@ lcd2usb_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char
 	int id = (displayID == 0) ? LCD2USB_CTRL_BOTH
 	: ((displayID == 1) ? LCD2USB_CTRL_0 : LCD2USB_CTRL_1);
 
-	/* flush current buffer if target or command type are different */
+	/* queue current buffer if target or command type are different */
 	if ((p->tx_buf.type >= 0) && (p->tx_buf.type != (type | id)))
-		lcd2usb_HD44780_flush(p);
+		lcd2usb_send_buffer(p);
 
 	/* add new item to buffer */
 	p->tx_buf.type = (type | id);
 	p->tx_buf.buffer[p->tx_buf.use_count++] = ch;
 
-	/* flush buffer if it's full */
+	/* queue buffer if it's full */
 	if (p->tx_buf.use_count == LCD2USB_MAX_CMD)
-		lcd2usb_HD44780_flush(p);
+		lcd2usb_send_buffer(p);
 }
 
 /**
- * Actually send data or command to the display.
+ * Queue the buffered data or commands as one control transfer.
  * \param p  Pointer to driver's private data structure.
  */
-void
-lcd2usb_HD44780_flush(PrivateData *p)
+static void
+lcd2usb_send_buffer(PrivateData *p)
 {
 	/* only if some data available */
 	if (p->tx_buf.use_count == 0)
 		return;
 
-	/* construct and send message */
-	if (libusb_control_transfer(
-			p->libusbHandle,
+	/* construct and queue message */
+	if (usb_out_queue_control((UsbOutQueue *) p->connection_data,
 			LIBUSB_REQUEST_TYPE_VENDOR,
 			p->tx_buf.type | (p->tx_buf.use_count - 1),
 			p->tx_buf.buffer[0] | (p->tx_buf.buffer[1] << 8),
 			p->tx_buf.buffer[2] | (p->tx_buf.buffer[3] << 8),
-			NULL, 0, 1000) < 0) {
-		p->hd44780_functions->drv_report(RPT_WARNING, "lcd2usb_HD44780_flush: flush failed");
+			NULL, 0) < 0) {
+		p->hd44780_functions->drv_report(RPT_WARNING, "lcd2usb_send_buffer: queueing failed");
 	}
 
 	/* buffer is now free again. Not necessary to clear what's in it. */
@@ -197,6 +212,23 @@ lcd2usb_HD44780_flush(PrivateData *p)
 	p->tx_buf.use_count = 0;
 }
 
+/**
+ * Actually send data or command to the display. All transfers queued since
+ * the last flush are submitted at once and complete in the background.
+ * \param p  Pointer to driver's private data structure.
+ */
+void
+lcd2usb_HD44780_flush(PrivateData *p)
+{
+	UsbOutQueue *queue = (UsbOutQueue *) p->connection_data;
+
+	lcd2usb_send_buffer(p);
+	usb_out_queue_submit(queue);
+
+	if (usb_out_queue_errors(queue) > 0)
+		p->hd44780_functions->drv_report(RPT_WARNING, "lcd2usb_HD44780_flush: flush failed");
+}
+
 /**
  * Turn display backlight on or off.
  * Backlight is turned on or off by toggeling between the brightness and
@@ -213,9 +245,10 @@ lcd2usb_HD44780_backlight(PrivateData *p, unsigned char state)
 	p->hd44780_functions->drv_debug(RPT_DEBUG, "lcd2usb_HD44780_backlight: Setting backlight to %d", promille);
 
 	/* and set it (converted from [0,1000] -> [0,255]) */
-	if (libusb_control_transfer(p->libusbHandle, LIBUSB_REQUEST_TYPE_VENDOR, LCD2USB_SET_BRIGHTNESS,
-			     (promille * 255) / 1000, 0, NULL, 0, 1000) < 0)
+	if (usb_out_queue_control((UsbOutQueue *) p->connection_data, LIBUSB_REQUEST_TYPE_VENDOR,
+			LCD2USB_SET_BRIGHTNESS, (promille * 255) / 1000, 0, NULL, 0) < 0)
 		p->hd44780_functions->drv_report(RPT_WARNING, "lcd2usb_HD44780_backlight: setting backlight failed");
+	usb_out_queue_submit((UsbOutQueue *) p->connection_data);
 }
 
 
@@ -227,9 +260,10 @@ lcd2usb_HD44780_backlight(PrivateData *p, unsigned char state)
 void
 lcd2usb_HD44780_set_contrast(PrivateData *p, unsigned char value)
 {
-	if (libusb_control_transfer(p->libusbHandle, LIBUSB_REQUEST_TYPE_VENDOR, LCD2USB_SET_CONTRAST,
-			     value, 0, NULL, 0, 1000) < 0)
+	if (usb_out_queue_control((UsbOutQueue *) p->connection_data, LIBUSB_REQUEST_TYPE_VENDOR,
+			LCD2USB_SET_CONTRAST, value, 0, NULL, 0) < 0)
 		p->hd44780_functions->drv_report(RPT_WARNING, "lcd2usb_HD44780_set_contrast: setting contrast failed");
+	usb_out_queue_submit((UsbOutQueue *) p->connection_data);
 }
 
 
@@ -253,7 +287,7 @@ lcd2usb_HD44780_scankeypad(PrivateData *p)
 		0,
 		(char *) buffer,
 		sizeof(buffer),
-		1000
+		LCD2USB_TIMEOUT
 	);
 
 	if (nBytes != -1) {
@@ -272,8 +306,12 @@ void
 lcd2usb_HD44780_close(PrivateData *p)
 {
 	if (p->libusbHandle != NULL) {
+		/* let the device finish queued output */
+		usb_out_queue_free((UsbOutQueue *) p->connection_data);
+		p->connection_data = NULL;
 		libusb_close(p->libusbHandle);
 		p->libusbHandle = NULL;
+		usb_events_exit();
 	}
 	if (p->tx_buf.buffer != NULL) {
 		free(p->tx_buf.buffer);
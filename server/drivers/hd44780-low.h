@@ -219,6 +219,7 @@ typedef struct hd44780_private_data {
 	int ftdi_line_EN;
 	int ftdi_line_EN2;
 	int ftdi_line_backlight;
+	int ftdi_bitbang_rate;	/**< Highest rate bytes are clocked out at */
 #endif
 
 #ifdef HAVE_I2C
@@ -4,6 +4,11 @@
  * The LCD is operated in its serial mode to be connected via the SPI bus
  * using the Linux kernel spidev interface. The LCD SPI device should be
  * declared in your board setup code.
+ *
+ * Bytes are not sent one by one but queued as transfers of a single SPI
+ * message, which is submitted on flush or when the queue is full. The
+ * execution time of the controller is added to the transfers as delay,
+ * so the kernel does the timing between the bytes.
  */
 
 /*-
@@ -24,6 +29,7 @@
 #include "shared/report.h"
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 #include <errno.h>
 #include <unistd.h>
@@ -35,6 +41,9 @@
 
 void spi_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch);
 void spi_HD44780_backlight(PrivateData *p, unsigned char state);
+void spi_HD44780_uPause(PrivateData *p, int usecs);
+void spi_HD44780_flush(PrivateData *p);
+void spi_HD44780_close(PrivateData *p);
 
 #define DEFAULT_DEVICE		"/dev/spidev0.0"
 
@@ -45,6 +54,22 @@ void spi_HD44780_backlight(PrivateData *p, unsigned char state);
 /** KS0073 Register Select bit: 0 = instruction register follows, 1 = data register follows */
 #define RS	0x02u
 
+/** Number of transfers submitted in one SPI message, three bytes each; the
+ * default spidev buffer size of 4096 bytes limits a message as well */
+#define SPI_MAX_TRANSFERS	128
+
+/** Largest delay a transfer can carry */
+#define SPI_MAX_DELAY		0xFFFF
+
+/** Transfers waiting to be submitted */
+typedef struct {
+	struct spi_ioc_transfer xfer[SPI_MAX_TRANSFERS];
+	unsigned char data[SPI_MAX_TRANSFERS][3];
+	int count;
+	/** The generic pause function, for pauses outside of a message */
+	void (*uPause) (PrivateData *p, int usecs);
+} spi_queue;
+
 
 /**
  * Reverses the bits of \a u8.
@@ -64,43 +89,61 @@ bit_reverse8(uint8_t u8)
 
 
 /**
- * Do a SPI transfer by sending \c length bytes of \c outbuf and read the same
- * number of bytes into \c inbuf.
+ * Submit the queued transfers as one SPI message. Chip select is released
+ * after every transfer, as it would be if each was sent on its own.
  * \param p       Pointer to driver's private data structure.
- * \param outbuf  Buffer holding data to send.
- * \param inbuf   Buffer to store incoming data (or NULL).
- * \param length  Length of buffers (both).
- * \return  Status from ioctl.
  */
-static int
-spi_transfer(PrivateData *p, const unsigned char *outbuf, unsigned char *inbuf, unsigned length)
+void
+spi_HD44780_flush(PrivateData *p)
 {
-	struct spi_ioc_transfer xfer;
+	spi_queue *q = (spi_queue *) p->connection_data;
 	int status;
+	int i;
 
 	static unsigned char no_more_errormsgs = 0;
 
-	memset(&xfer, 0, sizeof(xfer));
-	xfer.tx_buf = (unsigned long) outbuf;
-	xfer.rx_buf = (unsigned long) inbuf;
-	xfer.len = length;
+	if (q->count == 0)
+		return;
+
+	for (i = 0; i < q->count; i++)
+		q->xfer[i].cs_change = (i < q->count - 1) ? 1 : 0;
 
-	p->hd44780_functions->drv_debug(RPT_DEBUG, "SPI sending %02x %02x %02x",
-					outbuf[0], outbuf[1], length > 2 ? outbuf[2] : 0xFFu);
-	status = ioctl(p->fd, SPI_IOC_MESSAGE(1), &xfer);
+	p->hd44780_functions->drv_debug(RPT_DEBUG, "SPI sending %d transfers", q->count);
+	status = ioctl(p->fd, SPI_IOC_MESSAGE(q->count), q->xfer);
 	if (status < 0) {
 		p->hd44780_functions->drv_report(no_more_errormsgs ? RPT_DEBUG : RPT_ERR,
 						 "HD44780: SPI: spidev write data %u failed: %s",
 						 status, strerror(errno));
 		no_more_errormsgs = 1;
 	}
-#ifdef DEBUG
-	if (inbuf)
-		p->hd44780_functions->drv_debug(RPT_DEBUG, "SPI returned data %02x %02x %02x",
-						inbuf[0], inbuf[1], length > 2 ? inbuf[2] : 0xFFu);
-#endif
 
-	return status;
+	q->count = 0;
+}
+
+
+/**
+ * Wait for some microseconds. Within a message the pause is added to the
+ * last queued transfer; otherwise it is spent right away.
+ * \param p      Pointer to driver's private data structure.
+ * \param usecs  Time to wait in microseconds.
+ */
+void
+spi_HD44780_uPause(PrivateData *p, int usecs)
+{
+	spi_queue *q = (spi_queue *) p->connection_data;
+
+	if (q->count > 0) {
+		struct spi_ioc_transfer *xfer = &q->xfer[q->count - 1];
+		/* Scaled like q->uPause() does */
+		long delay = (long) usecs * p->delayMult;
+
+		if (xfer->delay_usecs + delay <= SPI_MAX_DELAY) {
+			xfer->delay_usecs += delay;
+			return;
+		}
+		spi_HD44780_flush(p);
+	}
+	q->uPause(p, usecs);
 }
 
 
@@ -134,6 +177,13 @@ hd_init_spi(Driver *drvthis)
 		return -1;
 	}
 
+	p->connection_data = calloc(1, sizeof(spi_queue));
+	if (p->connection_data == NULL) {
+		report(RPT_ERR, "HD44780: SPI: Error allocating");
+		close(p->fd);
+		return -1;
+	}
+
 	/* Get and open the backlight device */
 	p->backlight_bit = -1;
 	strncpy(backlight_device,
@@ -155,6 +205,10 @@ hd_init_spi(Driver *drvthis)
 	}
 
 	hd44780_functions->senddata = spi_HD44780_senddata;
+	hd44780_functions->flush = spi_HD44780_flush;
+	hd44780_functions->close = spi_HD44780_close;
+	((spi_queue *) p->connection_data)->uPause = hd44780_functions->uPause;
+	hd44780_functions->uPause = spi_HD44780_uPause;
 	common_init(p, IF_8BIT);
 
 	return 0;
@@ -171,12 +225,17 @@ hd_init_spi(Driver *drvthis)
 void
 spi_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flags, unsigned char ch)
 {
-	unsigned char buf[3];
+	spi_queue *q = (spi_queue *) p->connection_data;
+	unsigned char *buf;
 	unsigned char reverse;
 
 	p->hd44780_functions->drv_report(RPT_DEBUG, "HD44780: SPI: sending %s %02x",
 					 RS_INSTR == flags ? "CMD" : "DATA", ch);
 
+	if (q->count == SPI_MAX_TRANSFERS)
+		spi_HD44780_flush(p);
+	buf = q->data[q->count];
+
 	if (flags == RS_INSTR)
 		buf[0] = SYNC;
 	else
@@ -190,7 +249,10 @@ spi_HD44780_senddata(PrivateData *p, unsigned char displayID, unsigned char flag
 	buf[1] = reverse & 0xF0;
 	buf[2] = (reverse & 0x0F) << 4;
 
-	spi_transfer(p, buf, NULL, sizeof(buf));
+	memset(&q->xfer[q->count], 0, sizeof(struct spi_ioc_transfer));
+	q->xfer[q->count].tx_buf = (unsigned long) buf;
+	q->xfer[q->count].len = sizeof(q->data[0]);
+	q->count++;
 }
 
 
@@ -214,3 +276,18 @@ spi_HD44780_backlight(PrivateData *p, unsigned char state)
 							 errno, strerror(errno));
 	}
 }
+
+
+/**
+ * Send what is still queued and free the queue.
+ * \param p      Pointer to driver's private data structure.
+ */
+void
+spi_HD44780_close(PrivateData *p)
+{
+	if (p->connection_data != NULL) {
+		spi_HD44780_flush(p);
+		free(p->connection_data);
+		p->connection_data = NULL;
+	}
+}
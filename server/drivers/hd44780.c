@@ -588,7 +588,7 @@ HD44780_init(Driver *drvthis)
 	 */
 	p->hd44780_functions->uPause = uPause;
 	p->hd44780_functions->drv_report = report;
-	p->hd44780_functions->drv_debug = debug;
+	p->hd44780_functions->drv_debug = debug_report;
 	p->hd44780_functions->senddata = NULL;
 	p->hd44780_functions->backlight = NULL;
 	p->hd44780_functions->set_contrast = NULL;
@@ -1127,6 +1127,7 @@ hd44780_set_backlight_internal(PrivateData *p, int state)
 			cmd = WINST_MODESET | WINST_TEXTMODE \
 			    | (brightness >= MAX_BRIGHTNESS/2 ? WINST_PWRON : WINST_PWROFF);
 			p->hd44780_functions->senddata(p, 0, RS_INSTR, cmd);
+			p->hd44780_functions->uPause(p, 500);
 			report(RPT_DEBUG, "hd44780: setting BL %s using winstar_oled internal cmd: %02x", state ? "on" : "off", cmd);
 			break;
 
@@ -1141,6 +1142,7 @@ hd44780_set_backlight_internal(PrivateData *p, int state)
 			else
 				cmd |= PT6314_BRIGHT_25; /* = 0x03 */
 			p->hd44780_functions->senddata(p, 0, RS_INSTR, cmd);
+			p->hd44780_functions->uPause(p, 40);  /* Minimum exec time for all commands */
 			report(RPT_DEBUG, "hd44780: setting BL %s using pt6314_vfd internal cmd: %02x", state ? "on" : "off", cmd);
 			break;
 
@@ -1165,6 +1167,8 @@ hd44780_set_backlight_config_cmds(PrivateData *p, int state)
 			if (cmd) {
 				report(RPT_DEBUG, "hd44780: setting BL on using cmd %02x", cmd);
 				p->hd44780_functions->senddata(p, 0, RS_INSTR, cmd);
+				/* Unknown commands may be as slow as CLEAR */
+				p->hd44780_functions->uPause(p, 1600);
 			}
 		}
 	}
@@ -1175,6 +1179,7 @@ hd44780_set_backlight_config_cmds(PrivateData *p, int state)
 			if (cmd) {
 				report(RPT_DEBUG, "hd44780: setting BL off using cmd %02x", cmd);
 				p->hd44780_functions->senddata(p, 0, RS_INSTR, cmd);
+				p->hd44780_functions->uPause(p, 1600);
 			}
 		}
 	}
@@ -44,6 +44,9 @@
 #include "shared/report.h"
 #include "picolcd.h"
 #include "timing.h"
+#ifdef HAVE_LIBUSB_1_0
+# include "usb_events.h"
+#endif
 
 #define NUM_CCs         8	/* max. number of custom characters */
 #define KEY_BUFFER_SIZE 8	/* size of the key ring buffer */
@@ -67,37 +70,16 @@ typedef struct {
 } keys;
 #endif
 
-/*
- * The current decision to use a separate select statement for libusb was
- * made to restrict the use of hardware related libraries to the drivers.
- * Ultimately it would be better if all socket and time event processing was
- * in one place. See:
- * http://libusb.sourceforge.net/api-1.0/group__asyncio.html#asyncevent
- *
- * If using a single select statement for all event processing libusb-1.0
- * initialisation, deinitialisation and event processing needs to be
- * performed by LCDd core code.  See comments in picoLCD_init(),
- * picoLCD_close() and picoLCD_get_key(). It may be convenient to use the
- * default context.
- */
-#undef USE_LIBUSB_SINGLE_SELECT
-
 /**
- * Multiple buffers are needed to ensure that no USB transfer is missed. Ideally
- * a single select statement with appropriate timeout should be used, in this
- * case double buffering is sufficient. When distributed select statements are
- * used processing of the USB signals is performed by
- * libusb_handle_events_timeout() in picoLCD_get_key(). This is called at 32Hz
- * (PROCESS_FREQ) i.e. every 31.25ms which is not really fast enough as the
- * picoLCD USB transfers can occur every 10ms. This may cause buffer overrun
- * problems for long bursts of IR data, to avoid problems there must be more
- * than 3 buffers.
+ * Multiple buffers are needed to ensure that no USB transfer is missed.
+ * USB events are handled continuously by the thread of usb_events.c, which
+ * resubmits an input transfer as soon as it completes, so double buffering
+ * is sufficient even for bursts of IR data every 10ms.
  */
-#ifdef USE_LIBUSB_SINGLE_SELECT
 #define USB_BUFFERS 2
-#else
-#define USB_BUFFERS 4
-#endif
+
+/** Timeout of output transfers in milliseconds */
+#define USB_OUT_TIMEOUT 1000
 
 #ifdef HAVE_LIBUSB_1_0
 /**
@@ -148,11 +130,13 @@ typedef struct picolcd_private_data {
 	int lirc_time_us;
 	int flush_threshold;
 #ifdef HAVE_LIBUSB_1_0
-	/* Pointer to libusb 1.0 session */
+	/* Pointer to libusb 1.0 session shared by all USB drivers */
 	libusb_context *lib_ctx;
 	/* structure for the details of the USB transfer */
 	UsbTransferData input_transfer[USB_BUFFERS];
-	/* buffer for the key press data */
+	/* output transfers queued until the next flush */
+	UsbOutQueue *out_queue;
+	/* buffer for the key press data; shared with the input call-back */
 	keys key_buffer[KEY_BUFFER_SIZE];
 	int key_read_index;	/* Read index in the key_buffer */
 	int key_write_index;	/* Write index in the key_buffer */
@@ -166,12 +150,13 @@ typedef struct picolcd_private_data {
 } PrivateData;
 
 /* Private function definitions */
-static void picolcd_send(USB_DEVICE_HANDLE *lcd, unsigned char *data, int size);
-static void picolcd_20x2_write(USB_DEVICE_HANDLE *lcd, const int row, const int col, const unsigned char *data);
-static void picolcd_20x4_write(USB_DEVICE_HANDLE *lcd, const int row, const int col, const unsigned char *data);
+static void picolcd_send(Driver *drvthis, unsigned char *data, int size);
+static void picolcd_submit(Driver *drvthis);
+static void picolcd_20x2_write(Driver *drvthis, const int row, const int col, const unsigned char *data);
+static void picolcd_20x4_write(Driver *drvthis, const int row, const int col, const unsigned char *data);
 static void picolcd_20x2_set_char(Driver *drvthis, int n, unsigned char *dat);
 static void picolcd_20x4_set_char(Driver *drvthis, int n, unsigned char *dat);
-static void set_key_lights(USB_DEVICE_HANDLE *lcd, int keys[], int state);
+static void set_key_lights(Driver *drvthis, int keys[], int state);
 static void picolcd_lircsend(Driver *drvthis);
 static void ir_transcode(Driver *drvthis, unsigned char *data, unsigned int cbdata);
 #ifdef HAVE_LIBUSB_1_0
@@ -260,7 +245,7 @@ picoLCD_init(Driver *drvthis)
 	int id;
 	int tmp;
 
-	p = (PrivateData *) malloc(sizeof(PrivateData));
+	p = (PrivateData *) calloc(1, sizeof(PrivateData));
 	if (p == NULL)
 		return -1;
 
@@ -271,23 +256,15 @@ picoLCD_init(Driver *drvthis)
 	p->device = NULL;
 
 #ifdef HAVE_LIBUSB_1_0
-#ifndef USE_LIBUSB_SINGLE_SELECT
-	/*
-	 * When using a single select statement libusb-1.0 should be
-	 * initialised once for all USB drivers so code equivalent to that
-	 * below should be somewhere common, before init_drivers() perhaps.
-	 */
-	error = libusb_init(&p->lib_ctx);
-	if (error) {
-		report(RPT_ERR, "%s: libusb_init error %d", drvthis->name, error);
+	p->out_queue = NULL;
+	p->key_wait_time = NULL;
+	for (i = 0; i < USB_BUFFERS; i++)
+		p->input_transfer[i].transfer = NULL;
+
+	/* The context and its event thread are shared by all USB drivers */
+	p->lib_ctx = usb_events_init();
+	if (p->lib_ctx == NULL)
 		return -1;
-	}
-#if LIBUSB_API_VERSION >= 0x01000106
-	libusb_set_option(p->lib_ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_WARNING);	// or LIBUSB_LOG_LEVEL_NONE
-#else
-	libusb_set_debug(p->lib_ctx, 3);
-#endif
-#endif
 
 	p->key_read_index = 0;
 	p->key_write_index = 0;
@@ -345,36 +322,9 @@ picoLCD_init(Driver *drvthis)
 		report(RPT_WARNING, "%s: libusb_set_interface_alt_setting error %d", drvthis->name, error);
 	}
 
-	/* Set-up USB input transfer data structures */
-	for (i = 0; i < USB_BUFFERS; i++)
-		p->input_transfer[i].transfer = NULL;
-	for (i = 0; i < USB_BUFFERS; i++)
-	{
-		UsbTransferData *utdp = &p->input_transfer[i];
-
-		utdp->drvthis = drvthis;
-		utdp->transfer = libusb_alloc_transfer(0);
-		if (utdp->transfer == NULL) {
-			report(RPT_ERR, "%s: libusb_alloc_transfer failed", drvthis->name);
-			free_usb_transfers(drvthis);
-			return -1;
-		}
-		libusb_fill_interrupt_transfer(utdp->transfer,
-				p->lcd,
-				LIBUSB_ENDPOINT_IN + 1,
-				utdp->buffer,
-				sizeof(utdp->buffer),
-				usb_cb_input,
-				(void *)utdp,
-				0);
-		utdp->status = libusb_submit_transfer(utdp->transfer);
-		if (utdp->status) {
-			report(RPT_ERR, "%s: libusb_submit_transfer error %d",
-					drvthis->name, utdp->status);
-			free_usb_transfers(drvthis);
-			return -1;
-		}
-	}
+	p->out_queue = usb_out_queue_new(p->lcd, USB_OUT_TRANSFERS, 64, USB_OUT_TIMEOUT);
+	if (p->out_queue == NULL)
+		return -1;
 
 #else				/* The libusb 0.1 way */
 
@@ -434,7 +384,7 @@ done:
 #endif	/* HAVE_LIBUSB_1_0 */
 
 	/* if the device has a init sequence send it to device */
-	picolcd_send(p->lcd, p->device->initseq, PICOLCD_MAX_DATA_LEN);
+	picolcd_send(drvthis, p->device->initseq, PICOLCD_MAX_DATA_LEN);
 
 	p->width = p->device->width;
 	p->height = p->device->height;
@@ -551,11 +501,12 @@ done:
 		picoLCD_backlight(drvthis, 0);
 
 	if (p->keylights)
-		set_key_lights(p->lcd, p->key_light, 1);
+		set_key_lights(drvthis, p->key_light, 1);
 	else
-		set_key_lights(p->lcd, p->key_light, 0);
+		set_key_lights(drvthis, p->key_light, 0);
 
 	picoLCD_set_contrast(drvthis, p->contrast);
+	picolcd_submit(drvthis);
 
 	/* setup LIRC */
 	lirchost = drvthis->config_get_string(drvthis->name, "LircHost", 0, NULL);
@@ -650,6 +601,43 @@ done:
 
 	}
 
+#ifdef HAVE_LIBUSB_1_0
+	/*
+	 * Set-up USB input transfer data structures. The USB event thread
+	 * starts calling usb_cb_input() as soon as they are submitted, so this
+	 * comes last, when the key and LIRC state it uses is set up.
+	 */
+	for (i = 0; i < USB_BUFFERS; i++)
+	{
+		UsbTransferData *utdp = &p->input_transfer[i];
+
+		utdp->drvthis = drvthis;
+		utdp->transfer = libusb_alloc_transfer(0);
+		if (utdp->transfer == NULL) {
+			report(RPT_ERR, "%s: libusb_alloc_transfer failed", drvthis->name);
+			free_usb_transfers(drvthis);
+			return -1;
+		}
+		libusb_fill_interrupt_transfer(utdp->transfer,
+				p->lcd,
+				LIBUSB_ENDPOINT_IN + 1,
+				utdp->buffer,
+				sizeof(utdp->buffer),
+				usb_cb_input,
+				(void *)utdp,
+				0);
+		usb_events_lock();
+		utdp->status = libusb_submit_transfer(utdp->transfer);
+		usb_events_unlock();
+		if (utdp->status) {
+			report(RPT_ERR, "%s: libusb_submit_transfer error %d",
+					drvthis->name, utdp->status);
+			free_usb_transfers(drvthis);
+			return -1;
+		}
+	}
+#endif
+
 	report(RPT_INFO, "%s: init complete", drvthis->name);
 
 	return 0;
@@ -668,31 +656,29 @@ picoLCD_close(Driver *drvthis)
 #ifdef HAVE_LIBUSB_1_0
 		int error;
 
-		free_usb_transfers(drvthis);
+		if (p->lcd != NULL) {
+			free_usb_transfers(drvthis);
 
-		error = libusb_release_interface(p->lcd, 0);
-		if (error) {
-			report(RPT_ERR, "%s: usb_release_interface error %d", drvthis->name, error);
-		}
+			/* Let the device finish queued output */
+			usb_out_queue_free(p->out_queue);
 
-		/* FIXME: Does it make sense to re-attach a kernel driver? */
-		error = libusb_attach_kernel_driver(p->lcd, 0);
-		if (error) {
-			report(RPT_ERR, "%s: libusb_attach_kernel_driver error %d", drvthis->name, error);
-		}
+			error = libusb_release_interface(p->lcd, 0);
+			if (error) {
+				report(RPT_ERR, "%s: usb_release_interface error %d", drvthis->name, error);
+			}
+
+			/* FIXME: Does it make sense to re-attach a kernel driver? */
+			error = libusb_attach_kernel_driver(p->lcd, 0);
+			if (error) {
+				report(RPT_ERR, "%s: libusb_attach_kernel_driver error %d", drvthis->name, error);
+			}
 
-		libusb_close(p->lcd);
+			libusb_close(p->lcd);
+		}
 		if (p->key_wait_time != NULL)
 			free(p->key_wait_time);
-#ifndef USE_LIBUSB_SINGLE_SELECT
-		/*
-		 * When using a single select statement the code below should
-		 * be called after closing all open devices and before the
-		 * application terminates this should be somewhere common,
-		 * after drivers_unload_all() perhaps.
-		 */
-		libusb_exit(p->lib_ctx);
-#endif
+		if (p->lib_ctx != NULL)
+			usb_events_exit();
 #else	/* The libusb 0.1 way */
 		usb_release_interface(p->lcd, 0);
 		usb_close(p->lcd);
@@ -779,7 +765,7 @@ picoLCD_flush(Driver *drvthis)
 		for (i = 0; i < p->width; i++) {
 			if (*fb++ != *lf++) {
 				strncpy((char *)text, (char *)p->framebuf + offset, p->width);
-				p->device->write(p->lcd, line, 0, text);
+				p->device->write(drvthis, line, 0, text);
 				memcpy(p->lstframe + offset, p->framebuf + offset, p->width);
 
 				debug(RPT_DEBUG, "%s: flush wrote line %d (%s)",
@@ -790,6 +776,9 @@ picoLCD_flush(Driver *drvthis)
 		}
 	}
 
+	/* Send the changed lines and characters in one go */
+	picolcd_submit(drvthis);
+
 	debug(RPT_DEBUG, "%s: flush complete\n\t(%s)\n\t(%s)",
 		drvthis->name, p->framebuf, p->lstframe);
 }
@@ -1307,30 +1296,28 @@ picoLCD_get_key(Driver *drvthis)
 	int low_key;
 	struct timeval current_time, delay_time;
 
-#ifndef USE_LIBUSB_SINGLE_SELECT
-	/*
-	 * When using a single select statement polling for libusb-1.0 events
-	 * needs to be integrated into the LCDd main loop. See:
-	 * http://libusb.sourceforge.net/api-1.0/group__poll.html#pollmain
-	 */
-	struct timeval timeout;
-	/*
-	 * FIXME: It is not efficient to call this at 32Hz, it is only needed
-	 * if a key has been pressed or IR data has been received.
-	 *
-	 * Process any outstanding USB events for our session.
-	 */
-	timeout.tv_sec = 0;
-	timeout.tv_usec = 0;
-	libusb_handle_events_timeout(p->lib_ctx, &timeout);
-#endif
+	int have_key;
 
 	/*
 	 * Read any key events from the buffer and report, do not wait for
 	 * key up events so that the main loop timing is not disrupted; thus
 	 * the behaviour is somewhat different from the previous version.
+	 * The buffer is filled by the USB event thread.
 	 */
-	if (p->key_read_index == p->key_write_index) {
+	usb_events_lock();
+	have_key = (p->key_read_index != p->key_write_index);
+	if (have_key) {
+		high_key = p->key_buffer[p->key_read_index].high_key;
+		low_key = p->key_buffer[p->key_read_index].low_key;
+
+		/* Advance read buffer, wrapping around if necessary */
+		p->key_read_index++;
+		if (KEY_BUFFER_SIZE <= p->key_read_index)
+			p->key_read_index = 0;
+	}
+	usb_events_unlock();
+
+	if (!have_key) {
 		/* No new key, check if it is time to repeat a key */
 		if (p->reported_keys.high_key && timerisset(p->key_wait_time)) {
 			gettimeofday(&current_time, NULL);
@@ -1354,16 +1341,8 @@ picoLCD_get_key(Driver *drvthis)
 		}
 	}
 	else {
-		/* Get new key data */
-		high_key = p->key_buffer[p->key_read_index].high_key;
-		low_key = p->key_buffer[p->key_read_index].low_key;
-		debug(RPT_DEBUG, "%s: got %d, %d from key_buffer %d",
-		      drvthis->name, high_key, low_key, p->key_read_index);
-
-		/* Advance read buffer, wrapping around if necessary */
-		p->key_read_index++;
-		if (KEY_BUFFER_SIZE <= p->key_read_index)
-			p->key_read_index = 0;
+		debug(RPT_DEBUG, "%s: got %d, %d from key_buffer",
+		      drvthis->name, high_key, low_key);
 
 		/* Store the reported keys for repeat */
 		p->reported_keys.high_key = high_key;
@@ -1529,7 +1508,8 @@ picoLCD_set_contrast(Driver *drvthis, int promille)
 		packet[1] = p->device->contrast_max;
 	}
 
-	picolcd_send(p->lcd, packet, 2);
+	picolcd_send(drvthis, packet, 2);
+	picolcd_submit(drvthis);
 }
 
 
@@ -1586,11 +1566,11 @@ picoLCD_backlight(Driver *drvthis, int state)
 		if (s > p->device->bklight_max)
 			s = p->device->bklight_max;
 		packet[1] = (unsigned char) s;
-		picolcd_send(p->lcd, packet, 2);
+		picolcd_send(drvthis, packet, 2);
 		if (p->linklights) {
 			/* Only enable key lights if enabled by user */
 			if (p->keylights)
-				set_key_lights(p->lcd, p->key_light, state);
+				set_key_lights(drvthis, p->key_light, state);
 		}
 	}
 	else if (state == BACKLIGHT_OFF) {
@@ -1598,12 +1578,13 @@ picoLCD_backlight(Driver *drvthis, int state)
 		if (s > p->device->bklight_min)
 			s = p->device->bklight_min;
 		packet[1] = (unsigned char) s;
-		picolcd_send(p->lcd, packet, 2);
+		picolcd_send(drvthis, packet, 2);
 		if (p->linklights) {
 			/* Always turn key lights off */
-			set_key_lights(p->lcd, p->key_light, state);
+			set_key_lights(drvthis, p->key_light, state);
 		}
 	}
+	picolcd_submit(drvthis);
 }
 
 
@@ -1622,7 +1603,8 @@ picoLCD_output(Driver *drvthis, int state)
 	for (x = 0, m = 1; x < KEYPAD_LIGHTS; x++, m <<= 1) {
 		p->key_light[x] = state & m;
 	}
-	set_key_lights(p->lcd, p->key_light, 1);
+	set_key_lights(drvthis, p->key_light, 1);
+	picolcd_submit(drvthis);
 }
 
 
@@ -1891,40 +1873,60 @@ picolcd_lircsend(Driver *drvthis)
 
 
 /**
- * Send raw data to the display using low level usb_interrupt_write.
- * \param lcd   pointer to device handle
- * \param data  pointer to data packet to send
- * \param size  number of bytes to send
+ * Send raw data to the display. With libusb-1.0 the data is queued as an
+ * asynchronous interrupt transfer and sent by picolcd_submit().
+ * \param drvthis  Pointer to driver structure
+ * \param data     pointer to data packet to send
+ * \param size     number of bytes to send
  */
 static void
-picolcd_send(USB_DEVICE_HANDLE * lcd, unsigned char *data, int size)
+picolcd_send(Driver *drvthis, unsigned char *data, int size)
 {
-	if ((lcd == NULL) && (data == NULL))
+	PrivateData *p = drvthis->private_data;
+
+	if ((p->lcd == NULL) || (data == NULL))
 		return;
 #ifdef HAVE_LIBUSB_1_0
-	int error = 0;
-	int transferred = 0;
-	unsigned int timeout = 1000;	/* milliseconds */
-	error = libusb_interrupt_transfer(lcd, LIBUSB_ENDPOINT_OUT + 1, data, size, &transferred, timeout);
-	if (error) {
-		report(RPT_WARNING, "libusb_interrupt_transfer error %d, sent %d of %d bytes\n",
-			error, transferred, size);
+	if (usb_out_queue_interrupt(p->out_queue, LIBUSB_ENDPOINT_OUT + 1, data, size) < 0) {
+		report(RPT_WARNING, "%s: cannot queue %d bytes for the display",
+			drvthis->name, size);
 	}
 #else
-	usb_interrupt_write(lcd, USB_ENDPOINT_OUT + 1, (char *)data, size, 1000);
+	usb_interrupt_write(p->lcd, USB_ENDPOINT_OUT + 1, (char *)data, size, 1000);
+#endif
+}
+
+
+/**
+ * Submit the data queued by picolcd_send() to the display. The transfers
+ * complete in the background; failures are reported by the next call.
+ * \param drvthis  Pointer to driver structure
+ */
+static void
+picolcd_submit(Driver *drvthis)
+{
+#ifdef HAVE_LIBUSB_1_0
+	PrivateData *p = drvthis->private_data;
+	int errors;
+
+	usb_out_queue_submit(p->out_queue);
+
+	errors = usb_out_queue_errors(p->out_queue);
+	if (errors > 0)
+		report(RPT_WARNING, "%s: %d USB output transfers failed", drvthis->name, errors);
 #endif
 }
 
 
 /**
  * Write function for 20x4 desktop displays.
- * \param lcd   pointer to device handle
+ * \param drvthis  Pointer to driver structure
  * \param row   Row to place the string at
  * \param col   ignored
  * \param data  pointer to NUL terminated string
  */
 static void
-picolcd_20x4_write(USB_DEVICE_HANDLE * lcd, const int row, const int col, const unsigned char *data)
+picolcd_20x4_write(Driver *drvthis, const int row, const int col, const unsigned char *data)
 {
 	unsigned char packet[64] = {0x95, 0x01, 0x00, 0x01};
 	unsigned char lineset[4][6] = {
@@ -1942,38 +1944,38 @@ picolcd_20x4_write(USB_DEVICE_HANDLE * lcd, const int row, const int col, const
 	/* Send command to select row */
 	switch (row) {
 	    case 0:
-		picolcd_send(lcd, lineset[0], 6);
+		picolcd_send(drvthis, lineset[0], 6);
 		break;
 	    case 1:
-		picolcd_send(lcd, lineset[1], 6);
+		picolcd_send(drvthis, lineset[1], 6);
 		break;
 	    case 2:
-		picolcd_send(lcd, lineset[2], 6);
+		picolcd_send(drvthis, lineset[2], 6);
 		break;
 	    case 3:
-		picolcd_send(lcd, lineset[3], 6);
+		picolcd_send(drvthis, lineset[3], 6);
 		break;
 	    default:
-		picolcd_send(lcd, lineset[0], 6);
+		picolcd_send(drvthis, lineset[0], 6);
 		break;
 	}
 
 	/* Fill in an send packet */
 	packet[4] = len;
 	memcpy(packet + 5, data, len);
-	picolcd_send(lcd, packet, 5 + len);
+	picolcd_send(drvthis, packet, 5 + len);
 }
 
 
 /**
  * Write function for 20x2 OEM displays.
- * \param lcd   pointer to device handle
+ * \param drvthis  Pointer to driver structure
  * \param row   Row to place the string at
  * \param col   Column to place the string at
  * \param data  pointer to NUL terminated string
  */
 static void
-picolcd_20x2_write(USB_DEVICE_HANDLE * lcd, const int row, const int col, const unsigned char *data)
+picolcd_20x2_write(Driver *drvthis, const int row, const int col, const unsigned char *data)
 {
 	unsigned char packet[64] = {0x98};
 	int len = strlen((char *)data);
@@ -1992,7 +1994,7 @@ picolcd_20x2_write(USB_DEVICE_HANDLE * lcd, const int row, const int col, const
 
 	memcpy(packet + 4, data, len);
 
-	picolcd_send(lcd, packet, 4 + len);
+	picolcd_send(drvthis, packet, 4 + len);
 }
 
 
@@ -2021,7 +2023,7 @@ picolcd_20x2_set_char(Driver *drvthis, int n, unsigned char *dat)
 		packet[row + 2] = dat[row] & mask;
 	}
 
-	picolcd_send(p->lcd, packet, 10);
+	picolcd_send(drvthis, packet, 10);
 }
 
 
@@ -2034,8 +2036,6 @@ picolcd_20x2_set_char(Driver *drvthis, int n, unsigned char *dat)
 static void
 picolcd_20x4_set_char(Driver *drvthis, int n, unsigned char *dat)
 {
-	PrivateData *p = drvthis->private_data;
-
 	if ((n < 0) || (n >= NUM_CCs))
 		return;
 	if (dat == NULL)
@@ -2050,8 +2050,8 @@ picolcd_20x4_set_char(Driver *drvthis, int n, unsigned char *dat)
 		dat[4], dat[5], dat[6], dat[7]
 	};			/* 0x95 */
 
-	picolcd_send(p->lcd, command, 6);
-	picolcd_send(p->lcd, data, 13);
+	picolcd_send(drvthis, command, 6);
+	picolcd_send(drvthis, data, 13);
 }
 
 #ifndef HAVE_LIBUSB_1_0
@@ -2090,13 +2090,13 @@ get_key_event(usb_dev_handle * lcd, lcd_packet * packet, int timeout)
 
 /**
  * Set lights for individual keys.
- * \param lcd    Pointer to device handle
+ * \param drvthis  Pointer to driver structure
  * \param keys   Array indicating which key number to turn on
  * \param state  0 to turn all LEDs off, 1 to turn them on according to
  *               values set in 'keys' array
  */
 static void
-set_key_lights(USB_DEVICE_HANDLE * lcd, int keys[], int state)
+set_key_lights(Driver *drvthis, int keys[], int state)
 {
 	unsigned char packet[2] = {0x81};	/* set led */
 	unsigned int leds = 0;
@@ -2116,7 +2116,7 @@ set_key_lights(USB_DEVICE_HANDLE * lcd, int keys[], int state)
 	}
 
 	packet[1] = leds;
-	picolcd_send(lcd, packet, 2);
+	picolcd_send(drvthis, packet, 2);
 }
 
 
@@ -2132,22 +2132,20 @@ free_usb_transfers(Driver *drvthis)
 	PrivateData *p = drvthis->private_data;
 	int i;
 
+	usb_events_lock();
 	for (i = 0; i < USB_BUFFERS; i++) {
 		if (p->input_transfer[i].transfer != NULL) {
 			if (p->input_transfer[i].status == LIBUSB_SUCCESS) {
 				/* Need to cancel transfer before it is freed */
 				libusb_cancel_transfer(p->input_transfer[i].transfer);
-				while (p->input_transfer[i].status != LIBUSB_TRANSFER_CANCELLED) {
-					struct timeval timeout;
-					/*
-					 * Wait for the cancellation to complete, the
-					 * call-back will then have freed the
-					 * transfer.
-					 */
+				/*
+				 * Wait for the event thread to complete the
+				 * cancellation, the call-back will then have
+				 * freed the transfer.
+				 */
+				while (p->input_transfer[i].transfer != NULL) {
 					report(RPT_INFO, "%s: waiting for usb transfer %d to be cancelled", drvthis->name, i);
-					timeout.tv_sec = 1;
-					timeout.tv_usec = 0;
-					libusb_handle_events_timeout(p->lib_ctx, &timeout);
+					usb_events_wait(1000);
 				}
 			}
 			else {
@@ -2156,11 +2154,13 @@ free_usb_transfers(Driver *drvthis)
 			}
 		}
 	}
+	usb_events_unlock();
 }
 
 /**
  * Store key press and release events in a buffer ready for the get key function.
- * If the buffer is full key codes are discarded.
+ * If the buffer is full key codes are discarded. Must be called with
+ * usb_events_lock() held.
  *
  * \param drvthis   Pointer to driver structure
  * \param high_key  Highest numbered key pressed
@@ -2189,8 +2189,9 @@ key_buffer_put(Driver *drvthis, unsigned char high_key, unsigned char low_key)
 }
 
 /**
- * Call-back for USB input. Either calls key_buffer_put to process key events
- * or ir_trancode to process events from IR receiver.
+ * Call-back for USB input, run by the USB event thread. Either calls
+ * key_buffer_put to process key events or ir_trancode to process events
+ * from IR receiver.
  *
  * \param transfer  Structure containing the USB data
  */
@@ -2206,17 +2207,22 @@ usb_cb_input(struct libusb_transfer *transfer)
 	PrivateData *p_data = drvthis->private_data;
 
 	if (transfer->status != LIBUSB_TRANSFER_COMPLETED) {
-		report(RPT_ERR, "%s: input transfer status: %s", drvthis->name, status[transfer->status]);
+		if (transfer->status != LIBUSB_TRANSFER_CANCELLED)
+			report(RPT_ERR, "%s: input transfer status: %s", drvthis->name, status[transfer->status]);
+		usb_events_lock();
 		p->status = transfer->status;
 		libusb_free_transfer(transfer);
 		p->transfer = NULL;
+		usb_events_unlock();
 		return;
 	}
 
 	switch (transfer->buffer[0]) {
 	    case IN_REPORT_KEY_STATE:
 		debug(RPT_DEBUG, "%s: USB input call-back key", drvthis->name);
+		usb_events_lock();
 		key_buffer_put(drvthis, transfer->buffer[1], transfer->buffer[2]);
+		usb_events_unlock();
 		break;
 	    case IN_REPORT_IR_DATA:
 		debug(RPT_DEBUG, "%s: USB input call-back IR length %i", drvthis->name, transfer->buffer[1]);
@@ -2229,7 +2235,9 @@ usb_cb_input(struct libusb_transfer *transfer)
 	}
 
 	/* Re-transmit the input request transfer */
+	usb_events_lock();
 	p->status = libusb_submit_transfer(transfer);
+	usb_events_unlock();
 	if (p->status != LIBUSB_SUCCESS)
 		report(RPT_ERR, "%s: input transfer submit status %d", drvthis->name, p->status);
 }
@@ -68,7 +68,7 @@ typedef struct _picolcd_device {
 	int width;                  /* width of lcd screen */
 	int height;                 /* height of lcd screen */
 	/* Pointer to function that writes data to the LCD format */
-	void (*write) (USB_DEVICE_HANDLE *lcd, const int row, const int col, const unsigned char *data);
+	void (*write) (Driver *drvthis, const int row, const int col, const unsigned char *data);
 	/* Pointer to function that defines a custom character */
 	void (*cchar) (Driver *drvthis, int n, unsigned char *dat);
 } picolcd_device;
@@ -0,0 +1,490 @@
+/** \file server/drivers/usb_events.c
+ * Shared libusb-1.0 event handling for USB drivers.
+ *
+ * All drivers of a module use one libusb context. A thread handles its
+ * events continuously, so input transfers are serviced as soon as they
+ * complete and not only when LCDd polls for keys. Completion callbacks run
+ * on that thread; data they share with the driver is protected by
+ * usb_events_lock().
+ *
+ * Output is collected in a UsbOutQueue while a frame is flushed and then
+ * submitted as asynchronous transfers in one go. The device works through
+ * them in order while LCDd continues; a queue only blocks when all of its
+ * transfers are still in flight.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_LIBUSB_1_0
+
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "usb_events.h"
+#include "shared/report.h"
+
+/** Longest time in milliseconds the event thread waits for events */
+#define USB_EVENTS_INTERVAL	100
+
+/** One output transfer of a queue */
+typedef struct {
+	struct libusb_transfer *transfer;
+	unsigned char *buffer;	/**< Data, preceded by the setup packet for control transfers */
+	UsbOutQueue *queue;
+} UsbOutSlot;
+
+/** Queue of output transfers to one device */
+struct usb_out_queue {
+	libusb_device_handle *handle;
+	unsigned int timeout;	/**< Timeout of each transfer in milliseconds */
+	int size;		/**< Maximum data length of a transfer */
+	int count;		/**< Number of transfers */
+	UsbOutSlot *slots;
+	UsbOutSlot **free_slots;	/**< Stack of transfers not in use */
+	int num_free;
+	UsbOutSlot **staged;	/**< Transfers filled but not yet submitted, in order */
+	int num_staged;
+	int in_flight;		/**< Transfers submitted and not completed */
+	int errors;		/**< Transfers failed since last asked */
+};
+
+static pthread_mutex_t usb_events_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t usb_events_cond = PTHREAD_COND_INITIALIZER;
+static libusb_context *usb_ctx = NULL;
+static int usb_users = 0;
+static int usb_running = 0;
+static pthread_t usb_thread;
+
+
+/**
+ * Handle libusb events until usb_events_exit() stops the thread. Waiting
+ * threads are woken after each round.
+ * \param arg  Unused.
+ * \return     NULL.
+ */
+static void *
+usb_events_thread(void *arg)
+{
+	int running = 1;
+
+	while (running) {
+		struct timeval tv;
+
+		tv.tv_sec = 0;
+		tv.tv_usec = USB_EVENTS_INTERVAL * 1000;
+		libusb_handle_events_timeout_completed(usb_ctx, &tv, NULL);
+
+		pthread_mutex_lock(&usb_events_mutex);
+		pthread_cond_broadcast(&usb_events_cond);
+		running = usb_running;
+		pthread_mutex_unlock(&usb_events_mutex);
+	}
+	return NULL;
+}
+
+
+/**
+ * Start using the shared libusb context. The first call creates the context
+ * and starts the event thread.
+ * \return  The context, or NULL on error.
+ */
+libusb_context *
+usb_events_init(void)
+{
+	libusb_context *ctx = NULL;
+	int error;
+
+	pthread_mutex_lock(&usb_events_mutex);
+	if (usb_users == 0) {
+		error = libusb_init(&usb_ctx);
+		if (error) {
+			report(RPT_ERR, "%s: libusb_init error %d", __FUNCTION__, error);
+			usb_ctx = NULL;
+			goto out;
+		}
+#if LIBUSB_API_VERSION >= 0x01000106
+		libusb_set_option(usb_ctx, LIBUSB_OPTION_LOG_LEVEL, LIBUSB_LOG_LEVEL_WARNING);
+#else
+		libusb_set_debug(usb_ctx, 3);
+#endif
+		usb_running = 1;
+		if (pthread_create(&usb_thread, NULL, usb_events_thread, NULL) != 0) {
+			report(RPT_ERR, "%s: Could not start the USB event thread", __FUNCTION__);
+			usb_running = 0;
+			libusb_exit(usb_ctx);
+			usb_ctx = NULL;
+			goto out;
+		}
+	}
+	usb_users++;
+	ctx = usb_ctx;
+out:
+	pthread_mutex_unlock(&usb_events_mutex);
+	return ctx;
+}
+
+
+/**
+ * Stop using the shared libusb context. The last call stops the event
+ * thread and closes the context; all devices must be closed before.
+ */
+void
+usb_events_exit(void)
+{
+	pthread_mutex_lock(&usb_events_mutex);
+	if (usb_users == 0 || --usb_users > 0) {
+		pthread_mutex_unlock(&usb_events_mutex);
+		return;
+	}
+	usb_running = 0;
+	pthread_mutex_unlock(&usb_events_mutex);
+
+#if LIBUSB_API_VERSION >= 0x01000105
+	libusb_interrupt_event_handler(usb_ctx);
+#endif
+	pthread_join(usb_thread, NULL);
+	libusb_exit(usb_ctx);
+	usb_ctx = NULL;
+}
+
+
+/**
+ * Lock the data shared with completion callbacks.
+ */
+void
+usb_events_lock(void)
+{
+	pthread_mutex_lock(&usb_events_mutex);
+}
+
+
+/**
+ * Unlock the data shared with completion callbacks.
+ */
+void
+usb_events_unlock(void)
+{
+	pthread_mutex_unlock(&usb_events_mutex);
+}
+
+
+/**
+ * Wait until the event thread has handled events. The lock must be held;
+ * it is released while waiting.
+ * \param timeout  Longest time to wait in milliseconds.
+ * \retval 0          Events were handled.
+ * \retval ETIMEDOUT  The timeout expired.
+ */
+int
+usb_events_wait(int timeout)
+{
+	struct timespec deadline;
+
+	clock_gettime(CLOCK_REALTIME, &deadline);
+	deadline.tv_sec += timeout / 1000;
+	deadline.tv_nsec += (timeout % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec++;
+		deadline.tv_nsec -= 1000000000L;
+	}
+	return pthread_cond_timedwait(&usb_events_cond, &usb_events_mutex, &deadline);
+}
+
+
+/**
+ * Completion callback of output transfers; runs on the event thread.
+ * \param transfer  The completed transfer.
+ */
+static void LIBUSB_CALL
+usb_out_cb(struct libusb_transfer *transfer)
+{
+	UsbOutSlot *slot = (UsbOutSlot *) transfer->user_data;
+	UsbOutQueue *q = slot->queue;
+
+	pthread_mutex_lock(&usb_events_mutex);
+	if (transfer->status != LIBUSB_TRANSFER_COMPLETED)
+		q->errors++;
+	q->free_slots[q->num_free++] = slot;
+	q->in_flight--;
+	pthread_cond_broadcast(&usb_events_cond);
+	pthread_mutex_unlock(&usb_events_mutex);
+}
+
+
+/**
+ * Create a queue of output transfers.
+ * \param handle     Device the transfers go to.
+ * \param transfers  Number of transfers that can be queued or in flight.
+ * \param size       Maximum data length of one transfer.
+ * \param timeout    Timeout of each transfer in milliseconds.
+ * \return  The new queue, or NULL on error.
+ */
+UsbOutQueue *
+usb_out_queue_new(libusb_device_handle *handle, int transfers, int size, unsigned int timeout)
+{
+	UsbOutQueue *q;
+	int i;
+
+	q = calloc(1, sizeof(UsbOutQueue));
+	if (q == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
+	q->handle = handle;
+	q->timeout = timeout;
+	q->size = size;
+	q->slots = calloc(transfers, sizeof(UsbOutSlot));
+	q->free_slots = calloc(transfers, sizeof(UsbOutSlot *));
+	q->staged = calloc(transfers, sizeof(UsbOutSlot *));
+	if (q->slots == NULL || q->free_slots == NULL || q->staged == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		usb_out_queue_free(q);
+		return NULL;
+	}
+
+	for (i = 0; i < transfers; i++) {
+		UsbOutSlot *slot = &q->slots[i];
+
+		slot->queue = q;
+		slot->transfer = libusb_alloc_transfer(0);
+		slot->buffer = malloc(LIBUSB_CONTROL_SETUP_SIZE + size);
+		q->count++;
+		if (slot->transfer == NULL || slot->buffer == NULL) {
+			report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+			usb_out_queue_free(q);
+			return NULL;
+		}
+		q->free_slots[q->num_free++] = slot;
+	}
+
+	return q;
+}
+
+
+/**
+ * Submit the staged transfers in order. Must be called with the lock held.
+ * \param q  The queue.
+ */
+static void
+usb_out_queue_submit_locked(UsbOutQueue *q)
+{
+	int i, error;
+
+	for (i = 0; i < q->num_staged; i++) {
+		UsbOutSlot *slot = q->staged[i];
+
+		error = libusb_submit_transfer(slot->transfer);
+		if (error) {
+			report(RPT_DEBUG, "%s: libusb_submit_transfer error %d", __FUNCTION__, error);
+			q->errors++;
+			q->free_slots[q->num_free++] = slot;
+		}
+		else
+			q->in_flight++;
+	}
+	q->num_staged = 0;
+}
+
+
+/**
+ * Get a transfer to fill, waiting for one to complete if all are in use.
+ * Must be called with the lock held.
+ * \param q  The queue.
+ * \return   The transfer, or NULL if none became available in time.
+ */
+static UsbOutSlot *
+usb_out_queue_get_slot(UsbOutQueue *q)
+{
+	while (q->num_free == 0) {
+		if (q->num_staged > 0)
+			usb_out_queue_submit_locked(q);
+		if (q->num_free > 0)
+			break;
+		if (usb_events_wait(q->timeout + USB_EVENTS_INTERVAL) == ETIMEDOUT) {
+			q->errors++;
+			return NULL;
+		}
+	}
+	return q->free_slots[--q->num_free];
+}
+
+
+/**
+ * Queue an interrupt transfer.
+ * \param q         The queue.
+ * \param endpoint  Endpoint address, including the direction bit.
+ * \param data      Data to send.
+ * \param len       Length of the data.
+ * \retval 0   Success.
+ * \retval -1  Error; the data is too long or no transfer became available.
+ */
+int
+usb_out_queue_interrupt(UsbOutQueue *q, unsigned char endpoint,
+			const unsigned char *data, int len)
+{
+	UsbOutSlot *slot;
+
+	if (len > q->size)
+		return -1;
+
+	pthread_mutex_lock(&usb_events_mutex);
+	slot = usb_out_queue_get_slot(q);
+	if (slot != NULL) {
+		memcpy(slot->buffer, data, len);
+		libusb_fill_interrupt_transfer(slot->transfer, q->handle, endpoint,
+					       slot->buffer, len, usb_out_cb, slot, q->timeout);
+		q->staged[q->num_staged++] = slot;
+	}
+	pthread_mutex_unlock(&usb_events_mutex);
+
+	return (slot != NULL) ? 0 : -1;
+}
+
+
+/**
+ * Queue a control transfer to the host-to-device direction.
+ * \param q             The queue.
+ * \param request_type  bmRequestType of the setup packet.
+ * \param request       bRequest of the setup packet.
+ * \param value         wValue of the setup packet.
+ * \param index         wIndex of the setup packet.
+ * \param data          Data to send (may be NULL if len is 0).
+ * \param len           Length of the data.
+ * \retval 0   Success.
+ * \retval -1  Error; the data is too long or no transfer became available.
+ */
+int
+usb_out_queue_control(UsbOutQueue *q, uint8_t request_type, uint8_t request,
+		      uint16_t value, uint16_t index,
+		      const unsigned char *data, int len)
+{
+	UsbOutSlot *slot;
+
+	if (len > q->size)
+		return -1;
+
+	pthread_mutex_lock(&usb_events_mutex);
+	slot = usb_out_queue_get_slot(q);
+	if (slot != NULL) {
+		libusb_fill_control_setup(slot->buffer, request_type, request, value, index, len);
+		if (len > 0)
+			memcpy(slot->buffer + LIBUSB_CONTROL_SETUP_SIZE, data, len);
+		libusb_fill_control_transfer(slot->transfer, q->handle, slot->buffer,
+					     usb_out_cb, slot, q->timeout);
+		q->staged[q->num_staged++] = slot;
+	}
+	pthread_mutex_unlock(&usb_events_mutex);
+
+	return (slot != NULL) ? 0 : -1;
+}
+
+
+/**
+ * Submit the queued transfers. They complete in the background.
+ * \param q  The queue.
+ */
+void
+usb_out_queue_submit(UsbOutQueue *q)
+{
+	pthread_mutex_lock(&usb_events_mutex);
+	usb_out_queue_submit_locked(q);
+	pthread_mutex_unlock(&usb_events_mutex);
+}
+
+
+/**
+ * Submit the queued transfers and wait until all transfers have completed
+ * or one of them timed out.
+ * \param q  The queue.
+ */
+void
+usb_out_queue_drain(UsbOutQueue *q)
+{
+	pthread_mutex_lock(&usb_events_mutex);
+	usb_out_queue_submit_locked(q);
+	while (q->in_flight > 0) {
+		if (usb_events_wait(q->timeout + USB_EVENTS_INTERVAL) == ETIMEDOUT)
+			break;
+	}
+	pthread_mutex_unlock(&usb_events_mutex);
+}
+
+
+/**
+ * Get the number of transfers that failed since the last call.
+ * \param q  The queue.
+ * \return   Number of failed transfers.
+ */
+int
+usb_out_queue_errors(UsbOutQueue *q)
+{
+	int errors;
+
+	pthread_mutex_lock(&usb_events_mutex);
+	errors = q->errors;
+	q->errors = 0;
+	pthread_mutex_unlock(&usb_events_mutex);
+
+	return errors;
+}
+
+
+/**
+ * Send the queued transfers, wait for them and free the queue.
+ * \param q  The queue.
+ */
+void
+usb_out_queue_free(UsbOutQueue *q)
+{
+	int i;
+
+	if (q == NULL)
+		return;
+
+	if (q->slots != NULL && q->free_slots != NULL && q->staged != NULL) {
+		usb_out_queue_drain(q);
+
+		pthread_mutex_lock(&usb_events_mutex);
+		if (q->in_flight > 0) {
+			/* Cancel what is left; the callbacks still run */
+			for (i = 0; i < q->count; i++)
+				libusb_cancel_transfer(q->slots[i].transfer);
+			while (q->in_flight > 0) {
+				if (usb_events_wait(q->timeout + USB_EVENTS_INTERVAL) == ETIMEDOUT)
+					break;
+			}
+		}
+		pthread_mutex_unlock(&usb_events_mutex);
+		if (q->in_flight > 0) {
+			/* Better leak the transfers than free them under libusb */
+			report(RPT_WARNING, "%s: %d USB transfers did not complete",
+				__FUNCTION__, q->in_flight);
+			return;
+		}
+	}
+
+	if (q->slots != NULL) {
+		for (i = 0; i < q->count; i++) {
+			if (q->slots[i].transfer != NULL)
+				libusb_free_transfer(q->slots[i].transfer);
+			free(q->slots[i].buffer);
+		}
+		free(q->slots);
+	}
+	free(q->free_slots);
+	free(q->staged);
+	free(q);
+}
+
+#endif /* HAVE_LIBUSB_1_0 */
@@ -0,0 +1,53 @@
+/** \file server/drivers/usb_events.h
+ * Shared libusb-1.0 event handling for USB drivers: an event thread servicing
+ * all asynchronous transfers, and queues of output transfers submitted once
+ * per flush.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifndef USB_EVENTS_H
+#define USB_EVENTS_H
+
+#include <libusb.h>
+
+/** Number of output transfers a queue uses by default */
+#define USB_OUT_TRANSFERS	32
+
+/* Start using the shared context; the first user starts the event thread */
+libusb_context *usb_events_init(void);
+/* Stop using the shared context; the last user stops the event thread */
+void usb_events_exit(void);
+
+/* Serialize access to data shared with completion callbacks, which run on
+ * the event thread */
+void usb_events_lock(void);
+void usb_events_unlock(void);
+/* Wait with the lock held until the event thread handled events */
+int usb_events_wait(int timeout);
+
+/** Queue of output transfers to one device */
+typedef struct usb_out_queue UsbOutQueue;
+
+UsbOutQueue *usb_out_queue_new(libusb_device_handle *handle, int transfers, int size, unsigned int timeout);
+void usb_out_queue_free(UsbOutQueue *q);
+
+/* Queue transfers; they are sent in order by the next submit */
+int usb_out_queue_interrupt(UsbOutQueue *q, unsigned char endpoint,
+			    const unsigned char *data, int len);
+int usb_out_queue_control(UsbOutQueue *q, uint8_t request_type, uint8_t request,
+			  uint16_t value, uint16_t index,
+			  const unsigned char *data, int len);
+
+/* Submit the queued transfers without waiting for them */
+void usb_out_queue_submit(UsbOutQueue *q);
+/* Submit the queued transfers and wait until all have completed */
+void usb_out_queue_drain(UsbOutQueue *q);
+/* Number of transfers that failed since the last call */
+int usb_out_queue_errors(UsbOutQueue *q);
+
+#endif
@@ -30,9 +30,10 @@
 #include "menuscreens.h"
 #include "input.h"
 #include "render.h" /* For server_msg* */
+#include "stats.h"
 
 
-LinkedList *keylist;
+static LL_list keylist;
 char *toggle_rotate_key;
 char *prev_screen_key;
 char *next_screen_key;
@@ -42,45 +43,77 @@ char *scroll_down_key;
 /* Local functions */
 int server_input(int key);
 void input_internal_key(const char *key);
+static void input_read_keys(void);
+static void input_free_keys(void);
+static void input_free_reservation(KeyReservation *kr);
 
 
 int input_init(void)
 {
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
-	keylist = LL_new();
+	LL_ListInit(&keylist);
 
+	input_read_keys();
+
+	return 0;
+}
+
+
+void input_reload(void)
+{
+	debug(RPT_DEBUG, "%s()", __FUNCTION__);
+
+	input_free_keys();
+	input_read_keys();
+}
+
+
+static void input_read_keys(void)
+{
 	/* Get rotate/scroll keys from config file */
 	toggle_rotate_key = strdup(config_get_string("server", "ToggleRotateKey", 0, "Enter"));
 	prev_screen_key = strdup(config_get_string("server", "PrevScreenKey", 0, "Left"));
 	next_screen_key = strdup(config_get_string("server", "NextScreenKey", 0, "Right"));
 	scroll_up_key = strdup(config_get_string("server", "ScrollUpKey", 0, "Up"));
 	scroll_down_key = strdup(config_get_string("server", "ScrollDownKey", 0, "Down"));
+}
 
-	return 0;
+
+static void input_free_keys(void)
+{
+	free(toggle_rotate_key);
+	free(prev_screen_key);
+	free(next_screen_key);
+	free(scroll_up_key);
+	free(scroll_down_key);
 }
 
 
 void input_shutdown()
 {
-	if (!keylist) {
+	LL_link *l, *tmp;
+
+	if (keylist.anchor.next == NULL) {
 		/* Program shutdown before completed startup */
 		return;
 	}
 
-	free(keylist);
+	LL_FOREACH_SAFE(&keylist, l, tmp) {
+		KeyReservation *kr = LL_ENTRY(l, KeyReservation, link);
 
-	free(toggle_rotate_key);
-	free(prev_screen_key);
-	free(next_screen_key);
-	free(scroll_up_key);
-	free(scroll_down_key);
+		LL_ListRemove(&keylist, l);
+		input_free_reservation(kr);
+	}
+
+	input_free_keys();
 }
 
 
-void handle_input(void)
+int handle_input(void)
 {
 	const char *key;
+	int keys = 0;
 	Screen *current_screen;
 	Client *current_client;
 	KeyReservation *kr;
@@ -95,6 +128,8 @@ void handle_input(void)
 
 	/* Handle all keypresses */
 	while ((key = drivers_get_key()) != NULL) {
+		stats_key_read();
+		keys++;
 
 		/* keys from key_add have highest priority */
 		if (current_screen && screen_find_key(current_screen, key)) {
@@ -114,6 +149,7 @@ void handle_input(void)
 			input_internal_key(key);
 		}
 	}
+	return keys;
 }
 
 
@@ -148,9 +184,19 @@ input_internal_key(const char *key)
 	}
 }
 
+static void input_free_reservation(KeyReservation *kr)
+{
+	Arena *arena = (kr->client != NULL) ? kr->client->arena : NULL;
+
+	arena_free(arena, kr->key);
+	arena_free(arena, kr);
+}
+
 int input_reserve_key(const char *key, bool exclusive, Client *client)
 {
+	Arena *arena = (client != NULL) ? client->arena : NULL;
 	KeyReservation *kr;
+	LL_link *l;
 
 	debug(RPT_DEBUG, "%s(key=\"%.40s\", exclusive=%d, client=[%d])",
 		__FUNCTION__, key, exclusive, (client?client->sock:-1));
@@ -158,7 +204,8 @@ int input_reserve_key(const char *key, bool exclusive, Client *client)
 	/* Find out if this key is already reserved in a way that interferes
 	 * with the new reservation.
 	 */
-	for (kr = LL_GetFirst(keylist); kr != NULL; kr = LL_GetNext(keylist)) {
+	LL_FOREACH(&keylist, l) {
+		kr = LL_ENTRY(l, KeyReservation, link);
 		if (strcmp(kr->key, key) == 0) {
 			if (kr->exclusive || exclusive) {
 				/* Sorry ! */
@@ -168,11 +215,20 @@ int input_reserve_key(const char *key, bool exclusive, Client *client)
 	}
 
 	/* We can now safely add it ! */
-	kr = malloc(sizeof(KeyReservation));
-	kr->key = strdup(key);
+	kr = arena_calloc(arena, sizeof(KeyReservation));
+	if (kr == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return -1;
+	}
+	kr->key = arena_strdup(arena, key);
+	if (kr->key == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		arena_free(arena, kr);
+		return -1;
+	}
 	kr->exclusive = exclusive;
 	kr->client = client;
-	LL_Push(keylist, kr);
+	LL_ListAppend(&keylist, &kr->link);
 
 	report(RPT_INFO, "Key \"%.40s\" is now reserved %s by client [%d]",
 		key, (exclusive ? "exclusively" : "shared"), (client ? client->sock : -1));
@@ -183,16 +239,17 @@ int input_reserve_key(const char *key, bool exclusive, Client *client)
 void input_release_key(const char *key, Client *client)
 {
 	KeyReservation *kr;
+	LL_link *l;
 
 	debug(RPT_DEBUG, "%s(key=\"%.40s\", client=[%d])", __FUNCTION__, key, (client ? client->sock : -1));
 
-	for (kr = LL_GetFirst(keylist); kr != NULL; kr = LL_GetNext(keylist)) {
+	LL_FOREACH(&keylist, l) {
+		kr = LL_ENTRY(l, KeyReservation, link);
 		if ((kr->client == client) && (strcmp(kr->key, key) == 0)) {
 			report(RPT_INFO, "Key \"%.40s\" reserved %s by client [%d] and is now released",
 				key, (kr->exclusive ? "exclusively" : "shared"), (client ? client->sock : -1));
-			free(kr->key);
-			free(kr);
-			LL_DeleteNode(keylist, NEXT);
+			LL_ListRemove(&keylist, l);
+			input_free_reservation(kr);
 			return;
 		}
 	}
@@ -200,18 +257,18 @@ void input_release_key(const char *key, Client *client)
 
 void input_release_client_keys(Client *client)
 {
-	KeyReservation *kr;
+	LL_link *l, *tmp;
 
 	debug(RPT_DEBUG, "%s(client=[%d])", __FUNCTION__, (client ? client->sock : -1));
 
-	for (kr = LL_GetFirst(keylist); kr != NULL; kr = LL_GetNext(keylist)) {
+	LL_FOREACH_SAFE(&keylist, l, tmp) {
+		KeyReservation *kr = LL_ENTRY(l, KeyReservation, link);
+
 		if (kr->client == client) {
 			report(RPT_INFO, "Key \"%.40s\" reserved %s by client [%d] and is now released",
 				kr->key, (kr->exclusive ? "exclusively" : "shared"), (client ? client->sock : -1));
-			free(kr->key);
-			free(kr);
-			// jump to node before deleted one to not miss any
-			LL_DeleteNode(keylist, PREV);
+			LL_ListRemove(&keylist, l);
+			input_free_reservation(kr);
 		}
 	}
 }
@@ -219,10 +276,12 @@ void input_release_client_keys(Client *client)
 KeyReservation *input_find_key(const char *key, Client *client)
 {
 	KeyReservation *kr;
+	LL_link *l;
 
 	debug(RPT_DEBUG, "%s(key=\"%.40s\", client=[%d])", __FUNCTION__, key, (client?client->sock:-1));
 
-	for (kr = LL_GetFirst(keylist); kr != NULL; kr = LL_GetNext(keylist)) {
+	LL_FOREACH(&keylist, l) {
+		kr = LL_ENTRY(l, KeyReservation, link);
 		if (strcmp(kr->key, key) == 0) {
 			if (kr->exclusive || client == kr->client) {
 				return kr;
@@ -20,14 +20,17 @@
 # include <stdbool.h>
 #endif
 #include "shared/defines.h"
+#include "shared/LL.h"
 
-/* Accepts and uses keypad input while displaying screens... */
-void handle_input(void);
+/* Accepts and uses keypad input while displaying screens...
+ * Returns the number of keys handled. */
+int handle_input(void);
 
 typedef struct KeyReservation {
 	char *key;
 	bool exclusive;
 	Client *client;		/* NULL for internal clients */
+	LL_link link;		/* In the list of reservations */
 } KeyReservation;
 
 
@@ -37,6 +40,9 @@ int input_init(void);
 void input_shutdown(void);
 	/* Shut it down */
 
+void input_reload(void);
+	/* Re-read the server's keys from the config */
+
 int input_reserve_key(const char *key, bool exclusive, Client *client);
 	/* Reserves a key for a client */
 	/* Return -1 if reservation of key is not possible */
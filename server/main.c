@@ -64,6 +64,7 @@
 #include "serverscreens.h"
 #include "menuscreens.h"
 #include "input.h"
+#include "stats.h"
 #include "shared/configfile.h"
 #include "drivers.h"
 #include "main.h"
@@ -80,11 +81,15 @@
 #define DEFAULT_DRIVER_PATH		""	/* not needed */
 #define MAX_DRIVERS			8
 #define DEFAULT_FOREGROUND_MODE		0
+#define DEFAULT_PARALLEL_INIT		0
+#define DEFAULT_DRIVER_INIT_TIMEOUT	10
 #define DEFAULT_ROTATE_SERVER_SCREEN	SERVERSCREEN_ON
 #define DEFAULT_REPORTDEST		RPT_DEST_STDERR
 #define DEFAULT_REPORTLEVEL		RPT_WARNING
 
 #define DEFAULT_FRAME_INTERVAL		125000
+#define DEFAULT_MAX_FRAME_RATE		32
+#define DEFAULT_IDLE_FRAME_RATE		2
 #define DEFAULT_SCREEN_DURATION		32
 #define DEFAULT_BACKLIGHT		BACKLIGHT_OPEN
 #define DEFAULT_HEARTBEAT		HEARTBEAT_OPEN
@@ -123,6 +128,8 @@ char configfile[256];	/* a lot of space in the executable. */
 char user[64];		/* The values will be overwritten anyway... */
 
 int frame_interval = DEFAULT_FRAME_INTERVAL;
+static int max_frame_rate = DEFAULT_MAX_FRAME_RATE;
+static int idle_frame_rate = DEFAULT_IDLE_FRAME_RATE;
 
 /* The drivers and their driver parameters */
 char *drivernames[MAX_DRIVERS];
@@ -233,8 +240,13 @@ main(int argc, char **argv)
 	install_signal_handlers(!foreground_mode);
 		/* Only catch SIGHUP if not in foreground mode */
 
+	/* From now on a slow syslog must not stall the server */
+	report_async_start();
+
 	/* Startup the subparts of the server */
-	CHAIN(e, sock_init(bind_addr, bind_port));
+	CHAIN(e, stats_init(config_get_string("Server", "StatsSocket", 0, NULL)));
+	CHAIN(e, sock_init(bind_addr, bind_port,
+			   config_get_string("Server", "UnixSocket", 0, NULL)));
 	CHAIN(e, screenlist_init());
 	CHAIN(e, init_drivers());
 	CHAIN(e, clients_init());
@@ -295,6 +307,7 @@ process_command_line(int argc, char **argv)
 	debug(RPT_DEBUG, "%s(argc=%d, argv=...)", __FUNCTION__, argc);
 
 	/* Reset getopt */
+	optind = 1; /* Rescan from the start, also on reload */
 	opterr = 0; /* Prevent some messages to stderr */
 
 	/* Analyze options here.. (please try to keep list of options the
@@ -457,6 +470,14 @@ process_configfile(char *configfile)
 	}
 
 	frame_interval = config_get_int("Server", "FrameInterval", 0, DEFAULT_FRAME_INTERVAL);
+	if (frame_interval <= 0) {
+		report(RPT_WARNING, "FrameInterval must be positive, using %d", DEFAULT_FRAME_INTERVAL);
+		frame_interval = DEFAULT_FRAME_INTERVAL;
+	}
+	max_frame_rate = config_get_int("Server", "MaxFrameRate", 0, DEFAULT_MAX_FRAME_RATE);
+	max_frame_rate = max(max_frame_rate, 1);
+	idle_frame_rate = config_get_int("Server", "IdleFrameRate", 0, DEFAULT_IDLE_FRAME_RATE);
+	idle_frame_rate = max(idle_frame_rate, 1);
 
 	if (report_dest == UNSET_INT) {
 		int rs = config_get_bool("Server", "ReportToSyslog", 0, UNSET_INT);
@@ -664,12 +685,28 @@ static int
 init_drivers(void)
 {
 	int i, res;
+	int parallel_init;
+	int init_timeout;
 
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
+	/* Drivers may be initialized in threads of their own. This is off by
+	 * default because port access granted by ioperm() is per thread. */
+	parallel_init = config_get_bool("Server", "ParallelDriverInit", 0, DEFAULT_PARALLEL_INIT);
+	init_timeout = config_get_int("Server", "DriverInitTimeout", 0, DEFAULT_DRIVER_INIT_TIMEOUT);
+	if (init_timeout <= 0)
+		init_timeout = DEFAULT_DRIVER_INIT_TIMEOUT;
+
 	for (i = 0; i < num_drivers; i++) {
 
-		res = drivers_load_driver(drivernames[i]);
+		/* Drivers kept running across a reload */
+		if ((drivers_find(drivernames[i]) != NULL) || drivers_is_pending(drivernames[i]))
+			continue;
+
+		if (parallel_init)
+			res = drivers_start_driver(drivernames[i], init_timeout);
+		else
+			res = drivers_load_driver(drivernames[i]);
 		if (res >= 0) {
 			/* Load went OK */
 
@@ -680,6 +717,17 @@ init_drivers(void)
 		}
 	}
 
+	/* Only wait for the drivers up to the first output driver, the
+	 * others are added by the main loop once they are ready */
+	for (i = 0; (i < num_drivers) && !output_driver; i++) {
+		if (!drivers_is_pending(drivernames[i]))
+			continue;
+
+		res = drivers_wait_pending(drivernames[i]);
+		if (res < 0)
+			report(RPT_ERR, "Could not load driver %.40s", drivernames[i]);
+	}
+
 	/* Do we have a running output driver ?*/
 	if (output_driver)
 		return 0;
@@ -697,6 +745,10 @@ drop_privs(char *user)
 	debug(RPT_DEBUG, "%s(user=\"%.40s\")", __FUNCTION__, user);
 
 	if (getuid() == 0 || geteuid() == 0) {
+		/* Drivers still initializing in their threads may need root to
+		 * open their devices; setuid() applies to them as well. */
+		drivers_wait_all_pending();
+
 		if ((pwent = getpwnam(user)) == NULL) {
 			report(RPT_ERR, "User %.40s not a valid user!", user);
 			return -1;
@@ -716,10 +768,20 @@ static void
 do_reload(void)
 {
 	int e = 0;
-
-	drivers_unload_all();		/* Close all drivers */
-
-	config_clear();
+	int reloaded = 0;
+	ConfigTree *old_config;
+	char *old_driverpath;
+	char old_bind_addr[64];
+	unsigned int old_bind_port = bind_port;
+	Driver *drv;
+
+	/* Drivers still initializing use the current config */
+	drivers_wait_all_pending();
+
+	/* Keep the old config to find out which drivers need a restart */
+	old_driverpath = strdup(config_get_string("Server", "DriverPath", 0, ""));
+	strncpy(old_bind_addr, bind_addr, sizeof(old_bind_addr));
+	old_config = config_detach();
 	clear_settings();
 
 	/* Reread command line*/
@@ -730,6 +792,9 @@ do_reload(void)
 		strncpy(configfile, DEFAULT_CONFIGFILE, sizeof(configfile));
 	CHAIN(e, process_configfile(configfile));
 
+	/* Unchanged sections stay the same, drivers may still use their values */
+	config_adopt_unchanged(old_config);
+
 	/* Set default values */
 	CHAIN(e, (set_default_settings(), 0));
 
@@ -738,59 +803,172 @@ do_reload(void)
 	CHAIN(e, (report(RPT_INFO, "Set report level to %d, output to %s", report_level,
 			((report_dest == RPT_DEST_SYSLOG) ? "syslog" : "stderr")), 0));
 
-	/* And restart the drivers */
+	if ((bind_port != old_bind_port) || (strcmp(bind_addr, old_bind_addr) != 0))
+		report(RPT_WARNING, "Changed Bind or Port only takes effect after a restart");
+
+	/* Close the drivers that are gone or whose settings changed... */
+	if (e >= 0) {
+		int driverpath_changed = (strcmp(old_driverpath,
+				config_get_string("Server", "DriverPath", 0, "")) != 0);
+
+		do {
+			for (drv = drivers_getfirst(); drv != NULL; drv = drivers_getnext()) {
+				int i;
+
+				if (driverpath_changed || config_section_changed(old_config, drv->name))
+					break;
+				for (i = 0; i < num_drivers; i++) {
+					if (strcasecmp(drivernames[i], drv->name) == 0)
+						break;
+				}
+				if (i == num_drivers)
+					break;
+			}
+			if (drv != NULL) {
+				report(RPT_NOTICE, "Reloading driver [%.40s]", drv->name);
+				drivers_unload_driver(drv);
+				reloaded++;
+			}
+		} while (drv != NULL);
+	}
+
+	/* ...and start the new ones; the others just keep running */
 	CHAIN(e, init_drivers());
+
+	/* Apply server settings that are not re-read on every use */
+	input_reload();
+
+	config_free_detached(old_config);
+	free(old_driverpath);
+
 	CHAIN_END(e, "Critical error while reloading, abort.");
+	report(RPT_NOTICE, "Configuration reloaded, %d driver(s) restarted", reloaded);
 }
 
 
+/** Current time in microseconds */
+static long long
+mainloop_time(void)
+{
+	struct timeval t;
+
+	gettimeofday(&t, NULL);
+	return (long long) t.tv_sec * 1000000 + t.tv_usec;
+}
+
+
+/**
+ * The main loop of the server.
+ *
+ * Client input and keys are handled PROCESS_FREQ times per second. The
+ * timer advances once every frame_interval whatever else happens, as the
+ * screen durations and the speed of scrollers, titles and the heartbeat
+ * are counted in its ticks. Frames however are rendered when needed:
+ * \li  on the ticks that move a scroller, title or blinking cursor,
+ * \li  at IdleFrameRate otherwise, which also refreshes the heartbeat,
+ * \li  right after a client or key changed something, up to MaxFrameRate,
+ *      if the displays are fast enough to keep up with that,
+ * \li  also in between ticks while the screen is animated, that is, it has
+ *      scrollers moving several steps per tick, up to MaxFrameRate so they
+ *      take them one by one.
+ *
+ * Rendering and presenting may take at most RENDER_BUDGET percent of the
+ * time; beyond that frames are shed so input handling stays on time.
+ */
 static void
 do_mainloop(void)
 {
 	Screen *s;
-	struct timeval t;
-	struct timeval last_t;
-	int sleeptime;
-	long int process_lag = 0;
-	long int render_lag = 0;
-	long int t_diff;
+	Screen *last_screen = NULL;
+	struct timeval render_start;
+	unsigned long last_serial = 0;
+	long long now, last_now;
+	long long next_process;		/* when the next processing stroke is due */
+	long long next_tick;		/* when the timer advances next */
+	long long tick_start;		/* when the current tick began */
+	long long next_render;		/* earliest time for the next frame */
+	long long wakeup;
+	long long load_start;		/* start of the period busy is counted for */
+	long long busy = 0;		/* time spent rendering in that period */
+	long render_cost = 0;		/* average time to render and present */
+	long fast_interval;
+	int idle_ticks = 0;		/* ticks since the last frame */
+	int dirty = 1;			/* something changed since the last frame */
+	int animated = 0;		/* the last frame changes within a tick */
+	long next_change = -1;		/* next tick changing the last frame */
+	int frame_due = 0;		/* a frame is waiting to be rendered */
+	int tick_due = 0;		/* ... because of a timer tick */
+	double rate = 0;
 
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
-	gettimeofday(&t, NULL); /* Get initial time */
+	now = last_now = load_start = mainloop_time();
+	next_process = next_tick = next_render = tick_start = now;
 
 	while (1) {
-		/* Get current time */
-		last_t = t;
-		gettimeofday(&t, NULL);
-		t_diff = t.tv_sec - last_t.tv_sec;
-		if ( ((t_diff + 1) > (LONG_MAX / 1e6)) || (t_diff < 0) ) {
-			/* We're going to overflow the calculation - probably been to sleep, fudge the values */
-			t_diff = 0;
-			process_lag = 1;
-			render_lag = frame_interval;
-		} else {
-			t_diff *= 1e6;
-			t_diff += t.tv_usec - last_t.tv_usec;
+		double nominal_rate = 1e6 / frame_interval;
+		int fast;
+
+		now = mainloop_time();
+		if (now < last_now) {
+			/* The clock was set back, start over */
+			next_process = next_tick = next_render = tick_start = now;
 		}
-                process_lag += t_diff;
-		if (process_lag > 0) {
+		last_now = now;
+
+		if (now >= next_process) {
 			/* Time for a processing stroke */
 			sock_poll_clients();		/* poll clients for input*/
-			parse_all_client_messages();	/* analyze input from network clients*/
-			handle_input();		/* handle key input from devices*/
+			if (parse_all_client_messages() > 0)	/* analyze input from network clients*/
+				dirty = 1;
+			if (handle_input() > 0)		/* handle key input from devices*/
+				dirty = 1;
+			drivers_attach_pending();	/* add drivers that finished initializing */
+			stats_poll();			/* serve requests for statistics */
 
 			/* We've done the job... */
-			process_lag = 0 - (1e6/PROCESS_FREQ);
+			next_process = now + 1000000 / PROCESS_FREQ;
 			/* Note : this does not make a fixed frequency */
 		}
 
-		render_lag += t_diff;
-		if (render_lag > 0) {
-			/* Time for a rendering stroke */
-			timer ++;
+		if (now >= next_tick) {
+			/* Time for a timer tick */
+			long ticks = (now - next_tick) / frame_interval + 1;
+
+			if (ticks > MAX_RENDER_LAG_FRAMES) {
+				/* Too much lag is not corrected, causing slowdown */
+				ticks = MAX_RENDER_LAG_FRAMES;
+				next_tick = now;
+			}
+			next_tick += (long long) ticks * frame_interval;
+			tick_start = next_tick - frame_interval;
+			stats_add(STAT_MISSED_DEADLINES, ticks - 1 + tick_due);
+
+			timer += ticks;
 			screenlist_process();
+			if (screenlist_current() != last_screen)
+				dirty = 1;
+
+			idle_ticks += ticks;
+			if (dirty || ((next_change >= 0) && (timer >= next_change))
+			    || (idle_ticks * idle_frame_rate >= nominal_rate))
+				frame_due = tick_due = 1;
+		}
+
+		/* Show changes right away and animate in between ticks if the
+		 * displays can keep up */
+		fast_interval = 1000000 / max_frame_rate;
+		fast = (max_frame_rate > nominal_rate)
+		       && (render_cost * 100 < fast_interval * RENDER_BUDGET / 2);
+		if ((dirty || animated) && fast)
+			frame_due = 1;
+
+		if (frame_due && (now >= next_render)) {
+			/* Time for a rendering stroke */
+			long cost;
+
 			s = screenlist_current();
+			last_screen = s;
 
 			/* TODO: Move this call to every client connection
 			 *       and every screen add...
@@ -798,27 +976,81 @@ do_mainloop(void)
 			if (s == server_screen) {
 				update_server_screen();
 			}
-			render_screen(s, timer);
+			gettimeofday(&render_start, NULL);
+			render_screen(s, timer,
+				      min((now - tick_start) * RENDER_PHASES / frame_interval,
+					  RENDER_PHASES - 1));
+			cost = stats_usec_since(&render_start);
+			stats_observe(STAT_RENDER_TIME, cost);
+			stats_inc(STAT_FRAMES_RENDERED);
+
+			/* Hand the latest composed frame to the drivers */
+			animated = 1;
+			next_change = timer + 1;
+			if (composed_frames != NULL) {
+				ComposedFrame *f = compose_buffer_acquire(composed_frames);
+
+				if (f != NULL) {
+					long present;
+
+					if ((last_serial != 0) && (f->serial > last_serial + 1))
+						stats_add(STAT_FRAMES_SKIPPED, f->serial - last_serial - 1);
+					last_serial = f->serial;
+					animated = f->animated;
+					next_change = f->next_change;
+
+					gettimeofday(&render_start, NULL);
+					drivers_present(f);
+					present = stats_usec_since(&render_start);
+					stats_observe(STAT_PRESENT_TIME, present);
+					stats_frame_presented();
+					cost += present;
+				}
+			}
 
-			/* We've done the job... */
-			if (render_lag > frame_interval * MAX_RENDER_LAG_FRAMES) {
-				/* Cause rendering slowdown because too much lag */
-				render_lag = frame_interval * MAX_RENDER_LAG_FRAMES;
+			/* Keep rendering within its share of the time */
+			render_cost = (render_cost * 3 + cost) / 4;
+			next_render = now + cost * 100 / RENDER_BUDGET;
+			if (fast)
+				next_render = max(next_render, now + fast_interval);
+
+			/* Publish the rate aimed for */
+			rate = (fast && (dirty || animated)) ? max_frame_rate
+			       : (next_change > timer)
+				 ? max(nominal_rate / (next_change - timer),
+				       min(idle_frame_rate, nominal_rate))
+			       : min(idle_frame_rate, nominal_rate);
+			if (render_cost > 0)
+				rate = min(rate, 1e6 * RENDER_BUDGET / 100 / render_cost);
+			stats_set_gauge(STAT_FRAME_RATE, rate);
+
+			busy += cost;
+			if (now - load_start >= 1000000) {
+				stats_set_gauge(STAT_RENDER_LOAD, (double) busy / (now - load_start));
+				load_start = now;
+				busy = 0;
 			}
-			render_lag -= frame_interval;
-			/* Note: this DOES make a fixed frequency (except with slowdown) */
+
+			/* We've done the job... */
+			frame_due = tick_due = 0;
+			dirty = 0;
+			idle_ticks = 0;
 		}
 
 		/* Sleep just as long as needed */
-		sleeptime = min(0-process_lag, 0-render_lag);
-		if (sleeptime > 0) {
-			usleep(sleeptime);
+		wakeup = min(next_process, next_tick);
+		if (frame_due)
+			wakeup = min(wakeup, next_render);
+		now = mainloop_time();
+		if (wakeup > now) {
+			usleep(wakeup - now);
 		}
 
 		/* Check if a SIGHUP has been caught */
 		if (got_reload_signal) {
 			got_reload_signal = 0;
 			do_reload();
+			dirty = 1;
 		}
 	}
 
@@ -866,8 +1098,10 @@ exit_program(int val)
 	screenlist_shutdown();		/* shutdown screens (must come after client_shutdown) */
 	input_shutdown();		/* shutdown key input part */
         sock_shutdown();                /* shutdown the sockets server */
+	stats_shutdown();		/* remove the statistics socket */
 
 	report(RPT_INFO, "Exiting.");
+	report_async_stop();
 	_exit(EXIT_SUCCESS);
 }
 
@@ -32,6 +32,9 @@ extern char *build_date;
 #define MAX_RENDER_LAG_FRAMES 16
 /* Allow the rendering strokes to lag behind this many frames.
  * More lag will not be corrected, but will cause slow-down. */
+#define RENDER_BUDGET 50
+/* Percentage of the time rendering and presenting frames may take.
+ * Beyond that frames are dropped to keep handling input on time. */
 
 extern long timer;
 /* 32 bits at 8Hz will overflow in 2 ^ 29 = 5e8 seconds = 17 years.
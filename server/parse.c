@@ -26,6 +26,7 @@
 #include "commands/command_list.h"
 #include "parse.h"
 #include "sock.h"
+#include "stats.h"
 
 #define MAX_ARGUMENTS 40
 
@@ -175,6 +176,7 @@ static void parse_message(const char *str, Client *c)
 		error = 1;
 
 	if (error) {
+		stats_inc(STAT_PARSE_ERRORS);
 		sock_send_error(c->sock, "Could not parse command\n");
 		return;
 	}
@@ -183,33 +185,41 @@ static void parse_message(const char *str, Client *c)
 	function = get_command_function(argv[0]);
 
 	if (function != NULL) {
+		c->commands++;
 		error = function(c, argc, argv);
 		if (error) {
+			stats_inc(STAT_COMMAND_ERRORS);
 			sock_printf_error(c->sock, "Function returned error \"%.40s\"\n", argv[0]);
 			report(RPT_WARNING, "Command function returned an error after command from client on socket %d: %.40s", c->sock, str);
 		}
 	}
 	else {
+		stats_inc(STAT_INVALID_COMMANDS);
 		sock_printf_error(c->sock, "Invalid command \"%.40s\"\n", argv[0]);
 		report(RPT_WARNING, "Invalid command from client on socket %d: %.40s", c->sock, str);
 	}
 }
 
 
-void
+int
 parse_all_client_messages(void)
 {
-	Client *c;
+	Client *c, *next;
+	int messages = 0;
 
 	debug(RPT_DEBUG, "%s()", __FUNCTION__);
 
-	for (c = clients_getfirst(); c != NULL; c = clients_getnext()) {
+	for (c = clients_getfirst(); c != NULL; c = next) {
 		char *str;
 
+		/* c may be destroyed below */
+		next = clients_getnext(c);
+
 		/* And parse all its messages...*/
 		for (str = client_get_message(c); str != NULL; str = client_get_message(c)) {
 			parse_message(str, c);
 			free(str);
+			messages++;
 
 			if (c->state == GONE) {
 				sock_destroy_client_socket(c);
@@ -217,6 +227,7 @@ parse_all_client_messages(void)
 			}
 		}
 	}
+	return messages;
 }
 
 
@@ -13,6 +13,7 @@
 #define PARSE_H
 
 // This should be pretty self-explanatory...
-void parse_all_client_messages(void);
+// Returns the number of messages parsed.
+int parse_all_client_messages(void);
 
 #endif
@@ -45,7 +45,9 @@
 #include "screen.h"
 #include "screenlist.h"
 #include "widget.h"
+#include "compose.h"
 #include "render.h"
+#include "main.h"
 
 #define BUFSIZE 1024	/* larger than display width => large enough */
 
@@ -60,9 +62,15 @@ int titlespeed = 1;
 int output_state = 0;
 char *server_msg_text;
 int server_msg_expire = 0;
+static long server_msg_timer;	/**< timer tick the expiry was last counted at */
 
+/** Frames composed by the renderer and consumed by the driver flush */
+ComposeBuffer *composed_frames = NULL;
+static ComposedFrame *frame;	/**< frame being rendered at the moment */
+static int phase;		/**< part of the tick elapsed, in 1/RENDER_PHASES */
 
-static void render_frame(LinkedList *list, int left, int top, int right, int bottom, int fwid, int fhgt, char fscroll, int fspeed, long timer);
+
+static void render_frame(LL_list *list, int left, int top, int right, int bottom, int fwid, int fhgt, char fscroll, int fspeed, long timer);
 static void render_string(Widget *w, int left, int top, int right, int bottom, int fy);
 static void render_hbar(Widget *w, int left, int top, int right, int bottom, int fy);
 static void render_vbar(Widget *w, int left, int top, int right, int bottom);
@@ -70,36 +78,62 @@ static void render_pbar(Widget *w, int left, int top, int right, int bottom);
 static void render_title(Widget *w, int left, int top, int right, int bottom, long timer);
 static void render_scroller(Widget *w, int left, int top, int right, int bottom, long timer);
 static void render_num(Widget *w, int left, int top, int right, int bottom);
+static long render_steps(long timer, int steps_per_tick);
+static void render_changes_at(long tick);
+static void render_changes_every(long timer, long period);
 
 
 /**
- * Renders a screen. The following actions are taken in order:
+ * Renders a screen into the back buffer of composed_frames and publishes
+ * it. The following actions are taken in order:
  *
- * \li  Clear the screen.
+ * \li  Clear the frame.
  * \li  Set the backlight.
  * \li  Set out-of-band data (output).
  * \li  Render the frame contents.
  * \li  Set the cursor.
  * \li  Draw the heartbeat.
  * \li  Show any server message.
- * \li  Flush all output to screen.
+ * \li  Publish the frame for the drivers.
+ *
+ * The frame's \c animated flag tells whether rendering it again within the
+ * same tick would give a different result, and \c next_change the first
+ * later tick that does, without any client changing it. The heartbeat is
+ * left out: it is refreshed with the idle frames.
  *
  * \param s      The screen to render.
- * \param timer  A value increased with every call.
+ * \param timer  The current timer tick; the same tick may be rendered
+ *               more than once.
+ * \param sub    Part of the tick elapsed, from 0 to RENDER_PHASES - 1.
+ *               Scrollers and frames moving several steps per tick take
+ *               them one by one in between ticks.
  * \return  -1 on error, 0 on success.
  */
 int
-render_screen(Screen *s, long timer)
+render_screen(Screen *s, long timer, int sub)
 {
 	int tmp_state = 0;
 
-	debug(RPT_DEBUG, "%s(screen=[%.40s], timer=%ld)  ==== START RENDERING ====", __FUNCTION__, s->id, timer);
+	debug(RPT_DEBUG, "%s(screen=[%.40s], timer=%ld, sub=%d)  ==== START RENDERING ====", __FUNCTION__, s->id, timer, sub);
 
 	if (s == NULL)
 		return -1;
 
-	/* 1. Clear the LCD screen... */
-	drivers_clear();
+	phase = min(max(sub, 0), RENDER_PHASES - 1);
+
+	/* 1. Get a clear frame, (re)creating the buffers if the display changed */
+	if ((composed_frames != NULL)
+	    && ((composed_frames->frames[0].width != display_props->width)
+		|| (composed_frames->frames[0].height != display_props->height))) {
+		compose_buffer_destroy(composed_frames);
+		composed_frames = NULL;
+	}
+	if (composed_frames == NULL) {
+		composed_frames = compose_buffer_create(display_props->width, display_props->height);
+		if (composed_frames == NULL)
+			return -1;
+	}
+	frame = compose_buffer_begin(composed_frames);
 
 	/* 2. Set up the backlight */
 	/*-
@@ -132,35 +166,39 @@ render_screen(Screen *s, long timer)
 	/* NOTE: dirty stripping of other options... */
 	/* Backlight flash: check timer and flip backlight as appropriate */
 	if (tmp_state & BACKLIGHT_FLASH) {
-		drivers_backlight(
-			(
+		render_changes_at(((timer & 7) >= 6) ? timer + 1 : (timer | 7));
+		frame->backlight = (
 				(tmp_state & BACKLIGHT_ON)
 				^ ((timer & 7) == 7)
-			) ? BACKLIGHT_ON : BACKLIGHT_OFF);
+			) ? BACKLIGHT_ON : BACKLIGHT_OFF;
 	}
 	/* Backlight blink: check timer and flip backlight as appropriate */
 	else if (tmp_state & BACKLIGHT_BLINK) {
-		drivers_backlight(
-			(
+		render_changes_at(((timer & 15) >= 13) ? timer + 1 : (timer | 15) - 1);
+		frame->backlight = (
 				(tmp_state & BACKLIGHT_ON)
 				^ ((timer & 14) == 14)
-			) ? BACKLIGHT_ON : BACKLIGHT_OFF);
+			) ? BACKLIGHT_ON : BACKLIGHT_OFF;
 	}
 	else {
 		/* Simple: Only send lowest bit then... */
-		drivers_backlight(tmp_state & BACKLIGHT_ON);
+		frame->backlight = tmp_state & BACKLIGHT_ON;
 	}
 
 	/* 3. Output ports from LCD - outputs depend on the current screen */
-	drivers_output(output_state);
+	frame->output = output_state;
 
 	/* 4. Draw a frame... */
-	render_frame(s->widgetlist, 0, 0,
+	render_frame(&s->widgetlist, 0, 0,
 			display_props->width, display_props->height,
 			s->width, s->height, 'v', max(s->duration / s->height, 1), timer);
 
 	/* 5. Set the cursor */
-	drivers_cursor(s->cursor_x, s->cursor_y, s->cursor);
+	frame->cursor_x = s->cursor_x;
+	frame->cursor_y = s->cursor_y;
+	frame->cursor = s->cursor;
+	if (frame->cursor != CURSOR_OFF)
+		render_changes_at((timer | 1) + 1);	/* the fallback cursor blinks */
 
 	/* 6. Set the heartbeat */
 	if (heartbeat != HEARTBEAT_OPEN) {
@@ -175,20 +213,31 @@ render_screen(Screen *s, long timer)
 	else {
 		tmp_state = heartbeat_fallback;
 	}
-	drivers_heartbeat(tmp_state);
+	frame->heartbeat = tmp_state;
 
 	/* 7. If there is an server message that is not expired, display it */
+	compose_begin_overlay(frame);
 	if (server_msg_expire > 0) {
-		drivers_string(display_props->width - strlen(server_msg_text) + 1,
+		compose_string(frame, display_props->width - strlen(server_msg_text) + 1,
 				display_props->height, server_msg_text);
-		server_msg_expire--;
-		if (server_msg_expire == 0) {
+
+		/* Count down in timer ticks, frames may be rendered in between */
+		if (timer > server_msg_timer) {
+			server_msg_expire -= timer - server_msg_timer;
+			server_msg_timer = timer;
+		}
+		if (server_msg_expire <= 0) {
+			server_msg_expire = 0;
 			free(server_msg_text);
 		}
+		render_changes_at(timer + max(server_msg_expire, 1));
 	}
+	if (frame->animated)
+		render_changes_at(timer + 1);
 
-	/* 8. Flush display out, frame and all... */
-	drivers_flush();
+	/* 8. Hand the frame over, the drivers flush it at their own pace */
+	compose_buffer_publish(composed_frames);
+	frame = NULL;
 
 	debug(RPT_DEBUG, "==== END RENDERING ====");
 	return 0;
@@ -199,7 +248,7 @@ render_screen(Screen *s, long timer)
 /* Best thing to do is to remove support for frames... but anyway... */
 /* */
 static void
-render_frame(LinkedList *list,
+render_frame(LL_list *list,
 		int left,	/* left edge of frame */
 		int top,	/* top edge of frame */
 		int right,	/* right edge of frame */
@@ -211,6 +260,7 @@ render_frame(LinkedList *list,
 		long timer)	/* current timer tick */
 {
 	int fy = 0;		/* Scrolling offset for the frame... */
+	LL_link *l;
 
 	debug(RPT_DEBUG, "%s(list=%p, left=%d, top=%d, "
 			  "right=%d, bottom=%d, fwid=%d, fhgt=%d, "
@@ -227,9 +277,14 @@ render_frame(LinkedList *list,
 		if ((fspeed != 0) && (fhgt > bottom - top)) {
 			int fy_max = fhgt - (bottom - top) + 1;
 
-			fy = (fspeed > 0)
-			     ? (timer / fspeed) % fy_max
-			     : (-fspeed * timer) % fy_max;
+			if (fspeed > 0) {
+				fy = (timer / fspeed) % fy_max;
+				render_changes_every(timer, fspeed);
+			}
+			else {
+				fy = render_steps(timer, -fspeed) % fy_max;
+				frame->animated = 1;
+			}
 
 			fy = max(fy, 0);	// safeguard against negative values
 
@@ -240,15 +295,9 @@ render_frame(LinkedList *list,
 		/* TODO:  Frames don't scroll horizontally yet! */
 	}
 
-	/* reset widget list */
-	LL_Rewind(list);
-
 	/* loop over all widgets */
-	do {
-		Widget *w = (Widget *) LL_Get(list);
-
-		if (w == NULL)
-			return;
+	LL_FOREACH(list, l) {
+		Widget *w = LL_ENTRY(l, Widget, link);
 
 		/* TODO:  Make this cleaner and more flexible! */
 		switch (w->type) {
@@ -265,7 +314,7 @@ render_frame(LinkedList *list,
 			render_pbar(w, left, top - fy, right, bottom);
 			break;
 		case WID_ICON:	  /* FIXME:  Icons don't work in frames! */
-			drivers_icon(w->x, w->y, w->length);
+			compose_icon(frame, w->x, w->y, w->length);
 			break;
 		case WID_TITLE:	  /* FIXME:  Doesn't work quite right in frames... */
 			render_title(w, left, top, right, bottom, timer);
@@ -284,7 +333,7 @@ render_frame(LinkedList *list,
 				int new_bottom = min(top + w->bottom, bottom);
 
 				if ((new_left < right) && (new_top < bottom))	/* Render only if it's visible... */
-					render_frame(w->frame_screen->widgetlist, new_left, new_top,
+					render_frame(&w->frame_screen->widgetlist, new_left, new_top,
 							new_right, new_bottom, w->width, w->height,
 							w->length, w->speed, timer);
 			}
@@ -292,7 +341,7 @@ render_frame(LinkedList *list,
 		case WID_NUM:	  /* FIXME: doesn't work in frames... */
 			/* NOTE: y=10 means COLON (:) */
 			if ((w->x > 0) && (w->y >= 0) && (w->y <= 10)) {
-				drivers_num(w->x + left, w->y);
+				compose_num(frame, w->x + left, w->y);
 			}
 			break;
 		case WID_NONE:
@@ -300,7 +349,7 @@ render_frame(LinkedList *list,
 		default:
 			break;
 		}
-	} while (LL_Next(list) == 0);
+	}
 }
 
 
@@ -319,7 +368,7 @@ render_string(Widget *w, int left, int top, int right, int bottom, int fy)
 		 * strings totally off-screen. Is this on purpose? (M. Dolze)
 		 */
 		w->x = min(w->x, right - left);
-		drivers_string(w->x + left, w->y + top, w->text);
+		compose_string(frame, w->x + left, w->y + top, w->text);
 	}
 }
 
@@ -344,7 +393,7 @@ render_hbar(Widget *w, int left, int top, int right, int bottom, int fy)
 				   (display_props->cellwidth * len);
 		}
 
-		drivers_hbar(w->x + left, w->y + top, len, promille, BAR_PATTERN_FILLED);
+		compose_hbar(frame, w->x + left, w->y + top, len, promille, BAR_PATTERN_FILLED);
 	}
 	else if (w->length < 0) {
 		/* TODO:  Rearrange stuff to get left-extending
@@ -369,7 +418,7 @@ render_vbar(Widget *w, int left, int top, int right, int bottom)
 		int full_len = display_props->height;
 		int promille = (long) 1000 * w->length / (display_props->cellheight * full_len);
 
-		drivers_vbar(w->x + left, w->y + top, full_len, promille, BAR_PATTERN_FILLED);
+		compose_vbar(frame, w->x + left, w->y + top, full_len, promille, BAR_PATTERN_FILLED);
 	}
 	else if (w->length < 0) {
 		/* TODO:  Rearrange stuff to get down-extending
@@ -389,7 +438,7 @@ render_pbar(Widget *w, int left, int top, int right, int bottom)
 	if (!((w->x > 0) && (w->y > 0) && (w->width > 0)))
 		return;
 
-        drivers_pbar(w->x + left, w->y + top, w->width, w->promille,
+        compose_pbar(frame, w->x + left, w->y + top, w->width, w->promille,
        		     w->begin_label, w->end_label);
 }
 
@@ -414,8 +463,8 @@ render_title(Widget *w, int left, int top, int right, int bottom, long timer)
 		: max(TITLESPEED_MIN, TITLESPEED_MAX - titlespeed);
 
 	/* display leading fillers */
-	drivers_icon(w->x + left, w->y + top, ICON_BLOCK_FILLED);
-	drivers_icon(w->x + left + 1, w->y + top, ICON_BLOCK_FILLED);
+	compose_icon(frame, w->x + left, w->y + top, ICON_BLOCK_FILLED);
+	compose_icon(frame, w->x + left + 1, w->y + top, ICON_BLOCK_FILLED);
 
 	length = min(length, sizeof(str)-1);
 	if ((length <= width) || (delay == 0)) {
@@ -432,6 +481,8 @@ render_title(Widget *w, int left, int top, int right, int bottom, long timer)
 		int offset = timer;
 		int reverse;
 
+		render_changes_at(timer + 1);
+
 		/* if the delay is "too large" increase cycle length */
 		if ((delay != 0) && (delay < length / (length - width)))
 			offset /= delay;
@@ -464,11 +515,11 @@ render_title(Widget *w, int left, int top, int right, int bottom, long timer)
 	}
 
 	/* display text */
-	drivers_string(w->x + 3 + left, w->y + top, str);
+	compose_string(frame, w->x + 3 + left, w->y + top, str);
 
 	/* display trailing fillers */
 	for ( ; x < vis_width; x++) {
-		drivers_icon(w->x + x + left, w->y + top, ICON_BLOCK_FILLED);
+		compose_icon(frame, w->x + x + left, w->y + top, ICON_BLOCK_FILLED);
 	}
 }
 
@@ -491,12 +542,17 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 	screen_width = abs(w->right - w->left + 1);
 	screen_width = min(screen_width, sizeof(str)-1);
 
+	if (w->speed > 0)
+		render_changes_every(timer, w->speed);
+	else if (w->speed < 0)
+		frame->animated = 1;
+
 	switch (w->length) {	/* actually, direction... */
 	case 'm': // Marquee
 		length = strlen(w->text);
 		if (length <= screen_width) {
 			/* it fits within the box, just render it */
-			drivers_string(w->left, w->top, w->text);
+			compose_string(frame, w->left, w->top, w->text);
 			break;
 		}
 
@@ -509,7 +565,8 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 		}
 		else if (w->speed < 0) {
 			necessaryTimeUnits = length / (w->speed * -1);
-			offset = (timer % necessaryTimeUnits) * w->speed * -1;
+			offset = render_steps(timer, -w->speed)
+				 % (necessaryTimeUnits * -w->speed);
 		}
 		else {
 			offset = 0;
@@ -531,14 +588,14 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 				}
 			}
 			str[screen_width] = '\0';
-			drivers_string(w->left, w->top, str);
+			compose_string(frame, w->left, w->top, str);
 		}
 		break;
 	case 'h':
 		length = strlen(w->text) + 1;
 		if (length <= screen_width) {
 			/* it fits within the box, just render it */
-			drivers_string(w->left, w->top, w->text);
+			compose_string(frame, w->left, w->top, w->text);
 		}
 		else {
 			int effLength = length - screen_width;
@@ -558,15 +615,16 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 				}
 			}
 			else if (w->speed < 0) {
+				long steps = render_steps(timer, -w->speed);
+				long cycle;
+
 				necessaryTimeUnits = effLength / (w->speed * -1);
-				if (((timer / necessaryTimeUnits) % 2) == 0) {
-					offset = (timer % (effLength / (w->speed * -1)))
-						 * w->speed * -1;
+				cycle = necessaryTimeUnits * -w->speed;
+				if (((steps / cycle) % 2) == 0) {
+					offset = steps % cycle;
 				}
 				else {
-					offset = (((timer % (effLength / (w->speed * -1)))
-						  * w->speed * -1)
-						  - effLength + 1) * -1;
+					offset = ((steps % cycle) - effLength + 1) * -1;
 				}
 			}
 			else {
@@ -575,7 +633,7 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 			if (offset <= length) {
 				strncpy(str, &((w->text)[offset]), screen_width);
 				str[screen_width] = '\0';
-				drivers_string(w->left, w->top, str);
+				compose_string(frame, w->left, w->top, str);
 				/*debug(RPT_DEBUG, "scroller %s : %d", str, length-offset); */
 			}
 		}
@@ -588,7 +646,7 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 		length = strlen(w->text);
 		if (length <= screen_width) {
 			/* no scrolling required... */
-			drivers_string(w->left, w->top, w->text);
+			compose_string(frame, w->left, w->top, w->text);
 		}
 		else {
 			int lines_required = (length / screen_width)
@@ -602,7 +660,7 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 				for (i = 0; i < lines_required; i++) {
 					strncpy(str, &((w->text)[i * screen_width]), screen_width);
 					str[screen_width] = '\0';
-					drivers_string(w->left, w->top + i, str);
+					compose_string(frame, w->left, w->top + i, str);
 				}
 			}
 			else {
@@ -626,15 +684,16 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 					}
 				}
 				else if (w->speed < 0) {
+					long steps = render_steps(timer, -w->speed);
+					long cycle;
+
 					necessaryTimeUnits = effLines / (w->speed * -1);
-					if (((timer / necessaryTimeUnits) % 2) == 0) {
-						begin = (timer % necessaryTimeUnits)
-							 * w->speed * -1;
+					cycle = necessaryTimeUnits * -w->speed;
+					if (((steps / cycle) % 2) == 0) {
+						begin = steps % cycle;
 					}
 					else {
-						begin = (((timer % necessaryTimeUnits)
-							 * w->speed * -1) - effLines + 1)
-							 * -1;
+						begin = ((steps % cycle) - effLines + 1) * -1;
 					}
 				}
 				else {
@@ -646,7 +705,7 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 					str[screen_width] = '\0';
 					/*debug(RPT_DEBUG, "rendering: '%s' of %s", */
 					/*str,w->text); */
-					drivers_string(w->left, w->top + (i - begin), str);
+					compose_string(frame, w->left, w->top + (i - begin), str);
 				}
 			}
 		}
@@ -655,6 +714,45 @@ render_scroller(Widget *w, int left, int top, int right, int bottom, long timer)
 }
 
 
+/**
+ * Count the steps taken so far by something moving several steps per tick,
+ * including those taken in the current tick up to the phase rendered.
+ * \param timer           The current timer tick.
+ * \param steps_per_tick  Number of steps per tick.
+ * \return  Number of steps.
+ */
+static long
+render_steps(long timer, int steps_per_tick)
+{
+	return timer * steps_per_tick + (long) phase * steps_per_tick / RENDER_PHASES;
+}
+
+
+/**
+ * Note that the frame being rendered changes again at the given tick.
+ * \param tick  The timer tick.
+ */
+static void
+render_changes_at(long tick)
+{
+	if ((frame->next_change < 0) || (tick < frame->next_change))
+		frame->next_change = tick;
+}
+
+
+/**
+ * Note that the frame being rendered changes again when the timer reaches
+ * the next multiple of \c period.
+ * \param timer   The current timer tick.
+ * \param period  Number of ticks per step.
+ */
+static void
+render_changes_every(long timer, long period)
+{
+	render_changes_at((timer / period + 1) * period);
+}
+
+
 static void render_num(Widget *w, int left, int top, int right, int bottom)
 {
 	debug(RPT_DEBUG, "%s(w=%p, left=%d, top=%d, right=%d, bottom=%d)",
@@ -662,7 +760,7 @@ static void render_num(Widget *w, int left, int top, int right, int bottom)
 
 	/* NOTE: y=10 means COLON (:) */
 	if ((w->x > 0) && (w->y >= 0) && (w->y <= 10)) {
-		drivers_num(w->x + left, w->y);
+		compose_num(frame, w->x + left, w->y);
 	}
 }
 
@@ -688,6 +786,7 @@ server_msg(const char *text, int expire)
 	strcat(server_msg_text, text);
 
 	server_msg_expire = expire;
+	server_msg_timer = timer;
 
 	return 0;
 }
@@ -12,6 +12,8 @@
 #ifndef RENDER_H
 #define RENDER_H
 
+#include "compose.h"
+
 #define HEARTBEAT_OFF		0
 #define HEARTBEAT_ON		1
 #define HEARTBEAT_OPEN		2
@@ -37,8 +39,14 @@ extern int backlight;
 extern int titlespeed;
 extern int output_state;
 
+/* Frames composed by render_screen(), to be consumed by drivers_present() */
+extern ComposeBuffer *composed_frames;
+
+/* Number of parts a tick is divided into for rendering in between ticks */
+#define RENDER_PHASES		256
+
 /* Render the given screen. */
-int render_screen(Screen *s, long timer);
+int render_screen(Screen *s, long timer, int sub);
 
 /* Display a short message, which must be shorter than 16 chars, in a corner */
 int server_msg(const char *text, int expire);
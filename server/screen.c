@@ -52,6 +52,7 @@ Screen *
 screen_create(char *id, Client *client)
 {
 	Screen *s;
+	Arena *arena;
 
 	debug(RPT_DEBUG, "%s(id=\"%.40s\", client=[%d])",
 		 __FUNCTION__, id, (client?client->sock:-1));
@@ -62,16 +63,17 @@ screen_create(char *id, Client *client)
 	}
 	/* Client can be NULL for serverscreens and other client-less screens */
 
-	s = calloc(sizeof(Screen), 1);
+	arena = (client != NULL) ? client->arena : NULL;
+	s = arena_calloc(arena, sizeof(Screen));
 	if (s == NULL) {
 		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
 		return NULL;
 	}
 
-	s->id = strdup(id);
+	s->id = arena_strdup(arena, id);
 	if (s->id == NULL) {
 		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
-		free(s);
+		arena_free(arena, s);
 		return NULL;
 	}
 
@@ -88,13 +90,7 @@ screen_create(char *id, Client *client)
 	s->cursor_x = 1;
 	s->cursor_y = 1;
 
-	s->widgetlist = LL_new();
-	if (s->widgetlist == NULL) {
-		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
-		free(s->id);
-		free(s);
-		return NULL;
-	}
+	LL_ListInit(&s->widgetlist);
 
 	menuscreen_add_screen(s);
 
@@ -108,7 +104,8 @@ screen_create(char *id, Client *client)
 void
 screen_destroy(Screen *s)
 {
-	Widget *w;
+	Arena *arena = screen_arena(s);
+	LL_link *l, *tmp;
 
 	debug(RPT_DEBUG, "%s(s=[%.40s])", __FUNCTION__, s->id);
 
@@ -116,22 +113,40 @@ screen_destroy(Screen *s)
 
 	screenlist_remove(s);
 
-	for (w = LL_GetFirst(s->widgetlist); w; w = LL_GetNext(s->widgetlist)) {
+	LL_FOREACH_SAFE(&s->widgetlist, l, tmp) {
 		/* Free a widget...*/
-		widget_destroy(w);
+		widget_destroy(LL_ENTRY(l, Widget, link));
 	}
-	LL_Destroy(s->widgetlist);
 
-	if (s->id != NULL)
-		free(s->id);
+	arena_free(arena, s->id);
+	arena_free(arena, s->name);
+	arena_free(arena, s->keys);
+	arena_free(arena, s);
+}
 
-	if (s->name != NULL)
-		free(s->name);
 
-	if (s->keys != NULL)
-		free(s->keys);
+/** Take a screen and the screens of its frames off the server's lists
+ * without freeing them. Used when the memory goes away with the client's
+ * arena.
+ * \param s    Screen to unlink.
+ */
+void
+screen_unlink(Screen *s)
+{
+	LL_link *l;
+
+	debug(RPT_DEBUG, "%s(s=[%.40s])", __FUNCTION__, s->id);
 
-	free(s);
+	menuscreen_remove_screen(s);
+
+	screenlist_remove(s);
+
+	LL_FOREACH(&s->widgetlist, l) {
+		Widget *w = LL_ENTRY(l, Widget, link);
+
+		if (w->type == WID_FRAME)
+			screen_unlink(w->frame_screen);
+	}
 }
 
 
@@ -146,7 +161,7 @@ screen_add_widget(Screen *s, Widget *w)
 {
 	debug(RPT_DEBUG, "%s(s=[%.40s], widget=[%.40s])", __FUNCTION__, s->id, w->id);
 
-	LL_Push(s->widgetlist, (void *) w);
+	LL_ListAppend(&s->widgetlist, &w->link);
 
 	return 0;
 }
@@ -163,7 +178,7 @@ screen_remove_widget(Screen *s, Widget *w)
 {
 	debug(RPT_DEBUG, "%s(s=[%.40s], widget=[%.40s])", __FUNCTION__, s->id, w->id);
 
-	LL_Remove(s->widgetlist, (void *) w, NEXT);
+	LL_ListRemove(&s->widgetlist, &w->link);
 
 	return 0;
 }
@@ -177,7 +192,7 @@ screen_remove_widget(Screen *s, Widget *w)
 Widget *
 screen_find_widget(Screen *s, char *id)
 {
-	Widget *w;
+	LL_link *l;
 
 	if (!s)
 		return NULL;
@@ -186,16 +201,19 @@ screen_find_widget(Screen *s, char *id)
 
 	debug(RPT_DEBUG, "%s(s=[%.40s], id=\"%.40s\")", __FUNCTION__, s->id, id);
 
-	for (w = LL_GetFirst(s->widgetlist); w != NULL; w = LL_GetNext(s->widgetlist)) {
+	LL_FOREACH(&s->widgetlist, l) {
+		Widget *w = LL_ENTRY(l, Widget, link);
+
 		if (0 == strcmp(w->id, id)) {
 			debug(RPT_DEBUG, "%s: Found %s", __FUNCTION__, id);
 			return w;
 		}
 		/* Search subscreens recursively */
 		if (w->type == WID_FRAME) {
-			w = widget_search_subs(w, id);
-			if (w != NULL)
-				return w;
+			Widget *sub = widget_search_subs(w, id);
+
+			if (sub != NULL)
+				return sub;
 		}
 	}
 	debug(RPT_DEBUG, "%s: Not found", __FUNCTION__);
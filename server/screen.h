@@ -52,7 +52,8 @@ typedef struct Screen {
 	short int cursor_y;
 	char *keys;
 	int keys_size;
-	LinkedList *widgetlist;
+	LL_list widgetlist;
+	LL_link link;			/**< In the client's list of screens */
 	struct Client *client;
 } Screen;
 
@@ -75,25 +76,31 @@ Screen *screen_create(char *id, Client *client);
 /* Destroys a screen */
 void screen_destroy(Screen *s);
 
+/* Removes a screen from the server's lists without freeing it */
+void screen_unlink(Screen *s);
+
+/* Arena holding the screen's memory; NULL for screens without client */
+#define screen_arena(s)	(((s)->client != NULL) ? (s)->client->arena : NULL)
+
 /* Add a widget to a screen */
 int screen_add_widget(Screen *s, Widget *w);
 
 /* Remove a widget from a screen (does not destroy it) */
 int screen_remove_widget(Screen *s, Widget *w);
 
-/* List functions */
+/* List functions; screen_getnext_widget() returns the widget after w */
 static inline Widget *screen_getfirst_widget(Screen *s)
 {
-	return (Widget *) ((s != NULL)
-			   ? LL_GetFirst(s->widgetlist)
-			   : NULL);
+	return ((s != NULL) && (LL_ListLength(&s->widgetlist) > 0))
+	       ? LL_ENTRY(s->widgetlist.anchor.next, Widget, link)
+	       : NULL;
 }
 
-static inline Widget *screen_getnext_widget(Screen *s)
+static inline Widget *screen_getnext_widget(Screen *s, Widget *w)
 {
-	return (Widget *) ((s != NULL)
-			   ? LL_GetNext(s->widgetlist)
-			   : NULL);
+	return ((s != NULL) && (w != NULL) && (w->link.next != &s->widgetlist.anchor))
+	       ? LL_ENTRY(w->link.next, Widget, link)
+	       : NULL;
 }
 
 
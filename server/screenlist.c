@@ -24,6 +24,7 @@
 #include "screenlist.h"
 
 #include "main.h" /* for timer */
+#include "stats.h"
 
 /* Local functions */
 int compare_priority(void *one, void *two);
@@ -198,6 +199,7 @@ screenlist_switch(Screen *s)
 		/* It's a server screen, no need to inform it. */
 	}
 	report(RPT_INFO, "%s: switched to screen [%.40s]", __FUNCTION__, s->id);
+	stats_inc(STAT_SCREEN_SWITCHES);
 	current_screen = s;
 	current_screen_start_time = timer;
 }
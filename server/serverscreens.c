@@ -170,7 +170,7 @@ update_server_screen(void)
 	}
 
 	/* ... and screens */
-	for (c = clients_getfirst(); c != NULL; c = clients_getnext()) {
+	for (c = clients_getfirst(); c != NULL; c = clients_getnext(c)) {
 		num_screens += client_screen_count(c);
 	}
 
@@ -17,6 +17,10 @@
  *               2009, Markus Dolze - input ring buffer
  */
 
+#ifdef __linux__
+# define _GNU_SOURCE		/* for struct ucred */
+#endif
+
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
@@ -34,6 +38,7 @@
 #include <arpa/inet.h>
 #include <sys/time.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <fcntl.h>
 #include <string.h>
 
@@ -43,11 +48,13 @@
 
 #include "clients.h"
 #include "sock.h"
+#include "stats.h"
 
 
 /****************************************************************************/
 static fd_set active_fd_set, read_fd_set;
 static int listening_fd;
+static int unix_listening_fd = -1;
 
 /* For efficiency we maintain a list of open sockets. Nodes in this list
  * are obtained from a pre-allocated pool - this removes heap operations
@@ -71,6 +78,9 @@ typedef struct _ClientSocketMap
  * is obtained from the freeClientSocketPool array. */
 ClientSocketMap *freeClientSocketPool;
 
+/* Clients by socket, to account the data sent to them */
+static Client **socketClients;
+
 
 /* Length of longest transmission allowed at once...*/
 #define MAXMSG 8192
@@ -78,21 +88,27 @@ ClientSocketMap *freeClientSocketPool;
 /**** Internal function declarations ****************************************/
 static int sock_read_from_client(ClientSocketMap *clientSocketMap);
 static void sock_destroy_socket(void);
+static void sock_count_sent(int fd, size_t size);
+static void sock_get_peer_credentials(int sock, long *pid, long *uid);
 
 
 /** Initialize sockets.
  * Prepare server socket, and initialize socket management structures.
  * \param bind_addr       Hostname / IP address to bind to.
  * \param bind_port       Port to bind to.
+ * \param unix_path       Path of a UNIX socket to listen on as well;
+ *                        a leading '@' selects the abstract namespace.
+ *                        May be \c NULL.
  * \retval  <0            error
  * \retval   0            success
  */
 int
-sock_init(char* bind_addr, int bind_port)
+sock_init(char* bind_addr, int bind_port, const char *unix_path)
 {
 	int i;
 
-	debug(RPT_DEBUG, "%s(bind_addr=\"%s\", port=%d)", __FUNCTION__, bind_addr, bind_port);
+	debug(RPT_DEBUG, "%s(bind_addr=\"%s\", port=%d, unix_path=\"%s\")", __FUNCTION__,
+	      bind_addr, bind_port, (unix_path != NULL) ? unix_path : "");
 
 	/* Create the socket and set it up to accept connections. */
 	listening_fd = sock_create_inet_socket(bind_addr, bind_port);
@@ -102,6 +118,12 @@ sock_init(char* bind_addr, int bind_port)
 		return -1;
 	}
 
+	if ((unix_path != NULL) && (*unix_path != '\0')) {
+		unix_listening_fd = sock_create_unix_socket(unix_path);
+		if (unix_listening_fd < 0)
+			return -1;
+	}
+
 	/* Create the socket -> Client mapping pool */
 	/* How large can FD_SETSIZE be? Even if it is ~2000 this only uses a
 	   few kilobytes of memory. Let's trade size for speed! */
@@ -123,6 +145,14 @@ sock_init(char* bind_addr, int bind_port)
 		LL_AddNode(freeClientSocketList, (void*) &freeClientSocketPool[i]);
 	}
 
+	socketClients = calloc(FD_SETSIZE, sizeof(Client *));
+	if (socketClients == NULL) {
+		report(RPT_ERR, "%s: Error allocating client sockets.",
+			__FUNCTION__);
+		return -1;
+	}
+	sock_send_callback = sock_count_sent;
+
 	/* Create and initialize the open socket list with the server socket */
 	openSocketList = LL_new();
 	if (openSocketList == NULL) {
@@ -137,6 +167,13 @@ sock_init(char* bind_addr, int bind_port)
 		entry->socket = listening_fd;
 		entry->client = NULL;
 		LL_AddNode(openSocketList, (void*) entry);
+
+		if (unix_listening_fd >= 0) {
+			entry = (ClientSocketMap*) LL_Pop(freeClientSocketList);
+			entry->socket = unix_listening_fd;
+			entry->client = NULL;
+			LL_AddNode(openSocketList, (void*) entry);
+		}
 	}
 
 	if ((messageRing = sring_create(MAXMSG)) == NULL) {
@@ -180,6 +217,14 @@ sock_shutdown(void)
                   LL_Destroy(openSocketList);
         */
 	close(listening_fd);
+	/* The socket file is not removed here: after dropping privileges
+	 * that may not be allowed any more. The next start replaces it. */
+	if (unix_listening_fd >= 0) {
+		close(unix_listening_fd);
+		unix_listening_fd = -1;
+	}
+	sock_send_callback = NULL;
+	free(socketClients);
 	LL_Destroy(freeClientSocketList);
 	free(freeClientSocketPool);
 	sring_destroy(messageRing);
@@ -247,6 +292,85 @@ sock_create_inet_socket(char *addr, unsigned int port)
 }
 
 
+/** Create a UNIX socket, bind to it and listen on it.
+ * Must be called after sock_create_inet_socket(), which resets the set
+ * of sockets select() waits for.
+ * \param path       Path of the socket; a leading '@' selects the
+ *                   abstract namespace, which leaves no file behind.
+ * \retval  <0       error
+ * \return           the socket on success
+ */
+int
+sock_create_unix_socket(const char *path)
+{
+	struct sockaddr_un name;
+	socklen_t len;
+	int sock;
+	int abstract = (path[0] == '@');
+
+	debug(RPT_DEBUG, "%s(path=\"%s\")", __FUNCTION__, path);
+
+	if (strlen(path) >= sizeof(name.sun_path)) {
+		report(RPT_ERR, "%s: socket path too long: %s", __FUNCTION__, path);
+		return -1;
+	}
+#ifndef __linux__
+	if (abstract) {
+		report(RPT_ERR, "%s: abstract sockets are only available on Linux",
+			__FUNCTION__);
+		return -1;
+	}
+#endif
+
+	sock = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		report(RPT_ERR, "%s: cannot create socket - %s",
+			__FUNCTION__, sock_geterror());
+		return -1;
+	}
+
+	memset(&name, 0, sizeof(name));
+	name.sun_family = AF_UNIX;
+	strcpy(name.sun_path, path);
+	if (abstract) {
+		/* The name starts with a NUL byte and is not terminated */
+		name.sun_path[0] = '\0';
+		len = offsetof(struct sockaddr_un, sun_path) + strlen(path);
+	}
+	else {
+		/* Remove the socket a previous instance left behind */
+		if (sock_unlink_stale(path) < 0) {
+			close(sock);
+			return -1;
+		}
+		len = sizeof(name);
+	}
+
+	if (bind(sock, (struct sockaddr *) &name, len) < 0) {
+		report(RPT_ERR, "%s: cannot bind to %s - %s",
+			__FUNCTION__, path, sock_geterror());
+		close(sock);
+		return -1;
+	}
+	/* Local clients may connect over TCP anyway */
+	if (!abstract)
+		chmod(path, 0666);
+
+	if (listen(sock, SOMAXCONN) < 0) {
+		report(RPT_ERR, "%s: error in attempting to listen to %s - %s",
+			__FUNCTION__, path, sock_geterror());
+		close(sock);
+		return -1;
+	}
+
+	report(RPT_NOTICE, "Listening for queries on %s", path);
+
+	FD_SET(sock, &active_fd_set);
+
+	return sock;
+}
+
+
 /** Service all clients with pending input.
  * \retval  <0       error
  * \retval   0       success
@@ -278,21 +402,37 @@ sock_poll_clients(void)
 	     clientSocket = LL_GetNext(openSocketList)) {
 
 		if (FD_ISSET(clientSocket->socket, &read_fd_set)) {
-			if (clientSocket->socket == listening_fd) {
-				/* Connection request on original socket. */
+			if ((clientSocket->socket == listening_fd)
+			    || (clientSocket->socket == unix_listening_fd)) {
+				/* Connection request on a listening socket. */
 				Client *c;
 				int new_sock;
-				struct sockaddr_in clientname;
-				socklen_t size = sizeof(clientname);
+				long peer_pid = -1, peer_uid = -1;
 
-				new_sock = accept(listening_fd, (struct sockaddr *) &clientname, &size);
-				if (new_sock < 0) {
-					report(RPT_ERR, "%s: Accept error - %s",
-						__FUNCTION__, sock_geterror());
-					return -1;
+				if (clientSocket->socket == listening_fd) {
+					struct sockaddr_in clientname;
+					socklen_t size = sizeof(clientname);
+
+					new_sock = accept(listening_fd, (struct sockaddr *) &clientname, &size);
+					if (new_sock < 0) {
+						report(RPT_ERR, "%s: Accept error - %s",
+							__FUNCTION__, sock_geterror());
+						return -1;
+					}
+					report(RPT_NOTICE, "Connect from host %s:%hu on socket %i",
+						inet_ntoa(clientname.sin_addr), ntohs(clientname.sin_port), new_sock);
+				}
+				else {
+					new_sock = accept(unix_listening_fd, NULL, NULL);
+					if (new_sock < 0) {
+						report(RPT_ERR, "%s: Accept error - %s",
+							__FUNCTION__, sock_geterror());
+						return -1;
+					}
+					sock_get_peer_credentials(new_sock, &peer_pid, &peer_uid);
+					report(RPT_NOTICE, "Connect from pid %ld, uid %ld on socket %i",
+						peer_pid, peer_uid, new_sock);
 				}
-				report(RPT_NOTICE, "Connect from host %s:%hu on socket %i",
-					inet_ntoa(clientname.sin_addr), ntohs(clientname.sin_port), new_sock);
 				FD_SET(new_sock, &active_fd_set);
 
 				fcntl(new_sock, F_SETFL, O_NONBLOCK);
@@ -304,6 +444,12 @@ sock_poll_clients(void)
 					return -1;
 				}
 				else {
+					c->peer_pid = peer_pid;
+					c->peer_uid = peer_uid;
+					stats_inc(STAT_CONNECTS);
+					if (new_sock < FD_SETSIZE)
+						socketClients[new_sock] = c;
+
 					/* add new_sock */
 					ClientSocketMap *newClientSocket;
 					newClientSocket = (ClientSocketMap *) LL_Pop(freeClientSocketList);
@@ -360,6 +506,9 @@ sock_read_from_client(ClientSocketMap *clientSocketMap)
 		char *str;
 
 		debug(RPT_DEBUG, "%s: received %4d bytes", __FUNCTION__, nbytes);
+		stats_add(STAT_BYTES_IN, nbytes);
+		if (clientSocketMap->client)
+			clientSocketMap->client->bytes_in += nbytes;
 
 		/* Append to ring buffer */
 		sring_write(messageRing, buffer, nbytes);
@@ -396,6 +545,48 @@ sock_read_from_client(ClientSocketMap *clientSocketMap)
 }
 
 
+/** Find out which process connected on a UNIX socket.
+ * \param sock  The connected socket.
+ * \param pid   Set to the peer's process id; -1 if unknown.
+ * \param uid   Set to the peer's user id; -1 if unknown.
+ */
+static void
+sock_get_peer_credentials(int sock, long *pid, long *uid)
+{
+#if defined(SO_PEERCRED) && (defined(__linux__) || defined(__OpenBSD__))
+# ifdef __OpenBSD__
+	struct sockpeercred cred;
+# else
+	struct ucred cred;
+# endif
+	socklen_t len = sizeof(cred);
+
+	if (getsockopt(sock, SOL_SOCKET, SO_PEERCRED, &cred, &len) == 0) {
+		*pid = cred.pid;
+		*uid = cred.uid;
+		return;
+	}
+	report(RPT_WARNING, "%s: cannot get credentials of socket %i - %s",
+		__FUNCTION__, sock, sock_geterror());
+#endif
+	*pid = -1;
+	*uid = -1;
+}
+
+
+/** Account data sent to a client; called by sock_send().
+ * \param fd    Socket the data was sent on.
+ * \param size  Number of bytes sent.
+ */
+static void
+sock_count_sent(int fd, size_t size)
+{
+	stats_add(STAT_BYTES_OUT, size);
+	if ((fd >= 0) && (fd < FD_SETSIZE) && (socketClients[fd] != NULL))
+		socketClients[fd]->bytes_out += size;
+}
+
+
 /* comparison function to find a ClientsocketMap entry by client */
 int byClient(void *csm, void *client)
 {
@@ -435,8 +626,11 @@ sock_destroy_socket(void)
 		if (entry->client != NULL) {
 			report(RPT_NOTICE, "Client on socket %i disconnected",
 				entry->socket);
+			stats_inc(STAT_DISCONNECTS);
+			if (entry->socket < FD_SETSIZE)
+				socketClients[entry->socket] = NULL;
+			clients_remove_client(entry->client);
 			client_destroy(entry->client);
-			clients_remove_client(entry->client, PREV);
 			entry->client = NULL;
 		}
 		else {
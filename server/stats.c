@@ -0,0 +1,634 @@
+/** \file server/stats.c
+ * This file contains the counters and histograms that describe what the
+ * server is doing: commands parsed, traffic per client, time spent
+ * rendering and flushing the drivers, and so on.
+ *
+ * Counting has to be cheap enough to leave it on all the time. Every thread
+ * updates its own shard of the counters without contention; the shards are
+ * only summed up when the statistics are requested, either by the \c stats
+ * command or through the optional UNIX socket.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#include <unistd.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdarg.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "shared/report.h"
+#include "shared/sockets.h"
+#include "shared/LL.h"
+
+#include "clients.h"
+#include "commands/command_list.h"
+#include "stats.h"
+
+/** Number of threads that get a shard of their own */
+#define STATS_MAX_SHARDS	8
+/** Number of drivers whose flushes are recorded */
+#define STATS_MAX_DRIVERS	16
+/** Number of histogram buckets, including the overflow bucket */
+#define STATS_BUCKETS		12
+
+/** Upper bounds of the histogram buckets in microseconds */
+static const long bucket_bounds[STATS_BUCKETS - 1] = {
+	10, 50, 100, 250, 500, 1000, 2500, 5000, 10000, 50000, 100000
+};
+
+/** A histogram of durations */
+typedef struct StatsHistogram {
+	unsigned long buckets[STATS_BUCKETS];	/**< Observations per bucket */
+	unsigned long long sum;			/**< Sum of all observations in us */
+} StatsHistogram;
+
+/** The counters updated by one thread */
+typedef struct StatsShard {
+	unsigned long counters[STAT_NUM_COUNTERS];
+	StatsHistogram hists[STAT_NUM_HISTOGRAMS];
+} StatsShard;
+
+/** Flush statistics of a driver */
+typedef struct DriverStats {
+	char name[32];
+	StatsHistogram flush;
+} DriverStats;
+
+/** Growing buffer for the formatted statistics */
+typedef struct StatsText {
+	char *buf;
+	size_t len;
+	size_t size;
+} StatsText;
+
+static const char *counter_names[STAT_NUM_COUNTERS] = {
+	"lcdd_parse_errors_total",
+	"lcdd_invalid_commands_total",
+	"lcdd_command_errors_total",
+	"lcdd_received_bytes_total",
+	"lcdd_sent_bytes_total",
+	"lcdd_connects_total",
+	"lcdd_disconnects_total",
+	"lcdd_frames_rendered_total",
+	"lcdd_frames_presented_total",
+	"lcdd_frames_skipped_total",
+	"lcdd_screen_switches_total",
+	"lcdd_keys_total",
+	"lcdd_missed_deadlines_total",
+};
+
+static const char *counter_help[STAT_NUM_COUNTERS] = {
+	"Commands that could not be parsed.",
+	"Commands that do not exist.",
+	"Commands that returned an error.",
+	"Bytes received from clients.",
+	"Bytes sent to clients.",
+	"Clients that connected.",
+	"Clients that disconnected.",
+	"Frames rendered.",
+	"Frames presented on the drivers.",
+	"Frames superseded before they were presented.",
+	"Changes of the screen being shown.",
+	"Keys read from the drivers.",
+	"Frames that were not rendered when they were due.",
+};
+
+static const char *gauge_names[STAT_NUM_GAUGES] = {
+	"lcdd_frame_rate",
+	"lcdd_render_load_ratio",
+};
+
+static const char *gauge_help[STAT_NUM_GAUGES] = {
+	"Frames per second the main loop aims for.",
+	"Share of the time spent rendering and presenting, averaged.",
+};
+
+static const char *hist_names[STAT_NUM_HISTOGRAMS] = {
+	"lcdd_render_seconds",
+	"lcdd_present_seconds",
+	"lcdd_input_latency_seconds",
+};
+
+static const char *hist_help[STAT_NUM_HISTOGRAMS] = {
+	"Time to render a screen.",
+	"Time to replay a frame on all drivers.",
+	"Time from reading a key to the next frame being presented.",
+};
+
+static StatsShard shards[STATS_MAX_SHARDS];
+static int num_shards = 0;
+
+#ifdef HAVE_PTHREAD
+static __thread StatsShard *my_shard = NULL;
+#else
+static StatsShard *my_shard = NULL;
+#endif
+
+static double gauges[STAT_NUM_GAUGES];
+
+static DriverStats driver_stats[STATS_MAX_DRIVERS];
+static int num_driver_stats = 0;
+
+static struct timeval key_time;		/**< When the oldest unshown key was read */
+static int key_pending = 0;		/**< A key has been read since the last frame */
+
+static time_t start_time;
+static int stats_fd = -1;
+static char *stats_path = NULL;
+
+static void stats_observe_hist(StatsHistogram *h, long usec);
+static void stats_printf(StatsText *t, const char *format, ...);
+static void stats_format_hist(StatsText *t, const char *name, const char *labels,
+			      const StatsHistogram *h);
+static void stats_format_label(StatsText *t, const char *value);
+
+
+/**
+ * Set up the statistics.
+ * \param socket_path  Path of a UNIX socket serving the statistics, or NULL.
+ * \retval  <0         error.
+ * \retval   0         success.
+ */
+int
+stats_init(const char *socket_path)
+{
+	struct sockaddr_un addr;
+
+	debug(RPT_DEBUG, "%s(socket=\"%s\")", __FUNCTION__,
+	      (socket_path != NULL) ? socket_path : "(null)");
+
+	start_time = time(NULL);
+
+	if ((socket_path == NULL) || (*socket_path == '\0'))
+		return 0;
+
+	if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+		report(RPT_ERR, "%s: socket path too long: %s", __FUNCTION__, socket_path);
+		return -1;
+	}
+
+	if (sock_unlink_stale(socket_path) < 0)
+		return -1;
+
+	stats_fd = socket(PF_UNIX, SOCK_STREAM, 0);
+	if (stats_fd < 0) {
+		report(RPT_ERR, "%s: cannot create socket - %s", __FUNCTION__, strerror(errno));
+		return -1;
+	}
+
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	strcpy(addr.sun_path, socket_path);
+
+	if ((bind(stats_fd, (struct sockaddr *) &addr, sizeof(addr)) < 0)
+	    || (listen(stats_fd, 4) < 0)) {
+		report(RPT_ERR, "%s: cannot listen on %s - %s",
+		       __FUNCTION__, socket_path, strerror(errno));
+		close(stats_fd);
+		stats_fd = -1;
+		return -1;
+	}
+	fcntl(stats_fd, F_SETFL, O_NONBLOCK);
+	fcntl(stats_fd, F_SETFD, FD_CLOEXEC);
+	stats_path = strdup(socket_path);
+
+	report(RPT_NOTICE, "Serving statistics on %s", socket_path);
+	return 0;
+}
+
+
+/**
+ * Close the statistics socket.
+ */
+void
+stats_shutdown(void)
+{
+	debug(RPT_DEBUG, "%s()", __FUNCTION__);
+
+	if (stats_fd >= 0) {
+		close(stats_fd);
+		stats_fd = -1;
+	}
+	if (stats_path != NULL) {
+		unlink(stats_path);
+		free(stats_path);
+		stats_path = NULL;
+	}
+}
+
+
+/* Get the shard of the calling thread */
+static inline StatsShard *
+stats_shard(void)
+{
+	if (my_shard == NULL) {
+		int i = __atomic_fetch_add(&num_shards, 1, __ATOMIC_RELAXED);
+
+		/* Threads beyond the limit share the last shard */
+		my_shard = &shards[(i < STATS_MAX_SHARDS) ? i : STATS_MAX_SHARDS - 1];
+	}
+	return my_shard;
+}
+
+
+/**
+ * Count events.
+ * \param counter  The counter to increase.
+ * \param value    Number of events.
+ */
+void
+stats_add(StatCounter counter, unsigned long value)
+{
+	__atomic_fetch_add(&stats_shard()->counters[counter], value, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Set a gauge. Gauges are not sharded: only the main thread, which also
+ * formats the statistics, may set them.
+ * \param gauge  The gauge to set.
+ * \param value  Its new value.
+ */
+void
+stats_set_gauge(StatGauge gauge, double value)
+{
+	gauges[gauge] = value;
+}
+
+
+/**
+ * Record a duration.
+ * \param hist  The histogram to record it in.
+ * \param usec  The duration in microseconds.
+ */
+void
+stats_observe(StatHistogram hist, long usec)
+{
+	stats_observe_hist(&stats_shard()->hists[hist], usec);
+}
+
+
+/**
+ * Record the duration of a driver's flush().
+ * Must only be called by the thread driving the displays.
+ * \param name  Name of the driver.
+ * \param usec  The duration in microseconds.
+ */
+void
+stats_driver_flush(const char *name, long usec)
+{
+	int i;
+
+	for (i = 0; i < num_driver_stats; i++) {
+		if (strcmp(driver_stats[i].name, name) == 0)
+			break;
+	}
+	if (i == num_driver_stats) {
+		if (num_driver_stats == STATS_MAX_DRIVERS)
+			return;
+		strncpy(driver_stats[i].name, name, sizeof(driver_stats[i].name) - 1);
+		num_driver_stats++;
+	}
+	stats_observe_hist(&driver_stats[i].flush, usec);
+}
+
+
+/**
+ * Note that a key has been read; the time until the next frame is presented
+ * is the latency of the key. Must be called by the main thread.
+ */
+void
+stats_key_read(void)
+{
+	stats_inc(STAT_KEYS);
+	if (!key_pending) {
+		gettimeofday(&key_time, NULL);
+		key_pending = 1;
+	}
+}
+
+
+/**
+ * Note that a frame has been presented on the drivers.
+ * Must be called by the main thread.
+ */
+void
+stats_frame_presented(void)
+{
+	stats_inc(STAT_FRAMES_PRESENTED);
+	if (key_pending) {
+		stats_observe(STAT_INPUT_LATENCY, stats_usec_since(&key_time));
+		key_pending = 0;
+	}
+}
+
+
+/**
+ * Get the microseconds elapsed since a point in time.
+ * \param start  The point in time, from gettimeofday().
+ * \return  Elapsed time in microseconds.
+ */
+long
+stats_usec_since(const struct timeval *start)
+{
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	return (now.tv_sec - start->tv_sec) * 1000000L + (now.tv_usec - start->tv_usec);
+}
+
+
+static void
+stats_observe_hist(StatsHistogram *h, long usec)
+{
+	int b;
+
+	if (usec < 0)
+		usec = 0;
+	for (b = 0; (b < STATS_BUCKETS - 1) && (usec > bucket_bounds[b]); b++)
+		;
+	__atomic_fetch_add(&h->buckets[b], 1, __ATOMIC_RELAXED);
+	__atomic_fetch_add(&h->sum, usec, __ATOMIC_RELAXED);
+}
+
+
+/**
+ * Format all statistics in the Prometheus text exposition format.
+ * Must be called by the main thread, as it reads the client list.
+ * \param comments  Include the HELP and TYPE comments.
+ * \return  The text, to be freed by the caller, or NULL on error.
+ */
+char *
+stats_format(int comments)
+{
+	StatsText t = { NULL, 0, 0 };
+	StatsHistogram sum;
+	const ArenaStats *mem;
+	Client *c;
+	int i, j, b;
+
+	stats_printf(&t, "");
+
+	if (comments)
+		stats_printf(&t, "# HELP lcdd_uptime_seconds Time since the server started.\n"
+				 "# TYPE lcdd_uptime_seconds gauge\n");
+	stats_printf(&t, "lcdd_uptime_seconds %ld\n", (long) (time(NULL) - start_time));
+
+	/* Sum up the shards */
+	for (i = 0; i < STAT_NUM_COUNTERS; i++) {
+		unsigned long value = 0;
+
+		for (j = 0; j < STATS_MAX_SHARDS; j++)
+			value += __atomic_load_n(&shards[j].counters[i], __ATOMIC_RELAXED);
+
+		if (comments)
+			stats_printf(&t, "# HELP %s %s\n# TYPE %s counter\n",
+				     counter_names[i], counter_help[i], counter_names[i]);
+		stats_printf(&t, "%s %lu\n", counter_names[i], value);
+	}
+
+	for (i = 0; i < STAT_NUM_GAUGES; i++) {
+		if (comments)
+			stats_printf(&t, "# HELP %s %s\n# TYPE %s gauge\n",
+				     gauge_names[i], gauge_help[i], gauge_names[i]);
+		stats_printf(&t, "%s %g\n", gauge_names[i], gauges[i]);
+	}
+
+	for (i = 0; i < STAT_NUM_HISTOGRAMS; i++) {
+		memset(&sum, 0, sizeof(sum));
+		for (j = 0; j < STATS_MAX_SHARDS; j++) {
+			for (b = 0; b < STATS_BUCKETS; b++)
+				sum.buckets[b] += __atomic_load_n(&shards[j].hists[i].buckets[b], __ATOMIC_RELAXED);
+			sum.sum += __atomic_load_n(&shards[j].hists[i].sum, __ATOMIC_RELAXED);
+		}
+
+		if (comments)
+			stats_printf(&t, "# HELP %s %s\n# TYPE %s histogram\n",
+				     hist_names[i], hist_help[i], hist_names[i]);
+		stats_format_hist(&t, hist_names[i], "", &sum);
+	}
+
+	/* Commands by type */
+	if (comments)
+		stats_printf(&t, "# HELP lcdd_commands_total Commands parsed.\n"
+				 "# TYPE lcdd_commands_total counter\n");
+	for (i = 0; ; i++) {
+		unsigned long count;
+		const char *keyword = get_command_stats(i, &count);
+
+		if (keyword == NULL)
+			break;
+		if (count > 0)
+			stats_printf(&t, "lcdd_commands_total{command=\"%s\"} %lu\n", keyword, count);
+	}
+
+	/* Drivers */
+	if (comments)
+		stats_printf(&t, "# HELP lcdd_driver_flush_seconds Time spent in a driver's flush().\n"
+				 "# TYPE lcdd_driver_flush_seconds histogram\n");
+	for (i = 0; i < num_driver_stats; i++) {
+		StatsText labels = { NULL, 0, 0 };
+
+		stats_printf(&labels, "driver=");
+		stats_format_label(&labels, driver_stats[i].name);
+		stats_printf(&labels, ",");
+		if (labels.buf != NULL)
+			stats_format_hist(&t, "lcdd_driver_flush_seconds", labels.buf, &driver_stats[i].flush);
+		free(labels.buf);
+	}
+
+	/* Clients */
+	if (comments)
+		stats_printf(&t, "# HELP lcdd_clients Clients connected.\n"
+				 "# TYPE lcdd_clients gauge\n");
+	stats_printf(&t, "lcdd_clients %d\n", clients_client_count());
+
+	if (comments)
+		stats_printf(&t, "# HELP lcdd_client_queue_depth Messages of a client waiting to be parsed.\n"
+				 "# TYPE lcdd_client_queue_depth gauge\n"
+				 "# HELP lcdd_client_received_bytes_total Bytes received from a client.\n"
+				 "# TYPE lcdd_client_received_bytes_total counter\n"
+				 "# HELP lcdd_client_sent_bytes_total Bytes sent to a client.\n"
+				 "# TYPE lcdd_client_sent_bytes_total counter\n"
+				 "# HELP lcdd_client_commands_total Commands parsed for a client.\n"
+				 "# TYPE lcdd_client_commands_total counter\n"
+				 "# HELP lcdd_client_memory_bytes Memory in use by a client's screens and widgets.\n"
+				 "# TYPE lcdd_client_memory_bytes gauge\n"
+				 "# HELP lcdd_client_memory_reserved_bytes Memory reserved by a client's arena.\n"
+				 "# TYPE lcdd_client_memory_reserved_bytes gauge\n"
+				 "# HELP lcdd_client_allocations_total Allocations made for a client.\n"
+				 "# TYPE lcdd_client_allocations_total counter\n");
+	for (c = clients_getfirst(); c != NULL; c = clients_getnext(c)) {
+		StatsText labels = { NULL, 0, 0 };
+
+		stats_printf(&labels, "socket=\"%d\",name=", c->sock);
+		stats_format_label(&labels, (c->name != NULL) ? c->name : "");
+		if (c->peer_pid >= 0)
+			stats_printf(&labels, ",pid=\"%ld\",uid=\"%ld\"",
+				     c->peer_pid, c->peer_uid);
+		if (labels.buf == NULL)
+			continue;
+
+		stats_printf(&t, "lcdd_client_queue_depth{%s} %d\n",
+			     labels.buf, LL_Length(c->messages));
+		stats_printf(&t, "lcdd_client_received_bytes_total{%s} %lu\n",
+			     labels.buf, c->bytes_in);
+		stats_printf(&t, "lcdd_client_sent_bytes_total{%s} %lu\n",
+			     labels.buf, c->bytes_out);
+		stats_printf(&t, "lcdd_client_commands_total{%s} %lu\n",
+			     labels.buf, c->commands);
+		mem = arena_stats(c->arena);
+		stats_printf(&t, "lcdd_client_memory_bytes{%s} %lu\n",
+			     labels.buf, (unsigned long) mem->in_use);
+		stats_printf(&t, "lcdd_client_memory_reserved_bytes{%s} %lu\n",
+			     labels.buf, (unsigned long) mem->reserved);
+		stats_printf(&t, "lcdd_client_allocations_total{%s} %lu\n",
+			     labels.buf, mem->allocs);
+		free(labels.buf);
+	}
+
+	if (t.buf == NULL)
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+	return t.buf;
+}
+
+
+/**
+ * Serve the pending requests on the statistics socket: every connection
+ * gets the current statistics and is closed.
+ */
+void
+stats_poll(void)
+{
+	int fd;
+
+	if (stats_fd < 0)
+		return;
+
+	while ((fd = accept(stats_fd, NULL, NULL)) >= 0) {
+		char *text = stats_format(1);
+		struct timeval timeout = { 0, 100000 };
+
+		/* Don't let a reader that does not read stall the server */
+		setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+		if (text != NULL) {
+			size_t len = strlen(text);
+			size_t offset = 0;
+
+			while (offset < len) {
+				ssize_t n = write(fd, text + offset, len - offset);
+
+				if (n <= 0)
+					break;
+				offset += n;
+			}
+			free(text);
+		}
+		close(fd);
+	}
+}
+
+
+/* Append to a StatsText; on error the text is freed and set to NULL */
+static void
+stats_printf(StatsText *t, const char *format, ...)
+{
+	va_list ap;
+	char *buf;
+	int n;
+
+	if ((t->buf == NULL) && (t->size > 0))
+		return;		/* earlier error */
+
+	while (1) {
+		if (t->buf != NULL) {
+			va_start(ap, format);
+			n = vsnprintf(t->buf + t->len, t->size - t->len, format, ap);
+			va_end(ap);
+			if ((n >= 0) && (n < t->size - t->len)) {
+				t->len += n;
+				return;
+			}
+		}
+
+		buf = realloc(t->buf, (t->size == 0) ? 4096 : 2 * t->size);
+		if (buf == NULL) {
+			free(t->buf);
+			t->buf = NULL;
+			return;
+		}
+		t->buf = buf;
+		t->size = (t->size == 0) ? 4096 : 2 * t->size;
+		t->buf[t->len] = '\0';
+	}
+}
+
+
+static void
+stats_format_hist(StatsText *t, const char *name, const char *labels, const StatsHistogram *h)
+{
+	unsigned long count = 0;
+	int b;
+
+	for (b = 0; b < STATS_BUCKETS; b++) {
+		count += h->buckets[b];
+		if (b < STATS_BUCKETS - 1)
+			stats_printf(t, "%s_bucket{%sle=\"%g\"} %lu\n",
+				     name, labels, bucket_bounds[b] / 1e6, count);
+		else
+			stats_printf(t, "%s_bucket{%sle=\"+Inf\"} %lu\n", name, labels, count);
+	}
+	if (*labels != '\0') {
+		/* strip the trailing comma */
+		int len = strlen(labels) - 1;
+
+		stats_printf(t, "%s_sum{%.*s} %.6f\n", name, len, labels, h->sum / 1e6);
+		stats_printf(t, "%s_count{%.*s} %lu\n", name, len, labels, count);
+	}
+	else {
+		stats_printf(t, "%s_sum %.6f\n", name, h->sum / 1e6);
+		stats_printf(t, "%s_count %lu\n", name, count);
+	}
+}
+
+
+/* Append a quoted label value, escaping as the text format requires */
+static void
+stats_format_label(StatsText *t, const char *value)
+{
+	char buf[2 * CLIENT_NAME_SIZE + 3];
+	int i = 0;
+
+	buf[i++] = '"';
+	for (; (*value != '\0') && (i < sizeof(buf) - 3); value++) {
+		if ((*value == '"') || (*value == '\\')) {
+			buf[i++] = '\\';
+			buf[i++] = *value;
+		}
+		else if (*value == '\n') {
+			buf[i++] = '\\';
+			buf[i++] = 'n';
+		}
+		else
+			buf[i++] = *value;
+	}
+	buf[i++] = '"';
+	buf[i] = '\0';
+
+	stats_printf(t, "%s", buf);
+}
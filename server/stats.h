@@ -0,0 +1,79 @@
+/** \file server/stats.h
+ * Defines the counters and histograms describing what the server is doing.
+ */
+
+/* This file is part of LCDd, the lcdproc server.
+ *
+ * This file is released under the GNU General Public License.
+ * Refer to the COPYING file distributed with this package.
+ */
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/time.h>
+
+/** Event counters of the server */
+typedef enum {
+	STAT_PARSE_ERRORS,	/**< Commands that could not be parsed */
+	STAT_INVALID_COMMANDS,	/**< Commands that do not exist */
+	STAT_COMMAND_ERRORS,	/**< Command functions returning an error */
+	STAT_BYTES_IN,		/**< Bytes received from clients */
+	STAT_BYTES_OUT,		/**< Bytes sent to clients */
+	STAT_CONNECTS,		/**< Clients that connected */
+	STAT_DISCONNECTS,	/**< Clients that disconnected */
+	STAT_FRAMES_RENDERED,	/**< Frames composed by the renderer */
+	STAT_FRAMES_PRESENTED,	/**< Frames replayed on the drivers */
+	STAT_FRAMES_SKIPPED,	/**< Frames superseded before being presented */
+	STAT_SCREEN_SWITCHES,	/**< Changes of the screen being shown */
+	STAT_KEYS,		/**< Keys read from the drivers */
+	STAT_MISSED_DEADLINES,	/**< Frames not rendered when they were due */
+	STAT_NUM_COUNTERS
+} StatCounter;
+
+/** Values set by the server */
+typedef enum {
+	STAT_FRAME_RATE,	/**< Frames per second the main loop aims for */
+	STAT_RENDER_LOAD,	/**< Share of the time spent rendering and presenting */
+	STAT_NUM_GAUGES
+} StatGauge;
+
+/** Durations recorded by the server */
+typedef enum {
+	STAT_RENDER_TIME,	/**< Time to render a screen */
+	STAT_PRESENT_TIME,	/**< Time to replay a frame on all drivers */
+	STAT_INPUT_LATENCY,	/**< Time from reading a key to the next frame being presented */
+	STAT_NUM_HISTOGRAMS
+} StatHistogram;
+
+/* Set up the statistics; socket_path is the optional path of a UNIX
+ * socket serving them in the Prometheus text format */
+int stats_init(const char *socket_path);
+void stats_shutdown(void);
+
+/* Count events */
+void stats_add(StatCounter counter, unsigned long value);
+#define stats_inc(counter)	stats_add((counter), 1)
+
+/* Set a gauge; must only be called by the main thread */
+void stats_set_gauge(StatGauge gauge, double value);
+
+/* Record durations in microseconds */
+void stats_observe(StatHistogram hist, long usec);
+void stats_driver_flush(const char *name, long usec);
+
+/* Measure the latency from a key press to the display */
+void stats_key_read(void);
+void stats_frame_presented(void);
+
+/* Microseconds elapsed since start */
+long stats_usec_since(const struct timeval *start);
+
+/* Format all statistics in the Prometheus text format; the text must
+ * be freed by the caller */
+char *stats_format(int comments);
+
+/* Serve pending requests on the statistics socket */
+void stats_poll(void);
+
+#endif
@@ -81,14 +81,24 @@ struct icontable {
 Widget *
 widget_create(char *id, WidgetType type, Screen *screen)
 {
+	Arena *arena = screen_arena(screen);
 	Widget *w;
 
 	debug(RPT_DEBUG, "%s(id=\"%s\", type=%d, screen=[%s])", __FUNCTION__, id, type, screen->id);
 
 	/* Create it */
-	w = calloc(1, sizeof(Widget));
+	w = arena_calloc(arena, sizeof(Widget));
+	if (w == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
 
-	w->id = strdup(id);
+	w->id = arena_strdup(arena, id);
+	if (w->id == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		arena_free(arena, w);
+		return NULL;
+	}
 	w->type = type;
 	w->screen = screen;
 	w->x = 1;
@@ -117,19 +127,24 @@ widget_create(char *id, WidgetType type, Screen *screen)
 void
 widget_destroy(Widget *w)
 {
-	debug(RPT_DEBUG, "%s(w=[%s])", __FUNCTION__, w->id);
+	Arena *arena;
 
 	if (!w)
 		return;
 
-	free(w->id);
-	free(w->text);
+	debug(RPT_DEBUG, "%s(w=[%s])", __FUNCTION__, w->id);
+
+	arena = screen_arena(w->screen);
+	arena_free(arena, w->id);
+	arena_free(arena, w->text);
+	arena_free(arena, w->begin_label);
+	arena_free(arena, w->end_label);
 
 	/* Free subscreen of frame widget too */
 	if (w->type == WID_FRAME)
 		screen_destroy(w->frame_screen);
 
-	free(w);
+	arena_free(arena, w);
 }
 
 
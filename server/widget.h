@@ -47,6 +47,7 @@ typedef struct Widget {
 	char *begin_label;		/**< label in front of pbars; or NULL */
 	char *end_label;		/**< label at end of pbars; or NULL */
 	struct Screen *frame_screen;	/**< frame widget get an associated screen */
+	LL_link link;			/**< In the screen's list of widgets */
 	//LinkedList *kids;		/* Frames can contain more widgets...*/
 } Widget;
 
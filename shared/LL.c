@@ -17,6 +17,15 @@
 
 #include <stdlib.h>
 #include <stdio.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
 #include "LL.h"
 
 #ifdef DEBUG
@@ -25,6 +34,71 @@
 
 //TODO: Test everything?
 
+/** Number of nodes allocated at once */
+#define LL_SLAB_NODES	64
+
+/** Nodes not in use by any list, linked by their \c next pointers */
+static LL_node *free_nodes = NULL;
+
+#ifdef HAVE_PTHREAD
+/* Lists are used by the drivers' init threads as well */
+static pthread_mutex_t free_nodes_mutex = PTHREAD_MUTEX_INITIALIZER;
+#endif
+
+
+/** Get a node from the free list, refilling it with a new slab when empty.
+ * Slabs are never returned to the system; lists rarely shrink for good.
+ * \return  Pointer to an unlinked node; \c NULL on error.
+ */
+static LL_node *
+LL_node_alloc(void)
+{
+	LL_node *node;
+
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&free_nodes_mutex);
+#endif
+	if (free_nodes == NULL) {
+		LL_node *slab = malloc(LL_SLAB_NODES * sizeof(LL_node));
+
+		if (slab != NULL) {
+			int i;
+
+			for (i = 0; i < LL_SLAB_NODES - 1; i++)
+				slab[i].next = &slab[i + 1];
+			slab[LL_SLAB_NODES - 1].next = NULL;
+			free_nodes = slab;
+		}
+	}
+	node = free_nodes;
+	if (node != NULL)
+		free_nodes = node->next;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&free_nodes_mutex);
+#endif
+
+	return node;
+}
+
+
+/** Put a node back on the free list.
+ * \param node  Node no longer linked into any list.
+ */
+static void
+LL_node_free(LL_node *node)
+{
+	node->prev = NULL;
+	node->data = NULL;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock(&free_nodes_mutex);
+#endif
+	node->next = free_nodes;
+	free_nodes = node;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock(&free_nodes_mutex);
+#endif
+}
+
 
 /** Create new linked list.
  * \return  Pointer to freshly created list object; \c NULL on error.
@@ -45,6 +119,7 @@ LL_new(void)
 	list->tail.prev = &list->head;
 	list->tail.next = NULL;
 	list->current = &list->head;
+	list->count = 0;
 
 	return list;
 }
@@ -80,10 +155,7 @@ LL_Destroy(LinkedList *list)
 		if (prev != NULL)
 			prev->next = next;
 
-		node->next = NULL;
-		node->prev = NULL;
-
-		free(node);
+		LL_node_free(node);
 	}
 
 	free(list);
@@ -377,7 +449,7 @@ LL_AddNode(LinkedList *list, void *add)
 	if (!list->current)
 		return -1;
 
-	node = malloc(sizeof(LL_node));
+	node = LL_node_alloc();
 	if (node == NULL)
 		return -1;
 
@@ -396,6 +468,7 @@ LL_AddNode(LinkedList *list, void *add)
 	list->current->next = node;
 
 	list->current = node;
+	list->count++;
 
 	return 0;
 }
@@ -420,7 +493,7 @@ LL_InsertNode(LinkedList *list, void *add)
 	if (!list->current)
 		return -1;
 
-	node = malloc(sizeof(LL_node));
+	node = LL_node_alloc();
 	if (node == NULL)
 		return -1;
 
@@ -437,6 +510,7 @@ LL_InsertNode(LinkedList *list, void *add)
 	list->current->prev = node;
 
 	list->current = node;
+	list->count++;
 
 	return 0;
 }
@@ -473,13 +547,10 @@ LL_DeleteNode(LinkedList *list, Direction whereto)
 	if (next)
 		next->prev = prev;
 
-	list->current->prev = NULL;
-	list->current->next = NULL;
 	// This should not free things; the user should do it explicitly.
 	//if(list->current->data) free(list->current->data);
-	list->current->data = NULL;
-
-	free(list->current);
+	LL_node_free(list->current);
+	list->count--;
 
 	switch (whereto) {
 		case HEAD:	list->current = list->head.next;
@@ -715,25 +786,17 @@ LL_SwapNodes(LL_node *one, LL_node *two)
 }
 
 
-/** Calculate the length of a list.
+/** Get the length of a list.
  * \param list   List object.
  * \return       Number of nodes in the list; \c -1 on error.
  */
 int
 LL_Length(LinkedList *list)
 {
-	LL_node *node;
-	int num = 0;
-
 	if (!list)
 		return -1;
 
-	node = &list->head;
-
-	for (num = -1; node != &list->tail; num++)
-		node = node->next;
-
-	return num;
+	return list->count;
 }
 
 
@@ -921,3 +984,72 @@ LL_dprint(LinkedList *list)
 
 	printf("Tail:  prev:\t0x%p\taddr:\t0x%p\tnext:\t0x%p\n", list->tail.prev, &list->tail, list->tail.next);
 }
+
+
+/** Initialize an empty intrusive list.
+ * \param list   List object.
+ */
+void
+LL_ListInit(LL_list *list)
+{
+	list->anchor.prev = &list->anchor;
+	list->anchor.next = &list->anchor;
+	list->count = 0;
+}
+
+
+/** Add a link before another one in an intrusive list.
+ * \param list   List object.
+ * \param pos    Link to insert before; the list's anchor to append.
+ * \param link   Link to add; must not be in any list.
+ */
+void
+LL_ListInsertBefore(LL_list *list, LL_link *pos, LL_link *link)
+{
+	link->next = pos;
+	link->prev = pos->prev;
+	pos->prev->next = link;
+	pos->prev = link;
+	list->count++;
+}
+
+
+/** Add a link at the end of an intrusive list.
+ * \param list   List object.
+ * \param link   Link to add; must not be in any list.
+ */
+void
+LL_ListAppend(LL_list *list, LL_link *link)
+{
+	LL_ListInsertBefore(list, &list->anchor, link);
+}
+
+
+/** Add a link at the start of an intrusive list.
+ * \param list   List object.
+ * \param link   Link to add; must not be in any list.
+ */
+void
+LL_ListPrepend(LL_list *list, LL_link *link)
+{
+	LL_ListInsertBefore(list, list->anchor.next, link);
+}
+
+
+/** Remove a link from an intrusive list.
+ * Removing a link that is not in a list does nothing.
+ * \param list   List object.
+ * \param link   Link to remove.
+ */
+void
+LL_ListRemove(LL_list *list, LL_link *link)
+{
+	if (link->next == NULL)
+		return;
+
+	link->prev->next = link->next;
+	link->next->prev = link->prev;
+	link->prev = NULL;
+	link->next = NULL;
+	list->count--;
+}
@@ -15,6 +15,8 @@
 #ifndef LL_H
 #define LL_H
 
+#include <stddef.h>
+
 /***********************************************************************
   Linked Lists!  (Doubly-Linked Lists)
   *******************************************************************
@@ -88,6 +90,17 @@
       ... do something to it ...
     } while(LL_Next(list) == 0);
 
+  This moves the list's "current" pointer, so a loop like this must not
+  call anything that walks the same list again.  LL_FOREACH_NODE() keeps
+  its position in a variable of its own and can be nested:
+
+    LL_node *node;
+
+    LL_FOREACH_NODE(list, node) {
+      my_data = (my_data *)node->data;
+      ... do something to it, but don't add or delete nodes ...
+    }
+
   *******************************************************************
 
   You can also treat the list like a stack, or a queue.  Just use the
@@ -106,6 +119,33 @@
 
   There are also other goodies, like sorting and searching.
 
+  *******************************************************************
+
+  Structures that are always kept in the same list can embed the links
+  instead (an "intrusive" list).  Adding and removing them never
+  allocates, and removing needs no search:
+
+    typedef struct my_data {
+      char string[16];
+      LL_link link;
+    } my_data;
+
+    LL_list list;
+    LL_link *l, *tmp;
+
+    LL_ListInit(&list);
+    LL_ListAppend(&list, &thingie->link);
+
+    LL_FOREACH(&list, l) {
+      my_data *thingie = LL_ENTRY(l, my_data, link);
+      ...
+    }
+
+    LL_FOREACH_SAFE(&list, l, tmp) {    // allows removing the entry
+      LL_ListRemove(&list, l);
+      free(LL_ENTRY(l, my_data, link));
+    }
+
   *******************************************************************
   That's about it, for now...  Be sure to free the list when you're done!
 ***********************************************************************/
@@ -136,9 +176,24 @@ typedef struct LinkedList {
 	LL_node head;		/**< List's head anchor */
 	LL_node tail;		/**< List's tail anchor */
 	LL_node *current;	/**< Pointer to current node */
+	int count;		/**< Number of nodes in the list */
 } LinkedList;
 
 
+/** Link embedded in a structure kept in an intrusive list */
+typedef struct LL_link {
+	struct LL_link *prev;	/**< Previous link; the anchor at the start */
+	struct LL_link *next;	/**< Next link; the anchor at the end */
+} LL_link;
+
+
+/** Structure for an intrusive list */
+typedef struct LL_list {
+	LL_link anchor;		/**< Circular anchor: first and last link */
+	int count;		/**< Number of links in the list */
+} LL_list;
+
+
 // Creates a new list...
 LinkedList *LL_new(void);
 // Destroying lists...
@@ -207,4 +262,30 @@ int LL_Sort(LinkedList *list, int (*compare)(void *, void *));
 // Debugging...
 void LL_dprint(LinkedList *list);
 
+// Walk the nodes without using the list's current pointer
+#define LL_FOREACH_NODE(list, node) \
+	for ((node) = (list)->head.next; (node) != &(list)->tail; (node) = (node)->next)
+
+
+// Intrusive lists...
+void LL_ListInit(LL_list *list);
+void LL_ListAppend(LL_list *list, LL_link *link);	// Add link at the end
+void LL_ListPrepend(LL_list *list, LL_link *link);	// Add link at the start
+void LL_ListInsertBefore(LL_list *list, LL_link *pos, LL_link *link);
+void LL_ListRemove(LL_list *list, LL_link *link);
+
+#define LL_ListLength(list)	((list)->count)
+
+// Get the structure containing a link
+#define LL_ENTRY(link, type, member) \
+	((type *) ((char *) (link) - offsetof(type, member)))
+
+// Walk the links; the _SAFE variant allows removing the current one
+#define LL_FOREACH(list, link) \
+	for ((link) = (list)->anchor.next; (link) != &(list)->anchor; (link) = (link)->next)
+#define LL_FOREACH_SAFE(list, link, tmp) \
+	for ((link) = (list)->anchor.next, (tmp) = (link)->next; \
+	     (link) != &(list)->anchor; \
+	     (link) = (tmp), (tmp) = (link)->next)
+
 #endif
@@ -1,5 +1,13 @@
 /** \file configfile.c
  * Define routines to read INI-file like files.
+ *
+ * The config is read once and not modified afterwards (except for the
+ * config_read_string() extension), while drivers look up many keys during
+ * their initialization. So all the work is done when reading: sections and
+ * keys are put in hash tables indexed by their case-folded names, the values
+ * of keys with the same name are chained, and every value is converted to
+ * integer, float and boolean right away. The lookups then neither allocate
+ * nor parse anything.
  */
 
 /* This file is part of LCDd, the lcdproc server.
@@ -18,43 +26,83 @@
 #include <strings.h>
 #include <unistd.h>
 #include <stdlib.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
 #endif
 
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+#endif
+
 #include "shared/report.h"
+#include "shared/configfile.h"
 
 
+/** Number of hash buckets for the keys of a section; must be a power of 2 */
+#define KEY_BUCKETS		32
+/** Number of hash buckets for the sections; must be a power of 2 */
+#define SECTION_BUCKETS		64
+
+/** Value of ConfigKey.bool_value if the value is no legal boolean */
+#define NO_BOOL			-1
+
 /** configuration key */
 typedef struct _config_key {
 	char *name;			/**< name of the config key */
 	char *value;			/**< value of the config key */
+	unsigned int hash;		/**< hash of the case-folded name */
+	short has_int;			/**< value is a legal integer */
+	short has_float;		/**< value is a legal floating point number */
+	short bool_value;		/**< value as boolean, or NO_BOOL */
+	long int int_value;		/**< value as integer */
+	double float_value;		/**< value as floating point number */
 	struct _config_key *next_key;	/**< pointer to next config key */
+	struct _config_key *hash_next;	/**< next key with a different name in the bucket */
+	struct _config_key *next_value;	/**< next key with the same name */
+	struct _config_key *last_value;	/**< last key with the same name (only in the first one) */
+	int num_values;			/**< number of keys with the same name (only in the first one) */
 } ConfigKey;
 
 /** configuration section */
 typedef struct _config_section {
 	char *name;			/**< name of the config section */
+	unsigned int hash;		/**< hash of the case-folded name */
 	ConfigKey *first_key;		/**< config keys in the config section */
+	ConfigKey *last_key;		/**< last config key in the config section */
+	ConfigKey *buckets[KEY_BUCKETS];	/**< first keys of each name, by hash */
+	short adopted;			/**< identical section taken over on reload */
 	struct _config_section *next_section;	/**< pointer to next config section */
+	struct _config_section *hash_next;	/**< next section in the bucket */
 } ConfigSection;
 
+/** detached configuration, see config_detach() */
+struct _config_tree {
+	ConfigSection *first_section;	/**< sections of the detached config */
+};
+
 
 static ConfigSection *first_section = NULL;
 /* Yes there is a static. It's C after all :)*/
+static ConfigSection *section_buckets[SECTION_BUCKETS];
 
 
+static unsigned int hash_name(const char *name);
 static ConfigSection *find_section(const char *sectionname);
+static ConfigSection *find_section_in(ConfigSection *list, const char *sectionname);
+static void index_sections(void);
+static int sections_equal(ConfigSection *a, ConfigSection *b);
+static void free_sections(ConfigSection *list);
 static ConfigSection *add_section(const char *sectionname);
+static ConfigKey *find_first_key(ConfigSection *s, const char *keyname);
 static ConfigKey *find_key(ConfigSection *s, const char *keyname, int skip);
 static ConfigKey *add_key(ConfigSection *s, const char *keyname, const char *value);
-#if defined(LCDPROC_CONFIG_READ_STRING)
-static char get_next_char_f(FILE *f);
-static int process_config(ConfigSection **current_section, char(*get_next_char)(), const char *source_descr, FILE *f);
-#else
-static int process_config(ConfigSection **current_section, const char *source_descr, FILE *f);
-#endif
+static void convert_value(ConfigKey *k);
+static int process_config(ConfigSection **current_section, const char *buf, size_t len, const char *source_descr);
 
 
 /**** PUBLIC FUNCTIONS ****/
@@ -66,24 +114,51 @@ static int process_config(ConfigSection **current_section, const char *source_de
  */
 int config_read_file(const char *filename)
 {
-	FILE *f;
+	int fd;
+	struct stat st;
+	char *buf;
 	ConfigSection *curr_section = NULL;
 	int result = 0;
 
 	report(RPT_NOTICE, "Using Configuration File: %s", filename);
 
-	f = fopen(filename, "r");
-	if (f == NULL) {
+	fd = open(filename, O_RDONLY);
+	if (fd < 0) {
+		return -1;
+	}
+	if (fstat(fd, &st) < 0) {
+		close(fd);
 		return -1;
 	}
 
-#if defined(LCDPROC_CONFIG_READ_STRING)
-	result = process_config(&curr_section, get_next_char_f, filename, f);
-#else
-	result = process_config(&curr_section, filename, f);
+	/* An empty file is a valid (empty) config */
+	if (st.st_size == 0) {
+		close(fd);
+		return 0;
+	}
+
+#if defined(HAVE_SYS_MMAN_H) && defined(HAVE_MMAP)
+	/* Map the file and let the tokenizer run over it in one go */
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (buf != MAP_FAILED) {
+		close(fd);
+		result = process_config(&curr_section, buf, st.st_size, filename);
+		munmap(buf, st.st_size);
+		return result;
+	}
 #endif
 
-	fclose(f);
+	/* No mmap: read the file into memory */
+	buf = malloc(st.st_size);
+	if ((buf == NULL) || (read(fd, buf, st.st_size) != st.st_size)) {
+		free(buf);
+		close(fd);
+		return -1;
+	}
+	close(fd);
+
+	result = process_config(&curr_section, buf, st.st_size, filename);
+	free(buf);
 
 	return result;
 }
@@ -93,18 +168,12 @@ int config_read_file(const char *filename)
 int config_read_string(const char *sectionname, const char *str)
 /* All the config parameters are placed in the given section in memory.*/
 {
-	int pos = 0;
 	ConfigSection *s;
 
-	/* We use a nested function to transfer the characters from buffer to parser*/
-	char get_next_char() {
-		return str[pos++];
-	}
-
 	if ((s = find_section(sectionname)) == NULL)
 		s = add_section(sectionname);
 
-	return process_config(&s, get_next_char, "command line", NULL);
+	return process_config(&s, str, strlen(str), "command line");
 }
 #endif
 
@@ -187,20 +256,10 @@ short config_get_bool(const char *sectionname, const char *keyname,
 {
 	ConfigKey *k = find_key(find_section(sectionname), keyname, skip);
 
-	if (k == NULL)
+	if ((k == NULL) || (k->bool_value == NO_BOOL))
 		return default_value;
 
-	if ((strcasecmp(k->value, "0") == 0) || (strcasecmp(k->value, "false") == 0) ||
-	    (strcasecmp(k->value, "n") == 0) || (strcasecmp(k->value, "no") == 0) ||
-	    (strcasecmp(k->value, "off") == 0)) {
-		return 0;
-	}
-	if ((strcasecmp(k->value, "1") == 0) || (strcasecmp(k->value, "true") == 0) ||
-	    (strcasecmp(k->value, "y") == 0) || (strcasecmp(k->value, "yes") == 0) ||
-	    (strcasecmp(k->value, "on") == 0)) {
-		return 1;
-	}
-	return default_value;
+	return k->bool_value;
 }
 
 
@@ -229,17 +288,9 @@ short config_get_tristate(const char *sectionname, const char *keyname,
 	if (k == NULL)
 		return default_value;
 
-	if ((strcasecmp(k->value, "0") == 0) || (strcasecmp(k->value, "false") == 0) ||
-	    (strcasecmp(k->value, "n") == 0) || (strcasecmp(k->value, "no") == 0) ||
-	    (strcasecmp(k->value, "off") == 0)) {
-		return 0;
-	}
-	if ((strcasecmp(k->value, "1") == 0) || (strcasecmp(k->value, "true") == 0) ||
-	    (strcasecmp(k->value, "y") == 0) || (strcasecmp(k->value, "yes") == 0) ||
-	    (strcasecmp(k->value, "on") == 0)) {
-		return 1;
-	}
-	if ((strcasecmp(k->value, "2") == 0) ||
+	if (k->bool_value != NO_BOOL)
+		return k->bool_value;
+	if ((strcmp(k->value, "2") == 0) ||
 	    ((name3rd != NULL) && (strcasecmp(k->value, name3rd) == 0))) {
 		return 2;
 	}
@@ -262,14 +313,9 @@ long int config_get_int(const char *sectionname, const char *keyname,
 {
 	ConfigKey *k = find_key(find_section(sectionname), keyname, skip);
 
-	if (k != NULL) {
-		char *end;
-		long int v = strtol(k->value, &end, 0);
+	if ((k != NULL) && k->has_int)
+		return k->int_value;
 
-		if ((end != NULL) && (end != k->value) && (*end == '\0'))
-			/* Conversion successful */
-			return v;
-	}
 	return default_value;
 }
 
@@ -289,14 +335,9 @@ double config_get_float(const char *sectionname, const char *keyname,
 {
 	ConfigKey *k = find_key(find_section(sectionname), keyname, skip);
 
-	if (k != NULL) {
-		char *end;
-		double v = strtod(k->value, &end);
+	if ((k != NULL) && k->has_float)
+		return k->float_value;
 
-		if ((end != NULL) && (end != k->value) && (*end == '\0'))
-			/* Conversion successful*/
-			return v;
-	}
 	return default_value;
 }
 
@@ -319,30 +360,205 @@ int config_has_section(const char *sectionname)
  * \retval n           key found with \c n values (\c n > 0)
  */
 int config_has_key(const char *sectionname, const char *keyname)
+{
+	ConfigKey *k = find_first_key(find_section(sectionname), keyname);
+
+	return (k != NULL) ? k->num_values : 0;
+}
+
+
+/** Clear configuration. */
+void config_clear(void)
+{
+	free_sections(first_section);
+
+	/* Finally make everything inaccessible */
+	first_section = NULL;
+	index_sections();
+}
+
+
+/** Detach the configuration in memory, leaving an empty one behind.
+ *
+ * This is the first step of a reload: read the new configuration, take
+ * over the unchanged sections with config_adopt_unchanged(), ask which
+ * sections changed with config_section_changed() and finally free the old
+ * configuration using config_free_detached().
+ *
+ * \return  The detached configuration; \c NULL on allocation error.
+ */
+ConfigTree *config_detach(void)
+{
+	ConfigTree *old = malloc(sizeof(ConfigTree));
+
+	if (old == NULL)
+		return NULL;
+
+	old->first_section = first_section;
+	first_section = NULL;
+	index_sections();
+
+	return old;
+}
+
+
+/** Take over the sections of a detached configuration that are identical
+ * in the configuration in memory.
+ *
+ * The section of the detached configuration replaces its copy, so all
+ * values that have been handed out from it before (and may still be held
+ * by e.g. drivers that are not reloaded) stay valid.
+ *
+ * \param old  Detached configuration.
+ */
+void config_adopt_unchanged(ConfigTree *old)
+{
+	ConfigSection **place;
+
+	if (old == NULL)
+		return;
+
+	for (place = &first_section; *place != NULL; place = &((*place)->next_section)) {
+		ConfigSection *s_new = *place;
+		ConfigSection **old_place;
+
+		for (old_place = &old->first_section; *old_place != NULL; old_place = &((*old_place)->next_section)) {
+			ConfigSection *s_old = *old_place;
+
+			if ((strcasecmp(s_old->name, s_new->name) == 0) && sections_equal(s_old, s_new)) {
+				/* unlink from the detached config ... */
+				*old_place = s_old->next_section;
+
+				/* ... and put it in the place of the new one */
+				s_old->next_section = s_new->next_section;
+				s_old->adopted = 1;
+				*place = s_old;
+
+				s_new->next_section = NULL;
+				free_sections(s_new);
+				break;
+			}
+		}
+	}
+	index_sections();
+}
+
+
+/** Test whether a section differs between a detached configuration
+ * and the configuration in memory.
+ * \param old          Detached configuration, after config_adopt_unchanged().
+ * \param sectionname  Name of the section to look for.
+ * \retval 0           section unchanged (or absent in both)
+ * \retval 1           section changed, added or removed
+ */
+int config_section_changed(ConfigTree *old, const char *sectionname)
 {
 	ConfigSection *s = find_section(sectionname);
-	int count = 0;
 
-	if (s != NULL) {
-		ConfigKey *k;
+	if (s != NULL)
+		return (s->adopted) ? 0 : 1;
+
+	return (old != NULL && find_section_in(old->first_section, sectionname) != NULL) ? 1 : 0;
+}
+
+
+/** Free a detached configuration.
+ * \param old  Detached configuration.
+ */
+void config_free_detached(ConfigTree *old)
+{
+	if (old == NULL)
+		return;
+
+	free_sections(old->first_section);
+	free(old);
+}
+
+
+/**** INTERNAL FUNCTIONS ****/
+
+/* Case-insensitive FNV-1a */
+static unsigned int hash_name(const char *name)
+{
+	unsigned int h = 2166136261u;
 
-		for (k = s->first_key; k != NULL; k = k->next_key) {
-			/* Did we find the right key ?*/
-			if (strcasecmp(k->name, keyname) == 0)
-				count++;
+	for ( ; *name != '\0'; name++) {
+		h ^= (unsigned char) tolower((unsigned char) *name);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+
+static ConfigSection *find_section(const char *sectionname)
+{
+	unsigned int h = hash_name(sectionname);
+	ConfigSection *s;
+
+	for (s = section_buckets[h & (SECTION_BUCKETS - 1)]; s != NULL; s = s->hash_next) {
+		if ((s->hash == h) && (strcasecmp(s->name, sectionname) == 0)) {
+			return s;
 		}
 	}
-	return count;
+	return NULL; /* not found */
 }
 
 
-/** Clear configuration. */
-void config_clear(void)
+/* Rebuild the section hash table from the list of sections */
+static void index_sections(void)
+{
+	ConfigSection *s;
+	ConfigSection **last[SECTION_BUCKETS];
+	int i;
+
+	for (i = 0; i < SECTION_BUCKETS; i++) {
+		section_buckets[i] = NULL;
+		last[i] = &section_buckets[i];
+	}
+
+	/* Keep the order, so the first of equally named sections is found */
+	for (s = first_section; s != NULL; s = s->next_section) {
+		i = s->hash & (SECTION_BUCKETS - 1);
+		s->hash_next = NULL;
+		*last[i] = s;
+		last[i] = &s->hash_next;
+	}
+}
+
+
+static ConfigSection *find_section_in(ConfigSection *list, const char *sectionname)
+{
+	ConfigSection *s;
+
+	for (s = list; s != NULL; s = s->next_section) {
+		if (strcasecmp(s->name, sectionname) == 0) {
+			return s;
+		}
+	}
+	return NULL; /* not found */
+}
+
+
+static int sections_equal(ConfigSection *a, ConfigSection *b)
+{
+	ConfigKey *ka, *kb;
+
+	for (ka = a->first_key, kb = b->first_key;
+	     ka != NULL && kb != NULL;
+	     ka = ka->next_key, kb = kb->next_key) {
+		if ((strcasecmp(ka->name, kb->name) != 0) || (strcmp(ka->value, kb->value) != 0))
+			return 0;
+	}
+	return (ka == NULL && kb == NULL) ? 1 : 0;
+}
+
+
+static void free_sections(ConfigSection *list)
 {
 	ConfigSection *s;
 	ConfigSection *next_s;
 
-	for (s = first_section; s != NULL; s = next_s) {
+	for (s = list; s != NULL; s = next_s) {
 		ConfigKey *k;
 		ConfigKey *next_k;
 
@@ -361,23 +577,6 @@ void config_clear(void)
 		free(s->name);
 		free(s);
 	}
-	/* Finally make everything inaccessible */
-	first_section = NULL;
-}
-
-
-/**** INTERNAL FUNCTIONS ****/
-
-static ConfigSection *find_section(const char *sectionname)
-{
-	ConfigSection *s;
-
-	for (s = first_section; s != NULL; s = s->next_section) {
-		if (strcasecmp(s->name, sectionname) == 0) {
-			return s;
-		}
-	}
-	return NULL; /* not found */
 }
 
 
@@ -389,75 +588,132 @@ static ConfigSection *add_section(const char *sectionname)
 	for (s = first_section; s != NULL; s = s->next_section)
 		place = &(s->next_section);
 
-	*place = (ConfigSection *) malloc(sizeof(ConfigSection));
+	*place = (ConfigSection *) calloc(1, sizeof(ConfigSection));
 	if (*place != NULL) {
+		ConfigSection **bucket;
+
 		(*place)->name = strdup(sectionname);
-		(*place)->first_key = NULL;
-		(*place)->next_section = NULL;
+		(*place)->hash = hash_name(sectionname);
+
+		/* Append to its hash bucket */
+		bucket = &section_buckets[(*place)->hash & (SECTION_BUCKETS - 1)];
+		while (*bucket != NULL)
+			bucket = &((*bucket)->hash_next);
+		*bucket = *place;
 	}
 
 	return(*place);
 }
 
 
-static ConfigKey *find_key(ConfigSection *s, const char *keyname, int skip)
+static ConfigKey *find_first_key(ConfigSection *s, const char *keyname)
 {
+	unsigned int h;
 	ConfigKey *k;
-	int count = 0;
-	ConfigKey *last_key = NULL;
 
 	/* Check for NULL section*/
 	if (s == NULL)
 		return NULL;
 
-	for (k = s->first_key; k != NULL; k = k->next_key) {
+	h = hash_name(keyname);
+	for (k = s->buckets[h & (KEY_BUCKETS - 1)]; k != NULL; k = k->hash_next) {
+		if ((k->hash == h) && (strcasecmp(k->name, keyname) == 0))
+			return k;
+	}
+	return NULL; /* not found*/
+}
 
-		/* Did we find the right key ?*/
-		if (strcasecmp(k->name, keyname) == 0) {
-			if (count == skip)
-				return k;
 
-			count++;
-			last_key = k;
-		}
-	}
+static ConfigKey *find_key(ConfigSection *s, const char *keyname, int skip)
+{
+	ConfigKey *k = find_first_key(s, keyname);
+
+	if (k == NULL)
+		return NULL;
+
 	if (skip == -1)
-		return last_key;
+		return k->last_value;
 
-	return NULL; /* not found*/
+	if ((skip < 0) || (skip >= k->num_values))
+		return NULL; /* not found*/
+
+	while (skip-- > 0)
+		k = k->next_value;
+
+	return k;
 }
 
 
 static ConfigKey *add_key(ConfigSection *s, const char *keyname, const char *value)
 {
 	if (s != NULL) {
-		ConfigKey *k;
-		ConfigKey **place = &(s->first_key);
-
-		for (k = s->first_key; k != NULL; k = k->next_key)
-			place = &(k->next_key);
+		ConfigKey *k = (ConfigKey *) calloc(1, sizeof(ConfigKey));
+		ConfigKey *first;
+
+		if (k == NULL)
+			return NULL;
+
+		k->name = strdup(keyname);
+		k->value = strdup(value);
+		k->hash = hash_name(keyname);
+		convert_value(k);
+
+		/* Append to the list of keys of the section ... */
+		if (s->last_key != NULL)
+			s->last_key->next_key = k;
+		else
+			s->first_key = k;
+		s->last_key = k;
+
+		/* ... and to the other values of the key, or to the hash table */
+		first = find_first_key(s, keyname);
+		if (first != NULL) {
+			first->last_value->next_value = k;
+			first->last_value = k;
+			first->num_values++;
+		}
+		else {
+			ConfigKey **bucket = &s->buckets[k->hash & (KEY_BUCKETS - 1)];
 
-		*place = (ConfigKey *) malloc(sizeof(ConfigKey));
-		if (*place != NULL) {
-			(*place)->name = strdup(keyname);
-			(*place)->value = strdup(value);
-			(*place)->next_key = NULL;
+			k->last_value = k;
+			k->num_values = 1;
+			k->hash_next = *bucket;
+			*bucket = k;
 		}
 
-		return(*place);
+		return k;
 	}
 	return NULL;
 }
 
 
-#if defined(LCDPROC_CONFIG_READ_STRING)
-static char get_next_char_f(FILE *f)
+/* Convert the value of a key to all the types it can be read as */
+static void convert_value(ConfigKey *k)
 {
-	int c = fgetc(f);
+	const char *v = k->value;
+	char *end;
+
+	k->int_value = strtol(v, &end, 0);
+	k->has_int = ((end != v) && (*end == '\0'));
 
-	return((c == EOF) ? '\0' : c);
+	k->float_value = strtod(v, &end);
+	k->has_float = ((end != v) && (*end == '\0'));
+
+	/* keep these checks consistent with interpret_boolean_arg() in LCDd */
+	if ((strcasecmp(v, "0") == 0) || (strcasecmp(v, "false") == 0) ||
+	    (strcasecmp(v, "n") == 0) || (strcasecmp(v, "no") == 0) ||
+	    (strcasecmp(v, "off") == 0)) {
+		k->bool_value = 0;
+	}
+	else if ((strcasecmp(v, "1") == 0) || (strcasecmp(v, "true") == 0) ||
+	    (strcasecmp(v, "y") == 0) || (strcasecmp(v, "yes") == 0) ||
+	    (strcasecmp(v, "on") == 0)) {
+		k->bool_value = 1;
+	}
+	else {
+		k->bool_value = NO_BOOL;
+	}
 }
-#endif
 
 
 /* Parser states */
@@ -482,12 +738,9 @@ static char get_next_char_f(FILE *f)
 #define MAXVALUELENGTH		200
 
 
-#if defined(LCDPROC_CONFIG_READ_STRING)
-static int process_config(ConfigSection **current_section, char(*get_next_char)(), const char *source_descr, FILE *f)
-#else
-static int process_config(ConfigSection **current_section, const char *source_descr, FILE *f)
-#endif
+static int process_config(ConfigSection **current_section, const char *buf, size_t len, const char *source_descr)
 {
+	size_t pos = 0;
 	int state = ST_INITIAL;
 	int ch;
 	char sectionname[MAXSECTIONLABELLENGTH+1];
@@ -500,22 +753,9 @@ static int process_config(ConfigSection **current_section, const char *source_de
 	int line_nr = 1;
 	int error = 0;
 
-#if !defined(LCDPROC_CONFIG_READ_STRING)
-	if (f == NULL)
-		return(0);
-#endif
-
 	while (state != ST_END) {
 
-#if defined(LCDPROC_CONFIG_READ_STRING)
-		ch = (f != NULL)
-			? get_next_char(f)
-			: get_next_char();
-#else
-		ch = fgetc(f);
-		if (ch == EOF)
-			ch = '\0';
-#endif
+		ch = (pos < len) ? (unsigned char) buf[pos++] : '\0';
 
 		/* Secretly keep count of the line numbers */
 		if (ch == '\n')
@@ -19,6 +19,9 @@
 #include "config.h"
 #endif
 
+/** Opaque handle to a configuration detached by config_detach(). */
+typedef struct _config_tree ConfigTree;
+
 /* Opens the specified file and reads everything into memory.
  * Returns 0  when config file was successfully parsed
  * Returns <0 on errors
@@ -104,4 +107,21 @@ int config_has_key(const char *sectionname, const char *keyname);
  */
 void config_clear(void);
 
+/* Detaches the config in memory, so it can be compared to a newly read one.
+ */
+ConfigTree *config_detach(void);
+
+/* Takes over the sections of a detached config that did not change, so
+ * values read from them before stay valid.
+ */
+void config_adopt_unchanged(ConfigTree *old);
+
+/* Checks if a section differs between a detached config and the current one.
+ */
+int config_section_changed(ConfigTree *old, const char *sectionname);
+
+/* Frees a detached config.
+ */
+void config_free_detached(ConfigTree *old);
+
 #endif
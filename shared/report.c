@@ -1,5 +1,14 @@
 /** \file shared/report.c
  * Contains reporting functions.
+ *
+ * By default messages are written synchronously by the calling thread.
+ * After report_async_start() they are put into a lock-free ring buffer
+ * instead, which is drained by a background thread, so a slow syslog can
+ * no longer stall the caller. In this mode messages are also rate limited
+ * per call site (identified by the format string): at most
+ * REPORT_SITE_BURST messages per second are passed on, the others are
+ * counted and summarized once the burst is over. Messages that do not fit
+ * into the ring are dropped and counted as well.
  */
 
 /*-
@@ -18,12 +27,68 @@
 #include <stdio.h>
 #include <string.h>
 #include <syslog.h>
+#include <time.h>
+#include <stdint.h>
+#include <unistd.h>
+
+#ifdef HAVE_CONFIG_H
+# include "config.h"
+#endif
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
 
 #include "report.h"
 
 static int report_level = RPT_INFO;
 static int report_dest = RPT_DEST_STORE;
 
+#ifdef HAVE_PTHREAD
+#define REPORT_RING_SIZE	256	/**< number of slots, must be a power of 2 */
+#define REPORT_MSG_SIZE		504
+#define REPORT_SITES		256	/**< number of rate limited call sites, power of 2 */
+#define REPORT_SITE_BURST	10	/**< messages per call site and second */
+
+/** One message in the ring buffer */
+typedef struct ReportSlot {
+	unsigned long seq;		/**< sequence number, see report_enqueue() */
+	int level;
+	char msg[REPORT_MSG_SIZE];
+} ReportSlot;
+
+/** Rate limiting state of one call site */
+typedef struct ReportSite {
+	uintptr_t key;			/**< identifies the site, 0 if unused */
+	const char *format;		/**< format string used at the site */
+	long window;			/**< second the count applies to */
+	int count;			/**< messages in the current window */
+	int suppressed;			/**< messages not reported yet */
+	int level;			/**< level of the suppressed messages */
+} ReportSite;
+
+static ReportSlot *ring = NULL;
+static unsigned long ring_head = 0;	/**< next slot to write (producers) */
+static unsigned long ring_tail = 0;	/**< next slot to read (drainer) */
+static ReportSite sites[REPORT_SITES];
+
+static unsigned long msgs_dropped = 0;	/**< ring buffer was full (total) */
+static unsigned long msgs_suppressed = 0; /**< rate limited (total) */
+static unsigned long dropped_pending = 0; /**< drops not yet reported */
+
+static int async_running = 0;
+static int atexit_installed = 0;
+static int drainer_idle = 0;
+static int drainer_stop = 0;
+static pthread_t drainer_thread;
+static pthread_mutex_t drainer_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t drainer_cond = PTHREAD_COND_INITIALIZER;
+
+static int report_rate_limited(const char *file, int line, int level, const char *format);
+static void report_enqueue(int level, const char *format, va_list ap);
+static void *report_drainer(void *arg);
+#endif
+
 #define MAX_STORED_MSGS 200
 
 static char *stored_msgs[MAX_STORED_MSGS];
@@ -33,9 +98,36 @@ static int num_stored_msgs = 0;
 /* local functions */
 static void store_report_message(int level, const char *message);
 static void flush_messages();
+static void write_message(int level, const char *message);
+static void report_v(const char *file, int line, int level, const char *format, va_list ap);
+
+/* The report() macro passes the call site on to report_at() */
+#undef report
 
 void
 report(const int level, const char *format,... /* args */ )
+{
+	va_list ap;
+
+	va_start(ap, format);
+	report_v(NULL, 0, level, format, ap);
+	va_end(ap);
+}
+
+
+void
+report_at(const char *file, int line, const int level, const char *format,... /* args */ )
+{
+	va_list ap;
+
+	va_start(ap, format);
+	report_v(file, line, level, format, ap);
+	va_end(ap);
+}
+
+
+static void
+report_v(const char *file, int line, int level, const char *format, va_list ap)
 {
 	/* Check if we should report it */
 	if (level <= report_level || report_dest == RPT_DEST_STORE) {
@@ -46,8 +138,20 @@ report(const int level, const char *format,... /* args */ )
 		 * Linux, FreeBSD and Solaris
 		 */
 
-		va_list ap;
-		va_start(ap, format);
+#ifdef HAVE_PTHREAD
+		if (__atomic_load_n(&async_running, __ATOMIC_ACQUIRE)
+		    && (report_dest != RPT_DEST_STORE)) {
+			if (level > RPT_CRIT) {
+				if (!report_rate_limited(file, line, level, format))
+					report_enqueue(level, format, ap);
+				return;
+			}
+			/* Critical messages are written right away, as the
+			 * program exits after them; but after the messages
+			 * explaining what went wrong. */
+			report_async_stop();
+		}
+#endif
 
 		switch (report_dest) {
 		    case RPT_DEST_STDERR:
@@ -63,7 +167,6 @@ report(const int level, const char *format,... /* args */ )
 			store_report_message(level, buf);
 			break;
 		}
-		va_end(ap);
 	}
 }
 
@@ -127,3 +230,300 @@ flush_messages()
 	}
 	num_stored_msgs = 0;
 }
+
+
+/**
+ * Write a formatted message to the current destination.
+ */
+static void
+write_message(int level, const char *message)
+{
+	switch (report_dest) {
+	    case RPT_DEST_STDERR:
+		fprintf(stderr, "%s\n", message);
+		break;
+	    case RPT_DEST_SYSLOG:
+		syslog(LOG_USER | (level + 2), "%s", message);
+		break;
+	    case RPT_DEST_STORE:
+		store_report_message(level, message);
+		break;
+	}
+}
+
+
+#ifdef HAVE_PTHREAD
+/**
+ * Start the background thread and report asynchronously from now on.
+ * Must be called after the last fork() of the program. The messages still
+ * queued when the program exits are written out by an atexit() handler.
+ * \retval  0  OK
+ * \retval <0  error; messages are still reported synchronously.
+ */
+int
+report_async_start(void)
+{
+	int i;
+
+	if (async_running)
+		return 0;
+
+	ring = calloc(REPORT_RING_SIZE, sizeof(ReportSlot));
+	if (ring == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return -1;
+	}
+	for (i = 0; i < REPORT_RING_SIZE; i++)
+		ring[i].seq = i;
+	ring_head = ring_tail = 0;
+	drainer_stop = 0;
+
+	if (pthread_create(&drainer_thread, NULL, report_drainer, NULL) != 0) {
+		report(RPT_ERR, "%s: Could not create thread", __FUNCTION__);
+		free(ring);
+		ring = NULL;
+		return -1;
+	}
+	__atomic_store_n(&async_running, 1, __ATOMIC_RELEASE);
+
+	if (!atexit_installed) {
+		atexit(report_async_stop);
+		atexit_installed = 1;
+	}
+
+	return 0;
+}
+
+
+/**
+ * Write out the messages still in the ring buffer and stop reporting
+ * asynchronously. Gives up after a short while if the background thread
+ * does not make progress, so it is safe to call on the way out.
+ */
+void
+report_async_stop(void)
+{
+	int i;
+
+	if (!__atomic_load_n(&async_running, __ATOMIC_ACQUIRE))
+		return;
+
+	__atomic_store_n(&drainer_stop, 1, __ATOMIC_SEQ_CST);
+	pthread_mutex_lock(&drainer_mutex);
+	pthread_cond_signal(&drainer_cond);
+	pthread_mutex_unlock(&drainer_mutex);
+
+	/* Wait up to 200 ms for the ring buffer to drain */
+	for (i = 0; i < 200; i++) {
+		if (__atomic_load_n(&ring_tail, __ATOMIC_ACQUIRE)
+		    == __atomic_load_n(&ring_head, __ATOMIC_ACQUIRE))
+			break;
+		usleep(1000);
+	}
+	__atomic_store_n(&async_running, 0, __ATOMIC_RELEASE);
+}
+
+
+/**
+ * Get the number of messages that were not reported.
+ * \param dropped     Messages dropped because the ring buffer was full.
+ * \param suppressed  Messages suppressed by the rate limit.
+ */
+void
+report_get_counters(unsigned long *dropped, unsigned long *suppressed)
+{
+	*dropped = __atomic_load_n(&msgs_dropped, __ATOMIC_RELAXED);
+	*suppressed = __atomic_load_n(&msgs_suppressed, __ATOMIC_RELAXED);
+}
+
+
+/*
+ * Count a message against the limit of its call site, given by file and
+ * line; calls through the report() function have no file and are told
+ * apart by their format string only.
+ * Returns 1 if the message must be suppressed. Concurrent callers
+ * may make the counts slightly inaccurate, which is harmless.
+ */
+static int
+report_rate_limited(const char *file, int line, int level, const char *format)
+{
+	ReportSite *site = NULL;
+	uintptr_t key = (file != NULL)
+			? (uintptr_t) file + (uintptr_t) line * 2654435761u
+			: (uintptr_t) format;
+	uintptr_t h;
+	long now = time(NULL);
+	int i;
+
+	if (key == 0)
+		key = 1;
+	h = key ^ (key >> 7) ^ (key >> 16);
+	for (i = 0; i < REPORT_SITES; i++) {
+		ReportSite *s = &sites[(h + i) & (REPORT_SITES - 1)];
+		uintptr_t expected = 0;
+
+		if (__atomic_load_n(&s->key, __ATOMIC_ACQUIRE) == key)
+			site = s;
+		else if (__atomic_compare_exchange_n(&s->key, &expected, key, 0,
+						     __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			__atomic_store_n(&s->format, format, __ATOMIC_RELEASE);
+			site = s;
+		}
+		else if (expected == key)
+			site = s;
+		if (site != NULL)
+			break;
+	}
+	if (site == NULL)
+		return 0;	/* table full: do not limit */
+
+	if (__atomic_load_n(&site->window, __ATOMIC_RELAXED) != now) {
+		__atomic_store_n(&site->window, now, __ATOMIC_RELAXED);
+		__atomic_store_n(&site->count, 0, __ATOMIC_RELAXED);
+	}
+	if (__atomic_add_fetch(&site->count, 1, __ATOMIC_RELAXED) <= REPORT_SITE_BURST)
+		return 0;
+
+	site->level = level;
+	__atomic_add_fetch(&site->suppressed, 1, __ATOMIC_RELAXED);
+	__atomic_add_fetch(&msgs_suppressed, 1, __ATOMIC_RELAXED);
+	return 1;
+}
+
+
+/*
+ * Put a message into the ring buffer. The ring is a bounded queue for
+ * multiple producers and one consumer: a slot whose seq equals the
+ * position is free, seq == position + 1 marks a slot ready to be read.
+ */
+static void
+report_enqueue(int level, const char *format, va_list ap)
+{
+	ReportSlot *slot;
+	unsigned long pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+
+	while (1) {
+		long diff;
+
+		slot = &ring[pos & (REPORT_RING_SIZE - 1)];
+		diff = (long) __atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) - (long) pos;
+		if (diff == 0) {
+			if (__atomic_compare_exchange_n(&ring_head, &pos, pos + 1, 1,
+							__ATOMIC_RELAXED, __ATOMIC_RELAXED))
+				break;
+		}
+		else if (diff < 0) {
+			/* Ring buffer full */
+			__atomic_add_fetch(&msgs_dropped, 1, __ATOMIC_RELAXED);
+			__atomic_add_fetch(&dropped_pending, 1, __ATOMIC_RELAXED);
+			return;
+		}
+		else {
+			pos = __atomic_load_n(&ring_head, __ATOMIC_RELAXED);
+		}
+	}
+
+	slot->level = level;
+	vsnprintf(slot->msg, sizeof(slot->msg), format, ap);
+	__atomic_store_n(&slot->seq, pos + 1, __ATOMIC_SEQ_CST);
+
+	/* Wake the drainer if it went to sleep */
+	if (__atomic_load_n(&drainer_idle, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&drainer_mutex);
+		pthread_cond_signal(&drainer_cond);
+		pthread_mutex_unlock(&drainer_mutex);
+	}
+}
+
+
+/*
+ * Report the messages suppressed by the rate limit and the ones dropped.
+ */
+static void
+report_summaries(void)
+{
+	long now = time(NULL);
+	unsigned long n;
+	char buf[REPORT_MSG_SIZE];
+	int i;
+
+	for (i = 0; i < REPORT_SITES; i++) {
+		ReportSite *s = &sites[i];
+
+		if ((__atomic_load_n(&s->suppressed, __ATOMIC_RELAXED) == 0)
+		    || (__atomic_load_n(&s->format, __ATOMIC_ACQUIRE) == NULL)
+		    || (__atomic_load_n(&s->window, __ATOMIC_RELAXED) == now))
+			continue;
+		n = __atomic_exchange_n(&s->suppressed, 0, __ATOMIC_RELAXED);
+		snprintf(buf, sizeof(buf), "%lu more messages like \"%.200s\" suppressed",
+			 n, s->format);
+		write_message(s->level, buf);
+	}
+
+	n = __atomic_exchange_n(&dropped_pending, 0, __ATOMIC_RELAXED);
+	if (n > 0) {
+		snprintf(buf, sizeof(buf), "%lu messages dropped, report buffer full", n);
+		write_message(RPT_WARNING, buf);
+	}
+}
+
+
+/*
+ * Background thread: write the messages from the ring buffer.
+ */
+static void *
+report_drainer(void *arg)
+{
+	while (1) {
+		ReportSlot *slot = &ring[ring_tail & (REPORT_RING_SIZE - 1)];
+
+		if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) == ring_tail + 1) {
+			write_message(slot->level, slot->msg);
+			__atomic_store_n(&slot->seq, ring_tail + REPORT_RING_SIZE, __ATOMIC_RELEASE);
+			__atomic_store_n(&ring_tail, ring_tail + 1, __ATOMIC_RELEASE);
+			continue;
+		}
+
+		report_summaries();
+		if (__atomic_load_n(&drainer_stop, __ATOMIC_SEQ_CST))
+			break;
+
+		/* Sleep until a message arrives, or a second for the summaries */
+		pthread_mutex_lock(&drainer_mutex);
+		__atomic_store_n(&drainer_idle, 1, __ATOMIC_SEQ_CST);
+		if ((__atomic_load_n(&slot->seq, __ATOMIC_SEQ_CST) != ring_tail + 1)
+		    && !__atomic_load_n(&drainer_stop, __ATOMIC_SEQ_CST)) {
+			struct timespec ts;
+
+			clock_gettime(CLOCK_REALTIME, &ts);
+			ts.tv_sec++;
+			pthread_cond_timedwait(&drainer_cond, &drainer_mutex, &ts);
+		}
+		__atomic_store_n(&drainer_idle, 0, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&drainer_mutex);
+	}
+	return NULL;
+}
+
+#else
+
+int
+report_async_start(void)
+{
+	return -1;
+}
+
+
+void
+report_async_stop(void)
+{
+}
+
+
+void
+report_get_counters(unsigned long *dropped, unsigned long *suppressed)
+{
+	*dropped = *suppressed = 0;
+}
+
+#endif /* HAVE_PTHREAD */
@@ -80,6 +80,19 @@ int set_reporting( char *application_name, int new_level, int new_dest );
 /** Report the message to the selected destination if important enough */
 void report( const int level, const char *format, .../*args*/ );
 
+/** The same, for the report() macro: messages are rate limited per call site */
+void report_at( const char *file, int line, const int level, const char *format, .../*args*/ );
+#define report(...) report_at(__FILE__, __LINE__, __VA_ARGS__)
+
+/** Report from a background thread from now on (call after forking) */
+int report_async_start( void );
+
+/** Write out pending messages and report synchronously again */
+void report_async_stop( void );
+
+/** Get the number of messages dropped and suppressed by the rate limit */
+void report_get_counters( unsigned long *dropped, unsigned long *suppressed );
+
 /**
  * The code that this function generates will not be in the executable when
  * compiled without debugging. This way memory and CPU cycles are saved.
@@ -90,11 +103,15 @@ static inline void dont_report( const int level, const char *format, .../*args*/
 /**
  * Consider the debug function to be exactly the same as the report function.
  * The only difference is that it is only compiled in if DEBUG is defined.
+ * Without DEBUG the arguments are still type checked, but never evaluated.
+ * Use debug_report where a function pointer is needed.
  */
 #ifdef DEBUG
 #  define debug report
+#  define debug_report report
 #else
-#  define debug dont_report
+#  define debug(...) (0 ? report(__VA_ARGS__) : (void) 0)
+#  define debug_report dont_report
 #endif
 
 #endif  /* REPORT_H */
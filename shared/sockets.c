@@ -15,6 +15,7 @@
 #include <errno.h>
 #include <stdlib.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <sys/socket.h>
 #include <sys/un.h>
 #include <netinet/in.h>
@@ -22,6 +23,7 @@
 #include <arpa/inet.h>
 #include <stdarg.h>
 #include <fcntl.h>
+#include <poll.h>
 
 #ifdef HAVE_CONFIG_H
 # include "config.h"
@@ -35,6 +37,25 @@
 
 typedef struct sockaddr_in sockaddr_in;
 
+/** Function called after data was sent, e.g. to count the traffic */
+void (*sock_send_callback) (int fd, size_t size) = NULL;
+
+/**
+ * Wait until a non-blocking socket is ready instead of spinning on EAGAIN.
+ * \param fd      Socket file descriptor
+ * \param events  POLLIN or POLLOUT
+ */
+static void
+sock_wait(int fd, short events)
+{
+	struct pollfd pfd;
+
+	pfd.fd = fd;
+	pfd.events = events;
+	while ((poll(&pfd, 1, -1) < 0) && (errno == EINTR))
+		;
+}
+
 /**
  * Tries to resolve a resolve a hostname.
  * \param name      Pointer to resolves IP-address
@@ -60,10 +81,113 @@ sock_init_sockaddr (sockaddr_in *name, const char *hostname, unsigned short int
 	return 0;
 }
 
+/**
+ * Connect to a server's UNIX socket.
+ * \param path  Path of the socket; a leading '@' selects the abstract namespace
+ * \return  socket file descriptor on success, -1 on error
+ */
+static int
+sock_connect_unix (const char *path)
+{
+	struct sockaddr_un name;
+	socklen_t len;
+	int sock;
+
+	if (strlen (path) >= sizeof (name.sun_path)) {
+		report (RPT_ERR, "sock_connect: socket path too long: %s", path);
+		return -1;
+	}
+
+	sock = socket (PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		report (RPT_ERR, "sock_connect: Error creating socket");
+		return sock;
+	}
+
+	memset (&name, 0, sizeof (name));
+	name.sun_family = AF_UNIX;
+	strcpy (name.sun_path, path);
+	len = sizeof (name);
+	if (path[0] == '@') {
+		name.sun_path[0] = '\0';
+		len = offsetof (struct sockaddr_un, sun_path) + strlen (path);
+	}
+
+	if (connect (sock, (struct sockaddr *) &name, len) < 0) {
+		report (RPT_ERR, "sock_connect: connect to %s failed", path);
+		close (sock);
+		return -1;
+	}
+
+	fcntl (sock, F_SETFL, O_NONBLOCK);
+
+	return sock;
+}
+
+/**
+ * Remove the socket file a previous server left behind, before binding a
+ * new socket to the same path. Anything that is not a socket is left
+ * alone, and so is a socket another process still accepts connections on.
+ * \param path  Path of the UNIX socket.
+ * \retval  0  The path is free.
+ * \retval -1  The path is in use or cannot be checked; the error has been
+ *             reported.
+ */
+int
+sock_unlink_stale (const char *path)
+{
+	struct sockaddr_un name;
+	struct stat st;
+	int sock;
+	int res;
+	int err;
+
+	if (lstat (path, &st) < 0) {
+		if (errno == ENOENT)
+			return 0;
+		report (RPT_ERR, "sock_unlink_stale: cannot check %s - %s", path, strerror (errno));
+		return -1;
+	}
+	if (!S_ISSOCK (st.st_mode)) {
+		report (RPT_ERR, "sock_unlink_stale: %s exists and is not a socket", path);
+		return -1;
+	}
+	if (strlen (path) >= sizeof (name.sun_path)) {
+		report (RPT_ERR, "sock_unlink_stale: socket path too long: %s", path);
+		return -1;
+	}
+
+	/* Only a socket nobody listens on any more refuses the connection;
+	 * do not block on one whose backlog is full */
+	sock = socket (PF_UNIX, SOCK_STREAM, 0);
+	if (sock < 0) {
+		report (RPT_ERR, "sock_unlink_stale: Error creating socket - %s", strerror (errno));
+		return -1;
+	}
+	fcntl (sock, F_SETFL, O_NONBLOCK);
+	memset (&name, 0, sizeof (name));
+	name.sun_family = AF_UNIX;
+	strcpy (name.sun_path, path);
+	res = connect (sock, (struct sockaddr *) &name, sizeof (name));
+	err = errno;
+	close (sock);
+
+	if (res == 0 || err != ECONNREFUSED) {
+		report (RPT_ERR, "sock_unlink_stale: %s is in use by another server", path);
+		return -1;
+	}
+	if (unlink (path) < 0) {
+		report (RPT_ERR, "sock_unlink_stale: cannot remove %s - %s", path, strerror (errno));
+		return -1;
+	}
+	return 0;
+}
+
 /**
  * Connect to server.
- * \param host  Hostname or IP-address
- * \param port  Port number
+ * \param host  Hostname or IP-address; or the path of a UNIX socket,
+ *              starting with '/' or, for the abstract namespace, '@'
+ * \param port  Port number; ignored for UNIX sockets
  * \return  socket file descriptor on success, -1 on error
  */
 int
@@ -73,6 +197,9 @@ sock_connect (char *host, unsigned short int port)
 	int sock;
 	int err = 0;
 
+	if ((host[0] == '/') || (host[0] == '@'))
+		return sock_connect_unix (host);
+
 	report (RPT_DEBUG, "sock_connect: Creating socket");
 	sock = socket (PF_INET, SOCK_STREAM, 0);
 	if (sock < 0) {
@@ -179,7 +306,8 @@ sock_recv_string (int fd, char *dest, size_t maxlen)
 			if (errno == EAGAIN) {
 				if (recvBytes) {
 					// We've begun to read a string, but no bytes are
-					// available.  Loop.
+					// available.  Wait for the rest.
+					sock_wait(fd, POLLIN);
 					continue;
 				}
 				return 0;
@@ -236,6 +364,7 @@ sock_send (int fd, const void *src, size_t size)
 				report (RPT_DEBUG, "Message was: '%.*s'", size-offset, (char *) src);
 				return sent;
 			}
+			sock_wait(fd, POLLOUT);
 			continue;
 		} else if (sent == 0) {
 			// when this returns zero, it generally means
@@ -246,6 +375,9 @@ sock_send (int fd, const void *src, size_t size)
 		offset += sent;
 	}
 
+	if (sock_send_callback != NULL)
+		sock_send_callback(fd, offset);
+
 	return offset;
 }
 
@@ -276,6 +408,259 @@ sock_recv (int fd, void *dest, size_t maxlen)
 	return err;
 }
 
+/**
+ * Create a buffered reader for a socket.
+ * \param fd    Socket file descriptor (should be non-blocking)
+ * \param size  Size of the buffer; also the maximum length of a line
+ * \return  Pointer to the new reader, or NULL on error.
+ */
+SockReader *
+sock_reader_create(int fd, size_t size)
+{
+	SockReader *r = calloc(1, sizeof(SockReader));
+
+	if (r == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
+	r->buf = malloc(size);
+	if (r->buf == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		free(r);
+		return NULL;
+	}
+	r->fd = fd;
+	r->size = size;
+
+	return r;
+}
+
+/**
+ * Destroy a buffered reader. The socket is not closed.
+ * \param r  The reader
+ */
+void
+sock_reader_destroy(SockReader *r)
+{
+	if (r != NULL) {
+		free(r->buf);
+		free(r);
+	}
+}
+
+/**
+ * Read whatever the socket has available into the buffer, without waiting.
+ * \param r  The reader
+ * \return  Number of bytes read, 0 if nothing was available or the buffer is
+ *          full, -1 if the connection was closed or on error.
+ */
+int
+sock_reader_fill(SockReader *r)
+{
+	int n;
+
+	if (r->closed)
+		return -1;
+
+	/* move the unread data to the front */
+	if (r->start > 0) {
+		memmove(r->buf, r->buf + r->start, r->len);
+		r->start = 0;
+	}
+	if (r->len == r->size)
+		return 0;
+
+	do {
+		n = read(r->fd, r->buf + r->len, r->size - r->len);
+	} while ((n < 0) && (errno == EINTR));
+
+	if (n > 0) {
+		r->len += n;
+		return n;
+	}
+	if ((n < 0) && (errno == EAGAIN))
+		return 0;
+
+	if (n < 0)
+		report(RPT_ERR, "sock_reader_fill: socket read error");
+	r->closed = 1;
+	return -1;
+}
+
+/**
+ * Get the next complete line. If no complete line is buffered, this reads
+ * what the socket has available, but it never waits for more data.
+ * A line longer than the buffer is returned in pieces.
+ * \param r       The reader
+ * \param dest    Pointer to buffer to store the line without the newline
+ * \param maxlen  Size of dest; longer lines are truncated
+ * \return  Length of the line including the newline, 0 if no complete line
+ *          is available, -1 if the connection is closed and all data has
+ *          been read.
+ */
+int
+sock_readline(SockReader *r, char *dest, size_t maxlen)
+{
+	char *eol;
+	size_t len;
+
+	if ((r == NULL) || (dest == NULL) || (maxlen <= 0))
+		return -1;
+
+	eol = memchr(r->buf + r->start, '\n', r->len);
+	if ((eol == NULL) && (sock_reader_fill(r) > 0))
+		eol = memchr(r->buf + r->start, '\n', r->len);
+
+	if (eol != NULL)
+		len = eol - (r->buf + r->start) + 1;
+	else if ((r->len == r->size) || (r->closed && (r->len > 0)))
+		len = r->len;
+	else
+		return (r->closed) ? -1 : 0;
+
+	if (len < maxlen) {
+		memcpy(dest, r->buf + r->start, len);
+		dest[(eol != NULL) ? len - 1 : len] = '\0';
+	}
+	else {
+		memcpy(dest, r->buf + r->start, maxlen - 1);
+		dest[maxlen - 1] = '\0';
+	}
+	r->start += len;
+	r->len -= len;
+
+	return len;
+}
+
+/**
+ * Create a buffered writer for a socket.
+ * \param fd    Socket file descriptor
+ * \param size  Size of the buffer
+ * \return  Pointer to the new writer, or NULL on error.
+ */
+SockWriter *
+sock_writer_create(int fd, size_t size)
+{
+	SockWriter *w = calloc(1, sizeof(SockWriter));
+
+	if (w == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		return NULL;
+	}
+	w->buf = malloc(size);
+	if (w->buf == NULL) {
+		report(RPT_ERR, "%s: Error allocating", __FUNCTION__);
+		free(w);
+		return NULL;
+	}
+	w->fd = fd;
+	w->size = size;
+
+	return w;
+}
+
+/**
+ * Destroy a buffered writer after sending the pending data. The socket is
+ * not closed.
+ * \param w  The writer
+ */
+void
+sock_writer_destroy(SockWriter *w)
+{
+	if (w != NULL) {
+		sock_writer_flush(w);
+		free(w->buf);
+		free(w);
+	}
+}
+
+/**
+ * Add printf-like formatted output.
+ * \param w       The writer
+ * \param format  Format string
+ * \param ...     Arguments to the format string
+ * \return  Number of bytes added, -1 on error.
+ */
+int
+sock_writer_printf(SockWriter *w, const char *format, .../*args*/)
+{
+	char buf[MAXMSG];
+	va_list ap;
+	int size = 0;
+
+	va_start(ap, format);
+	size = vsnprintf(buf, sizeof(buf), format, ap);
+	va_end(ap);
+
+	if (size < 0) {
+		report(RPT_ERR, "sock_writer_printf: vsnprintf failed");
+		return -1;
+	}
+	if (size >= sizeof(buf)) {
+		report(RPT_WARNING, "sock_writer_printf: vsnprintf truncated message");
+		size = sizeof(buf) - 1;
+	}
+
+	return sock_writer_send(w, buf, size);
+}
+
+/**
+ * Add a string.
+ * \param w       The writer
+ * \param string  Pointer to the string to send.
+ * \return  Number of bytes added, -1 on error.
+ */
+int
+sock_writer_send_string(SockWriter *w, const char *string)
+{
+	return sock_writer_send(w, string, strlen(string));
+}
+
+/**
+ * Add raw data. The buffer is flushed first if the data does not fit;
+ * data larger than the buffer is sent right away.
+ * \param w     The writer
+ * \param src   Buffer holding the data to send
+ * \param size  Number of bytes to send
+ * \return  Number of bytes added, -1 on error.
+ */
+int
+sock_writer_send(SockWriter *w, const void *src, size_t size)
+{
+	if ((w == NULL) || (src == NULL))
+		return -1;
+
+	if (w->len + size > w->size) {
+		if (sock_writer_flush(w) < 0)
+			return -1;
+		if (size > w->size)
+			return sock_send(w->fd, src, size);
+	}
+	memcpy(w->buf + w->len, src, size);
+	w->len += size;
+
+	return size;
+}
+
+/**
+ * Send the pending data.
+ * \param w  The writer
+ * \return  Number of bytes sent, -1 on error.
+ */
+int
+sock_writer_flush(SockWriter *w)
+{
+	int sent;
+
+	if ((w == NULL) || (w->len == 0))
+		return 0;
+
+	sent = sock_send(w->fd, w->buf, w->len);
+	w->len = 0;
+
+	return sent;
+}
+
 /*****************************************************************************/
 
 /**
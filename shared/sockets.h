@@ -19,6 +19,8 @@
 
 /** Connect to server on host, port */
 int sock_connect (char *host, unsigned short int port);
+/** Remove a socket file no server listens on any more */
+int sock_unlink_stale (const char *path);
 /** Disconnect from server */
 int sock_close (int fd);
 /** Send printf-like formatted output */
@@ -32,6 +34,50 @@ int sock_recv_string (int fd, char *dest, size_t maxlen);
 /** Receive raw data */
 int sock_recv (int fd, void *dest, size_t maxlen);
 
+/** Optional function called with the number of bytes sent on a socket */
+extern void (*sock_send_callback) (int fd, size_t size);
+
+
+/** Buffered reader splitting the input of a non-blocking socket into lines */
+typedef struct SockReader {
+	int fd;			/**< socket file descriptor */
+	char *buf;		/**< received data */
+	size_t size;		/**< size of buf */
+	size_t start;		/**< offset of the first unread byte in buf */
+	size_t len;		/**< number of unread bytes in buf */
+	int closed;		/**< peer has closed the connection or read error */
+} SockReader;
+
+/** Buffered writer collecting output until it is flushed */
+typedef struct SockWriter {
+	int fd;			/**< socket file descriptor */
+	char *buf;		/**< data not sent yet */
+	size_t size;		/**< size of buf */
+	size_t len;		/**< number of bytes in buf */
+} SockWriter;
+
+/** Create a buffered reader for a socket */
+SockReader *sock_reader_create (int fd, size_t size);
+/** Destroy a buffered reader */
+void sock_reader_destroy (SockReader *r);
+/** Read whatever is available into the buffer */
+int sock_reader_fill (SockReader *r);
+/** Get the next complete line */
+int sock_readline (SockReader *r, char *dest, size_t maxlen);
+
+/** Create a buffered writer for a socket */
+SockWriter *sock_writer_create (int fd, size_t size);
+/** Destroy a buffered writer, sending the pending data */
+void sock_writer_destroy (SockWriter *w);
+/** Add printf-like formatted output */
+int sock_writer_printf (SockWriter *w, const char *format, .../*args*/);
+/** Add a string */
+int sock_writer_send_string (SockWriter *w, const char *string);
+/** Add raw data */
+int sock_writer_send (SockWriter *w, const void *src, size_t size);
+/** Send the pending data */
+int sock_writer_flush (SockWriter *w);
+
 
 /** Return the error message for the last error occured */
 char *sock_geterror(void);